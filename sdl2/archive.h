@@ -0,0 +1,65 @@
+/*
+Layout of the packed asset archive written by packer.cpp and read by main.cpp
+
+* Header, then the index of entries, then the blobs, each starting on an ARCHIVE_ALIGNMENT boundary
+* Every file keeps its original bytes, and images and WAVs can also carry pre-decoded pixels or samples
+* Numbers are stored in the byte order of the machine that packed it
+*/
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <SDL2/SDL.h>
+
+// First bytes of every archive, and the layout version
+const char ARCHIVE_MAGIC[ 4 ] = { 'L', 'P', 'A', 'K' };
+const Uint32 ARCHIVE_VERSION = 1;
+
+// Blobs start on cache line boundaries, so pixels and samples can be used where they lie
+const Uint32 ARCHIVE_ALIGNMENT = 64;
+
+// Longest path an entry can be looked up by, including the terminating zero
+const int ARCHIVE_NAME_LENGTH = 64;
+
+// Format samples are pre-decoded to, the same one init() opens the mixer with
+const int ARCHIVE_SAMPLE_FREQUENCY = 44100;
+const Uint16 ARCHIVE_SAMPLE_FORMAT = AUDIO_S16SYS;
+const int ARCHIVE_SAMPLE_CHANNELS = 2;
+
+// What an entry's decoded blob holds
+enum ArchiveDecoded
+{
+    ARCHIVE_DECODED_NONE,
+    ARCHIVE_DECODED_PIXELS,  // SDL_PIXELFORMAT_RGBA32, color key already turned into alpha
+    ARCHIVE_DECODED_SAMPLES  // ARCHIVE_SAMPLE_FORMAT interleaved samples
+};
+
+struct LArchiveHeader
+{
+    char magic[ 4 ];
+    Uint32 version;
+    Uint32 entryCount;
+    Uint32 reserved;
+};
+
+struct LArchiveEntry
+{
+    // Path the file was packed from, like resources/dot.bmp
+    char name[ ARCHIVE_NAME_LENGTH ];
+
+    // The file as it was on disk
+    Uint64 fileOffset;
+    Uint64 fileSize;
+
+    // Pre-decoded pixels or samples, size 0 when there are none
+    Uint64 decodedOffset;
+    Uint64 decodedSize;
+    Uint32 decoded;
+
+    // Image size and row length in bytes, for pixels
+    Uint32 width;
+    Uint32 height;
+    Uint32 pitch;
+};
+
+#endif
@@ -1,20 +1,106 @@
 /*
 To compile on Ubuntu
 * sudo apt-get install --yes libsdl2-dev
-* g++ main.cpp -I /usr/include/SDL2/ -lSDL2 -lGL -lSDL2_image -lSDL2_ttf -lSDL2_mixer -g
+* g++ main.cpp -I /usr/include/SDL2/ -lSDL2 -lGL -lSDL2_image -lSDL2_ttf -lSDL2_mixer -pthread -g
  -g to debug
+ -O3 when running the benchmarks, so loops like DotSystem::move get vectorized
+ -DLPROFILER=0 compiles the frame profiler hooks out
 * Execute with ./a.out -g
+* Needs SDL 2.0.18 or newer for SDL_RenderGeometry, and SDL_ttf 2.0.18 or newer for glyph kerning
+* packer.cpp is a separate tool that packs resources/ into one archive, see the top of that file
+
+Options
+* --bench-sprites N  draw N thousand dots with LTexture::render and with LSpriteBatch and compare
+* --no-vsync         do not wait for vertical refresh when presenting
+* --fps-cap N        limit frames per second when vsync is off (0 is uncapped)
+* --sim-ticks N      run N simulation ticks without a window and print ticks per second
+* --bench-broadphase compare brute force wall collision with LCollisionWorld as dot and wall counts grow
+* --check-collision  compare the SIMD checkCollision overload with the scalar one and time both
+* --bench-dots       move 1k, 100k and 1M dots as Dot objects and as a DotSystem and print updates per second
+* --dots N           add a crowd of N dots to the scene, moved in parallel by the job system
+* --workers N        number of job system worker threads (default is one less than the CPU count)
+* --bench-jobs       job system throughput, latency with workers asleep and awake, and DotSystem scaling from 1 thread up
+* --bench-buttons    dispatch mouse events to a toolbar of buttons one by one and through LButtonLayer, and compare
+* --overlay          show frames per second and the number of dots in the top left corner
+* --raster          draw textures with our own software rasterizer, also used when no accelerated renderer can be created
+* --raster-filter F  sample scaled and rotated images with nearest or bilinear filtering (default nearest)
+* --bench-raster     check the SIMD blending kernels on random spans, then draw rotate/flip, alpha and scaled scenes with SDL's software renderer and with the rasterizer, and compare, exits 1 on a mismatch
+* --raster-untiled   rasterize on the main thread instead of in tiles spread over the job system
+* --bench-raster-threads draw a busy scene with the tiled rasterizer on 1 core up to all of them, and check every frame matches the untiled one
+* --bench-text       draw a changing counter with a new texture every frame and from the glyph atlas, and compare
+* --bench-ui         lay out a deep widget tree, time steady frames and a change to one leaf, and check only what moved is laid out again
+* --bench-mixer      check the SIMD mixing kernels against the scalar ones, then mix 8 to 512 voices offline with both and print how much faster than real time, exits 1 on a mismatch
+* --bench-audio-queue send the mixer 10 thousand to a million commands a second while audio plays, and count late callbacks, exits 1 if any
+* --audio-buffer N   ask the audio device for N frame buffers (default 256), doubled until the device keeps up
+* --audio-rate HZ    audio output rate (default 44100)
+* --audio-format F   audio sample format, s16 or f32 (default s16)
+* --audio-latency    print the time from each key press to its sound's first sample, and a summary on exit
+* --bench-audio-latency play sounds for simulated key presses with 64 to 2048 frame buffers and print the latency of each
+* --bench-music      stream music while disk reads get slower and count underruns, then check seeks and crossfades for gaps
+* --bench-loading    decode every asset one after another and then on the job system, and compare
+* --hot-reload       watch resources/ and reload images and sounds as they change on disk (Linux only)
+* --archive FILE     load media from an archive written by packer instead of from loose files
+* --sound-cache DIR  keep sound effects converted to the device format in DIR between runs (default soundcache)
+* --no-sound-cache   convert sound effects at every start instead
+* --bench-sound-cache time loading the sound effects with no cache, into an empty one, from a warm one, and after the device changes
+* --profile          time each phase of the main loop, draw a frame time graph and print a summary on exit
+* --trace FILE       write Chrome trace event JSON of every frame to FILE on exit (open in chrome://tracing)
+* --headless N       draw N frames with no display or sound card, one tick each with scripted input,
+                     then print frames per second, p50/p99 frame time and a checksum of the last frame
+* --no-idle          keep ticking and polling at the full rate even when nothing is moving
+* --bench-idle N     run the game for N seconds, then print how many frames were drawn and the CPU time used
+* --full-redraw      clear and redraw the whole screen every frame instead of only the parts that changed
+* --record FILE      log keyboard and mouse input, stamped with simulation ticks, to FILE
+* --replay FILE      play input logged by --record at the same ticks instead of live input, quit when it ends
 
 */
 
 // Using SDL and Standard IO
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
-//#include <SDL2/SDL_ttf.h>
+#include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL_mixer.h>  // for sound
+#include "archive.h"  // packed asset archive layout, shared with packer.cpp
 #include <stdio.h>
 #include <string>
 #include <cmath>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <set>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// inotify tells us when files in resources/ change, for hot reloading
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Archives are mapped into memory where we can, and read in whole elsewhere
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#define HAVE_MMAP 1
+#endif
+
+// SSE2 is always there on x86-64, AVX2 is checked for at runtime
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __SSE2__ ) )
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
 
 // Screen dimension constants
@@ -26,6 +112,142 @@ const int BUTTON_WIDTH = 300;
 const int BUTTON_HEIGHT = 200;
 const int TOTAL_BUTTONS = 4;
 
+// Simulation runs at a fixed rate no matter how fast frames are drawn
+const int TICKS_PER_SECOND = 120;
+const double TICK_SECONDS = 1.0 / TICKS_PER_SECOND;
+
+// Longest frame the simulation will catch up on, so a stall does not snowball into more ticks
+const double MAX_FRAME_SECONDS = 0.25;
+
+// Side of a collision grid cell, a few dots wide
+const int COLLISION_CELL_SIZE = 64;
+
+// Side of an LButtonLayer grid cell, about one toolbar button
+const int BUTTON_CELL_SIZE = 32;
+
+// Side of the texture glyphs are rasterized into
+const int GLYPH_ATLAS_SIZE = 512;
+
+// Glyph shelves are this many pixels tall or a multiple of it, so glyphs of close sizes share shelves
+const int GLYPH_SHELF_STEP = 8;
+
+// Size the frame overlay is drawn at
+const int OVERLAY_FONT_SIZE = 16;
+
+// Texture atlas page dimensions
+const int ATLAS_PAGE_SIZE = 2048;
+
+// Transparent gap left around every image packed into an atlas page
+const int ATLAS_PADDING = 2;
+
+// How long an idle worker, or a thread in LJobSystem::wait, keeps looking for jobs before it sleeps, far shorter than a wake up
+const double JOB_SPIN_SECONDS = 50e-6;
+
+// Side of the screen tiles LRasterizer bins draws into, each tile is rasterized as one job
+const int RASTER_TILE_SIZE = 64;
+
+// Frames the profiler keeps timings for, two seconds at 120 frames per second
+const int PROFILE_FRAMES = 240;
+
+// Trace events kept for --trace, enough for several minutes, later ones are dropped
+const int PROFILE_MAX_TRACE_EVENTS = 1 << 20;
+
+// Trace events room is made for up front, a short run never grows the vector and a long one only grows it now and then
+const int PROFILE_TRACE_RESERVE_EVENTS = PROFILE_MAX_TRACE_EVENTS / 64;
+
+// Longest the main loop sleeps waiting for input when nothing moves, so hot reload still looks in regularly
+const Uint32 IDLE_WAIT_MS = 100;
+
+// Changed areas kept apart before they are merged into one box around them all
+const int DIRTY_MAX_RECTS = 16;
+
+// Sounds LMixer plays at once, playing more steals the least important voice
+const int MIXER_VOICES = 64;
+
+// Commands waiting for the audio callback, a power of two
+const int AUDIO_QUEUE_SIZE = 1024;
+
+// Callback periods the game thread waits for the callback to take commands, after that it takes them itself
+const int AUDIO_STALL_PERIODS = 4;
+
+// Device buffers openAudio() will ask for, in frames, it doubles from the one configured up to the largest
+const int AUDIO_MIN_BUFFER_FRAMES = 32;
+const int AUDIO_MAX_BUFFER_FRAMES = 4096;
+
+// Buffers smaller than this are listened to for a moment after opening, to see whether the device keeps them fed
+const int AUDIO_PROBE_BUFFER_FRAMES = 1024;
+const Uint32 AUDIO_PROBE_MS = 250;
+
+// First bytes of every sound cache file, and the layout version
+const char SOUND_CACHE_MAGIC[ 4 ] = { 'L', 'S', 'N', 'D' };
+const Uint32 SOUND_CACHE_VERSION = 1;
+
+// Where sounds converted to the device format are kept between runs, unless --sound-cache says otherwise
+const std::string SOUND_CACHE_DIRECTORY = "soundcache";
+
+// Decoded music is kept in a ring of this many blocks of this many frames, about 1.5 seconds at 44.1 kHz
+const int MUSIC_BLOCK_FRAMES = 4096;
+const int MUSIC_BLOCKS = 16;
+
+// Blocks decoded before a track starts playing, about 370 ms, so a disk that takes that long per read never runs it dry
+const int MUSIC_START_BLOCKS = 4;
+
+// Bytes of a music file read at once, large so a slow disk seeks rarely
+const int MUSIC_READ_BYTES = 64 * 1024;
+
+// How often a music decoder looks for blocks the audio callback is done with, the callback never wakes it
+const Uint32 MUSIC_POLL_MS = 10;
+
+// Tracks playing at once, one fading in while the others fade out, so seeking again mid crossfade finds one free
+const int MUSIC_DECKS = 3;
+
+// Crossfade when seeking, long enough not to click
+const double MUSIC_SEEK_FADE_SECONDS = 0.03;
+
+// Fade when pausing, resuming or halting music
+const double MUSIC_PAUSE_FADE_SECONDS = 0.05;
+
+// Frames LMixer mixes at a time, gain changes ramp over one block so they do not click
+const int MIXER_BLOCK_FRAMES = 512;
+
+// Pitch range of a voice, beyond it a sound is a click or a rumble, and the top keeps the 32.32 step far from overflowing
+const double MIXER_MIN_PITCH = 1.0 / 64;
+const double MIXER_MAX_PITCH = 64.0;
+
+// Frames the resampling filter reads around a position, half before it and half after
+const int RESAMPLE_TAPS = 16;
+
+// Fractional positions the filter is tabulated at, in bits, neighbouring phases are blended between
+const int RESAMPLE_PHASE_BITS = 8;
+const int RESAMPLE_PHASES = 1 << RESAMPLE_PHASE_BITS;
+
+// Filter bands, a voice uses the first one its pitch step fits so sounds pitched up do not alias
+const int RESAMPLE_BANDS = 4;
+const double RESAMPLE_BAND_STEPS[ RESAMPLE_BANDS ] = { 1.0, 1.5, 2.0, 3.0 };
+
+// Frame profiler hooks are compiled in unless built with -DLPROFILER=0
+#ifndef LPROFILER
+#define LPROFILER 1
+#endif
+
+// Packs many images into a few large textures, so sprites share a texture
+class LTextureAtlas;
+
+// Decodes images and sounds on worker threads
+class LAssetLoader;
+
+// Archive of every resource, mapped into memory
+class LAssetArchive;
+
+// Streams music from disk for LMixer
+class LMusicStream;
+
+// Sounds already converted to the device format, kept on disk between runs
+class LSoundCache;
+
+// Pixels of an image kept in memory for LRasterizer
+struct LRasterImage;
+
 // Texture wrapper class
 class LTexture
 {
@@ -39,6 +261,18 @@ class LTexture
         // Load image at a specified path
         bool loadFromFile( std::string path );
 
+        // Create texture from a decoded image, the surface is left to the caller
+        bool loadFromSurface( SDL_Surface* surface );
+
+        // Waits for an image queued on an asset loader and creates the texture from it
+        bool loadFromAsset( LAssetLoader& loader, int handle );
+
+        // Use a packed image from an atlas page instead of owning a texture
+        bool loadFromAtlas( LTextureAtlas& atlas, std::string name );
+
+        // Use part of a texture owned by someone else, with its pixels in memory if there are any
+        bool loadFromTexture( SDL_Texture* texture, SDL_Rect area, LRasterImage* image = NULL );
+
         // We don't load function if defined statement is not included
         #ifdef _SDL_TTF_H
         // Creates image from font string
@@ -67,6 +301,17 @@ class LTexture
         int getWidth();
         int getHeight();
 
+        // Gets the hardware texture and the part of it to draw for a clip
+        SDL_Texture* getTexture();
+        SDL_Rect getSourceRect( SDL_Rect* clip = NULL );
+
+        // Gets the pixels gRasterizer draws from, NULL when it was not open as the texture loaded
+        LRasterImage* getImage();
+
+        // Gets the modulation used when rendering
+        SDL_Color getColor();
+        SDL_BlendMode getBlendMode();
+
     private:
         // The actual hardware texture
         SDL_Texture* mTexture;
@@ -74,6 +319,387 @@ class LTexture
         // Image dimensions
         int mWidth;
         int mHeight;
+
+        // Whether mTexture belongs to this object or to an atlas page
+        bool mOwnsTexture;
+
+        // The same pixels in memory for gRasterizer, owned along with mTexture
+        LRasterImage* mImage;
+
+        // Where the image sits inside its atlas page
+        SDL_Rect mAtlasRect;
+
+        // Modulation kept per image, since atlas pages are shared
+        Uint8 mRed, mGreen, mBlue, mAlpha;
+        SDL_BlendMode mBlendMode;
+};
+
+class LTextureAtlas
+{
+    public:
+        // Initialize variables
+        LTextureAtlas();
+
+        // Deallocates memory
+        ~LTextureAtlas();
+
+        // Loads an image that will be packed under the given name
+        bool addImage( std::string name, std::string path );
+
+        // Adds an already decoded image, the atlas keeps its own reference to the surface
+        bool addSurface( std::string name, SDL_Surface* surface );
+
+        // Swaps the pixels of a packed image, in place when the size is unchanged or on a page of its own otherwise
+        bool replaceImage( std::string name, SDL_Surface* surface );
+
+        // Packs every added image into pages and creates the page textures
+        bool pack( int pageWidth = ATLAS_PAGE_SIZE, int pageHeight = ATLAS_PAGE_SIZE );
+
+        // Finds the page texture and sub-rect of a packed image, and the page's pixels if gRasterizer keeps them
+        bool lookup( std::string name, SDL_Texture** page, SDL_Rect* rect, LRasterImage** image = NULL );
+
+        // Deallocates pages and any images still waiting to be packed
+        void free();
+
+        // Gets the number of page textures
+        int getPageCount();
+
+    private:
+        // An image and where it ended up
+        struct Entry
+        {
+            std::string name;
+            SDL_Surface* surface;
+            int page;
+            SDL_Rect rect;
+        };
+
+        // Every added image, looked up by name through mIndex
+        std::vector<Entry> mEntries;
+        std::map<std::string, int> mIndex;
+
+        // The packed hardware textures
+        std::vector<SDL_Texture*> mPages;
+
+        // Each page's pixels in memory when gRasterizer is open, NULL otherwise
+        std::vector<LRasterImage*> mPageImages;
+};
+
+// Collects sprites for a frame and submits them as a few large vertex arrays
+class LSpriteBatch
+{
+    public:
+        // Initialize variables
+        LSpriteBatch();
+
+        // Starts collecting a new frame of sprites
+        void begin();
+
+        // Queues a sprite, same parameters as LTexture::render
+        void draw( LTexture& texture, int x, int y, SDL_Rect* clip = NULL, double angle = 0.0,
+                   SDL_Point* center = NULL, SDL_RendererFlip flip = SDL_FLIP_NONE );
+
+        // Sorts queued sprites by texture, then draws each run of one texture and blend mode with SDL_RenderGeometry
+        void end();
+
+        // Gets how many SDL_RenderGeometry calls the last end() made
+        int getSubmitCount();
+
+    private:
+        // One queued sprite, its four corners live in mVertices
+        struct Quad
+        {
+            SDL_Texture* texture;
+            SDL_BlendMode blendMode;
+            int firstVertex;
+        };
+
+        std::vector<Quad> mQuads;
+        std::vector<SDL_Vertex> mVertices;
+
+        // Reused every frame so submitting does not allocate
+        std::vector<int> mOrder;
+        std::vector<SDL_Vertex> mSortedVertices;
+        std::vector<int> mIndices;
+
+        // Size of the last texture seen this frame, to turn pixel rects into texture coordinates
+        SDL_Texture* mSizeTexture;
+        int mTextureWidth, mTextureHeight;
+
+        int mSubmitCount;
+};
+
+// Pixels LRasterizer draws from, ARGB8888 with straight alpha and rows width pixels long
+struct LRasterImage
+{
+    // Initialize variables
+    LRasterImage();
+
+    // Converts a surface, color keyed pixels become transparent the way they do on atlas pages
+    bool loadFromSurface( SDL_Surface* surface );
+
+    // Overwrites an area with a surface of the same size
+    bool update( SDL_Rect area, SDL_Surface* surface );
+
+    int width;
+    int height;
+    std::vector<Uint32> pixels;
+};
+
+// How LRasterizer samples images that are scaled or rotated
+enum LRasterFilter
+{
+    RASTER_NEAREST,
+    RASTER_BILINEAR
+};
+
+// Software render backend: LTextures are drawn into a 32-bit framebuffer in memory,
+// which is then presented with a single texture update
+class LRasterizer
+{
+    public:
+        // Initialize variables
+        LRasterizer();
+
+        // Deallocates memory
+        ~LRasterizer();
+
+        // Creates the framebuffer and the streaming texture of gRenderer it is presented through
+        bool open( int width, int height );
+
+        // Frees the framebuffer and the texture
+        void close();
+
+        // Creates the streaming texture again after the renderer's device was reset, the framebuffer is kept
+        bool resetTexture();
+
+        // Checks whether open() succeeded
+        bool isOpen();
+
+        // Chooses the scalar or the SIMD blending kernel, they give the same pixels
+        void setSimd( bool simd );
+
+        // Modulates a span of source pixels by color and blends it over the framebuffer
+        typedef void ( *BlendKernel )( Uint32* destination, const Uint32* source, int count, Uint32 color, SDL_BlendMode blending );
+
+        // Gets the name of the blending kernel in use
+        const char* getKernelName();
+
+        // Sets how scaled and rotated images are sampled
+        void setFilter( LRasterFilter filter );
+
+        // Records draws and rasterizes them at present() in tiles spread over gJobs, with the same pixels as drawing right away
+        void setTiled( bool tiled );
+        bool isTiled();
+
+        // Starts a frame, LTexture::render and LSpriteBatch draw into the framebuffer until present()
+        void begin();
+
+        // Checks whether a frame was begun and not yet presented
+        bool isDrawing();
+
+        // Limits drawing to a rect, NULL draws everywhere
+        void setClip( const SDL_Rect* clip );
+
+        // Fills the whole framebuffer, ignoring the clip like SDL_RenderClear
+        void clear( SDL_Color color );
+
+        // Fills or outlines a rect the way SDL_RenderFillRect and SDL_RenderDrawRect do
+        void fillRect( SDL_Rect rect, SDL_Color color, SDL_BlendMode blending );
+        void drawRect( SDL_Rect rect, SDL_Color color, SDL_BlendMode blending );
+
+        // Draws a line with both ends included, or one pixel, the way SDL_RenderDrawLine and SDL_RenderDrawPoint do
+        void drawLine( int x1, int y1, int x2, int y2, SDL_Color color, SDL_BlendMode blending );
+        void drawPoint( int x, int y, SDL_Color color, SDL_BlendMode blending );
+
+        // Draws part of an image the way SDL_RenderCopyEx does, color modulates it and its alpha is the alpha modulation
+        void copy( const LRasterImage& image, SDL_Rect source, SDL_Rect destination, double angle, const SDL_Point* center,
+                   SDL_RendererFlip flip, SDL_Color color, SDL_BlendMode blending );
+
+        // Uploads the framebuffer with one texture update, copies it to gRenderer and ends the frame
+        bool present();
+
+        // Ends the frame without presenting it, when nothing changed
+        void end();
+
+        // Rasterizes recorded draws into the framebuffer, present() and end() do this first
+        void flush();
+
+        // Gets the framebuffer once flushed, rows are getWidth() pixels long
+        const Uint32* getPixels();
+        int getWidth();
+        int getHeight();
+
+    private:
+        // What a draw does
+        enum CommandType
+        {
+            COMMAND_CLEAR,
+            COMMAND_FILL,
+            COMMAND_LINE,
+            COMMAND_COPY
+        };
+
+        // A draw with everything needed to rasterize any part of it later
+        struct Command
+        {
+            CommandType type;
+
+            // Pixels it can touch, inside the clip it was drawn with
+            SDL_Rect bounds;
+
+            // Fill color, or the modulation of an image
+            Uint32 color;
+            SDL_BlendMode blending;
+
+            // Ends of a line, and the point, Bresenham error and number of points a run of it starts from
+            // A whole line runs from its first point, a tile gets the run inside it
+            SDL_Point from;
+            SDL_Point to;
+            SDL_Point start;
+            int error;
+            int points;
+
+            // Image copies map screen pixels to the source area: u = du * x + duRow * y + u0, the same for v
+            const LRasterImage* image;
+            SDL_Rect source;
+            SDL_Rect destination;
+            bool straight;
+            LRasterFilter filter;
+            double du, duRow, u0;
+            double dv, dvRow, v0;
+        };
+
+        // Draws a command right away, or records it when tiled
+        void submit( const Command& command );
+
+        // Draws the part of a command inside area, sampling images into span
+        void execute( const Command& command, const SDL_Rect& area, Uint32* span );
+
+        // Moves a Bresenham walk along a line to its next point
+        static void stepLine( const Command& line, int& x, int& y, int& error );
+        void drawCopy( const Command& command, const SDL_Rect& area, Uint32* span );
+
+        // Samples count pixels along a line through an area of an image, u and v are 16.16 fixed point relative to the area
+        void fetchNearest( const LRasterImage& image, const SDL_Rect& area, int u, int v, int du, int dv, int count, Uint32* out );
+        void fetchBilinear( const LRasterImage& image, const SDL_Rect& area, int u, int v, int du, int dv, int count, Uint32* out );
+
+        // ARGB8888 framebuffer
+        std::vector<Uint32> mPixels;
+        int mWidth;
+        int mHeight;
+
+        // Streaming texture the framebuffer is uploaded to
+        SDL_Texture* mTexture;
+
+        // Where drawing is allowed
+        SDL_Rect mClip;
+
+        LRasterFilter mFilter;
+        bool mDrawing;
+
+        BlendKernel mBlend;
+        const char* mKernelName;
+
+        // Sampled source pixels of the row being drawn, reused so drawing does not allocate
+        std::vector<Uint32> mSpan;
+
+        // Draws recorded since the last flush, and for every tile the ones that touch it, in draw order
+        bool mTiled;
+        std::vector<Command> mCommands;
+        std::vector< std::vector<int> > mBins;
+
+        // A span for each tile, so tiles can be drawn on any thread
+        std::vector< std::vector<Uint32> > mTileSpans;
+};
+
+// Rects stored as separate side arrays, so one rect can be tested against many at once
+struct LRectBlock
+{
+    // Adds a rect, sides are computed the same way checkCollision does
+    void add( SDL_Rect rect );
+
+    // Removes every rect
+    void clear();
+
+    // Gets the number of rects
+    int size() const;
+
+    // Sides of every rect
+    std::vector<int> left;
+    std::vector<int> right;
+    std::vector<int> top;
+    std::vector<int> bottom;
+};
+
+// Most rects one checkCollision mask can report on
+const int RECT_BLOCK_MASK_BITS = 32;
+
+// Uniform grid broadphase holding static walls and moving colliders
+class LCollisionWorld
+{
+    public:
+        // Initialize a grid covering the given area, objects outside it land in the edge cells
+        LCollisionWorld( int width = SCREEN_WIDTH, int height = SCREEN_HEIGHT, int cellSize = COLLISION_CELL_SIZE );
+
+        // Adds a wall that never moves and returns its id
+        int addWall( SDL_Rect wall );
+
+        // Adds a moving collider and returns its id
+        int addCollider( SDL_Rect collider );
+
+        // Moves a collider, the grid is only touched when it crosses into other cells
+        void updateCollider( int id, SDL_Rect collider );
+
+        // Collects ids of walls or colliders sharing a cell with the area, they may not actually overlap
+        void queryWalls( SDL_Rect area, std::vector<int>& candidates );
+        void queryColliders( SDL_Rect area, std::vector<int>& candidates );
+
+        // Checks the rect against the candidate walls with checkCollision
+        bool hitsWall( SDL_Rect rect );
+
+        // Gets stored rects
+        SDL_Rect getWall( int id );
+        SDL_Rect getCollider( int id );
+
+        // Gets object counts
+        int getWallCount();
+        int getColliderCount();
+
+        // Removes every wall and collider
+        void clear();
+
+    private:
+        // Cells covered by a rect, as first and last column and row
+        SDL_Rect cellRange( SDL_Rect rect );
+
+        // Adds or removes an id in every cell of a range
+        void insert( std::vector< std::vector<int> >& cells, SDL_Rect range, int id );
+        void erase( std::vector< std::vector<int> >& cells, SDL_Rect range, int id );
+
+        // Collects ids from every cell of the area, each id once
+        void query( std::vector< std::vector<int> >& cells, std::vector<unsigned int>& stamps, SDL_Rect area, std::vector<int>& candidates );
+
+        // Grid dimensions
+        int mCellSize;
+        int mColumns, mRows;
+
+        // Ids in every cell, walls and colliders kept apart
+        std::vector< std::vector<int> > mWallCells;
+        std::vector< std::vector<int> > mColliderCells;
+
+        // Object rects, and the cells each collider is filed under
+        std::vector<SDL_Rect> mWalls;
+        std::vector<SDL_Rect> mColliders;
+        std::vector<SDL_Rect> mColliderRanges;
+
+        // Last query each object was reported in, so objects spanning several cells are reported once
+        std::vector<unsigned int> mWallStamps;
+        std::vector<unsigned int> mColliderStamps;
+        unsigned int mQueryStamp;
+
+        // Reused by hitsWall
+        std::vector<int> mCandidates;
 };
 
 // LButtonSprite
@@ -96,9 +722,24 @@ class LButton
         // Sets top left position
         void setPosition( int x, int y );
 
+        // Sets width and height, BUTTON_WIDTH by BUTTON_HEIGHT unless changed, negative sizes count as 0
+        void setSize( int width, int height );
+
+        // Gets the area the button covers
+        SDL_Rect getRect();
+
+        // Whether a point is on the button
+        bool contains( int x, int y );
+
         // Handles mouse event
         void handleEvent( SDL_Event* e );
 
+        // Changes the sprite for a mouse event that happened on or off the button
+        void setMouseState( Uint32 eventType, bool inside );
+
+        // Gets the sprite showing
+        LButtonSprite getSprite();
+
         // Shows button sprite
         void render();
 
@@ -106,921 +747,12089 @@ class LButton
         // Top left position
         SDL_Point mPosition;
 
+        // Width and height
+        int mWidth, mHeight;
+
         // Currently used global sprite
         LButtonSprite mCurrentSprite;
 };
 
-
-// a dot that will move around the screen
-class Dot
+// Buttons filed in a flat grid by the cells they cover, so a mouse event only looks at the buttons under it
+class LButtonLayer
 {
     public:
-        // dimensions of the dot
-        static const int DOT_WIDTH = 20;
-        static const int DOT_HEIGHT = 20;
+        // Initialize a grid covering the given area, buttons outside it land in the edge cells
+        LButtonLayer( int width = SCREEN_WIDTH, int height = SCREEN_HEIGHT, int cellSize = BUTTON_CELL_SIZE );
 
-        // Maximum axis velocity of the dot
-        static const int DOT_VEL = 10;
+        // Adds a button and returns its id, later buttons are on top
+        int add( LButton* button );
 
-        // Initialize the variables
-        Dot();
+        // Files every button again, call after moving or resizing any
+        void rebuild();
 
-        // Takes key presses and adjusts the dot's velocity
-        void handleEvent( SDL_Event& e);
+        // Gets the id of the topmost button at a point, -1 if there is none
+        int buttonAt( int x, int y );
 
-        // Moves the dot and checks collision
-        void move( SDL_Rect& wall );
+        // Sends a mouse event to the buttons under it and the ones it left, returns whether any sprite changed
+        bool handleEvent( SDL_Event* e );
 
-        // Shows the dot on the screen
-        void render();
+        // Gets the number of buttons
+        int getCount();
+
+        // Removes every button
+        void clear();
 
     private:
-        // X and Y offsets of the dot
-        int mPosX, mPosY;
+        // Fills mHits with the ids of buttons containing the point, lowest first
+        void collectHits( int x, int y );
 
-        // the velocity of the dot
-        int mVelX, mVelY;
+        // Grid dimensions
+        int mCellSize;
+        int mColumns, mRows;
 
-        // Dot's collision box
-        SDL_Rect mCollider;
+        // Buttons of cell i are mCellButtons[ mCellStart[ i ] ] up to mCellButtons[ mCellStart[ i + 1 ] ]
+        std::vector<int> mCellStart;
+        std::vector<int> mCellButtons;
+
+        // Registered buttons, not owned
+        std::vector<LButton*> mButtons;
+
+        // Buttons under the mouse after the last event, and under it now
+        std::vector<int> mHovered;
+        std::vector<int> mHits;
+
+        // Whether buttons were added since the grid was built
+        bool mStale;
 };
 
-// Key press surfaces constants
-enum KeyPressSurfaces
+// One sprite of a UI draw list, what LSpriteBatch::draw takes
+struct LDrawItem
 {
-    KEY_PRESS_SURFACE_DEFAULT,  // default count starts at 0
-    KEY_PRESS_SURFACE_UP,  // so this is 1
-    KEY_PRESS_SURFACE_DOWN,  // this is 2, etc.
-    KEY_PRESS_SURFACE_LEFT,
-    KEY_PRESS_SURFACE_RIGHT,
-    KEY_PRESS_SURFACE_TOTAL
+    LTexture* texture;
+    SDL_Rect clip;
+    bool clipped;
+    int x, y;
+
+    // Color for sprites of a shared texture like the glyph atlas, set on the texture when drawing
+    bool tinted;
+    SDL_Color color;
 };
 
+// Direction an LContainer stacks its children in
+enum LayoutDirection
+{
+    LAYOUT_VERTICAL,
+    LAYOUT_HORIZONTAL
+};
 
-// Start up SDL and create the window and surface
-bool init();
+// Node of a retained UI tree, measured and laid out again only after it or something below it changed
+class LWidget
+{
+    public:
+        // Initialize variables, a new widget needs measuring and laying out
+        LWidget();
 
-// Load the media
-bool loadMedia();
+        // Frees the children
+        virtual ~LWidget();
 
-// Frees media and shuts down SDL
-void close();
+        // Owns its children, so a copy would free them twice
+        LWidget( const LWidget& ) = delete;
+        LWidget& operator=( const LWidget& ) = delete;
 
-// Box collision detector
-bool checkCollision( SDL_Rect a, SDL_Rect b );
+        // Adds a child, which this widget then owns, and returns it
+        template <typename T>
+        T* add( T* child );
 
-// Loads individual image (SDL_Surface is software rendering whereas SDL_Texture is hardware rendering)
-SDL_Texture* loadTexture( std:: string path);
+        // Sets the smallest size the widget is given, whatever its content
+        void setMinimumSize( int width, int height );
 
-// The window we'll be rendering to
-SDL_Window* gWindow = NULL;  // make sure to have pointers point to NULL if not pointing to anything
+        // Shows or hides the widget, hidden widgets take no space
+        void setVisible( bool visible );
+        bool isVisible();
 
-// Textures need an SDL_Renderer to render to the screen
-SDL_Renderer* gRenderer = NULL;
+        // Gets the size the widget wants, cached until invalidateLayout()
+        SDL_Point measure();
 
-// The images that correspond to a keypress
-SDL_Surface* gKeyPressSurfaces[ KEY_PRESS_SURFACE_TOTAL ];
+        // Places the widget, skipped when it is clean and the area is unchanged, returns how many widgets were placed
+        int layout( SDL_Rect area );
 
-// Current displayed texture
-SDL_Texture* gTexture = NULL;
+        // Appends the sprites of the widget and then its children
+        void draw( std::vector<LDrawItem>& items );
 
-// Scene Textures using LTexture
-LTexture gFooTexture;
-LTexture gBackgroundTexture;
+        // Marks the widget's size or content as changed, which reaches every ancestor since their sizes may follow
+        void invalidateLayout();
 
-// Create some spirtes
-//SDL_Rect gSpriteClips[ 4 ];
-//LTexture gSpriteSheetTexture;
+        // Marks the widget's look as changed when its size is not
+        void invalidateDraw();
 
-// Walking animation
-const int WALKING_ANIMATION_FRAMES = 4;
-SDL_Rect gSpriteWalkClips[ 4 ];
-LTexture gSpriteWalkSheetTexture;
+        // Whether this widget or one below it needs laying out or drawing again
+        bool needsLayout();
+        bool needsDraw();
 
-// Texture for Rotation and Flipping
-LTexture gArrowTexture;
+        // Gets the laid out area
+        SDL_Rect getRect();
 
-// Globally used font
-//TTF_Font *gFont = NULL;
-LTexture gTextTexture;
+        // Gets children
+        int getChildCount();
+        LWidget* getChild( int i );
 
-// Mouse Button Sprites
-SDL_Rect gSpriteClips[ BUTTON_SPRITE_TOTAL ];
-LTexture gButtonSpriteSheetTexture;
+        // Gets the button behind the widget, NULL for widgets that are not buttons
+        virtual LButton* getButton();
 
-//Buttons objects
-LButton gButtons[ TOTAL_BUTTONS ];
+    protected:
+        // Size of the content alone, before the minimum size
+        virtual SDL_Point measureContent() = 0;
 
-//Scene textures
-LTexture gPressTexture;
-LTexture gUpTexture;
-LTexture gDownTexture;
-LTexture gLeftTexture;
-LTexture gRightTexture;
+        // Places the children inside mRect, returns how many widgets were placed
+        virtual int arrange();
 
-//Scene texture
-LTexture gPromptTexture;
+        // Appends the widget's own sprites
+        virtual void drawContent( std::vector<LDrawItem>& items );
 
-// Music that will be played
-Mix_Music *gMusic = NULL;
+        LWidget* mParent;
+        std::vector<LWidget*> mChildren;
 
-// Sound effects that will be used
-Mix_Chunk *gScratch = NULL;
-Mix_Chunk *gHigh = NULL;
-Mix_Chunk *gMedium = NULL;
-Mix_Chunk *gLow = NULL;
+        // Laid out area, and the cached measured size
+        SDL_Rect mRect;
+        SDL_Point mMeasured;
+        SDL_Point mMinimum;
 
-// Show the Dot
-LTexture gDotTexture;
+        bool mVisible;
 
-LTexture::LTexture()
-{
-    // This Constructor initializes variables
-    mTexture = NULL;
-    mWidth = 0;
-    mHeight = 0;
-}
+        // What has to be done again since the last pass
+        bool mMeasureDirty;
+        bool mLayoutDirty;
+        bool mDrawDirty;
+};
 
-LTexture::~LTexture()
+// Stacks its children one after another
+class LContainer : public LWidget
 {
-    // This Destructor deallocates
-    free();
-}
+    public:
+        // Initialize the direction, the gap between children and the space around them
+        LContainer( LayoutDirection direction = LAYOUT_VERTICAL, int spacing = 0, int padding = 0 );
 
-bool LTexture::loadFromFile( std::string path )
-{
-    // Get rid of preexisting texture if it exists
-    free();
+    protected:
+        SDL_Point measureContent();
+        int arrange();
 
-    // Final Texture
-    SDL_Texture* newTexture = NULL;
+    private:
+        LayoutDirection mDirection;
+        int mSpacing;
+        int mPadding;
+};
 
-    // Load image at specified path
-    SDL_Surface* loadedSurface = IMG_Load( path.c_str() );
-    if( loadedSurface == NULL )
-    {
-        printf(" Unable to load image %s! SDL_image Error: %s\n", path.c_str(), IMG_GetError() );
-    }
-    else
-    {
-        // Color key image (i.e. pick a color to make transparent )
-        SDL_SetColorKey( loadedSurface, SDL_TRUE, SDL_MapRGB( loadedSurface->format, 0, 0xFF, 0xFF ));  // surface, enable color keying, and the pixel we want to color key with (using cyan here)
+// LButton in a widget tree, showing its sprite from a sprite sheet
+class LButtonWidget : public LWidget
+{
+    public:
+        // Sheet and the clip of every LButtonSprite, the mouse out clip gives the size
+        LButtonWidget( LTexture* sheet, const SDL_Rect* clips );
 
-        // Create texture from surface pixels
-        newTexture = SDL_CreateTextureFromSurface( gRenderer, loadedSurface );
-        if( newTexture == NULL )
-        {
-            printf( "Unable to create texture from %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
-        }
-        else
-        {
-            // Get image dimensions
-            mWidth = loadedSurface->w;
-            mHeight = loadedSurface->h;
-        }
+        LButton* getButton();
 
-        // Get rid of old loaded surface
-        SDL_FreeSurface( loadedSurface );
-    }
+    protected:
+        SDL_Point measureContent();
+        int arrange();
+        void drawContent( std::vector<LDrawItem>& items );
 
-    // Return success
-    mTexture = newTexture;
-    return mTexture != NULL;
-}
+    private:
+        LButton mButton;
+        LTexture* mSheet;
+        const SDL_Rect* mClips;
+};
 
-#ifdef _SDL_TTF_H
-bool LTexture::loadFromRenderedText( std::string textureText, SDL_Color textColor )
+// Text drawn from the glyph atlas, one sprite per glyph
+class LLabel : public LWidget
 {
-    // Get rid of preexisting texture
-    free();
+    public:
+        // Initialize the font size
+        LLabel( int size = OVERLAY_FONT_SIZE );
 
-    // Render text surface, need surface to render onto
-    SDL_Surface* textSurface = TTF_RenderText_Solid( gFont, textureText.c_str(), textColor );
-    if( textSurface == NULL )
-    {
-        printf( "Unable to render text surface! SDL_TTF Error: %s\n", TTF_GetError() );
-    }
-    else
-    {
-        // Create texture from surface pixels
-        mTexture = SDL_CreateTextureFromSurface( gRenderer, textSurface );
-        if( mTexture == NULL )
-        {
-            printf( "Unable to create texture from rendered text! SDL Error: %s\n", SDL_GetError() );
-        }
-        else
-        {
-            // Get image dimensions
-            mWidth = textSurface->w;
-            mHeight = textSurface->h;
-        }
+        // Changes the text, nothing is redone when it is the same
+        void setText( std::string text, SDL_Color color );
 
-        // Get rid of old surface
-        SDL_FreeSurface( textSurface );
-    }
+        // Gets the text
+        std::string getText();
 
-    // Return success
-    return mTexture != NULL;
-}
-#endif
+    protected:
+        SDL_Point measureContent();
+        void drawContent( std::vector<LDrawItem>& items );
 
-void LTexture::free()
-{
-    // Free texture if it exists
-    if( mTexture != NULL )
-    {
-        SDL_DestroyTexture( mTexture );
-        mTexture = NULL;
-        mWidth = 0;
-        mHeight = 0;
-    }
-}
+    private:
+        std::string mText;
+        SDL_Color mColor;
+        int mSize;
+};
 
-void LTexture::render( int x, int y, SDL_Rect* clip, double angle, SDL_Point* center, SDL_RendererFlip flip )
+// Texture, or part of one, at its own size
+class LImage : public LWidget
 {
-    // Render a texture, with optional clip param to see what parts to clip and rotation or flip
+    public:
+        // Texture is not owned, a NULL clip shows all of it
+        LImage( LTexture* texture = NULL, const SDL_Rect* clip = NULL );
 
-    // Set rendering space and render to screen
-    SDL_Rect renderQuad = { x, y, mWidth, mHeight };
+        // Changes what is shown
+        void setTexture( LTexture* texture, const SDL_Rect* clip = NULL );
 
-    // Set clip rendering dimensions
-    if( clip != NULL )
-    {
-        renderQuad.w = clip->w;
-        renderQuad.h = clip->h;
-    }
+    protected:
+        SDL_Point measureContent();
+        void drawContent( std::vector<LDrawItem>& items );
 
-    SDL_RenderCopyEx( gRenderer, mTexture, clip, &renderQuad, angle, center, flip );
-}
+    private:
+        LTexture* mTexture;
+        SDL_Rect mClip;
+        bool mClipped;
+};
 
-// Enables blending
-void LTexture::setBlendMode( SDL_BlendMode blending )
+// Root of a widget tree filling an area, keeps the draw list and the button hit test in step with it
+class LWidgetTree
 {
-    // set blending function
-    SDL_SetTextureBlendMode( mTexture, blending );
-}
+    public:
+        // Initialize the root as a vertical container filling the area
+        LWidgetTree( int width = SCREEN_WIDTH, int height = SCREEN_HEIGHT );
 
+        // Gets the root container
+        LContainer& getRoot();
 
-// The lower the alpha, the more transparent a texture is
-void LTexture::setAlpha( Uint8 alpha )
-{
-    // Modulate texture alpha
-    SDL_SetTextureAlphaMod( mTexture, alpha );
-}
+        // Lays out what changed and rebuilds the draw list if anything looks different, returns how many widgets were placed
+        int update();
 
-void LTexture::setColor( Uint8 red, Uint8 green, Uint8 blue )
-{
-    // Modulate texture
-    SDL_SetTextureColorMod( mTexture, red, green, blue );
-}
+        // Sends a mouse event to the buttons, returns whether any of them changed look
+        bool handleEvent( SDL_Event* e );
 
-int LTexture::getWidth()
-{
-    return mWidth;
-}
+        // Queues the draw list, laying labels out again first if the atlas threw out their glyphs since update()
+        void render( LSpriteBatch& batch );
 
-int LTexture::getHeight()
-{
-    return mHeight;
-}
+        // Gets the draw list built by the last update()
+        const std::vector<LDrawItem>& getDrawList();
 
-// Constructor for LButton
-LButton::LButton()
-{
-    mPosition.x = 0;
-    mPosition.y = 0;
+    private:
+        // Collects the buttons of a subtree, in draw order
+        void collectButtons( LWidget* widget, std::vector<LButton*>& buttons );
 
-    mCurrentSprite = BUTTON_SPRITE_MOUSE_OUT;
-}
+        // Rebuilds the draw list if anything looks different, or shelves its glyphs sat on were thrown out since it was built
+        void refreshDrawList();
 
-void LButton::setPosition( int x, int y)
-{
-    mPosition.x = x;
-    mPosition.y = y;
-}
+        LContainer mRoot;
+        SDL_Rect mArea;
+        std::vector<LDrawItem> mDrawList;
 
-// Handle Mouse Events
-void LButton::handleEvent( SDL_Event* e )
+        // Hit test for every button of the tree, and the buttons filed in it
+        LButtonLayer mButtonLayer;
+        std::vector<LButton*> mButtons;
+
+        // Glyph evictions seen by the last draw list, labels are drawn again after more
+        int mGlyphEvictions;
+};
+
+// Glyphs of one font rasterized once per size into a shared texture, and UTF-8 strings drawn from it as batched quads
+class LGlyphAtlas
 {
-    // If mouse event happened
-    if( e->type == SDL_MOUSEMOTION || e->type == SDL_MOUSEBUTTONDOWN || e->type == SDL_MOUSEBUTTONUP )
-    {
-        // Get mouse position
-        int x, y;
-        SDL_GetMouseState( &x, &y );
+    public:
+        // Initialize variables
+        LGlyphAtlas();
 
-        // Check if mouse is in button
-        bool inside = true;
+        // Closes the font and frees the texture
+        ~LGlyphAtlas();
 
-        // Check if mouse is left of the button
-        if( x < mPosition.x )
-        {
-            inside = false;
-        }
+        // Opens a font file, from the archive when it holds it, each size is opened the first time it is used
+        bool open( std::string path );
 
-        // Check if mouse above the button
-        else if( x > mPosition.x + BUTTON_WIDTH )
-        {
-            inside = false;
-        }
+        // Closes every size and frees the texture
+        void free();
 
-        // Mouse above the button
-        else if( y < mPosition.y )
-        {
-            inside = false;
-        }
+        // Starts a frame, glyphs used during it are kept until the next one even when the texture is full
+        void beginFrame();
 
-        // Mouse below the button
-        else if( y > mPosition.y + BUTTON_HEIGHT )
-        {
-            inside = false;
-        }
+        // Queues a string with its top left corner at x, y, and returns its width
+        int drawText( LSpriteBatch& batch, const std::string& text, int x, int y, int size, SDL_Color color );
+
+        // Appends a sprite for every glyph of a string to a draw list, and returns its width
+        int layoutText( const std::string& text, int x, int y, int size, SDL_Color color, std::vector<LDrawItem>& items );
+
+        // Gets the width and height a string would be drawn at
+        SDL_Point measureText( const std::string& text, int size );
 
-        // Mouse is outside button
-        if( !inside )
+        // Gets how many glyphs are in the texture
+        int getGlyphCount();
+
+        // Gets how many shelves of glyphs were thrown out to make room
+        int getEvictionCount();
+
+    private:
+        // Where a glyph sits in the texture and how it is placed along a line
+        struct Glyph
         {
-            mCurrentSprite = BUTTON_SPRITE_MOUSE_OUT;
-        }
+            // Pixels in the texture, empty for glyphs like space
+            SDL_Rect rect;
 
-        // Mouse is inside button
-        else
+            // Offset of the pixels from the pen position and the top of the line
+            int offsetX, offsetY;
+
+            // How far the pen moves after it
+            int advance;
+
+            // Shelf holding it, -1 for glyphs with no pixels
+            int shelf;
+        };
+
+        // Row of the texture holding glyphs of about the same height, left to right
+        struct Shelf
         {
-            // Set mouse over sprite
-            switch( e->type)
-            {
-                case SDL_MOUSEMOTION:
-                mCurrentSprite = BUTTON_SPRITE_MOUSE_OVER_MOTION;
-                break;
+            int y;
+            int height;
+            int nextX;
 
-                case SDL_MOUSEBUTTONDOWN:
-                mCurrentSprite = BUTTON_SPRITE_MOUSE_DOWN;
-                break;
+            // Frame a glyph on it was last used in, the least recent shelf is emptied when the texture is full
+            Uint32 lastUsed;
 
-                case SDL_MOUSEBUTTONUP:
-                mCurrentSprite = BUTTON_SPRITE_MOUSE_UP;
-                break;
-            }
-        }
-    }
-}
+            // Glyphs on it
+            std::vector<Uint64> keys;
+        };
 
-void LButton::render()
-{
-    // Show current button sprite
-    gButtonSpriteSheetTexture.render( mPosition.x, mPosition.y, &gSpriteClips[ mCurrentSprite ] );
-}
+        // Gets the font opened at a size
+        TTF_Font* getFont( int size );
 
-Dot::Dot()
-{
-    // Constructor
+        // Gets a glyph, rasterizing it first when it is not in the texture, NULL when there is no room
+        Glyph* getGlyph( TTF_Font* font, int size, Uint32 codepoint );
 
-    // Initialize the offsets
-    mPosX = 0;
-    mPosY = 0;
+        // Finds room for a glyph, emptying the least recently used shelf if need be, returns the shelf or -1
+        int allocate( int width, int height, SDL_Rect& rect );
 
-    // Set collision box dimension
-    mCollider.w = DOT_WIDTH;
-    mCollider.h = DOT_HEIGHT;
+        // Walks a string glyph by glyph, appending sprites when items is not NULL, and returns its size
+        SDL_Point walkText( const std::string& text, int x, int y, int size, SDL_Color color, std::vector<LDrawItem>* items );
 
-    // Initialize the velocity
-    mVelX = 0;
-    mVelY = 0;
-}
+        // Reads the code point starting at i and moves i past it, bad sequences read as U+FFFD
+        static Uint32 decodeUtf8( const std::string& text, size_t& i );
 
-void Dot::handleEvent( SDL_Event& e )
-{
-    // if a key was pressed
-    if( e.type == SDL_KEYDOWN && e.key.repeat == 0 )
-    {
-        // Adjust the velocity
-        switch( e.key.keysym.sym )
-        {
-            case SDLK_UP: mVelY -= DOT_VEL; break;
-            case SDLK_DOWN: mVelY += DOT_VEL; break;
-            case SDLK_LEFT: mVelX -= DOT_VEL; break;
-            case SDLK_RIGHT: mVelX += DOT_VEL; break;
-        }
-    }
+        // Font file, and the font opened at every size used
+        std::string mPath;
+        std::map<int, TTF_Font*> mFonts;
 
-    // If a key was released
-    else if( e.type == SDL_KEYUP && e.key.repeat == 0 )
-    {
-        // Adjust the velocity
-        switch( e.key.keysym.sym )
-        {
-            case SDLK_UP: mVelY += DOT_VEL; break;
-            case SDLK_DOWN: mVelY -= DOT_VEL; break;
-            case SDLK_LEFT: mVelX += DOT_VEL; break;
-            case SDLK_RIGHT: mVelX -= DOT_VEL; break;
-        }
-    }
-}
+        // The texture, and an LTexture showing all of it for LSpriteBatch
+        SDL_Texture* mPageTexture;
+        LTexture mPage;
 
-void Dot::move( SDL_Rect& wall )
-{
-    // Move the dot left or right
-    mPosX += mVelX;
-    mCollider.x = mPosX;
+        std::vector<Shelf> mShelves;
+        std::unordered_map<Uint64, Glyph> mGlyphs;
 
-    // If the dot collided or went too far right or left
-    if( ( mPosX < 0 ) || ( mPosX + DOT_WIDTH > SCREEN_WIDTH ) || checkCollision( mCollider, wall ) )
-    {
-        // Move back
-        mPosX -= mVelX;
-        mCollider.x = mPosX;
-    }
+        // Sprites of the string being drawn, reused every call
+        std::vector<LDrawItem> mItems;
 
-    // Move the dot up or down
-    mPosY += mVelY;
-    mCollider.y = mPosY;
+        Uint32 mFrame;
+        int mEvictions;
+};
 
-    // If the dot went too far up or down
-    if( ( mPosY < 0 ) || ( mPosY + DOT_HEIGHT > SCREEN_HEIGHT ) || checkCollision( mCollider, wall ) )
-    {
-        // Move back
-        mPosY -= mVelY;
-        mCollider.y = mPosY;
-    }
-}
 
-void Dot::render()
+// a dot that will move around the screen
+class Dot
+{
+    public:
+        // dimensions of the dot
+        static const int DOT_WIDTH = 20;
+        static const int DOT_HEIGHT = 20;
+
+        // Maximum axis velocity of the dot, in pixels per simulation tick
+        static const int DOT_VEL = 5;
+
+        // Initialize the variables
+        Dot();
+
+        // Initialize the variables at a given position
+        Dot( int x, int y );
+
+        // Takes key presses and adjusts the dot's velocity
+        void handleEvent( SDL_Event& e);
+
+        // Moves the dot and checks collision
+        void move( SDL_Rect& wall );
+
+        // Moves the dot and checks collision against every wall, one by one
+        void move( std::vector<SDL_Rect>& walls );
+
+        // Moves the dot and checks collision against every wall, many at a time
+        void move( LRectBlock& walls );
+
+        // Moves the dot and checks collision against the walls of a collision world, then updates its collider there
+        void move( LCollisionWorld& world, int colliderId );
+
+        // Sets the velocity directly instead of through key presses
+        void setVelocity( int velX, int velY );
+
+        // Gets the collision box
+        SDL_Rect getCollider();
+
+        // Shows the dot on the screen
+        void render();
+
+        // Queues the dot into a sprite batch
+        void render( LSpriteBatch& batch );
+
+        // Queues the dot between its previous and current tick, alpha 0 is previous and 1 is current
+        void render( LSpriteBatch& batch, double alpha );
+
+        // Gets the position after the last tick
+        int getPosX();
+        int getPosY();
+
+        // Whether the dot has any velocity
+        bool isMoving();
+
+    private:
+        // Moves along each axis and moves back if blocked( mCollider ) says the new spot is taken
+        template <typename Blocked>
+        void moveUnless( Blocked blocked );
+
+        // X and Y offsets of the dot
+        int mPosX, mPosY;
+
+        // Offsets before the last tick, for interpolated rendering
+        int mPrevPosX, mPrevPosY;
+
+        // the velocity of the dot
+        int mVelX, mVelY;
+
+        // Dot's collision box
+        SDL_Rect mCollider;
+};
+
+// Many dots kept as separate arrays, so they all move in one cache friendly loop
+class DotSystem
+{
+    public:
+        // Adds a dot and returns its index
+        int add( int x, int y, int velX, int velY );
+
+        // Removes every dot
+        void clear();
+
+        // Gets the number of dots
+        int size();
+
+        // Whether any dot has velocity
+        bool isMoving();
+
+        // Moves every dot one tick, dots that would leave the screen move back like in Dot::move
+        void move();
+
+        // Moves the dots from first up to but not including last
+        void move( int first, int last );
+
+        // Moves the dots from first up to but not including last, dots that would hit a wall move back too
+        void move( int first, int last, const LRectBlock& walls );
+
+        // Copies positions of the dots from first up to but not including last
+        void getPositions( std::vector<SDL_Point>& positions, int first, int last );
+
+        // Queues every dot into a sprite batch
+        void render( LSpriteBatch& batch );
+
+        // Gets a dot's position
+        int getPosX( int i );
+        int getPosY( int i );
+
+        // Gets the collision boxes, left and top are the dot positions
+        const LRectBlock& getColliders();
+
+    private:
+        // Collision boxes, which also hold the positions
+        LRectBlock mColliders;
+
+        // Velocities
+        std::vector<int> mVelX;
+        std::vector<int> mVelY;
+
+        // Position on the axis being moved before the move, so dots that hit a wall can go back
+        std::vector<int> mPrevious;
+};
+
+// Counts jobs still running, a group of jobs is done when it reaches zero
+typedef std::atomic<int> LJobCounter;
+
+// Fixed pool of worker threads running small jobs, idle workers steal jobs queued by busy ones
+class LJobSystem
+{
+    public:
+        // Initialize variables
+        LJobSystem();
+
+        // Stops the workers
+        ~LJobSystem();
+
+        // Starts the workers, 0 means one per hardware thread besides the calling one
+        bool start( int workers = 0 );
+
+        // Finishes queued jobs and joins the workers
+        void stop();
+
+        // Queues a job on the calling thread's queue, counter goes up now and down when the job finishes
+        void run( std::function<void()> job, LJobCounter* counter );
+
+        // Runs queued jobs until the counter reaches zero, sleeps when there are none to run for a while
+        void wait( LJobCounter& counter );
+
+        // Splits 0 to count into chunks, runs body( first, last ) on each in parallel and waits for all of them
+        void parallelFor( int count, int chunk, std::function<void( int, int )> body );
+
+        // Gets the number of worker threads
+        int getWorkerCount();
+
+    private:
+        // A queued job and the counter to lower when it finishes
+        struct Job
+        {
+            std::function<void()> function;
+            LJobCounter* counter;
+        };
+
+        // Each thread pushes and pops the back of its own queue, thieves take from the front
+        struct Queue
+        {
+            std::mutex lock;
+            std::deque<Job> jobs;
+        };
+
+        // Pops a job from the thread's own queue or steals one, runs it, and returns false if there was none
+        bool runOne( int queueIndex );
+
+        // Worker thread body
+        void workerLoop( int queueIndex );
+
+        // Queue 0 belongs to threads that are not workers, worker i owns queue i + 1
+        std::vector<Queue*> mQueues;
+        std::vector<std::thread> mThreads;
+
+        // Jobs queued and not yet taken, so sleeping workers know when to wake
+        std::atomic<int> mQueuedJobs;
+        std::atomic<int> mSleepingWorkers;
+        std::atomic<bool> mRunning;
+        std::mutex mSleepLock;
+        std::condition_variable mWake;
+
+        // Threads asleep in wait(), woken when a job finishes or is queued
+        std::atomic<int> mSleepingWaiters;
+        std::condition_variable mJobDone;
+};
+
+// Decodes images and sounds on the job system, anything that needs the renderer or mixer is left to the calling thread
+class LAssetLoader
+{
+    public:
+        // Initialize variables
+        LAssetLoader();
+
+        // Deallocates memory
+        ~LAssetLoader();
+
+        // Queues an image to be decoded to a surface, returns a handle to wait on
+        int loadImage( std::string path );
+
+        // Queues a WAV file to be decoded and converted to the mixer's format, returns a handle to wait on
+        int loadSound( std::string path );
+
+        // Runs queued jobs until the asset is decoded, returns false if decoding failed
+        bool wait( int handle );
+
+        // Waits for every queued asset, calling progress( ready, total ) whenever more of them are done
+        bool waitAll( std::function<void( int, int )> progress = NULL );
+
+        // Waits for a decoded image, the loader keeps ownership
+        SDL_Surface* getSurface( int handle );
+
+        // Waits for decoded samples and makes a chunk from them, the chunk owns the samples after this
+        Mix_Chunk* takeChunk( int handle );
+
+        // Gets how many assets are decoded out of how many were queued
+        int getReadyCount();
+        int getCount();
+
+        // Gets how long an asset took to decode
+        double getDecodeSeconds( int handle );
+
+        // Checks whether a sound came from the sound cache instead of being converted
+        bool isCached( int handle );
+
+        // Reads assets queued after this from an archive instead of loose files, NULL goes back to files
+        void setArchive( LAssetArchive* archive );
+
+        // Looks sounds queued after this up in a cache of converted samples, and adds the ones it has to convert, NULL turns it off
+        void setCache( LSoundCache* cache );
+
+        // Waits for anything still decoding, then deallocates every asset
+        void free();
+
+    private:
+        // A queued file and what it decoded to
+        struct Asset
+        {
+            std::string path;
+            LAssetArchive* archive;
+            LSoundCache* cache;
+            bool isSound;
+            bool failed;
+            double seconds;
+
+            // Decoded image
+            SDL_Surface* surface;
+
+            // Decoded samples, and the format they were converted to
+            Uint8* samples;
+            Uint32 sampleBytes;
+            bool ownsSamples;
+            bool cached;
+            int frequency;
+            Uint16 format;
+            int channels;
+
+            // Non-zero until the decode job finishes
+            LJobCounter pending;
+        };
+
+        // Adds an asset without queueing it
+        int add( std::string path, bool isSound );
+
+        // Queues the decode job of an asset
+        void start( int handle );
+
+        // Decodes an asset, runs on whichever thread picks up the job
+        static void decode( Asset& asset );
+
+        // Opens an asset's file from the archive, or from disk when it is not in one
+        static SDL_RWops* openFile( Asset& asset );
+
+        // Reads an asset's whole file
+        static bool readFile( Asset& asset, std::vector<Uint8>& bytes );
+
+        // A deque so assets stay put while workers fill them in
+        std::deque<Asset> mAssets;
+        std::atomic<int> mReadyCount;
+
+        // Where new assets are read from, and where converted sounds are looked up
+        LAssetArchive* mArchive;
+        LSoundCache* mCache;
+};
+
+// Read-only view of an archive written by packer.cpp, mapped so assets are used where they lie
+class LAssetArchive
+{
+    public:
+        // Initialize variables
+        LAssetArchive();
+
+        // Deallocates memory
+        ~LAssetArchive();
+
+        // Maps an archive and checks its index, returns false if it is missing or damaged
+        bool open( std::string path );
+
+        // Unmaps the archive, nothing taken from it may be used after this
+        void free();
+
+        // Whether an archive is open
+        bool isOpen();
+
+        // Finds an entry by the path it was packed from, NULL if it is not in the archive
+        const LArchiveEntry* find( std::string name );
+
+        // Opens a file as it was on disk, read straight from the mapping
+        SDL_RWops* openFile( std::string name );
+
+        // Wraps pre-decoded pixels in a surface without copying them, NULL if the entry has none
+        SDL_Surface* getPixels( std::string name );
+
+        // Gets pre-decoded samples in place, read only, NULL if there are none or they are not in the given format
+        const Uint8* getSamples( std::string name, int frequency, Uint16 format, int channels, Uint32* length );
+
+    private:
+        // The whole archive, and whether it is mapped or was read into memory
+        Uint8* mData;
+        size_t mSize;
+        bool mMapped;
+
+        // The index inside mData, looked up by name through mIndex
+        const LArchiveEntry* mEntries;
+        std::map<std::string, int> mIndex;
+};
+
+// Start of a sound cache file, the samples follow it on a 64 byte boundary like archive blobs
+struct LSoundCacheHeader
+{
+    char magic[ 4 ];
+    Uint32 version;
+
+    // What the samples were converted from and to
+    Uint64 sourceHash;
+    Uint32 frequency;
+    Uint16 format;
+    Uint16 channels;
+    Uint32 sampleBytes;
+    Uint8 reserved[ 36 ];
+};
+
+// Sound samples converted to a device format on an earlier run, mapped back in so loading skips decoding and converting
+// Files are keyed by the source path, a hash of the source file and the format, so an edited sound or another device just misses and converts again
+class LSoundCache
+{
+    public:
+        // Initialize variables
+        LSoundCache();
+
+        // Unmaps every file
+        ~LSoundCache();
+
+        // Keeps cache files in a directory, made when it is missing, an empty path turns the cache off
+        void setDirectory( std::string directory );
+
+        // Whether a directory is set
+        bool isEnabled();
+
+        // Gets samples converted from a source file to a format, read only and used where they lie until free(), NULL when there are none
+        const Uint8* find( std::string source, Uint64 sourceHash, int frequency, Uint16 format, int channels, Uint32* length );
+
+        // Writes converted samples for the next run and deletes files of the same source with another hash, returns false if they could not be written
+        bool store( std::string source, Uint64 sourceHash, int frequency, Uint16 format, int channels, const Uint8* samples, Uint32 length );
+
+        // Unmaps every file found, no chunk made from them may be used after this
+        void free();
+
+        // Frees, then deletes every file this run found or wrote
+        void clear();
+
+    private:
+        // A file in memory, mapped or read
+        struct Mapping
+        {
+            Uint8* data;
+            size_t size;
+            bool mapped;
+        };
+
+        // Gets the file converted samples are kept in, every file of a source starts with the same prefix
+        std::string getPrefix( std::string source );
+        std::string getPath( std::string source, Uint64 sourceHash, int frequency, Uint16 format, int channels );
+
+        // Deletes the files a source's earlier contents were converted into
+        void removeStale( std::string source, Uint64 sourceHash );
+
+        // Unmaps or deallocates a file
+        static void release( const Mapping& mapping );
+
+        std::string mDirectory;
+
+        // Files found and written, loader jobs look things up from any thread
+        std::mutex mLock;
+        std::vector<Mapping> mMappings;
+        std::set<std::string> mFiles;
+};
+
+// Sound effect held as float stereo frames, the form LMixer reads
+class LSound
+{
+    public:
+        // Initialize variables
+        LSound();
+
+        // Deallocates memory
+        ~LSound();
+
+        // Copies a chunk's samples, which are in the format SDL_mixer was opened with
+        bool loadFromChunk( Mix_Chunk* chunk );
+
+        // Copies interleaved stereo frames recorded at a frequency
+        bool loadFromFrames( const float* frames, int frameCount, int frequency );
+
+        // Deallocates samples
+        void free();
+
+        // Gets the first frame, silent frames pad both ends so the resampling filter can read past them
+        const float* getFrames();
+
+        // Gets sound info
+        int getFrameCount();
+        int getFrequency();
+
+    private:
+        // Interleaved left and right samples, RESAMPLE_TAPS silent frames either side
+        std::vector<float> mSamples;
+        int mFrameCount;
+        int mFrequency;
+};
+
+// A WAV file decoded on its own thread into a fixed ring of blocks, so memory stays the same however long the track
+// The audio callback only copies out of the ring, it never reads the file or waits for the decoder
+class LMusicStream
+{
+    public:
+        // Initialize variables
+        LMusicStream();
+
+        // Stops decoding
+        ~LMusicStream();
+
+        // Starts decoding a track at a position into float stereo at a frequency, the file is opened on the decoder thread
+        // Errors show up through hasFailed(), call only while the mixer is not reading the stream
+        void open( std::string path, int frequency, double startSeconds = 0.0, bool loop = true );
+
+        // Stops the decoder and forgets the track, keeping the ring for the next one
+        void close();
+
+        // Makes every read wait this long first, to try read-ahead against a slow disk
+        void setReadDelay( Uint32 milliseconds );
+
+        // Copies decoded frames out, silence where none were decoded yet, returns how many were decoded, audio thread only
+        int read( float* frames, int frameCount );
+
+        // Checks whether enough is decoded to start playing, or decoding finished or failed
+        bool isReady();
+
+        // Checks whether the track ended and everything decoded was read
+        bool isFinished();
+
+        // Checks whether the file could not be opened or read
+        bool hasFailed();
+
+        // Marks the stream as played by a mixer, which the mixer clears once it lets go of it
+        void setInUse( bool inUse );
+        bool isInUse();
+
+        // Gets the track and where in it playback is, in seconds
+        std::string getPath();
+        double getPosition();
+
+        // Gets how many frames are decoded and waiting, and how many reads found the ring empty
+        int getBufferedFrames();
+        int getUnderrunCount();
+
+    private:
+        // Decoded frames, all but the last block of a track are full
+        struct Block
+        {
+            float samples[ MUSIC_BLOCK_FRAMES * 2 ];
+            int frames;
+        };
+
+        // Decoder thread, fills free blocks until told to stop or the track ends
+        void decode();
+
+        // Opens the file and finds its samples, decoder thread only
+        bool openFile();
+
+        // Decodes the next block, returns its frame count, 0 at the end of the track or -1 on failure, decoder thread only
+        int fillBlock( Block& block );
+
+        // Checks whether the decoder has a free block to fill
+        bool hasRoom();
+
+        // Ring of blocks, allocated on first open and kept, and a buffer for file reads
+        std::vector<Block> mBlocks;
+        std::vector<Uint8> mReadBuffer;
+
+        // Next block the decoder fills and the next the audio callback reads, and where in that one it is
+        std::atomic<Uint32> mHead;
+        std::atomic<Uint32> mTail;
+        int mReadOffset;
+
+        // Decoder thread, woken early when it has to stop
+        std::thread mThread;
+        std::mutex mLock;
+        std::condition_variable mWake;
+        bool mStopping;
+
+        // State the decoder and the audio callback share
+        std::atomic<bool> mEnded;
+        std::atomic<bool> mFailed;
+        std::atomic<bool> mInUse;
+        std::atomic<int> mUnderrunCount;
+        std::atomic<Uint64> mFramesRead;
+        std::atomic<double> mTrackSeconds;
+
+        // The track asked for
+        std::string mPath;
+        int mFrequency;
+        double mStartSeconds;
+        bool mLoop;
+        std::atomic<Uint32> mReadDelay;
+
+        // File and decoding state, decoder thread only
+        SDL_RWops* mFile;
+        SDL_AudioStream* mConverter;
+        Sint64 mDataStart;
+        Sint64 mDataBytes;
+        Sint64 mDataPosition;
+        int mFrameBytes;
+        bool mDrained;
+};
+
+// What the game thread asks the audio callback to do
+enum AudioCommandType
+{
+    AUDIO_PLAY,
+    AUDIO_STOP,
+    AUDIO_SET_GAIN,
+    AUDIO_SET_PITCH,
+    AUDIO_STOP_SOUND,
+    AUDIO_PLAY_MUSIC,
+    AUDIO_PAUSE_MUSIC,
+    AUDIO_RESUME_MUSIC,
+    AUDIO_HALT_MUSIC,
+    AUDIO_DETACH_MUSIC,
+    AUDIO_CANCEL_MUSIC
+};
+
+// One request to the audio callback, fields a type does not use are left alone
+struct LAudioCommand
+{
+    int type;
+    int voice;
+    LSound* sound;
+    LMusicStream* stream;
+    float seconds;
+    float gain;
+    float pan;
+    float pitch;
+    int priority;
+    bool loop;
+    Uint64 pressed;
+};
+
+// Ring of commands from one producer thread to one consumer thread, neither side ever waits on the other
+class LAudioQueue
+{
+    public:
+        // Initialize variables
+        LAudioQueue();
+
+        // Adds a command, returns false when the ring is full, producer thread only
+        bool push( const LAudioCommand& command );
+
+        // Takes the oldest command, returns false when there is none, consumer thread only
+        bool pop( LAudioCommand& command );
+
+        // Gets how many commands were ever pushed and popped, so the producer can wait for one to be taken
+        Uint32 getPushCount();
+        Uint32 getPopCount();
+
+    private:
+        LAudioCommand mCommands[ AUDIO_QUEUE_SIZE ];
+
+        // Next slot to write and next to read, on their own cache lines so the threads do not share one
+        alignas( 64 ) std::atomic<Uint32> mHead;
+        alignas( 64 ) std::atomic<Uint32> mTail;
+};
+
+// Mixes sound effects and music itself in SDL_mixer's audio callback, with gain, pan and pitch for every voice
+// The game thread only sends commands, so the callback never allocates, locks, or waits for it
+class LMixer
+{
+    public:
+        // Initialize variables, a mixer plays up to voiceCount sounds at once
+        LMixer( int voiceCount = MIXER_VOICES );
+
+        // Unhooks from SDL_mixer
+        ~LMixer();
+
+        // Mixes into whatever SDL_mixer opened the device with, after its own channels
+        bool open();
+
+        // Stops mixing into the device, voices are left as they are
+        void close();
+
+        // Sets the format mixInto writes, open() sets it to the device's, returns false if it cannot be mixed to
+        bool setOutput( int frequency, Uint16 format, int channels );
+
+        // Starts a sound, returns a voice handle, or -1 when the command queue is full
+        // pan goes from -1 left to 1 right, pitch 2 is an octave up within MIXER_MIN_PITCH to MIXER_MAX_PITCH, higher priority voices are stolen last
+        // pressed is the performance counter of the input that asked for it, to measure latency, or 0
+        int play( LSound* sound, float gain = 1.0f, float pan = 0.0f, float pitch = 1.0f, int priority = 0, bool loop = false, Uint64 pressed = 0 );
+
+        // Fades a voice out over a block, handles of voices that ended are ignored
+        void stop( int voice );
+
+        // Changes a playing voice, gain and pan ramp over a block
+        void setGain( int voice, float gain, float pan );
+        void setPitch( int voice, float pitch );
+
+        // Checks whether a voice handle still plays, or is about to
+        bool isPlaying( int voice );
+
+        // Stops every voice playing a sound and waits until the callback has let go of it, call before freeing or reloading it
+        void stopSound( LSound* sound );
+
+        // Starts a music stream once it has decoded enough, crossfading from any that plays over fadeSeconds
+        void playMusic( LMusicStream* stream, float fadeSeconds );
+
+        // Fades music out and keeps its place, or fades it back in from there
+        void pauseMusic();
+        void resumeMusic();
+
+        // Fades music out and lets go of it
+        void haltMusic();
+
+        // Lets go of a music stream at once and waits until the callback has, call before closing or reopening it
+        void detachMusic( LMusicStream* stream );
+
+        // Lets go of a music stream only if it is still waiting to start, returns false if it already plays
+        bool cancelMusic( LMusicStream* stream );
+
+        // Gets the output rate
+        int getFrequency();
+
+        // Takes queued commands and adds every voice into interleaved float stereo frames, audio thread only
+        void mix( float* frames, int frameCount );
+
+        // Mixes a block at a time into a buffer in the output format, clipping integer samples, audio thread only
+        void mixInto( Uint8* stream, int bytes );
+
+        // Uses the scalar kernels instead of the SIMD ones, to compare them
+        void setSimd( bool simd );
+
+        // Adds an interleaved run of frames resampled with the sinc filter
+        typedef Uint64 ( *ResampleKernel )( const float* samples, Uint64 position, Uint64 step, const float* kernels,
+                                            float* out, int frames, float gainLeft, float gainRight, float rampLeft, float rampRight );
+
+        // Adds an interleaved run of frames played at their own rate
+        typedef void ( *CopyKernel )( const float* samples, float* out, int frames,
+                                      float gainLeft, float gainRight, float rampLeft, float rampRight );
+
+        // Gets the filter tables, filled in once for every mixer
+        static const float* getKernels();
+
+        // Gets how many voices play, how many were stolen or refused, and how many commands did not fit the queue
+        int getActiveCount();
+        int getStolenCount();
+        int getRefusedCount();
+        int getDroppedCount();
+
+        // Gets how many callbacks ran, how many took longer than the audio they made, and the slowest one
+        int getCallbackCount();
+        int getXrunCount();
+        double getWorstCallbackSeconds();
+
+        // Starts the slowest callback over, to time a stretch of audio on its own
+        void resetWorstCallback();
+
+        // Gets how many frames the last callback asked for, which can differ from the buffer asked for
+        int getCallbackFrames();
+
+        // Gets how many voices played with a pressed time, and from that time until their first sample is due out of the device
+        int getLatencyCount();
+        double getLastLatencySeconds();
+        double getAverageLatencySeconds();
+        double getWorstLatencySeconds();
+
+    private:
+        // A sound being played
+        struct Voice
+        {
+            // NULL when the voice is free
+            LSound* sound;
+
+            // Handle play() gave out for it
+            int handle;
+
+            // Frame position and how far it moves each output frame, in 32.32 fixed point
+            Uint64 position;
+            Uint64 step;
+
+            // Gains at the end of the last block, and the ones the next block ramps to
+            float gainLeft;
+            float gainRight;
+            float targetLeft;
+            float targetRight;
+
+            // Stealing order, lowest priority first and the oldest among those
+            int priority;
+            Uint32 started;
+
+            bool loop;
+
+            // Fading out to end
+            bool stopping;
+
+            // When its input came, until the first block it is in records the latency
+            Uint64 pressed;
+        };
+
+        // A music stream, fading in or out along an equal power curve
+        struct MusicDeck
+        {
+            // NULL when the deck is empty
+            LMusicStream* stream;
+
+            // Where the fade is from 0 to 1, where it goes, and how far it moves each frame
+            float level;
+            float target;
+            float rate;
+
+            // Not playing until the stream has decoded enough
+            bool waiting;
+        };
+
+        // SDL_mixer's post mix hook
+        static void postMix( void* mixer, Uint8* stream, int bytes );
+
+        // Queues a command, control commands wait for room, returns false if one that may be dropped was
+        bool send( const LAudioCommand& command, bool droppable );
+
+        // Waits until the callback has taken every command sent so far, or takes them itself when nothing is mixing
+        void waitForCallback();
+
+        // Starts timing a wait for the callback when deadline is 0, then checks whether it has run out
+        bool hasCallbackStalled( Uint64& deadline );
+
+        // Carries out every queued command on the game thread, keeping the callback out while it does
+        void applyCommandsHere();
+
+        // Carries out every queued command, audio thread only
+        void applyCommands();
+        void apply( const LAudioCommand& command );
+
+        // Starts a voice for a play command, stealing one if they are all busy
+        void startVoice( const LAudioCommand& command );
+
+        // Adds one voice into a block and moves it on, returns false once it ended
+        bool mixVoice( Voice& voice, float* frames, int frameCount );
+
+        // Notes how long a voice's first sample in this block comes after its input
+        void recordLatency( Uint64 pressed, int frameCount );
+
+        // Adds the music decks into a block, starting streams that are ready and dropping ones that faded out
+        void mixMusic( float* frames, int frameCount );
+
+        // Empties a music deck and tells the game thread
+        void dropDeck( MusicDeck& deck );
+
+        // Frees a voice and tells the game thread
+        void freeVoice( int index );
+
+        // Gets the voice playing a handle, NULL once it ended
+        Voice* findVoice( int handle );
+
+        // Turns gain and pan into left and right gains
+        static void panGains( float gain, float pan, float& left, float& right );
+
+        // Moves a fade level toward its target by at most a distance
+        static float fadeToward( float value, float target, float distance );
+
+        // Turns a pitch into a position step for a sound
+        Uint64 pitchStep( LSound* sound, float pitch );
+
+        // Voices and music, only the audio thread touches them
+        std::vector<Voice> mVoices;
+
+        // Voices stolen this block, fading out over the next one beside the sounds that took their place
+        std::vector<Voice> mStolen;
+        Uint32 mPlayCount;
+        MusicDeck mDecks[ MUSIC_DECKS ];
+
+        // Pausing and halting fade every deck together, down to 0 and back to 1
+        float mMusicLevel;
+        float mMusicTarget;
+        bool mMusicPaused;
+        bool mMusicHalting;
+
+        // Handle each voice plays, 0 when free, written by the audio thread for isPlaying()
+        std::vector< std::atomic<int> > mVoiceHandles;
+
+        // Last handle given out by the game thread, and the last one the audio thread started
+        int mLastHandle;
+        std::atomic<int> mStartedHandle;
+
+        // Counters the audio thread keeps for the game thread
+        std::atomic<int> mStolenCount;
+        std::atomic<int> mRefusedCount;
+        int mDroppedCount;
+        std::atomic<int> mCallbackCount;
+        std::atomic<int> mXrunCount;
+        std::atomic<Uint64> mWorstCallbackTicks;
+        std::atomic<int> mCallbackFrames;
+        std::atomic<int> mLatencyCount;
+        std::atomic<Uint64> mLastLatencyTicks;
+        std::atomic<Uint64> mTotalLatencyTicks;
+        std::atomic<Uint64> mWorstLatencyTicks;
+
+        // The callback being mixed, when it started, how many frames it wants and where the block being mixed starts in it
+        Uint64 mCallbackStart;
+        int mCallbackLength;
+        int mCallbackOffset;
+
+        // Commands from the game thread
+        LAudioQueue mQueue;
+
+        // Held by the callback while it mixes, it skips a buffer rather than wait for the game thread to let go
+        std::mutex mMixLock;
+
+        // Output format
+        int mFrequency;
+        Uint16 mFormat;
+        int mChannels;
+        bool mHooked;
+
+        // A block mixed in float before it goes into the output, and one read from a music stream
+        float mBlock[ MIXER_BLOCK_FRAMES * 2 ];
+        float mMusicBlock[ MIXER_BLOCK_FRAMES * 2 ];
+
+        // Kernels picked for this CPU
+        ResampleKernel mResample;
+        CopyKernel mCopy;
+
+        // RESAMPLE_BANDS tables of RESAMPLE_PHASES + 1 phases of RESAMPLE_TAPS taps
+        const float* mKernels;
+};
+
+// Streams looping music tracks through a mixer, crossfading from one to the next, game thread only
+class LMusicPlayer
+{
+    public:
+        // Initialize variables, tracks play through mixer
+        LMusicPlayer( LMixer* mixer );
+
+        // Starts streaming a WAV track, the one playing carries on until enough is decoded and then fades over fadeSeconds
+        // While paused it only notes the track and place, which open once resumed
+        void play( std::string path, double fadeSeconds = 0.0, double startSeconds = 0.0 );
+
+        // Jumps within the track the same way, so there is neither a gap nor a click
+        void seek( double seconds );
+
+        // Fades the music out keeping its place, or back in from there
+        void pause();
+        void resume();
+
+        // Fades the music out and stops streaming it
+        void halt();
+
+        // Stops the decoders, call once the mixer no longer runs
+        void close();
+
+        // Gets player state
+        bool isPlaying();
+        bool isPaused();
+        std::string getPath();
+        double getPosition();
+
+        // Gets how often the playing track's ring ran dry
+        int getUnderrunCount();
+
+    private:
+        LMixer* mMixer;
+
+        // One stream plays while the others fade out or are free to fade the next track in
+        LMusicStream mStreams[ MUSIC_DECKS ];
+        int mCurrent;
+
+        // When each stream last started, the oldest has faded out the furthest
+        Uint32 mStarted[ MUSIC_DECKS ];
+        Uint32 mStartCount;
+        bool mPlaying;
+        bool mPaused;
+
+        // Track, place and fade asked for while paused, opened by resume()
+        bool mReopening;
+        std::string mReopenPath;
+        double mReopenSeconds;
+        double mReopenFade;
+};
+
+// Watches a resources directory and reloads assets in place when their files change
+class LHotReloader
+{
+    public:
+        // Initialize variables
+        LHotReloader();
+
+        // Stops watching
+        ~LHotReloader();
+
+        // Starts watching a directory, returns false where inotify is not available
+        bool start( std::string directory );
+
+        // Stops watching and frees sound effects that were swapped out
+        void stop();
+
+        // Reloads an atlas image when its file changes
+        void watchImage( std::string path, LTextureAtlas& atlas, std::string name );
+
+        // Points a texture at its atlas image again after that image reloads
+        void watchTexture( LTexture& texture, std::string name );
+
+        // Swaps a sound effect when its file changes, and reloads the mixer's copy of it if there is one
+        void watchSound( std::string path, Mix_Chunk** chunk, LSound* sound = NULL );
+
+        // Streams music again when its file changes, from where it was
+        void watchMusic( std::string path, LMusicPlayer* player );
+
+        // Reloads whatever changed since the last call, call between frames, returns how many assets were reloaded
+        int update();
+
+    private:
+        // A file and what to do with it when it changes
+        struct Watched
+        {
+            std::string path;
+            LTextureAtlas* atlas;
+            std::string name;
+            Mix_Chunk** chunk;
+            LSound* sound;
+            LMusicPlayer* player;
+        };
+
+        // A texture showing an atlas image
+        struct Binding
+        {
+            LTexture* texture;
+            std::string name;
+        };
+
+        // Reads pending inotify events, collecting the paths that were written or moved in
+        void readChanges( std::set<std::string>& changed );
+
+        // Frees swapped out chunks once no channel is playing them
+        void freeRetiredChunks( bool force );
+
+        std::string mDirectory;
+        int mNotify;
+
+        std::vector<Watched> mWatched;
+        std::vector<Binding> mBindings;
+        std::vector<Mix_Chunk*> mRetiredChunks;
+};
+
+// Phases of a main loop frame, in the order they run
+enum ProfilePhase
+{
+    PROFILE_EVENTS,
+    PROFILE_UPDATE,
+    PROFILE_CLEAR,
+    PROFILE_DRAW,
+    PROFILE_PRESENT,
+    PROFILE_WAIT,
+    PROFILE_PHASE_TOTAL
+};
+
+// Times the phases of each frame into a ring buffer, and optionally keeps every timing as a trace event
+class LProfiler
+{
+    public:
+        // Initialize variables
+        LProfiler();
+
+        // Turns timing on or off, nothing is recorded while off
+        void setEnabled( bool enabled );
+        bool isEnabled();
+
+        // Ends the current frame and starts the next one, main thread only
+        void beginFrame();
+
+        // Ends the running phase and starts another, main thread only
+        void mark( ProfilePhase phase );
+
+        // Adds a finished timing to the trace, any thread
+        void addTraceEvent( const char* name, Uint64 start, Uint64 end );
+
+        // Keeps trace events from now on, for writeTrace
+        void startTrace();
+
+        // Writes trace events as Chrome trace event JSON
+        bool writeTrace( std::string path );
+
+        // Draws the last PROFILE_FRAMES frames as bars stacked by phase, full height is 1/30 of a second
+        void renderGraph( int x, int y, int w, int h );
+
+        // Prints average and worst time per phase over the frames in the ring buffer
+        void printSummary();
+
+    private:
+        // Time spent in each phase of one frame, in performance counter ticks
+        struct FrameTiming
+        {
+            Uint64 phases[ PROFILE_PHASE_TOTAL ];
+            Uint64 total;
+        };
+
+        // A timing kept for the trace, on the thread with job queue tid
+        struct TraceEvent
+        {
+            const char* name;
+            Uint64 start;
+            Uint64 end;
+            int tid;
+        };
+
+        // Adds the running phase to the current frame
+        void closePhase( Uint64 now );
+
+        bool mEnabled;
+        Uint64 mFrequency;
+
+        // Ring buffer of frames, mFrameCount is the one being timed
+        FrameTiming mFrames[ PROFILE_FRAMES ];
+        int mFrameCount;
+        Uint64 mFrameStart;
+
+        // Running phase, PROFILE_PHASE_TOTAL between frames
+        ProfilePhase mPhase;
+        Uint64 mPhaseStart;
+
+        // Trace events, shared with workers
+        bool mTracing;
+        std::vector<TraceEvent> mTrace;
+        std::mutex mTraceLock;
+};
+
+// Times the enclosing scope as a trace event
+class LProfileScope
+{
+    public:
+        // Starts timing when the profiler is on
+        LProfileScope( const char* name );
+
+        // Adds the trace event
+        ~LProfileScope();
+
+    private:
+        const char* mName;
+        Uint64 mStart;
+};
+
+// Profiler hooks, these vanish when the profiler is compiled out
+#if LPROFILER
+#define PROFILE_FRAME() gProfiler.beginFrame()
+#define PROFILE_PHASE( phase ) gProfiler.mark( phase )
+#define PROFILE_SCOPE( name ) LProfileScope profileScope( name )
+#else
+#define PROFILE_FRAME()
+#define PROFILE_PHASE( phase )
+#define PROFILE_SCOPE( name )
+#endif
+
+// Kinds of event kept in an input log
+enum InputRecordKind
+{
+    INPUT_RECORD_KEY_DOWN,
+    INPUT_RECORD_KEY_UP,
+    INPUT_RECORD_MOUSE_MOTION,
+    INPUT_RECORD_MOUSE_DOWN,
+    INPUT_RECORD_MOUSE_UP,
+    INPUT_RECORD_END  // tick the session ended on
+};
+
+// First bytes of an input log, and the tick rate its ticks count in
+struct LInputLogHeader
+{
+    char magic[ 4 ];
+    Uint32 version;
+    Uint32 ticksPerSecond;
+    Uint32 reserved;
+};
+
+// One logged event, only the fields the game reads
+struct LInputRecord
+{
+    Uint32 tick;
+    Uint8 kind;
+    Uint8 detail;  // key repeat, or mouse button
+    Sint16 x;
+    Sint16 y;
+    Uint16 reserved;
+    Sint32 key;
+};
+
+// Writes input events to a log, stamped with the tick they happen before
+class LInputRecorder
+{
+    public:
+        // Initialize variables
+        LInputRecorder();
+
+        // Closes the log
+        ~LInputRecorder();
+
+        // Creates the log file
+        bool start( std::string path );
+
+        // Logs an event if it is input the game uses, returns whether it was logged
+        bool record( Uint32 tick, const SDL_Event& e );
+
+        // Marks the tick the session ended on and closes the log
+        void stop( Uint32 tick );
+
+        // Whether a log is open
+        bool isRecording();
+
+    private:
+        FILE* mFile;
+        int mCount;
+};
+
+// Input events stamped with the simulation tick they happen before, played back in lock-step
+class LInputReplay
+{
+    public:
+        // Initialize variables
+        LInputReplay();
+
+        // Adds an event to happen before a tick, events have to be added in tick order
+        void add( Uint32 tick, const SDL_Event& e );
+
+        // Gets the next event due before a tick, false once there are none left for it
+        bool poll( Uint32 tick, SDL_Event& e );
+
+        // Fills with a repeatable pattern of arrow key presses and releases over a number of ticks
+        void generate( Uint32 ticks, unsigned int seed );
+
+        // Fills with a log written by LInputRecorder
+        bool load( std::string path );
+
+        // Whether the session's last tick was reached and every event before it played
+        bool isFinished( Uint32 tick );
+
+        // Gets the tick the session ended on
+        Uint32 getEndTick();
+
+        // Removes every event and starts over
+        void clear();
+
+        // Gets how many events there are
+        int getCount();
+
+    private:
+        // An event and its tick
+        struct Entry
+        {
+            Uint32 tick;
+            SDL_Event event;
+        };
+
+        std::vector<Entry> mEntries;
+
+        // Next event to play
+        int mNext;
+
+        // Tick the session ended on
+        Uint32 mEndTick;
+};
+
+// Everything the renderer needs from the simulation, never changed once built
+struct LFrameSnapshot
+{
+    // Player dot before and after the last tick
+    SDL_Point dotPrevious;
+    SDL_Point dotCurrent;
+
+    // Crowd dots before and after the last tick
+    std::vector<SDL_Point> crowdPrevious;
+    std::vector<SDL_Point> crowdCurrent;
+
+    // The wall
+    SDL_Rect wall;
+};
+
+// Parts of the screen that changed since the last frame, found from where everything was drawn then and now
+class LDirtyRegions
+{
+    public:
+        // Initialize variables, the first frame is drawn whole
+        LDirtyRegions();
+
+        // Marks an item's old and new bounds when it moved, an empty rect means it is not drawn
+        void track( int id, const SDL_Rect& bounds );
+
+        // Marks an area as changed
+        void add( const SDL_Rect& rect );
+
+        // Marks the whole screen, when what was drawn before can no longer be trusted
+        void invalidateAll();
+
+        // Whether anything needs drawing
+        bool isEmpty();
+
+        // Changed areas, on screen and not overlapping each other
+        const std::vector<SDL_Rect>& getRects();
+
+        // Forgets the changed areas once they are drawn
+        void clear();
+
+    private:
+        // Where each tracked item was last drawn
+        std::vector<SDL_Rect> mBounds;
+
+        // Changed areas
+        std::vector<SDL_Rect> mRects;
+};
+
+// Key press surfaces constants
+enum KeyPressSurfaces
+{
+    KEY_PRESS_SURFACE_DEFAULT,  // default count starts at 0
+    KEY_PRESS_SURFACE_UP,  // so this is 1
+    KEY_PRESS_SURFACE_DOWN,  // this is 2, etc.
+    KEY_PRESS_SURFACE_LEFT,
+    KEY_PRESS_SURFACE_RIGHT,
+    KEY_PRESS_SURFACE_TOTAL
+};
+
+
+// Start up SDL and create the window and surface
+bool init();
+
+// Opens the audio device as configured, doubling the buffer while the device refuses it or cannot keep it fed
+bool openAudio();
+
+// Load the media
+bool loadMedia();
+
+// Registers everything loadMedia loads with a hot reloader
+void watchMedia( LHotReloader& reloader );
+
+// Frees media and shuts down SDL
+void close();
+
+// Box collision detector
+bool checkCollision( SDL_Rect a, SDL_Rect b );
+
+// Tests rect a against up to 32 rects of a block starting at first, bit i is set if rect first + i overlaps
+Uint32 checkCollision( SDL_Rect a, const LRectBlock& block, int first );
+
+// Tests rect a against every rect of a block
+bool checkCollisionAny( SDL_Rect a, const LRectBlock& block );
+
+// Checks every block kernel the CPU runs against the rect checkCollision, then times the rect one and the block one, returns false on any mismatch
+bool checkCollisionSelfTest();
+
+// Loads individual image (SDL_Surface is software rendering whereas SDL_Texture is hardware rendering)
+SDL_Texture* loadTexture( std:: string path);
+
+// Draws thousands of dots with LTexture::render and with LSpriteBatch and prints draws per second
+void benchmarkSpriteBatch( int sprites );
+
+// Runs the dot simulation without a window and prints ticks per second
+void runSimulation( int ticks );
+
+// Waits out the rest of a frame when vsync is off and a frame cap is set
+void waitForFrameCap( Uint64 frameStart, bool presented );
+
+// Plays the sound or drives the music a number key is bound to, pressed is the counter when the key went down
+void handleAudioKey( SDL_Keycode key, Uint64 pressed );
+
+// Moves growing crowds of dots among growing numbers of walls, brute force and with LCollisionWorld
+void benchmarkBroadphase();
+
+// Moves 1k to 1M dots as Dot objects and as a DotSystem and prints updates per second
+void benchmarkDotSystem();
+
+// Measures job throughput and latency, and how DotSystem updates scale with thread count
+void benchmarkJobSystem();
+
+// Where a dot is drawn between its previous and current tick
+SDL_Point interpolatePoint( const SDL_Point& previous, const SDL_Point& current, double alpha );
+
+// Draws a simulation snapshot between its previous and current tick, skipping dots outside clip
+void renderSnapshot( const LFrameSnapshot& snapshot, double alpha, const SDL_Rect* clip = NULL );
+
+// Creates gFrameTexture, or leaves it NULL so every frame is redrawn when render targets are missing
+void createFrameTexture();
+
+// Redraws what moved since the last frame into gFrameTexture, returns false when nothing did
+bool renderDirtySnapshot( const LFrameSnapshot& snapshot, double alpha, LDirtyRegions& dirty );
+
+// Reads back the render target and hashes it, so runs can be compared for identical output
+Uint64 checksumFrame();
+
+// 64 bit FNV-1a of some bytes
+Uint64 hashBytes( const void* bytes, size_t size );
+
+// Prints frames per second and the median and 99th percentile frame time
+void printFrameTimes( std::vector<double>& frameSeconds );
+
+// Draws the loading screen image with a bar showing how many assets are ready
+void renderLoadingScreen( LTexture& image, int ready, int total );
+
+// Decodes every asset loadMedia uses one after another and then on the job system, and prints both times
+void benchmarkAssetLoader( int workers );
+
+// Sends the same mouse events to a toolbar of buttons one by one and through LButtonLayer, and prints both times
+void benchmarkButtons();
+
+// Adds rows and columns of containers in turn, with a label, an image and a button at the bottom
+void addWidgetLevel( LContainer* parent, int depth, int fanout, const SDL_Rect* clips, std::vector<LWidget*>& leaves );
+
+// Draws a changing counter by rendering a texture every frame and from the glyph atlas, and prints both times
+void benchmarkText();
+
+// Appends the laid out area of a widget and then of everything below it
+void collectWidgetRects( LWidget* widget, std::vector<SDL_Rect>& rects );
+
+// Times the first layout of a deep widget tree, an update with nothing changed, and one after a leaf changes size
+// Returns false when an update places more than the changed subtree, or ends up anywhere a fresh layout would not
+bool benchmarkWidgets();
+
+// Checks every SIMD kernel the CPU runs against the scalar one, then mixes growing numbers of voices offline with both
+// and prints how much faster than real time, returns false when the kernels or the mixes disagree
+bool benchmarkMixer();
+
+// Sends mixer commands at growing rates while the audio device plays, and prints how many callbacks ran late
+// Returns false when any did, or the device would not open
+bool benchmarkAudioQueue();
+
+// Streams music while reads are slowed down more and more and counts underruns, then checks seeks and crossfades for gaps
+void benchmarkMusic();
+
+// Loads the sound effects with no cache, into an empty cache, from a warm one and for another device, and prints the cost of each
+void benchmarkSoundLoading();
+
+// Opens the audio device with growing buffers and prints how long simulated key presses take to reach the first sample
+void benchmarkAudioLatency();
+
+// Checks every blending kernel the CPU runs against the scalar one on random spans, then draws rotated, flipped, alpha blended
+// and scaled scenes with SDL's software renderer and with LRasterizer, and compares, returns false when the kernels disagree
+bool benchmarkRasterizer();
+
+// Draws a scene of many overlapping sprites, rects, lines and points untiled and then tiled on 1 to all cores, and compares
+void benchmarkTiledRasterizer();
+
+// Writes interleaved 16-bit samples to a WAV file
+bool writeWav( std::string path, const std::vector<Sint16>& samples, int channels, int frequency );
+
+// Audio device settings, changed by command line options before init(), openAudio() grows the buffer if it has to
+int gAudioFrequency = 44100;
+Uint16 gAudioFormat = MIX_DEFAULT_FORMAT;
+int gAudioBufferFrames = 256;
+
+// Renderer settings, changed by command line options before init()
+bool gUseSoftwareRenderer = false;
+bool gUseVSync = true;
+
+// Draw textures with gRasterizer instead of gRenderer, turned on as well when no accelerated renderer can be created
+bool gUseRasterizer = false;
+LRasterFilter gRasterFilter = RASTER_NEAREST;
+
+// Rasterize in tiles on the job system, turned off by --raster-untiled
+bool gRasterTiled = true;
+
+// Frames per second limit used when vsync is off, 0 is uncapped
+int gFrameCap = 0;
+
+// Render into gFrameSurface with no window, and play sound nowhere
+bool gHeadless = false;
+
+// Target of the software renderer in headless mode
+SDL_Surface* gFrameSurface = NULL;
+
+// Block waiting for input while nothing moves, turned off by --no-idle
+bool gIdleWaiting = true;
+
+// Keep the frame in gFrameTexture and redraw only what changed, turned off by --full-redraw
+bool gDirtyRendering = true;
+
+// Last frame drawn, copied to the screen when presenting, NULL when redrawing everything
+SDL_Texture* gFrameTexture = NULL;
+
+// What changed since gFrameTexture was drawn
+LDirtyRegions gDirtyRegions;
+
+// The window we'll be rendering to
+SDL_Window* gWindow = NULL;  // make sure to have pointers point to NULL if not pointing to anything
+
+// Textures need an SDL_Renderer to render to the screen
+SDL_Renderer* gRenderer = NULL;
+
+// Our own software renderer, presents through gRenderer
+LRasterizer gRasterizer;
+
+// The images that correspond to a keypress
+SDL_Surface* gKeyPressSurfaces[ KEY_PRESS_SURFACE_TOTAL ];
+
+// Current displayed texture
+SDL_Texture* gTexture = NULL;
+
+// Scene Textures using LTexture
+LTexture gFooTexture;
+LTexture gBackgroundTexture;
+
+// Create some spirtes
+//SDL_Rect gSpriteClips[ 4 ];
+//LTexture gSpriteSheetTexture;
+
+// Walking animation
+const int WALKING_ANIMATION_FRAMES = 4;
+SDL_Rect gSpriteWalkClips[ 4 ];
+LTexture gSpriteWalkSheetTexture;
+
+// Texture for Rotation and Flipping
+LTexture gArrowTexture;
+
+// Globally used font
+TTF_Font *gFont = NULL;
+
+// Glyphs of lazy.ttf for text drawn every frame
+LGlyphAtlas gGlyphs;
+LTexture gTextTexture;
+
+// Mouse Button Sprites
+SDL_Rect gSpriteClips[ BUTTON_SPRITE_TOTAL ];
+LTexture gButtonSpriteSheetTexture;
+
+//Buttons objects
+LButton gButtons[ TOTAL_BUTTONS ];
+
+// Finds which buttons a mouse event is over
+LButtonLayer gButtonLayer;
+
+//Scene textures
+LTexture gPressTexture;
+LTexture gUpTexture;
+LTexture gDownTexture;
+LTexture gLeftTexture;
+LTexture gRightTexture;
+
+//Scene texture
+LTexture gPromptTexture;
+
+
+// Sound effects that will be used
+Mix_Chunk *gScratch = NULL;
+Mix_Chunk *gHigh = NULL;
+Mix_Chunk *gMedium = NULL;
+Mix_Chunk *gLow = NULL;
+
+// The same sound effects as mixer voices
+LSound gScratchSound;
+LSound gHighSound;
+LSound gMediumSound;
+LSound gLowSound;
+
+// Mixes sound effects in the audio callback
+LMixer gMixer;
+
+// Music streamed from disk and looped by gMixer
+LMusicPlayer gMusic( &gMixer );
+
+// Show the Dot
+LTexture gDotTexture;
+
+// Every image under resources/ packed into a few pages
+LTextureAtlas gAtlas;
+
+// Batches sprites drawn in the main loop
+LSpriteBatch gSpriteBatch;
+
+// Times the main loop, off unless --profile or --trace is given
+LProfiler gProfiler;
+
+// Names of the profiler phases, for the summary and the trace
+const char* PROFILE_PHASE_NAMES[ PROFILE_PHASE_TOTAL ] = { "events", "update", "clear", "draw", "present", "wait" };
+
+// Graph colors of the profiler phases
+const SDL_Color PROFILE_PHASE_COLORS[ PROFILE_PHASE_TOTAL ] =
+{
+    { 0x80, 0x80, 0x80, 0xFF },
+    { 0x00, 0x80, 0xFF, 0xFF },
+    { 0xFF, 0xC0, 0x00, 0xFF },
+    { 0x00, 0xC0, 0x00, 0xFF },
+    { 0xFF, 0x00, 0x00, 0xFF },
+    { 0xC0, 0xC0, 0xC0, 0xFF }
+};
+
+// Worker threads for the update phase
+LJobSystem gJobs;
+
+// Packed resources, used by loadMedia when open
+LAssetArchive gArchive;
+
+// Sound effects converted on earlier runs, used by loadMedia when enabled
+LSoundCache gSoundCache;
+
+// Dots moved by a job each, big enough that queueing a job costs little next to running it
+const int DOTS_PER_JOB = 16384;
+
+// Which job queue the current thread pushes to, 0 for threads that are not workers
+static thread_local int tJobQueue = 0;
+
+// Images packed into gAtlas at startup, as lookup name and path
+const int TOTAL_ATLAS_IMAGES = 14;
+const char* ATLAS_IMAGES[ TOTAL_ATLAS_IMAGES ][ 2 ] =
+{
+    { "arrow", "resources/arrow.png" },
+    { "background", "resources/background.png" },
+    { "button", "resources/button.png" },
+    { "dot", "resources/dot.bmp" },
+    { "dots", "resources/dots.png" },
+    { "foo", "resources/foo.png" },
+    { "foo_walk", "resources/foo_walk.png" },
+    { "loading_image", "resources/loading_image.png" },
+    { "press", "resources/press.png" },
+    { "prompt", "resources/prompt.png" },
+    { "up", "resources/up.png" },
+    { "down", "resources/down.png" },
+    { "left", "resources/left.png" },
+    { "right", "resources/right.png" }
+};
+
+LTexture::LTexture()
+{
+    // This Constructor initializes variables
+    mTexture = NULL;
+    mWidth = 0;
+    mHeight = 0;
+
+    mOwnsTexture = true;
+    mImage = NULL;
+    mAtlasRect.x = 0;
+    mAtlasRect.y = 0;
+    mAtlasRect.w = 0;
+    mAtlasRect.h = 0;
+
+    mRed = 0xFF;
+    mGreen = 0xFF;
+    mBlue = 0xFF;
+    mAlpha = 0xFF;
+    mBlendMode = SDL_BLENDMODE_BLEND;
+}
+
+LTexture::~LTexture()
+{
+    // This Destructor deallocates
+    free();
+}
+
+bool LTexture::loadFromFile( std::string path )
+{
+    // Get rid of preexisting texture if it exists
+    free();
+
+    // Load image at specified path
+    SDL_Surface* loadedSurface = IMG_Load( path.c_str() );
+    if( loadedSurface == NULL )
+    {
+        printf(" Unable to load image %s! SDL_image Error: %s\n", path.c_str(), IMG_GetError() );
+    }
+    else
+    {
+        if( !loadFromSurface( loadedSurface ) )
+        {
+            printf( "Unable to create texture from %s!\n", path.c_str() );
+        }
+
+        // Get rid of old loaded surface
+        SDL_FreeSurface( loadedSurface );
+    }
+
+    // Return success
+    return mTexture != NULL;
+}
+
+bool LTexture::loadFromSurface( SDL_Surface* surface )
+{
+    // Get rid of preexisting texture if it exists
+    free();
+
+    // Color key image (i.e. pick a color to make transparent )
+    SDL_SetColorKey( surface, SDL_TRUE, SDL_MapRGB( surface->format, 0, 0xFF, 0xFF ));  // surface, enable color keying, and the pixel we want to color key with (using cyan here)
+
+    // Create texture from surface pixels
+    mTexture = SDL_CreateTextureFromSurface( gRenderer, surface );
+    if( mTexture == NULL )
+    {
+        printf( "Unable to create texture from surface! SDL Error: %s\n", SDL_GetError() );
+    }
+    else
+    {
+        // Get image dimensions
+        mWidth = surface->w;
+        mHeight = surface->h;
+
+        // Keep the pixels for the rasterizer too
+        if( gRasterizer.isOpen() )
+        {
+            mImage = new LRasterImage();
+            mImage->loadFromSurface( surface );
+        }
+    }
+
+    return mTexture != NULL;
+}
+
+bool LTexture::loadFromAsset( LAssetLoader& loader, int handle )
+{
+    // Decoding happens on a worker, but textures can only be created on the render thread
+    SDL_Surface* surface = loader.getSurface( handle );
+    if( surface == NULL )
+    {
+        free();
+        return false;
+    }
+    return loadFromSurface( surface );
+}
+
+bool LTexture::loadFromAtlas( LTextureAtlas& atlas, std::string name )
+{
+    // Get rid of preexisting texture if it exists
+    free();
+
+    // Point at the shared page, the atlas keeps ownership
+    SDL_Texture* page = NULL;
+    SDL_Rect area;
+    LRasterImage* image = NULL;
+    if( !atlas.lookup( name, &page, &area, &image ) )
+    {
+        printf( "Unable to find %s in texture atlas!\n", name.c_str() );
+        return false;
+    }
+
+    return loadFromTexture( page, area, image );
+}
+
+bool LTexture::loadFromTexture( SDL_Texture* texture, SDL_Rect area, LRasterImage* image )
+{
+    free();
+
+    mTexture = texture;
+    mOwnsTexture = false;
+    mImage = image;
+    mAtlasRect = area;
+    mWidth = area.w;
+    mHeight = area.h;
+    return mTexture != NULL;
+}
+
+#ifdef _SDL_TTF_H
+bool LTexture::loadFromRenderedText( std::string textureText, SDL_Color textColor )
+{
+    // Get rid of preexisting texture
+    free();
+
+    // Render text surface, need surface to render onto
+    SDL_Surface* textSurface = TTF_RenderText_Solid( gFont, textureText.c_str(), textColor );
+    if( textSurface == NULL )
+    {
+        printf( "Unable to render text surface! SDL_TTF Error: %s\n", TTF_GetError() );
+    }
+    else
+    {
+        // Create texture from surface pixels
+        mTexture = SDL_CreateTextureFromSurface( gRenderer, textSurface );
+        if( mTexture == NULL )
+        {
+            printf( "Unable to create texture from rendered text! SDL Error: %s\n", SDL_GetError() );
+        }
+        else
+        {
+            // Get image dimensions
+            mWidth = textSurface->w;
+            mHeight = textSurface->h;
+
+            // Keep the pixels for the rasterizer too
+            if( gRasterizer.isOpen() )
+            {
+                mImage = new LRasterImage();
+                mImage->loadFromSurface( textSurface );
+            }
+        }
+
+        // Get rid of old surface
+        SDL_FreeSurface( textSurface );
+    }
+
+    // Return success
+    return mTexture != NULL;
+}
+#endif
+
+void LTexture::free()
+{
+    // Free texture if it exists, atlas pages are freed by their atlas
+    if( mTexture != NULL )
+    {
+        if( mOwnsTexture )
+        {
+            SDL_DestroyTexture( mTexture );
+            delete mImage;
+        }
+        mTexture = NULL;
+        mWidth = 0;
+        mHeight = 0;
+    }
+    mOwnsTexture = true;
+    mImage = NULL;
+}
+
+void LTexture::render( int x, int y, SDL_Rect* clip, double angle, SDL_Point* center, SDL_RendererFlip flip )
+{
+    // Render a texture, with optional clip param to see what parts to clip and rotation or flip
+
+    // Set rendering space and render to screen
+    SDL_Rect renderQuad = { x, y, mWidth, mHeight };
+
+    // Set clip rendering dimensions
+    if( clip != NULL )
+    {
+        renderQuad.w = clip->w;
+        renderQuad.h = clip->h;
+    }
+
+    // The rasterizer modulates every draw itself, so owned and atlas images go the same way
+    if( mImage != NULL && gRasterizer.isDrawing() )
+    {
+        gRasterizer.copy( *mImage, getSourceRect( clip ), renderQuad, angle, center, flip, getColor(), mBlendMode );
+        return;
+    }
+
+    // Owned textures already carry their own modulation
+    if( mOwnsTexture )
+    {
+        SDL_RenderCopyEx( gRenderer, mTexture, clip, &renderQuad, angle, center, flip );
+        return;
+    }
+
+    // Atlas pages are shared, so move the clip into the page and apply this image's modulation
+    SDL_Rect source = mAtlasRect;
+    if( clip != NULL )
+    {
+        source.x += clip->x;
+        source.y += clip->y;
+        source.w = clip->w;
+        source.h = clip->h;
+    }
+
+    SDL_SetTextureColorMod( mTexture, mRed, mGreen, mBlue );
+    SDL_SetTextureAlphaMod( mTexture, mAlpha );
+    SDL_SetTextureBlendMode( mTexture, mBlendMode );
+    SDL_RenderCopyEx( gRenderer, mTexture, &source, &renderQuad, angle, center, flip );
+}
+
+// Enables blending
+void LTexture::setBlendMode( SDL_BlendMode blending )
+{
+    // set blending function
+    mBlendMode = blending;
+    if( mOwnsTexture )
+    {
+        SDL_SetTextureBlendMode( mTexture, blending );
+    }
+}
+
+
+// The lower the alpha, the more transparent a texture is
+void LTexture::setAlpha( Uint8 alpha )
+{
+    // Modulate texture alpha
+    mAlpha = alpha;
+    if( mOwnsTexture )
+    {
+        SDL_SetTextureAlphaMod( mTexture, alpha );
+    }
+}
+
+void LTexture::setColor( Uint8 red, Uint8 green, Uint8 blue )
+{
+    // Modulate texture
+    mRed = red;
+    mGreen = green;
+    mBlue = blue;
+    if( mOwnsTexture )
+    {
+        SDL_SetTextureColorMod( mTexture, red, green, blue );
+    }
+}
+
+int LTexture::getWidth()
+{
+    return mWidth;
+}
+
+int LTexture::getHeight()
+{
+    return mHeight;
+}
+
+SDL_Texture* LTexture::getTexture()
+{
+    return mTexture;
+}
+
+SDL_Rect LTexture::getSourceRect( SDL_Rect* clip )
+{
+    // Whole image unless clipped, moved into the atlas page if there is one
+    SDL_Rect source = { 0, 0, mWidth, mHeight };
+    if( clip != NULL )
+    {
+        source = *clip;
+    }
+    if( !mOwnsTexture )
+    {
+        source.x += mAtlasRect.x;
+        source.y += mAtlasRect.y;
+    }
+    return source;
+}
+
+LRasterImage* LTexture::getImage()
+{
+    return mImage;
+}
+
+SDL_Color LTexture::getColor()
+{
+    SDL_Color color = { mRed, mGreen, mBlue, mAlpha };
+    return color;
+}
+
+SDL_BlendMode LTexture::getBlendMode()
+{
+    return mBlendMode;
+}
+
+LSpriteBatch::LSpriteBatch()
+{
+    mSizeTexture = NULL;
+    mTextureWidth = 0;
+    mTextureHeight = 0;
+    mSubmitCount = 0;
+}
+
+void LSpriteBatch::begin()
+{
+    // Keep capacity from previous frames
+    mQuads.clear();
+    mVertices.clear();
+
+    // A texture freed since may have been reallocated at the same address with another size
+    mSizeTexture = NULL;
+}
+
+void LSpriteBatch::draw( LTexture& texture, int x, int y, SDL_Rect* clip, double angle, SDL_Point* center, SDL_RendererFlip flip )
+{
+    // The rasterizer has no draw calls to save, so sprites are drawn as they come
+    if( texture.getImage() != NULL && gRasterizer.isDrawing() )
+    {
+        texture.render( x, y, clip, angle, center, flip );
+        return;
+    }
+
+    SDL_Texture* hardwareTexture = texture.getTexture();
+    if( hardwareTexture == NULL )
+    {
+        return;
+    }
+
+    // Texture coordinates are 0 to 1, so we need the size of the whole texture
+    if( hardwareTexture != mSizeTexture )
+    {
+        SDL_QueryTexture( hardwareTexture, NULL, NULL, &mTextureWidth, &mTextureHeight );
+        mSizeTexture = hardwareTexture;
+    }
+
+    SDL_Rect source = texture.getSourceRect( clip );
+    float u0 = (float)source.x / mTextureWidth;
+    float v0 = (float)source.y / mTextureHeight;
+    float u1 = (float)( source.x + source.w ) / mTextureWidth;
+    float v1 = (float)( source.y + source.h ) / mTextureHeight;
+    if( flip & SDL_FLIP_HORIZONTAL )
+    {
+        std::swap( u0, u1 );
+    }
+    if( flip & SDL_FLIP_VERTICAL )
+    {
+        std::swap( v0, v1 );
+    }
+
+    // Rotate the corners around the center the way SDL_RenderCopyEx does (clockwise, in degrees)
+    float centerX = source.w / 2.0f;
+    float centerY = source.h / 2.0f;
+    if( center != NULL )
+    {
+        centerX = center->x;
+        centerY = center->y;
+    }
+    float cosine = 1.0f, sine = 0.0f;
+    if( angle != 0.0 )
+    {
+        double radians = angle * M_PI / 180.0;
+        cosine = (float)cos( radians );
+        sine = (float)sin( radians );
+    }
+
+    const float cornerX[ 4 ] = { 0.0f, (float)source.w, (float)source.w, 0.0f };
+    const float cornerY[ 4 ] = { 0.0f, 0.0f, (float)source.h, (float)source.h };
+    const float cornerU[ 4 ] = { u0, u1, u1, u0 };
+    const float cornerV[ 4 ] = { v0, v0, v1, v1 };
+
+    Quad quad;
+    quad.texture = hardwareTexture;
+    quad.blendMode = texture.getBlendMode();
+    quad.firstVertex = mVertices.size();
+    mQuads.push_back( quad );
+
+    SDL_Color color = texture.getColor();
+    for( int i = 0; i < 4; ++i )
+    {
+        float dx = cornerX[ i ] - centerX;
+        float dy = cornerY[ i ] - centerY;
+
+        SDL_Vertex vertex;
+        vertex.position.x = x + centerX + dx * cosine - dy * sine;
+        vertex.position.y = y + centerY + dx * sine + dy * cosine;
+        vertex.color = color;
+        vertex.tex_coord.x = cornerU[ i ];
+        vertex.tex_coord.y = cornerV[ i ];
+        mVertices.push_back( vertex );
+    }
+}
+
+void LSpriteBatch::end()
+{
+    PROFILE_SCOPE( "LSpriteBatch::end" );
+
+    mSubmitCount = 0;
+    if( mQuads.empty() )
+    {
+        return;
+    }
+
+    // Group by texture only, stable so sprites sharing a texture keep their draw order whatever their blend modes
+    mOrder.resize( mQuads.size() );
+    for( int i = 0; i < (int)mQuads.size(); ++i )
+    {
+        mOrder[ i ] = i;
+    }
+    std::stable_sort( mOrder.begin(), mOrder.end(), [ this ]( int a, int b )
+    {
+        return mQuads[ a ].texture < mQuads[ b ].texture;
+    } );
+
+    // Lay the vertices out in sorted order, two triangles per quad
+    mSortedVertices.resize( mVertices.size() );
+    mIndices.resize( mQuads.size() * 6 );
+    for( int i = 0; i < (int)mOrder.size(); ++i )
+    {
+        const Quad& quad = mQuads[ mOrder[ i ] ];
+        for( int corner = 0; corner < 4; ++corner )
+        {
+            mSortedVertices[ i * 4 + corner ] = mVertices[ quad.firstVertex + corner ];
+        }
+
+        int* index = &mIndices[ i * 6 ];
+        index[ 0 ] = i * 4;
+        index[ 1 ] = i * 4 + 1;
+        index[ 2 ] = i * 4 + 2;
+        index[ 3 ] = i * 4;
+        index[ 4 ] = i * 4 + 2;
+        index[ 5 ] = i * 4 + 3;
+    }
+
+    // One SDL_RenderGeometry call per run of matching texture and blend mode, a change of blend mode starts a new one
+    int runStart = 0;
+    for( int i = 1; i <= (int)mOrder.size(); ++i )
+    {
+        if( i < (int)mOrder.size()
+            && mQuads[ mOrder[ i ] ].texture == mQuads[ mOrder[ runStart ] ].texture
+            && mQuads[ mOrder[ i ] ].blendMode == mQuads[ mOrder[ runStart ] ].blendMode )
+        {
+            continue;
+        }
+
+        const Quad& first = mQuads[ mOrder[ runStart ] ];
+        SDL_SetTextureBlendMode( first.texture, first.blendMode );
+        SDL_RenderGeometry( gRenderer, first.texture, &mSortedVertices[ 0 ], mSortedVertices.size(),
+                            &mIndices[ runStart * 6 ], ( i - runStart ) * 6 );
+        ++mSubmitCount;
+        runStart = i;
+    }
+}
+
+int LSpriteBatch::getSubmitCount()
+{
+    return mSubmitCount;
+}
+
+LTextureAtlas::LTextureAtlas()
+{
+    // Nothing is packed yet
+}
+
+LTextureAtlas::~LTextureAtlas()
+{
+    // Deallocate pages
+    free();
+}
+
+bool LTextureAtlas::addImage( std::string name, std::string path )
+{
+    // Load image at specified path
+    SDL_Surface* loadedSurface = IMG_Load( path.c_str() );
+    if( loadedSurface == NULL )
+    {
+        printf( "Unable to load image %s! SDL_image Error: %s\n", path.c_str(), IMG_GetError() );
+        return false;
+    }
+
+    // The atlas took its own reference
+    bool success = addSurface( name, loadedSurface );
+    SDL_FreeSurface( loadedSurface );
+    return success;
+}
+
+bool LTextureAtlas::addSurface( std::string name, SDL_Surface* surface )
+{
+    if( surface == NULL )
+    {
+        return false;
+    }
+
+    // Freed after packing, the reference keeps it alive for whoever else holds it
+    ++surface->refcount;
+
+    // Color key the same way LTexture::loadFromFile does
+    SDL_SetColorKey( surface, SDL_TRUE, SDL_MapRGB( surface->format, 0, 0xFF, 0xFF ) );
+
+    Entry entry;
+    entry.name = name;
+    entry.surface = surface;
+    entry.page = -1;
+    entry.rect.x = 0;
+    entry.rect.y = 0;
+    entry.rect.w = surface->w;
+    entry.rect.h = surface->h;
+
+    mIndex[ name ] = mEntries.size();
+    mEntries.push_back( entry );
+    return true;
+}
+
+bool LTextureAtlas::pack( int pageWidth, int pageHeight )
+{
+    // Place tallest images first, so each shelf wastes little height
+    std::vector<int> order;
+    for( int i = 0; i < (int)mEntries.size(); ++i )
+    {
+        if( mEntries[ i ].page == -1 )
+        {
+            order.push_back( i );
+        }
+    }
+    std::stable_sort( order.begin(), order.end(), [ this ]( int a, int b )
+    {
+        return mEntries[ a ].rect.h > mEntries[ b ].rect.h;
+    } );
+
+    // Shelf packing: fill rows left to right, open a new row when one is full and a new page when rows run out
+    std::vector<SDL_Point> pageSizes;
+    int sharedPage = -1;
+    int shelfX = 0, shelfY = 0, shelfHeight = 0;
+    for( int i = 0; i < (int)order.size(); ++i )
+    {
+        Entry& entry = mEntries[ order[ i ] ];
+        int w = entry.rect.w + ATLAS_PADDING;
+        int h = entry.rect.h + ATLAS_PADDING;
+
+        // Images bigger than a page get a page of their own
+        if( w > pageWidth || h > pageHeight )
+        {
+            SDL_Point size = { w, h };
+            entry.page = pageSizes.size();
+            entry.rect.x = 0;
+            entry.rect.y = 0;
+            pageSizes.push_back( size );
+            continue;
+        }
+
+        // Row is full
+        if( shelfX + w > pageWidth )
+        {
+            shelfX = 0;
+            shelfY += shelfHeight;
+            shelfHeight = 0;
+        }
+
+        // Page is full, or there is no shared page yet
+        if( sharedPage == -1 || shelfY + h > pageHeight )
+        {
+            SDL_Point size = { pageWidth, pageHeight };
+            sharedPage = pageSizes.size();
+            pageSizes.push_back( size );
+            shelfX = shelfY = shelfHeight = 0;
+        }
+
+        entry.page = sharedPage;
+        entry.rect.x = shelfX;
+        entry.rect.y = shelfY;
+        shelfX += w;
+        shelfHeight = std::max( shelfHeight, h );
+    }
+
+    // Copy images into their page surfaces, then upload each page once
+    bool success = true;
+    int firstPage = mPages.size();
+    for( int page = 0; page < (int)pageSizes.size(); ++page )
+    {
+        SDL_Surface* pageSurface = SDL_CreateRGBSurfaceWithFormat( 0, pageSizes[ page ].x, pageSizes[ page ].y, 32, SDL_PIXELFORMAT_RGBA32 );
+        if( pageSurface == NULL )
+        {
+            printf( "Unable to create atlas page! SDL Error: %s\n", SDL_GetError() );
+            success = false;
+            break;
+        }
+
+        // Start fully transparent, color keyed pixels are skipped by the blit and stay that way
+        SDL_FillRect( pageSurface, NULL, SDL_MapRGBA( pageSurface->format, 0, 0, 0, 0 ) );
+        for( int i = 0; i < (int)order.size(); ++i )
+        {
+            Entry& entry = mEntries[ order[ i ] ];
+            if( entry.page == page )
+            {
+                SDL_Rect destination = entry.rect;
+                SDL_SetSurfaceBlendMode( entry.surface, SDL_BLENDMODE_NONE );
+                SDL_BlitSurface( entry.surface, NULL, pageSurface, &destination );
+                entry.page += firstPage;
+            }
+        }
+
+        SDL_Texture* pageTexture = SDL_CreateTextureFromSurface( gRenderer, pageSurface );
+        LRasterImage* pageImage = NULL;
+        if( pageTexture != NULL && gRasterizer.isOpen() )
+        {
+            pageImage = new LRasterImage();
+            pageImage->loadFromSurface( pageSurface );
+        }
+        SDL_FreeSurface( pageSurface );
+        if( pageTexture == NULL )
+        {
+            printf( "Unable to create atlas page texture! SDL Error: %s\n", SDL_GetError() );
+            success = false;
+            break;
+        }
+        SDL_SetTextureBlendMode( pageTexture, SDL_BLENDMODE_BLEND );
+        mPages.push_back( pageTexture );
+        mPageImages.push_back( pageImage );
+    }
+
+    // Source images are no longer needed once their pixels are on a page
+    for( int i = 0; i < (int)order.size(); ++i )
+    {
+        SDL_FreeSurface( mEntries[ order[ i ] ].surface );
+        mEntries[ order[ i ] ].surface = NULL;
+    }
+
+    return success;
+}
+
+bool LTextureAtlas::replaceImage( std::string name, SDL_Surface* surface )
+{
+    std::map<std::string, int>::iterator found = mIndex.find( name );
+    if( found == mIndex.end() || surface == NULL )
+    {
+        return false;
+    }
+    Entry& entry = mEntries[ found->second ];
+    if( entry.page < 0 || entry.page >= (int)mPages.size() )
+    {
+        return false;
+    }
+
+    // Color key the same way LTexture::loadFromFile does
+    SDL_SetColorKey( surface, SDL_TRUE, SDL_MapRGB( surface->format, 0, 0xFF, 0xFF ) );
+
+    // Same size: overwrite it on its page, so nothing pointing at the page or rect has to change
+    if( surface->w == entry.rect.w && surface->h == entry.rect.h )
+    {
+        // The page texture may not be RGBA32, so convert to whatever it is
+        Uint32 format;
+        SDL_QueryTexture( mPages[ entry.page ], &format, NULL, NULL, NULL );
+        SDL_Surface* pixels = SDL_CreateRGBSurfaceWithFormat( 0, surface->w, surface->h, 32, format );
+        if( pixels == NULL )
+        {
+            printf( "Unable to create atlas image! SDL Error: %s\n", SDL_GetError() );
+            return false;
+        }
+        SDL_FillRect( pixels, NULL, SDL_MapRGBA( pixels->format, 0, 0, 0, 0 ) );
+        SDL_SetSurfaceBlendMode( surface, SDL_BLENDMODE_NONE );
+        SDL_BlitSurface( surface, NULL, pixels, NULL );
+
+        bool success = SDL_UpdateTexture( mPages[ entry.page ], &entry.rect, pixels->pixels, pixels->pitch ) == 0;
+        if( !success )
+        {
+            printf( "Unable to update atlas page! SDL Error: %s\n", SDL_GetError() );
+        }
+        else if( mPageImages[ entry.page ] != NULL )
+        {
+            mPageImages[ entry.page ]->update( entry.rect, pixels );
+        }
+        SDL_FreeSurface( pixels );
+        return success;
+    }
+
+    // New size: it gets a page of its own and its old space goes unused until the next pack
+    SDL_Surface* pixels = SDL_CreateRGBSurfaceWithFormat( 0, surface->w, surface->h, 32, SDL_PIXELFORMAT_RGBA32 );
+    if( pixels == NULL )
+    {
+        printf( "Unable to create atlas page! SDL Error: %s\n", SDL_GetError() );
+        return false;
+    }
+    SDL_FillRect( pixels, NULL, SDL_MapRGBA( pixels->format, 0, 0, 0, 0 ) );
+    SDL_SetSurfaceBlendMode( surface, SDL_BLENDMODE_NONE );
+    SDL_BlitSurface( surface, NULL, pixels, NULL );
+
+    SDL_Texture* pageTexture = SDL_CreateTextureFromSurface( gRenderer, pixels );
+    LRasterImage* pageImage = NULL;
+    if( pageTexture != NULL && gRasterizer.isOpen() )
+    {
+        pageImage = new LRasterImage();
+        pageImage->loadFromSurface( pixels );
+    }
+    SDL_FreeSurface( pixels );
+    if( pageTexture == NULL )
+    {
+        printf( "Unable to create atlas page texture! SDL Error: %s\n", SDL_GetError() );
+        return false;
+    }
+    SDL_SetTextureBlendMode( pageTexture, SDL_BLENDMODE_BLEND );
+
+    entry.page = mPages.size();
+    entry.rect.x = 0;
+    entry.rect.y = 0;
+    entry.rect.w = surface->w;
+    entry.rect.h = surface->h;
+    mPages.push_back( pageTexture );
+    mPageImages.push_back( pageImage );
+    return true;
+}
+
+bool LTextureAtlas::lookup( std::string name, SDL_Texture** page, SDL_Rect* rect, LRasterImage** image )
+{
+    std::map<std::string, int>::iterator found = mIndex.find( name );
+    if( found == mIndex.end() )
+    {
+        return false;
+    }
+
+    Entry& entry = mEntries[ found->second ];
+    if( entry.page < 0 || entry.page >= (int)mPages.size() )
+    {
+        return false;
+    }
+
+    *page = mPages[ entry.page ];
+    *rect = entry.rect;
+    if( image != NULL )
+    {
+        *image = mPageImages[ entry.page ];
+    }
+    return true;
+}
+
+void LTextureAtlas::free()
+{
+    // Free pages
+    for( int i = 0; i < (int)mPages.size(); ++i )
+    {
+        SDL_DestroyTexture( mPages[ i ] );
+        delete mPageImages[ i ];
+    }
+    mPages.clear();
+    mPageImages.clear();
+
+    // Free images that were never packed
+    for( int i = 0; i < (int)mEntries.size(); ++i )
+    {
+        if( mEntries[ i ].surface != NULL )
+        {
+            SDL_FreeSurface( mEntries[ i ].surface );
+        }
+    }
+    mEntries.clear();
+    mIndex.clear();
+}
+
+int LTextureAtlas::getPageCount()
+{
+    return mPages.size();
+}
+
+LRasterImage::LRasterImage()
+{
+    width = 0;
+    height = 0;
+}
+
+bool LRasterImage::loadFromSurface( SDL_Surface* surface )
+{
+    width = 0;
+    height = 0;
+    pixels.clear();
+    if( surface == NULL )
+    {
+        return false;
+    }
+
+    // The whole image is one area to overwrite
+    width = surface->w;
+    height = surface->h;
+    pixels.resize( width * height );
+    SDL_Rect whole = { 0, 0, width, height };
+    if( !update( whole, surface ) )
+    {
+        width = 0;
+        height = 0;
+        pixels.clear();
+        return false;
+    }
+    return true;
+}
+
+bool LRasterImage::update( SDL_Rect area, SDL_Surface* surface )
+{
+    if( surface->w != area.w || surface->h != area.h || area.x < 0 || area.y < 0
+        || area.x + area.w > width || area.y + area.h > height )
+    {
+        return false;
+    }
+
+    // Blit onto transparent ARGB8888, color keyed pixels are skipped and stay transparent
+    SDL_Surface* argb = SDL_CreateRGBSurfaceWithFormat( 0, surface->w, surface->h, 32, SDL_PIXELFORMAT_ARGB8888 );
+    if( argb == NULL )
+    {
+        printf( "Unable to convert image for the rasterizer! SDL Error: %s\n", SDL_GetError() );
+        return false;
+    }
+    SDL_FillRect( argb, NULL, 0 );
+    SDL_BlendMode blending;
+    SDL_GetSurfaceBlendMode( surface, &blending );
+    SDL_SetSurfaceBlendMode( surface, SDL_BLENDMODE_NONE );
+    SDL_BlitSurface( surface, NULL, argb, NULL );
+    SDL_SetSurfaceBlendMode( surface, blending );
+
+    for( int y = 0; y < area.h; ++y )
+    {
+        memcpy( &pixels[ ( area.y + y ) * width + area.x ], (Uint8*)argb->pixels + y * argb->pitch, area.w * 4 );
+    }
+    SDL_FreeSurface( argb );
+    return true;
+}
+
+// x / 255 rounded, exact for x up to 255 * 255, the same sum the SIMD kernels do with _mm_mulhi_epu16
+static inline Uint32 divide255( Uint32 x )
+{
+    return ( ( x + 128 ) * 257 ) >> 16;
+}
+
+// One pixel at a time. Color and alpha modulation first, then
+// none: d = s, blend: d = s * a + d * (1 - a) with alpha a + d.a * (1 - a), add: d += s * a, mod: d *= s
+static void blendScalar( Uint32* destination, const Uint32* source, int count, Uint32 color, SDL_BlendMode blending )
+{
+    Uint32 modA = color >> 24, modR = ( color >> 16 ) & 0xFF, modG = ( color >> 8 ) & 0xFF, modB = color & 0xFF;
+    for( int i = 0; i < count; ++i )
+    {
+        Uint32 s = source[ i ];
+        Uint32 a = divide255( ( s >> 24 ) * modA );
+        if( a == 0 && ( blending == SDL_BLENDMODE_BLEND || blending == SDL_BLENDMODE_ADD ) )
+        {
+            continue;
+        }
+        Uint32 r = divide255( ( ( s >> 16 ) & 0xFF ) * modR );
+        Uint32 g = divide255( ( ( s >> 8 ) & 0xFF ) * modG );
+        Uint32 b = divide255( ( s & 0xFF ) * modB );
+
+        Uint32 d = destination[ i ];
+        Uint32 dA = d >> 24, dR = ( d >> 16 ) & 0xFF, dG = ( d >> 8 ) & 0xFF, dB = d & 0xFF;
+        if( blending == SDL_BLENDMODE_NONE )
+        {
+            dA = a;
+            dR = r;
+            dG = g;
+            dB = b;
+        }
+        else if( blending == SDL_BLENDMODE_ADD )
+        {
+            dR = std::min( 255u, dR + divide255( r * a ) );
+            dG = std::min( 255u, dG + divide255( g * a ) );
+            dB = std::min( 255u, dB + divide255( b * a ) );
+        }
+        else if( blending == SDL_BLENDMODE_MOD )
+        {
+            dR = divide255( r * dR );
+            dG = divide255( g * dG );
+            dB = divide255( b * dB );
+        }
+        else
+        {
+            dA = divide255( 255 * a + dA * ( 255 - a ) );
+            dR = divide255( r * a + dR * ( 255 - a ) );
+            dG = divide255( g * a + dG * ( 255 - a ) );
+            dB = divide255( b * a + dB * ( 255 - a ) );
+        }
+        destination[ i ] = ( dA << 24 ) | ( dR << 16 ) | ( dG << 8 ) | dB;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Blends two pixels spread to 16 bits a channel, the same arithmetic as blendScalar
+static inline __m128i blendPairSSE2( __m128i s, __m128i d, __m128i mod, SDL_BlendMode blending )
+{
+    const __m128i round = _mm_set1_epi16( 128 );
+    const __m128i scale = _mm_set1_epi16( 257 );
+    const __m128i full = _mm_set1_epi16( 255 );
+    const __m128i alphaLanes = _mm_setr_epi16( 0, 0, 0, -1, 0, 0, 0, -1 );
+
+    s = _mm_mulhi_epu16( _mm_add_epi16( _mm_mullo_epi16( s, mod ), round ), scale );
+    __m128i a = _mm_shufflehi_epi16( _mm_shufflelo_epi16( s, _MM_SHUFFLE( 3, 3, 3, 3 ) ), _MM_SHUFFLE( 3, 3, 3, 3 ) );
+    if( blending == SDL_BLENDMODE_NONE )
+    {
+        return s;
+    }
+    if( blending == SDL_BLENDMODE_ADD )
+    {
+        __m128i added = _mm_mulhi_epu16( _mm_add_epi16( _mm_mullo_epi16( s, a ), round ), scale );
+        return _mm_or_si128( _mm_and_si128( alphaLanes, d ), _mm_andnot_si128( alphaLanes, _mm_min_epi16( _mm_add_epi16( d, added ), full ) ) );
+    }
+    if( blending == SDL_BLENDMODE_MOD )
+    {
+        __m128i modulated = _mm_mulhi_epu16( _mm_add_epi16( _mm_mullo_epi16( s, d ), round ), scale );
+        return _mm_or_si128( _mm_and_si128( alphaLanes, d ), _mm_andnot_si128( alphaLanes, modulated ) );
+    }
+
+    // Source alpha times 255 in the alpha lane gives a + d.a * (1 - a) from the same sum as the colors
+    s = _mm_or_si128( _mm_andnot_si128( alphaLanes, s ), _mm_and_si128( alphaLanes, full ) );
+    __m128i sum = _mm_add_epi16( _mm_mullo_epi16( s, a ), _mm_mullo_epi16( d, _mm_sub_epi16( full, a ) ) );
+    return _mm_mulhi_epu16( _mm_add_epi16( sum, round ), scale );
+}
+
+// Four pixels at a time, groups with nothing visible in them are skipped
+static void blendSSE2( Uint32* destination, const Uint32* source, int count, Uint32 color, SDL_BlendMode blending )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaBytes = _mm_set1_epi32( (int)0xFF000000 );
+    __m128i mod = _mm_unpacklo_epi8( _mm_set1_epi32( (int)color ), zero );
+    bool skipClear = blending == SDL_BLENDMODE_BLEND || blending == SDL_BLENDMODE_ADD;
+
+    int i = 0;
+    for( ; i + 4 <= count; i += 4 )
+    {
+        __m128i s = _mm_loadu_si128( (const __m128i*)( source + i ) );
+        if( skipClear && _mm_movemask_epi8( _mm_cmpeq_epi32( _mm_and_si128( s, alphaBytes ), zero ) ) == 0xFFFF )
+        {
+            continue;
+        }
+        __m128i d = _mm_loadu_si128( (const __m128i*)( destination + i ) );
+        __m128i low = blendPairSSE2( _mm_unpacklo_epi8( s, zero ), _mm_unpacklo_epi8( d, zero ), mod, blending );
+        __m128i high = blendPairSSE2( _mm_unpackhi_epi8( s, zero ), _mm_unpackhi_epi8( d, zero ), mod, blending );
+        _mm_storeu_si128( (__m128i*)( destination + i ), _mm_packus_epi16( low, high ) );
+    }
+    blendScalar( destination + i, source + i, count - i, color, blending );
+}
+
+// Blends four pixels spread to 16 bits a channel, the same arithmetic as blendScalar
+__attribute__(( target( "avx2" ) ))
+static inline __m256i blendQuadAVX2( __m256i s, __m256i d, __m256i mod, SDL_BlendMode blending )
+{
+    const __m256i round = _mm256_set1_epi16( 128 );
+    const __m256i scale = _mm256_set1_epi16( 257 );
+    const __m256i full = _mm256_set1_epi16( 255 );
+    const __m256i alphaLanes = _mm256_setr_epi16( 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1 );
+
+    s = _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_mullo_epi16( s, mod ), round ), scale );
+    __m256i a = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( s, _MM_SHUFFLE( 3, 3, 3, 3 ) ), _MM_SHUFFLE( 3, 3, 3, 3 ) );
+    if( blending == SDL_BLENDMODE_NONE )
+    {
+        return s;
+    }
+    if( blending == SDL_BLENDMODE_ADD )
+    {
+        __m256i added = _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_mullo_epi16( s, a ), round ), scale );
+        return _mm256_blendv_epi8( _mm256_min_epi16( _mm256_add_epi16( d, added ), full ), d, alphaLanes );
+    }
+    if( blending == SDL_BLENDMODE_MOD )
+    {
+        __m256i modulated = _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_mullo_epi16( s, d ), round ), scale );
+        return _mm256_blendv_epi8( modulated, d, alphaLanes );
+    }
+
+    s = _mm256_blendv_epi8( s, full, alphaLanes );
+    __m256i sum = _mm256_add_epi16( _mm256_mullo_epi16( s, a ), _mm256_mullo_epi16( d, _mm256_sub_epi16( full, a ) ) );
+    return _mm256_mulhi_epu16( _mm256_add_epi16( sum, round ), scale );
+}
+
+// Eight pixels at a time, unpacking and packing stay within 128-bit lanes so the order comes back unchanged
+__attribute__(( target( "avx2" ) ))
+static void blendAVX2( Uint32* destination, const Uint32* source, int count, Uint32 color, SDL_BlendMode blending )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphaBytes = _mm256_set1_epi32( (int)0xFF000000 );
+    __m256i mod = _mm256_unpacklo_epi8( _mm256_set1_epi32( (int)color ), zero );
+    bool skipClear = blending == SDL_BLENDMODE_BLEND || blending == SDL_BLENDMODE_ADD;
+
+    int i = 0;
+    for( ; i + 8 <= count; i += 8 )
+    {
+        __m256i s = _mm256_loadu_si256( (const __m256i*)( source + i ) );
+        if( skipClear && _mm256_testz_si256( s, alphaBytes ) )
+        {
+            continue;
+        }
+        __m256i d = _mm256_loadu_si256( (const __m256i*)( destination + i ) );
+        __m256i low = blendQuadAVX2( _mm256_unpacklo_epi8( s, zero ), _mm256_unpacklo_epi8( d, zero ), mod, blending );
+        __m256i high = blendQuadAVX2( _mm256_unpackhi_epi8( s, zero ), _mm256_unpackhi_epi8( d, zero ), mod, blending );
+        _mm256_storeu_si256( (__m256i*)( destination + i ), _mm256_packus_epi16( low, high ) );
+    }
+    _mm256_zeroupper();
+    blendScalar( destination + i, source + i, count - i, color, blending );
+}
+#endif
+
+LRasterizer::LRasterizer()
+{
+    mWidth = 0;
+    mHeight = 0;
+    mTexture = NULL;
+    mClip.x = 0;
+    mClip.y = 0;
+    mClip.w = 0;
+    mClip.h = 0;
+    mFilter = RASTER_NEAREST;
+    mDrawing = false;
+    mTiled = false;
+    setSimd( true );
+}
+
+LRasterizer::~LRasterizer()
+{
+    close();
+}
+
+bool LRasterizer::open( int width, int height )
+{
+    close();
+    mWidth = width;
+    mHeight = height;
+    if( !resetTexture() )
+    {
+        close();
+        return false;
+    }
+
+    mPixels.assign( width * height, 0xFFFFFFFF );
+    mSpan.resize( width );
+
+    // A bin of commands and a span to sample into for every tile
+    int tiles = ( ( width + RASTER_TILE_SIZE - 1 ) / RASTER_TILE_SIZE ) * ( ( height + RASTER_TILE_SIZE - 1 ) / RASTER_TILE_SIZE );
+    mBins.assign( tiles, std::vector<int>() );
+    mTileSpans.assign( tiles, std::vector<Uint32>( RASTER_TILE_SIZE ) );
+    setClip( NULL );
+    return true;
+}
+
+bool LRasterizer::resetTexture()
+{
+    if( mTexture != NULL )
+    {
+        SDL_DestroyTexture( mTexture );
+    }
+
+    // Streaming, since every frame replaces all of it
+    mTexture = SDL_CreateTexture( gRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, mWidth, mHeight );
+    if( mTexture == NULL )
+    {
+        printf( "Unable to create rasterizer texture! SDL Error: %s\n", SDL_GetError() );
+        return false;
+    }
+    SDL_SetTextureBlendMode( mTexture, SDL_BLENDMODE_NONE );
+    return true;
+}
+
+void LRasterizer::close()
+{
+    if( mTexture != NULL )
+    {
+        SDL_DestroyTexture( mTexture );
+        mTexture = NULL;
+    }
+    mPixels.clear();
+    mCommands.clear();
+    mBins.clear();
+    mTileSpans.clear();
+    mWidth = 0;
+    mHeight = 0;
+    mDrawing = false;
+}
+
+bool LRasterizer::isOpen()
+{
+    return mTexture != NULL;
+}
+
+void LRasterizer::setSimd( bool simd )
+{
+    // Recorded draws are blended with the kernel they will be rasterized with, which has to be the one they were drawn with
+    flush();
+    mBlend = blendScalar;
+    mKernelName = "scalar";
+    #ifdef HAVE_X86_SIMD
+    if( simd )
+    {
+        mBlend = SDL_HasAVX2() ? blendAVX2 : blendSSE2;
+        mKernelName = SDL_HasAVX2() ? "AVX2" : "SSE2";
+    }
+    #endif
+}
+
+const char* LRasterizer::getKernelName()
+{
+    return mKernelName;
+}
+
+void LRasterizer::setFilter( LRasterFilter filter )
+{
+    mFilter = filter;
+}
+
+void LRasterizer::setTiled( bool tiled )
+{
+    flush();
+    mTiled = tiled;
+}
+
+bool LRasterizer::isTiled()
+{
+    return mTiled;
+}
+
+void LRasterizer::begin()
+{
+    mDrawing = isOpen();
+}
+
+bool LRasterizer::isDrawing()
+{
+    return mDrawing;
+}
+
+void LRasterizer::setClip( const SDL_Rect* clip )
+{
+    SDL_Rect whole = { 0, 0, mWidth, mHeight };
+    mClip = whole;
+    if( clip != NULL && !SDL_IntersectRect( clip, &whole, &mClip ) )
+    {
+        mClip.w = 0;
+        mClip.h = 0;
+    }
+}
+
+void LRasterizer::clear( SDL_Color color )
+{
+    // Nothing drawn before a clear can show, so it need not be rasterized
+    mCommands.clear();
+
+    Command command;
+    command.type = COMMAND_CLEAR;
+    command.bounds.x = 0;
+    command.bounds.y = 0;
+    command.bounds.w = mWidth;
+    command.bounds.h = mHeight;
+    command.color = ( (Uint32)color.a << 24 ) | ( (Uint32)color.r << 16 ) | ( (Uint32)color.g << 8 ) | color.b;
+    command.blending = SDL_BLENDMODE_NONE;
+    submit( command );
+}
+
+void LRasterizer::fillRect( SDL_Rect rect, SDL_Color color, SDL_BlendMode blending )
+{
+    Command command;
+    command.type = COMMAND_FILL;
+    command.color = ( (Uint32)color.a << 24 ) | ( (Uint32)color.r << 16 ) | ( (Uint32)color.g << 8 ) | color.b;
+    command.blending = blending;
+    if( SDL_IntersectRect( &rect, &mClip, &command.bounds ) )
+    {
+        submit( command );
+    }
+}
+
+void LRasterizer::drawRect( SDL_Rect rect, SDL_Color color, SDL_BlendMode blending )
+{
+    if( rect.w <= 0 || rect.h <= 0 )
+    {
+        return;
+    }
+
+    // Top and bottom rows, then the sides between them so no corner is blended twice
+    SDL_Rect top = { rect.x, rect.y, rect.w, 1 };
+    SDL_Rect bottom = { rect.x, rect.y + rect.h - 1, rect.w, 1 };
+    SDL_Rect left = { rect.x, rect.y + 1, 1, rect.h - 2 };
+    SDL_Rect right = { rect.x + rect.w - 1, rect.y + 1, 1, rect.h - 2 };
+    fillRect( top, color, blending );
+    if( rect.h > 1 )
+    {
+        fillRect( bottom, color, blending );
+    }
+    fillRect( left, color, blending );
+    if( rect.w > 1 )
+    {
+        fillRect( right, color, blending );
+    }
+}
+
+void LRasterizer::drawLine( int x1, int y1, int x2, int y2, SDL_Color color, SDL_BlendMode blending )
+{
+    Command command;
+    command.type = COMMAND_LINE;
+    command.color = ( (Uint32)color.a << 24 ) | ( (Uint32)color.r << 16 ) | ( (Uint32)color.g << 8 ) | color.b;
+    command.blending = blending;
+    command.from.x = x1;
+    command.from.y = y1;
+    command.to.x = x2;
+    command.to.y = y2;
+    command.start = command.from;
+    command.error = abs( x2 - x1 ) - abs( y2 - y1 );
+    command.points = std::max( abs( x2 - x1 ), abs( y2 - y1 ) ) + 1;
+    SDL_Rect box = { std::min( x1, x2 ), std::min( y1, y2 ), abs( x2 - x1 ) + 1, abs( y2 - y1 ) + 1 };
+    if( SDL_IntersectRect( &box, &mClip, &command.bounds ) )
+    {
+        submit( command );
+    }
+}
+
+void LRasterizer::drawPoint( int x, int y, SDL_Color color, SDL_BlendMode blending )
+{
+    SDL_Rect point = { x, y, 1, 1 };
+    fillRect( point, color, blending );
+}
+
+void LRasterizer::copy( const LRasterImage& image, SDL_Rect source, SDL_Rect destination, double angle, const SDL_Point* center,
+                        SDL_RendererFlip flip, SDL_Color color, SDL_BlendMode blending )
+{
+    if( source.w <= 0 || source.h <= 0 || destination.w <= 0 || destination.h <= 0 || source.x < 0 || source.y < 0
+        || source.x + source.w > image.width || source.y + source.h > image.height )
+    {
+        return;
+    }
+
+    Command command;
+    command.type = COMMAND_COPY;
+    command.color = ( (Uint32)color.a << 24 ) | ( (Uint32)color.r << 16 ) | ( (Uint32)color.g << 8 ) | color.b;
+    command.blending = blending;
+    command.image = &image;
+    command.source = source;
+    command.destination = destination;
+    command.filter = mFilter;
+
+    // Rotation center inside the destination, the middle unless given
+    double centerX = destination.w / 2.0;
+    double centerY = destination.h / 2.0;
+    if( center != NULL )
+    {
+        centerX = center->x;
+        centerY = center->y;
+    }
+    double cosine = 1.0, sine = 0.0;
+    if( angle != 0.0 )
+    {
+        double radians = angle * M_PI / 180.0;
+        cosine = cos( radians );
+        sine = sin( radians );
+    }
+
+    // Pixels the rotated rect can touch, inside the clip
+    SDL_Rect bounds = destination;
+    if( angle != 0.0 )
+    {
+        double minX = 1e9, minY = 1e9, maxX = -1e9, maxY = -1e9;
+        for( int corner = 0; corner < 4; ++corner )
+        {
+            double dx = ( corner == 1 || corner == 2 ? destination.w : 0 ) - centerX;
+            double dy = ( corner >= 2 ? destination.h : 0 ) - centerY;
+            double x = destination.x + centerX + dx * cosine - dy * sine;
+            double y = destination.y + centerY + dx * sine + dy * cosine;
+            minX = std::min( minX, x );
+            maxX = std::max( maxX, x );
+            minY = std::min( minY, y );
+            maxY = std::max( maxY, y );
+        }
+        bounds.x = (int)floor( minX );
+        bounds.y = (int)floor( minY );
+        bounds.w = (int)ceil( maxX ) - bounds.x;
+        bounds.h = (int)ceil( maxY ) - bounds.y;
+    }
+    if( !SDL_IntersectRect( &bounds, &mClip, &command.bounds ) )
+    {
+        return;
+    }
+
+    // Unscaled, unrotated and unflipped images are blended straight from their rows
+    command.straight = angle == 0.0 && flip == SDL_FLIP_NONE && source.w == destination.w && source.h == destination.h;
+
+    // Source position of a pixel center is linear in the screen position: u = du * x + duRow * y + u0, the same for v.
+    // Undo the rotation around the center, then the flip, then scale to the source
+    double scaleX = (double)source.w / destination.w;
+    double scaleY = (double)source.h / destination.h;
+    double flipX = ( flip & SDL_FLIP_HORIZONTAL ) ? -1.0 : 1.0;
+    double flipY = ( flip & SDL_FLIP_VERTICAL ) ? -1.0 : 1.0;
+    double originX = destination.x + centerX;
+    double originY = destination.y + centerY;
+    command.du = cosine * flipX * scaleX;
+    command.duRow = sine * flipX * scaleX;
+    command.dv = -sine * flipY * scaleY;
+    command.dvRow = cosine * flipY * scaleY;
+    command.u0 = ( ( flipX < 0 ? destination.w - centerX : centerX ) - ( originX * cosine + originY * sine ) * flipX ) * scaleX;
+    command.v0 = ( ( flipY < 0 ? destination.h - centerY : centerY ) - ( originY * cosine - originX * sine ) * flipY ) * scaleY;
+    submit( command );
+}
+
+void LRasterizer::submit( const Command& command )
+{
+    if( !mTiled )
+    {
+        execute( command, command.bounds, &mSpan[ 0 ] );
+        return;
+    }
+    mCommands.push_back( command );
+}
+
+void LRasterizer::flush()
+{
+    if( mCommands.empty() )
+    {
+        return;
+    }
+    PROFILE_SCOPE( "LRasterizer::flush" );
+
+    // Bin every command into the tiles it touches, in draw order
+    int tilesX = ( mWidth + RASTER_TILE_SIZE - 1 ) / RASTER_TILE_SIZE;
+    for( int tile = 0; tile < (int)mBins.size(); ++tile )
+    {
+        mBins[ tile ].clear();
+    }
+    int commandCount = mCommands.size();
+    for( int i = 0; i < commandCount; ++i )
+    {
+        // A line is walked once here and cut into runs, one for each tile it passes through, so no tile walks all of it
+        if( mCommands[ i ].type == COMMAND_LINE )
+        {
+            Command line = mCommands[ i ];
+            int x = line.start.x, y = line.start.y, error = line.error;
+            int tile = -1;
+            for( int point = 0; point < line.points; ++point )
+            {
+                if( x >= line.bounds.x && x < line.bounds.x + line.bounds.w && y >= line.bounds.y && y < line.bounds.y + line.bounds.h )
+                {
+                    int pointTile = ( y / RASTER_TILE_SIZE ) * tilesX + x / RASTER_TILE_SIZE;
+                    if( pointTile != tile )
+                    {
+                        // Lines only move one way along each axis, so a tile's points are one run
+                        tile = pointTile;
+                        Command run = line;
+                        run.start.x = x;
+                        run.start.y = y;
+                        run.error = error;
+                        run.points = 0;
+                        mBins[ tile ].push_back( mCommands.size() );
+                        mCommands.push_back( run );
+                    }
+                    ++mCommands.back().points;
+                }
+                else
+                {
+                    tile = -1;
+                }
+                stepLine( line, x, y, error );
+            }
+            continue;
+        }
+
+        const SDL_Rect& bounds = mCommands[ i ].bounds;
+        int lastX = ( bounds.x + bounds.w - 1 ) / RASTER_TILE_SIZE;
+        int lastY = ( bounds.y + bounds.h - 1 ) / RASTER_TILE_SIZE;
+        for( int tileY = bounds.y / RASTER_TILE_SIZE; tileY <= lastY; ++tileY )
+        {
+            for( int tileX = bounds.x / RASTER_TILE_SIZE; tileX <= lastX; ++tileX )
+            {
+                mBins[ tileY * tilesX + tileX ].push_back( i );
+            }
+        }
+    }
+
+    // Tiles share no pixels, so each one runs its commands in order on whichever thread picks it up
+    gJobs.parallelFor( mBins.size(), 1, [ this, tilesX ]( int first, int last )
+    {
+        for( int tile = first; tile < last; ++tile )
+        {
+            SDL_Rect tileRect = { ( tile % tilesX ) * RASTER_TILE_SIZE, ( tile / tilesX ) * RASTER_TILE_SIZE, RASTER_TILE_SIZE, RASTER_TILE_SIZE };
+            const std::vector<int>& bin = mBins[ tile ];
+            for( int i = 0; i < (int)bin.size(); ++i )
+            {
+                SDL_Rect area;
+                if( SDL_IntersectRect( &mCommands[ bin[ i ] ].bounds, &tileRect, &area ) )
+                {
+                    execute( mCommands[ bin[ i ] ], area, &mTileSpans[ tile ][ 0 ] );
+                }
+            }
+        }
+    } );
+    mCommands.clear();
+}
+
+void LRasterizer::execute( const Command& command, const SDL_Rect& area, Uint32* span )
+{
+    // Every pixel comes out the same whatever part of a command area covers, so tiles match drawing it whole
+    if( command.type == COMMAND_CLEAR )
+    {
+        for( int y = area.y; y < area.y + area.h; ++y )
+        {
+            std::fill( &mPixels[ y * mWidth + area.x ], &mPixels[ y * mWidth + area.x ] + area.w, command.color );
+        }
+    }
+    else if( command.type == COMMAND_FILL )
+    {
+        // A row of the color, blended with no modulation
+        std::fill( span, span + area.w, command.color );
+        for( int y = area.y; y < area.y + area.h; ++y )
+        {
+            mBlend( &mPixels[ y * mWidth + area.x ], span, area.w, 0xFFFFFFFF, command.blending );
+        }
+    }
+    else if( command.type == COMMAND_LINE )
+    {
+        // Bresenham along the run, plotting only the points inside the area
+        int x = command.start.x, y = command.start.y, error = command.error;
+        for( int point = 0; point < command.points; ++point )
+        {
+            if( x >= area.x && x < area.x + area.w && y >= area.y && y < area.y + area.h )
+            {
+                mBlend( &mPixels[ y * mWidth + x ], &command.color, 1, 0xFFFFFFFF, command.blending );
+            }
+            stepLine( command, x, y, error );
+        }
+    }
+    else
+    {
+        drawCopy( command, area, span );
+    }
+}
+
+void LRasterizer::stepLine( const Command& line, int& x, int& y, int& error )
+{
+    int dx = abs( line.to.x - line.from.x ), dy = -abs( line.to.y - line.from.y );
+    int doubled = error * 2;
+    if( doubled >= dy )
+    {
+        error += dy;
+        x += line.from.x < line.to.x ? 1 : -1;
+    }
+    if( doubled <= dx )
+    {
+        error += dx;
+        y += line.from.y < line.to.y ? 1 : -1;
+    }
+}
+
+void LRasterizer::drawCopy( const Command& command, const SDL_Rect& area, Uint32* span )
+{
+    const LRasterImage& image = *command.image;
+    const SDL_Rect& source = command.source;
+    const SDL_Rect& destination = command.destination;
+    if( command.straight )
+    {
+        for( int y = area.y; y < area.y + area.h; ++y )
+        {
+            const Uint32* row = &image.pixels[ ( source.y + y - destination.y ) * image.width + source.x + area.x - destination.x ];
+            mBlend( &mPixels[ y * mWidth + area.x ], row, area.w, command.color, command.blending );
+        }
+        return;
+    }
+
+    // Fixed point steps, positions are stepped from column 0 so a span starting anywhere lands on the same ones
+    int stepU = (int)lround( command.du * 65536.0 );
+    int stepV = (int)lround( command.dv * 65536.0 );
+    for( int y = area.y; y < area.y + area.h; ++y )
+    {
+        // Source position of column 0 of the row
+        double rowU = command.duRow * ( y + 0.5 ) + command.u0 + command.du * 0.5;
+        double rowV = command.dvRow * ( y + 0.5 ) + command.v0 + command.dv * 0.5;
+
+        // Columns whose source position falls inside the image, 0 <= u < w and 0 <= v < h
+        double first = area.x;
+        double last = area.x + area.w - 1;
+        const double steps[ 2 ] = { command.du, command.dv };
+        const double starts[ 2 ] = { rowU, rowV };
+        const double ends[ 2 ] = { (double)source.w, (double)source.h };
+        for( int axis = 0; axis < 2; ++axis )
+        {
+            if( fabs( steps[ axis ] ) < 1e-12 )
+            {
+                if( starts[ axis ] < 0.0 || starts[ axis ] >= ends[ axis ] )
+                {
+                    last = first - 1;
+                }
+                continue;
+            }
+            double enter = -starts[ axis ] / steps[ axis ];
+            double leave = ( ends[ axis ] - starts[ axis ] ) / steps[ axis ];
+            if( steps[ axis ] > 0.0 )
+            {
+                first = std::max( first, ceil( enter ) );
+                last = std::min( last, ceil( leave ) - 1.0 );
+            }
+            else
+            {
+                first = std::max( first, floor( leave ) + 1.0 );
+                last = std::min( last, floor( enter ) );
+            }
+        }
+        if( last < first )
+        {
+            continue;
+        }
+
+        int x = (int)first;
+        int count = (int)last - x + 1;
+        int u = (int)( llround( rowU * 65536.0 ) + (Sint64)stepU * x );
+        int v = (int)( llround( rowV * 65536.0 ) + (Sint64)stepV * x );
+        if( command.filter == RASTER_BILINEAR )
+        {
+            fetchBilinear( image, source, u, v, stepU, stepV, count, span );
+        }
+        else
+        {
+            fetchNearest( image, source, u, v, stepU, stepV, count, span );
+        }
+        mBlend( &mPixels[ y * mWidth + x ], span, count, command.color, command.blending );
+    }
+}
+
+void LRasterizer::fetchNearest( const LRasterImage& image, const SDL_Rect& area, int u, int v, int du, int dv, int count, Uint32* out )
+{
+    // Rounding at the edges of the span can land just outside, so positions are clamped
+    const Uint32* pixels = &image.pixels[ area.y * image.width + area.x ];
+    for( int i = 0; i < count; ++i )
+    {
+        int x = std::max( 0, std::min( area.w - 1, u >> 16 ) );
+        int y = std::max( 0, std::min( area.h - 1, v >> 16 ) );
+        out[ i ] = pixels[ y * image.width + x ];
+        u += du;
+        v += dv;
+    }
+}
+
+void LRasterizer::fetchBilinear( const LRasterImage& image, const SDL_Rect& area, int u, int v, int du, int dv, int count, Uint32* out )
+{
+    // Blend the four pixels around each position, 8 bits of weight, red and blue together and alpha and green together.
+    // Neighbours past the edge of the area repeat the edge, so atlas neighbours never bleed in
+    const Uint32* pixels = &image.pixels[ area.y * image.width + area.x ];
+    u -= 0x8000;
+    v -= 0x8000;
+    for( int i = 0; i < count; ++i )
+    {
+        int x0 = u >> 16;
+        int y0 = v >> 16;
+        Uint32 fx = ( u >> 8 ) & 0xFF;
+        Uint32 fy = ( v >> 8 ) & 0xFF;
+        int x1 = std::max( 0, std::min( area.w - 1, x0 + 1 ) );
+        int y1 = std::max( 0, std::min( area.h - 1, y0 + 1 ) );
+        x0 = std::max( 0, std::min( area.w - 1, x0 ) );
+        y0 = std::max( 0, std::min( area.h - 1, y0 ) );
+
+        Uint32 p00 = pixels[ y0 * image.width + x0 ];
+        Uint32 p10 = pixels[ y0 * image.width + x1 ];
+        Uint32 p01 = pixels[ y1 * image.width + x0 ];
+        Uint32 p11 = pixels[ y1 * image.width + x1 ];
+
+        Uint32 topRB = ( ( ( p00 & 0xFF00FF ) * ( 256 - fx ) + ( p10 & 0xFF00FF ) * fx ) >> 8 ) & 0xFF00FF;
+        Uint32 topAG = ( ( ( ( p00 >> 8 ) & 0xFF00FF ) * ( 256 - fx ) + ( ( p10 >> 8 ) & 0xFF00FF ) * fx ) >> 8 ) & 0xFF00FF;
+        Uint32 bottomRB = ( ( ( p01 & 0xFF00FF ) * ( 256 - fx ) + ( p11 & 0xFF00FF ) * fx ) >> 8 ) & 0xFF00FF;
+        Uint32 bottomAG = ( ( ( ( p01 >> 8 ) & 0xFF00FF ) * ( 256 - fx ) + ( ( p11 >> 8 ) & 0xFF00FF ) * fx ) >> 8 ) & 0xFF00FF;
+        Uint32 rb = ( ( topRB * ( 256 - fy ) + bottomRB * fy ) >> 8 ) & 0xFF00FF;
+        Uint32 ag = ( ( topAG * ( 256 - fy ) + bottomAG * fy ) >> 8 ) & 0xFF00FF;
+        out[ i ] = rb | ( ag << 8 );
+
+        u += du;
+        v += dv;
+    }
+}
+
+bool LRasterizer::present()
+{
+    mDrawing = false;
+    if( !isOpen() )
+    {
+        return false;
+    }
+    flush();
+
+    // The whole framebuffer goes up in one update
+    if( SDL_UpdateTexture( mTexture, NULL, &mPixels[ 0 ], mWidth * 4 ) != 0 )
+    {
+        printf( "Unable to update rasterizer texture! SDL Error: %s\n", SDL_GetError() );
+        return false;
+    }
+    return SDL_RenderCopy( gRenderer, mTexture, NULL, NULL ) == 0;
+}
+
+void LRasterizer::end()
+{
+    // The framebuffer is kept, so what was drawn still has to land in it
+    mDrawing = false;
+    flush();
+}
+
+const Uint32* LRasterizer::getPixels()
+{
+    return mPixels.empty() ? NULL : &mPixels[ 0 ];
+}
+
+int LRasterizer::getWidth()
+{
+    return mWidth;
+}
+
+int LRasterizer::getHeight()
+{
+    return mHeight;
+}
+
+// Constructor for LButton
+LButton::LButton()
+{
+    mPosition.x = 0;
+    mPosition.y = 0;
+    mWidth = BUTTON_WIDTH;
+    mHeight = BUTTON_HEIGHT;
+
+    mCurrentSprite = BUTTON_SPRITE_MOUSE_OUT;
+}
+
+void LButton::setPosition( int x, int y)
+{
+    mPosition.x = x;
+    mPosition.y = y;
+}
+
+void LButton::setSize( int width, int height )
+{
+    // contains() compares as unsigned, where a negative size would cover nearly every point
+    mWidth = std::max( 0, width );
+    mHeight = std::max( 0, height );
+}
+
+SDL_Rect LButton::getRect()
+{
+    SDL_Rect rect = { mPosition.x, mPosition.y, mWidth, mHeight };
+    return rect;
+}
+
+bool LButton::contains( int x, int y )
+{
+    // One unsigned compare per axis also catches points left of or above the button
+    return (unsigned int)( x - mPosition.x ) < (unsigned int)mWidth && (unsigned int)( y - mPosition.y ) < (unsigned int)mHeight;
+}
+
+// Handle Mouse Events
+void LButton::handleEvent( SDL_Event* e )
+{
+    // If mouse event happened, the position comes with it
+    if( e->type == SDL_MOUSEMOTION )
+    {
+        setMouseState( e->type, contains( e->motion.x, e->motion.y ) );
+    }
+    else if( e->type == SDL_MOUSEBUTTONDOWN || e->type == SDL_MOUSEBUTTONUP )
+    {
+        setMouseState( e->type, contains( e->button.x, e->button.y ) );
+    }
+}
+
+void LButton::setMouseState( Uint32 eventType, bool inside )
+{
+    // Mouse is outside button
+    if( !inside )
+    {
+        mCurrentSprite = BUTTON_SPRITE_MOUSE_OUT;
+    }
+
+    // Mouse is inside button
+    else
+    {
+        // Set mouse over sprite
+        switch( eventType )
+        {
+            case SDL_MOUSEMOTION:
+            mCurrentSprite = BUTTON_SPRITE_MOUSE_OVER_MOTION;
+            break;
+
+            case SDL_MOUSEBUTTONDOWN:
+            mCurrentSprite = BUTTON_SPRITE_MOUSE_DOWN;
+            break;
+
+            case SDL_MOUSEBUTTONUP:
+            mCurrentSprite = BUTTON_SPRITE_MOUSE_UP;
+            break;
+        }
+    }
+}
+
+LButtonSprite LButton::getSprite()
+{
+    return mCurrentSprite;
+}
+
+LButtonLayer::LButtonLayer( int width, int height, int cellSize )
+{
+    mCellSize = cellSize;
+    mColumns = std::max( 1, ( width + cellSize - 1 ) / cellSize );
+    mRows = std::max( 1, ( height + cellSize - 1 ) / cellSize );
+    mCellStart.assign( mColumns * mRows + 1, 0 );
+    mStale = false;
+}
+
+int LButtonLayer::add( LButton* button )
+{
+    mButtons.push_back( button );
+    mStale = true;
+    return mButtons.size() - 1;
+}
+
+void LButtonLayer::rebuild()
+{
+    // Cells covered by each button, clamped so nothing falls off the grid
+    std::vector<SDL_Rect> ranges( mButtons.size() );
+    std::vector<int> counts( mColumns * mRows, 0 );
+    for( int i = 0; i < (int)mButtons.size(); ++i )
+    {
+        SDL_Rect rect = mButtons[ i ]->getRect();
+        int firstColumn = std::min( mColumns - 1, std::max( 0, rect.x ) / mCellSize );
+        int firstRow = std::min( mRows - 1, std::max( 0, rect.y ) / mCellSize );
+        int lastColumn = std::min( mColumns - 1, std::max( 0, rect.x + rect.w - 1 ) / mCellSize );
+        int lastRow = std::min( mRows - 1, std::max( 0, rect.y + rect.h - 1 ) / mCellSize );
+        SDL_Rect range = { firstColumn, firstRow, lastColumn - firstColumn + 1, lastRow - firstRow + 1 };
+        ranges[ i ] = range;
+
+        for( int row = range.y; row < range.y + range.h; ++row )
+        {
+            for( int column = range.x; column < range.x + range.w; ++column )
+            {
+                ++counts[ row * mColumns + column ];
+            }
+        }
+    }
+
+    // Every cell's buttons sit together in one array, in the order they were added
+    mCellStart[ 0 ] = 0;
+    for( int cell = 0; cell < mColumns * mRows; ++cell )
+    {
+        mCellStart[ cell + 1 ] = mCellStart[ cell ] + counts[ cell ];
+        counts[ cell ] = mCellStart[ cell ];
+    }
+    mCellButtons.resize( mCellStart[ mColumns * mRows ] );
+    for( int i = 0; i < (int)mButtons.size(); ++i )
+    {
+        const SDL_Rect& range = ranges[ i ];
+        for( int row = range.y; row < range.y + range.h; ++row )
+        {
+            for( int column = range.x; column < range.x + range.w; ++column )
+            {
+                mCellButtons[ counts[ row * mColumns + column ]++ ] = i;
+            }
+        }
+    }
+
+    // Buttons may have moved out from under the mouse, the next event settles them
+    mStale = false;
+}
+
+void LButtonLayer::collectHits( int x, int y )
+{
+    if( mStale )
+    {
+        rebuild();
+    }
+
+    mHits.clear();
+    int column = std::min( mColumns - 1, std::max( 0, x ) / mCellSize );
+    int row = std::min( mRows - 1, std::max( 0, y ) / mCellSize );
+    int cell = row * mColumns + column;
+    for( int i = mCellStart[ cell ]; i < mCellStart[ cell + 1 ]; ++i )
+    {
+        int id = mCellButtons[ i ];
+        if( mButtons[ id ]->contains( x, y ) )
+        {
+            mHits.push_back( id );
+        }
+    }
+}
+
+int LButtonLayer::buttonAt( int x, int y )
+{
+    collectHits( x, y );
+    return mHits.empty() ? -1 : mHits.back();
+}
+
+bool LButtonLayer::handleEvent( SDL_Event* e )
+{
+    int x, y;
+    if( e->type == SDL_MOUSEMOTION )
+    {
+        x = e->motion.x;
+        y = e->motion.y;
+    }
+    else if( e->type == SDL_MOUSEBUTTONDOWN || e->type == SDL_MOUSEBUTTONUP )
+    {
+        x = e->button.x;
+        y = e->button.y;
+    }
+    else
+    {
+        return false;
+    }
+
+    // Buttons the mouse left go back to their out sprite, every other button off the mouse already shows it
+    bool changed = false;
+    collectHits( x, y );
+    for( int i = 0; i < (int)mHovered.size(); ++i )
+    {
+        if( std::find( mHits.begin(), mHits.end(), mHovered[ i ] ) == mHits.end() )
+        {
+            LButton* button = mButtons[ mHovered[ i ] ];
+            LButtonSprite before = button->getSprite();
+            button->setMouseState( e->type, false );
+            changed = changed || button->getSprite() != before;
+        }
+    }
+    for( int i = 0; i < (int)mHits.size(); ++i )
+    {
+        LButton* button = mButtons[ mHits[ i ] ];
+        LButtonSprite before = button->getSprite();
+        button->setMouseState( e->type, true );
+        changed = changed || button->getSprite() != before;
+    }
+    mHovered.swap( mHits );
+    return changed;
+}
+
+int LButtonLayer::getCount()
+{
+    return mButtons.size();
+}
+
+void LButtonLayer::clear()
+{
+    mButtons.clear();
+    mCellButtons.clear();
+    mCellStart.assign( mColumns * mRows + 1, 0 );
+    mHovered.clear();
+    mHits.clear();
+    mStale = false;
+}
+
+LWidget::LWidget()
+{
+    mParent = NULL;
+    mRect.x = 0;
+    mRect.y = 0;
+    mRect.w = 0;
+    mRect.h = 0;
+    mMeasured.x = 0;
+    mMeasured.y = 0;
+    mMinimum.x = 0;
+    mMinimum.y = 0;
+    mVisible = true;
+    mMeasureDirty = true;
+    mLayoutDirty = true;
+    mDrawDirty = true;
+}
+
+LWidget::~LWidget()
+{
+    for( int i = 0; i < (int)mChildren.size(); ++i )
+    {
+        delete mChildren[ i ];
+    }
+}
+
+template <typename T>
+T* LWidget::add( T* child )
+{
+    child->mParent = this;
+    mChildren.push_back( child );
+    invalidateLayout();
+    return child;
+}
+
+void LWidget::setMinimumSize( int width, int height )
+{
+    if( width != mMinimum.x || height != mMinimum.y )
+    {
+        mMinimum.x = width;
+        mMinimum.y = height;
+        invalidateLayout();
+    }
+}
+
+void LWidget::setVisible( bool visible )
+{
+    if( visible != mVisible )
+    {
+        mVisible = visible;
+        invalidateLayout();
+    }
+}
+
+bool LWidget::isVisible()
+{
+    return mVisible;
+}
+
+SDL_Point LWidget::measure()
+{
+    SDL_Point size = { 0, 0 };
+    if( !mVisible )
+    {
+        return size;
+    }
+
+    if( mMeasureDirty )
+    {
+        mMeasured = measureContent();
+        mMeasured.x = std::max( mMeasured.x, mMinimum.x );
+        mMeasured.y = std::max( mMeasured.y, mMinimum.y );
+        mMeasureDirty = false;
+    }
+    return mMeasured;
+}
+
+int LWidget::layout( SDL_Rect area )
+{
+    // A clean subtree in the same place is already right
+    if( !mVisible || ( !mLayoutDirty && area.x == mRect.x && area.y == mRect.y && area.w == mRect.w && area.h == mRect.h ) )
+    {
+        return 0;
+    }
+
+    mRect = area;
+    mLayoutDirty = false;
+    return 1 + arrange();
+}
+
+void LWidget::draw( std::vector<LDrawItem>& items )
+{
+    mDrawDirty = false;
+    if( !mVisible )
+    {
+        return;
+    }
+
+    drawContent( items );
+    for( int i = 0; i < (int)mChildren.size(); ++i )
+    {
+        mChildren[ i ]->draw( items );
+    }
+}
+
+void LWidget::invalidateLayout()
+{
+    // Stop at the first ancestor already waiting, everything above it is too
+    for( LWidget* widget = this; widget != NULL; widget = widget->mParent )
+    {
+        if( widget != this && widget->mMeasureDirty && widget->mLayoutDirty && widget->mDrawDirty )
+        {
+            break;
+        }
+        widget->mMeasureDirty = true;
+        widget->mLayoutDirty = true;
+        widget->mDrawDirty = true;
+    }
+}
+
+void LWidget::invalidateDraw()
+{
+    for( LWidget* widget = this; widget != NULL && !widget->mDrawDirty; widget = widget->mParent )
+    {
+        widget->mDrawDirty = true;
+    }
+}
+
+bool LWidget::needsLayout()
+{
+    return mLayoutDirty;
+}
+
+bool LWidget::needsDraw()
+{
+    return mDrawDirty;
+}
+
+SDL_Rect LWidget::getRect()
+{
+    return mRect;
+}
+
+int LWidget::getChildCount()
+{
+    return mChildren.size();
+}
+
+LWidget* LWidget::getChild( int i )
+{
+    return mChildren[ i ];
+}
+
+LButton* LWidget::getButton()
+{
+    return NULL;
+}
+
+int LWidget::arrange()
+{
+    return 0;
+}
+
+void LWidget::drawContent( std::vector<LDrawItem>& )
+{
+}
+
+LContainer::LContainer( LayoutDirection direction, int spacing, int padding )
+{
+    mDirection = direction;
+    mSpacing = spacing;
+    mPadding = padding;
+}
+
+SDL_Point LContainer::measureContent()
+{
+    // Children end to end along the direction, the widest one across it
+    SDL_Point size = { 0, 0 };
+    int shown = 0;
+    for( int i = 0; i < (int)mChildren.size(); ++i )
+    {
+        SDL_Point child = mChildren[ i ]->measure();
+        if( child.x == 0 && child.y == 0 )
+        {
+            continue;
+        }
+
+        if( mDirection == LAYOUT_VERTICAL )
+        {
+            size.x = std::max( size.x, child.x );
+            size.y += child.y;
+        }
+        else
+        {
+            size.x += child.x;
+            size.y = std::max( size.y, child.y );
+        }
+        ++shown;
+    }
+
+    int gaps = std::max( 0, shown - 1 ) * mSpacing;
+    size.x += 2 * mPadding + ( mDirection == LAYOUT_HORIZONTAL ? gaps : 0 );
+    size.y += 2 * mPadding + ( mDirection == LAYOUT_VERTICAL ? gaps : 0 );
+    return size;
+}
+
+int LContainer::arrange()
+{
+    // Every child at its measured size, clean children that did not move are skipped by layout()
+    int placed = 0;
+    int x = mRect.x + mPadding;
+    int y = mRect.y + mPadding;
+    for( int i = 0; i < (int)mChildren.size(); ++i )
+    {
+        SDL_Point child = mChildren[ i ]->measure();
+        if( child.x == 0 && child.y == 0 )
+        {
+            continue;
+        }
+
+        SDL_Rect area = { x, y, child.x, child.y };
+        placed += mChildren[ i ]->layout( area );
+        if( mDirection == LAYOUT_VERTICAL )
+        {
+            y += child.y + mSpacing;
+        }
+        else
+        {
+            x += child.x + mSpacing;
+        }
+    }
+    return placed;
+}
+
+LButtonWidget::LButtonWidget( LTexture* sheet, const SDL_Rect* clips )
+{
+    mSheet = sheet;
+    mClips = clips;
+}
+
+LButton* LButtonWidget::getButton()
+{
+    return &mButton;
+}
+
+SDL_Point LButtonWidget::measureContent()
+{
+    SDL_Point size = { mClips[ BUTTON_SPRITE_MOUSE_OUT ].w, mClips[ BUTTON_SPRITE_MOUSE_OUT ].h };
+    return size;
+}
+
+int LButtonWidget::arrange()
+{
+    // The button hit tests against wherever it was laid out
+    mButton.setPosition( mRect.x, mRect.y );
+    mButton.setSize( mRect.w, mRect.h );
+    return 0;
+}
+
+void LButtonWidget::drawContent( std::vector<LDrawItem>& items )
+{
+    LDrawItem item;
+    item.texture = mSheet;
+    item.clip = mClips[ mButton.getSprite() ];
+    item.clipped = true;
+    item.x = mRect.x;
+    item.y = mRect.y;
+    item.tinted = false;
+    items.push_back( item );
+}
+
+LLabel::LLabel( int size )
+{
+    mColor.r = 0;
+    mColor.g = 0;
+    mColor.b = 0;
+    mColor.a = 0xFF;
+    mSize = size;
+}
+
+void LLabel::setText( std::string text, SDL_Color color )
+{
+    if( text == mText && color.r == mColor.r && color.g == mColor.g && color.b == mColor.b && color.a == mColor.a )
+    {
+        return;
+    }
+
+    mText = text;
+    mColor = color;
+    invalidateLayout();
+}
+
+std::string LLabel::getText()
+{
+    return mText;
+}
+
+SDL_Point LLabel::measureContent()
+{
+    return gGlyphs.measureText( mText, mSize );
+}
+
+void LLabel::drawContent( std::vector<LDrawItem>& items )
+{
+    gGlyphs.layoutText( mText, mRect.x, mRect.y, mSize, mColor, items );
+}
+
+LImage::LImage( LTexture* texture, const SDL_Rect* clip )
+{
+    mTexture = NULL;
+    mClipped = false;
+    setTexture( texture, clip );
+}
+
+void LImage::setTexture( LTexture* texture, const SDL_Rect* clip )
+{
+    mTexture = texture;
+    mClipped = clip != NULL;
+    if( clip != NULL )
+    {
+        mClip = *clip;
+    }
+    invalidateLayout();
+}
+
+SDL_Point LImage::measureContent()
+{
+    SDL_Point size = { 0, 0 };
+    if( mTexture != NULL )
+    {
+        size.x = mClipped ? mClip.w : mTexture->getWidth();
+        size.y = mClipped ? mClip.h : mTexture->getHeight();
+    }
+    return size;
+}
+
+void LImage::drawContent( std::vector<LDrawItem>& items )
+{
+    if( mTexture == NULL )
+    {
+        return;
+    }
+
+    LDrawItem item;
+    item.texture = mTexture;
+    item.clip = mClip;
+    item.clipped = mClipped;
+    item.x = mRect.x;
+    item.y = mRect.y;
+    item.tinted = false;
+    items.push_back( item );
+}
+
+LWidgetTree::LWidgetTree( int width, int height ) : mButtonLayer( width, height )
+{
+    mGlyphEvictions = 0;
+    mArea.x = 0;
+    mArea.y = 0;
+    mArea.w = width;
+    mArea.h = height;
+}
+
+LContainer& LWidgetTree::getRoot()
+{
+    return mRoot;
+}
+
+int LWidgetTree::update()
+{
+    // Nothing changed, nothing to do
+    int placed = 0;
+    if( mRoot.needsLayout() )
+    {
+        mRoot.measure();
+        placed = mRoot.layout( mArea );
+
+        // Buttons moved, so file them again, from scratch only when the set of buttons changed
+        std::vector<LButton*> buttons;
+        collectButtons( &mRoot, buttons );
+        if( buttons != mButtons )
+        {
+            // The new layer does not know what was hovered, so start every button from mouse out
+            for( int i = 0; i < (int)mButtons.size(); ++i )
+            {
+                mButtons[ i ]->setMouseState( SDL_MOUSEMOTION, false );
+            }
+            mButtonLayer.clear();
+            for( int i = 0; i < (int)buttons.size(); ++i )
+            {
+                mButtonLayer.add( buttons[ i ] );
+            }
+            mButtons.swap( buttons );
+        }
+        else
+        {
+            mButtonLayer.rebuild();
+        }
+    }
+
+    refreshDrawList();
+    return placed;
+}
+
+bool LWidgetTree::handleEvent( SDL_Event* e )
+{
+    // A button changing sprite changes the draw list but not the layout
+    if( mButtonLayer.handleEvent( e ) )
+    {
+        mRoot.invalidateDraw();
+        return true;
+    }
+    return false;
+}
+
+void LWidgetTree::render( LSpriteBatch& batch )
+{
+    // Text drawn between update() and now may have filled the atlas, and glyphs the list did not use this frame are not kept
+    refreshDrawList();
+
+    for( int i = 0; i < (int)mDrawList.size(); ++i )
+    {
+        LDrawItem& item = mDrawList[ i ];
+        if( item.tinted )
+        {
+            item.texture->setColor( item.color.r, item.color.g, item.color.b );
+            item.texture->setAlpha( item.color.a );
+        }
+        batch.draw( *item.texture, item.x, item.y, item.clipped ? &item.clip : NULL );
+    }
+}
+
+const std::vector<LDrawItem>& LWidgetTree::getDrawList()
+{
+    return mDrawList;
+}
+
+LGlyphAtlas::LGlyphAtlas()
+{
+    mPageTexture = NULL;
+    mFrame = 0;
+    mEvictions = 0;
+}
+
+LGlyphAtlas::~LGlyphAtlas()
+{
+    free();
+}
+
+bool LGlyphAtlas::open( std::string path )
+{
+    free();
+
+    // Open the size the overlay uses now, so a missing font shows up at startup
+    mPath = path;
+    if( getFont( OVERLAY_FONT_SIZE ) == NULL )
+    {
+        mPath.clear();
+        return false;
+    }
+    return true;
+}
+
+void LGlyphAtlas::free()
+{
+    for( std::map<int, TTF_Font*>::iterator i = mFonts.begin(); i != mFonts.end(); ++i )
+    {
+        TTF_CloseFont( i->second );
+    }
+    mFonts.clear();
+
+    mPage.free();
+    if( mPageTexture != NULL )
+    {
+        SDL_DestroyTexture( mPageTexture );
+        mPageTexture = NULL;
+    }
+    mShelves.clear();
+    mGlyphs.clear();
+    mPath.clear();
+}
+
+void LGlyphAtlas::beginFrame()
+{
+    ++mFrame;
+}
+
+int LGlyphAtlas::drawText( LSpriteBatch& batch, const std::string& text, int x, int y, int size, SDL_Color color )
+{
+    mItems.clear();
+    SDL_Point extent = walkText( text, x, y, size, color, &mItems );
+
+    // Every glyph shares the texture and the color
+    mPage.setColor( color.r, color.g, color.b );
+    mPage.setAlpha( color.a );
+    for( int i = 0; i < (int)mItems.size(); ++i )
+    {
+        batch.draw( mPage, mItems[ i ].x, mItems[ i ].y, &mItems[ i ].clip );
+    }
+    return extent.x;
+}
+
+int LGlyphAtlas::layoutText( const std::string& text, int x, int y, int size, SDL_Color color, std::vector<LDrawItem>& items )
+{
+    return walkText( text, x, y, size, color, &items ).x;
+}
+
+SDL_Point LGlyphAtlas::measureText( const std::string& text, int size )
+{
+    SDL_Color color = { 0, 0, 0, 0 };
+    return walkText( text, 0, 0, size, color, NULL );
+}
+
+int LGlyphAtlas::getGlyphCount()
+{
+    return mGlyphs.size();
+}
+
+int LGlyphAtlas::getEvictionCount()
+{
+    return mEvictions;
+}
+
+TTF_Font* LGlyphAtlas::getFont( int size )
+{
+    std::map<int, TTF_Font*>::iterator found = mFonts.find( size );
+    if( found != mFonts.end() )
+    {
+        return found->second;
+    }
+    if( mPath.empty() )
+    {
+        return NULL;
+    }
+
+    // The archive keeps the font mapped, so SDL_ttf can read it from there
+    TTF_Font* font = NULL;
+    if( gArchive.isOpen() && gArchive.find( mPath ) != NULL )
+    {
+        font = TTF_OpenFontRW( gArchive.openFile( mPath ), 1, size );
+    }
+    else
+    {
+        font = TTF_OpenFont( mPath.c_str(), size );
+    }
+    if( font == NULL )
+    {
+        printf( "Unable to open font %s at size %d! SDL_ttf Error: %s\n", mPath.c_str(), size, TTF_GetError() );
+    }
+
+    // Failures are remembered too, so they are not retried every frame
+    mFonts[ size ] = font;
+    return font;
+}
+
+LGlyphAtlas::Glyph* LGlyphAtlas::getGlyph( TTF_Font* font, int size, Uint32 codepoint )
+{
+    Uint64 key = ( (Uint64)size << 21 ) | codepoint;
+    std::unordered_map<Uint64, Glyph>::iterator found = mGlyphs.find( key );
+    if( found != mGlyphs.end() )
+    {
+        if( found->second.shelf >= 0 )
+        {
+            mShelves[ found->second.shelf ].lastUsed = mFrame;
+        }
+        return &found->second;
+    }
+
+    // The texture is made the first time a glyph is, when there is a renderer
+    if( mPageTexture == NULL )
+    {
+        mPageTexture = SDL_CreateTexture( gRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE );
+        if( mPageTexture == NULL )
+        {
+            printf( "Unable to create glyph texture! SDL Error: %s\n", SDL_GetError() );
+            return NULL;
+        }
+        std::vector<Uint32> clear( GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE, 0 );
+        SDL_UpdateTexture( mPageTexture, NULL, &clear[ 0 ], GLYPH_ATLAS_SIZE * 4 );
+        SDL_SetTextureBlendMode( mPageTexture, SDL_BLENDMODE_BLEND );
+        SDL_Rect whole = { 0, 0, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE };
+        mPage.loadFromTexture( mPageTexture, whole );
+    }
+
+    Glyph glyph;
+    glyph.rect.x = 0;
+    glyph.rect.y = 0;
+    glyph.rect.w = 0;
+    glyph.rect.h = 0;
+    glyph.offsetX = 0;
+    glyph.offsetY = 0;
+    glyph.advance = 0;
+    glyph.shelf = -1;
+
+    int minX, maxX, minY, maxY;
+    TTF_GlyphMetrics32( font, codepoint, &minX, &maxX, &minY, &maxY, &glyph.advance );
+
+    // White, so the color comes from modulation, laid out in a box one line tall
+    SDL_Color white = { 0xFF, 0xFF, 0xFF, 0xFF };
+    SDL_Surface* rendered = TTF_RenderGlyph32_Blended( font, codepoint, white );
+    SDL_Surface* pixels = rendered == NULL ? NULL : SDL_ConvertSurfaceFormat( rendered, SDL_PIXELFORMAT_ARGB8888, 0 );
+    SDL_FreeSurface( rendered );
+    if( pixels != NULL )
+    {
+        // Keep only the box around pixels that show
+        int left = pixels->w, right = -1, top = pixels->h, bottom = -1;
+        for( int row = 0; row < pixels->h; ++row )
+        {
+            const Uint32* line = (const Uint32*)( (const Uint8*)pixels->pixels + row * pixels->pitch );
+            for( int column = 0; column < pixels->w; ++column )
+            {
+                if( ( line[ column ] >> 24 ) != 0 )
+                {
+                    left = std::min( left, column );
+                    right = std::max( right, column );
+                    top = std::min( top, row );
+                    bottom = std::max( bottom, row );
+                }
+            }
+        }
+
+        if( right >= left )
+        {
+            int width = right - left + 1;
+            int height = bottom - top + 1;
+            glyph.shelf = allocate( width, height, glyph.rect );
+            if( glyph.shelf < 0 )
+            {
+                SDL_FreeSurface( pixels );
+                return NULL;
+            }
+
+            const Uint8* first = (const Uint8*)pixels->pixels + top * pixels->pitch + left * 4;
+            SDL_UpdateTexture( mPageTexture, &glyph.rect, first, pixels->pitch );
+            glyph.offsetX = left;
+            glyph.offsetY = top;
+            mShelves[ glyph.shelf ].keys.push_back( key );
+        }
+        SDL_FreeSurface( pixels );
+    }
+
+    return &( mGlyphs[ key ] = glyph );
+}
+
+int LGlyphAtlas::allocate( int width, int height, SDL_Rect& rect )
+{
+    // A pixel of gap right and below, so filtering never picks up a neighbor
+    int paddedWidth = width + 1;
+    int paddedHeight = height + 1;
+    int shelfHeight = ( paddedHeight + GLYPH_SHELF_STEP - 1 ) / GLYPH_SHELF_STEP * GLYPH_SHELF_STEP;
+    if( paddedWidth > GLYPH_ATLAS_SIZE || shelfHeight > GLYPH_ATLAS_SIZE )
+    {
+        return -1;
+    }
+
+    // A shelf of the same height with room left
+    int chosen = -1;
+    for( int i = 0; i < (int)mShelves.size(); ++i )
+    {
+        if( mShelves[ i ].height == shelfHeight && mShelves[ i ].nextX + paddedWidth <= GLYPH_ATLAS_SIZE )
+        {
+            chosen = i;
+            break;
+        }
+    }
+
+    // A new shelf below the others
+    int bottom = mShelves.empty() ? 0 : mShelves.back().y + mShelves.back().height;
+    if( chosen < 0 && bottom + shelfHeight <= GLYPH_ATLAS_SIZE )
+    {
+        Shelf shelf;
+        shelf.y = bottom;
+        shelf.height = shelfHeight;
+        shelf.nextX = 0;
+        shelf.lastUsed = mFrame;
+        mShelves.push_back( shelf );
+        chosen = mShelves.size() - 1;
+    }
+
+    // Empty the least recently used run of neighboring shelves tall enough together, never one drawn from this frame
+    if( chosen < 0 )
+    {
+        int runLength = 0;
+        Uint32 runUsed = 0;
+        for( int first = 0; first < (int)mShelves.size(); ++first )
+        {
+            int height = 0;
+            Uint32 used = 0;
+            int last = first;
+            for( ; last < (int)mShelves.size() && height < shelfHeight && mShelves[ last ].lastUsed != mFrame; ++last )
+            {
+                height += mShelves[ last ].height;
+                used = std::max( used, mShelves[ last ].lastUsed );
+            }
+            if( height >= shelfHeight && ( chosen < 0 || used < runUsed ) )
+            {
+                chosen = first;
+                runLength = last - first;
+                runUsed = used;
+            }
+        }
+        if( chosen < 0 )
+        {
+            return -1;
+        }
+
+        // Throw out their glyphs and pixels
+        int top = mShelves[ chosen ].y;
+        int height = 0;
+        for( int i = chosen; i < chosen + runLength; ++i )
+        {
+            for( int k = 0; k < (int)mShelves[ i ].keys.size(); ++k )
+            {
+                mGlyphs.erase( mShelves[ i ].keys[ k ] );
+            }
+            height += mShelves[ i ].height;
+        }
+        std::vector<Uint32> clear( GLYPH_ATLAS_SIZE * height, 0 );
+        SDL_Rect area = { 0, top, GLYPH_ATLAS_SIZE, height };
+        SDL_UpdateTexture( mPageTexture, &area, &clear[ 0 ], GLYPH_ATLAS_SIZE * 4 );
+        ++mEvictions;
+
+        // One shelf the height needed, and what is left over as an empty shelf of its own
+        Shelf shelf;
+        shelf.y = top;
+        shelf.height = shelfHeight;
+        shelf.nextX = 0;
+        shelf.lastUsed = mFrame;
+        std::vector<Shelf> replacement( 1, shelf );
+        if( height > shelfHeight )
+        {
+            shelf.y = top + shelfHeight;
+            shelf.height = height - shelfHeight;
+            shelf.lastUsed = 0;
+            replacement.push_back( shelf );
+        }
+        mShelves.erase( mShelves.begin() + chosen, mShelves.begin() + chosen + runLength );
+        mShelves.insert( mShelves.begin() + chosen, replacement.begin(), replacement.end() );
+
+        // Glyphs on shelves below the run moved index
+        int shift = (int)replacement.size() - runLength;
+        if( shift != 0 )
+        {
+            for( std::unordered_map<Uint64, Glyph>::iterator i = mGlyphs.begin(); i != mGlyphs.end(); ++i )
+            {
+                if( i->second.shelf >= chosen + runLength )
+                {
+                    i->second.shelf += shift;
+                }
+            }
+        }
+    }
+
+    Shelf& shelf = mShelves[ chosen ];
+    rect.x = shelf.nextX;
+    rect.y = shelf.y;
+    rect.w = width;
+    rect.h = height;
+    shelf.nextX += paddedWidth;
+    shelf.lastUsed = mFrame;
+    return chosen;
+}
+
+SDL_Point LGlyphAtlas::walkText( const std::string& text, int x, int y, int size, SDL_Color color, std::vector<LDrawItem>* items )
+{
+    SDL_Point extent = { 0, 0 };
+    TTF_Font* font = getFont( size );
+    if( font == NULL || text.empty() )
+    {
+        return extent;
+    }
+
+    int lineSkip = TTF_FontLineSkip( font );
+    int penX = 0;
+    int penY = 0;
+    Uint32 previous = 0;
+    size_t i = 0;
+    while( i < text.size() )
+    {
+        Uint32 codepoint = decodeUtf8( text, i );
+        if( codepoint == '\n' )
+        {
+            penX = 0;
+            penY += lineSkip;
+            previous = 0;
+            continue;
+        }
+
+        // Characters the font lacks show as a question mark
+        if( !TTF_GlyphIsProvided32( font, codepoint ) )
+        {
+            codepoint = '?';
+        }
+
+        // Pairs like AV sit closer together
+        if( previous != 0 )
+        {
+            penX += TTF_GetFontKerningSizeGlyphs32( font, previous, codepoint );
+        }
+        previous = codepoint;
+
+        Glyph* glyph = getGlyph( font, size, codepoint );
+        if( glyph == NULL )
+        {
+            continue;
+        }
+        if( items != NULL && glyph->shelf >= 0 )
+        {
+            LDrawItem item;
+            item.texture = &mPage;
+            item.clip = glyph->rect;
+            item.clipped = true;
+            item.x = x + penX + glyph->offsetX;
+            item.y = y + penY + glyph->offsetY;
+            item.tinted = true;
+            item.color = color;
+            items->push_back( item );
+        }
+        penX += glyph->advance;
+        extent.x = std::max( extent.x, penX );
+    }
+    extent.y = penY + TTF_FontHeight( font );
+    return extent;
+}
+
+Uint32 LGlyphAtlas::decodeUtf8( const std::string& text, size_t& i )
+{
+    const Uint32 REPLACEMENT = 0xFFFD;
+    Uint8 lead = text[ i++ ];
+    if( lead < 0x80 )
+    {
+        return lead;
+    }
+
+    // Lead byte gives the length, continuation bytes carry six bits each
+    int length = 0;
+    Uint32 codepoint = 0;
+    if( ( lead & 0xE0 ) == 0xC0 )
+    {
+        length = 1;
+        codepoint = lead & 0x1F;
+    }
+    else if( ( lead & 0xF0 ) == 0xE0 )
+    {
+        length = 2;
+        codepoint = lead & 0x0F;
+    }
+    else if( ( lead & 0xF8 ) == 0xF0 )
+    {
+        length = 3;
+        codepoint = lead & 0x07;
+    }
+    else
+    {
+        return REPLACEMENT;
+    }
+
+    for( int n = 0; n < length; ++n )
+    {
+        if( i >= text.size() || ( (Uint8)text[ i ] & 0xC0 ) != 0x80 )
+        {
+            return REPLACEMENT;
+        }
+        codepoint = ( codepoint << 6 ) | ( (Uint8)text[ i++ ] & 0x3F );
+    }
+
+    // Overlong forms, surrogates and values past Unicode are not characters
+    const Uint32 SMALLEST[ 4 ] = { 0, 0x80, 0x800, 0x10000 };
+    if( codepoint < SMALLEST[ length ] || codepoint > 0x10FFFF || ( codepoint >= 0xD800 && codepoint <= 0xDFFF ) )
+    {
+        return REPLACEMENT;
+    }
+    return codepoint;
+}
+
+void LWidgetTree::collectButtons( LWidget* widget, std::vector<LButton*>& buttons )
+{
+    // Hidden buttons cannot be hit
+    if( !widget->isVisible() )
+    {
+        return;
+    }
+
+    if( widget->getButton() != NULL )
+    {
+        buttons.push_back( widget->getButton() );
+    }
+    for( int i = 0; i < widget->getChildCount(); ++i )
+    {
+        collectButtons( widget->getChild( i ), buttons );
+    }
+}
+
+void LWidgetTree::refreshDrawList()
+{
+    // Labels in the draw list may point at glyphs that were thrown out since, laying them out again finds them anew
+    if( gGlyphs.getEvictionCount() != mGlyphEvictions )
+    {
+        mGlyphEvictions = gGlyphs.getEvictionCount();
+        mRoot.invalidateDraw();
+    }
+
+    if( mRoot.needsDraw() )
+    {
+        mDrawList.clear();
+        mRoot.draw( mDrawList );
+    }
+}
+
+void LButton::render()
+{
+    // Show current button sprite
+    gButtonSpriteSheetTexture.render( mPosition.x, mPosition.y, &gSpriteClips[ mCurrentSprite ] );
+}
+
+Dot::Dot()
+{
+    // Constructor
+
+    // Initialize the offsets
+    mPosX = 0;
+    mPosY = 0;
+    mPrevPosX = 0;
+    mPrevPosY = 0;
+
+    // Set collision box dimension
+    mCollider.x = 0;
+    mCollider.y = 0;
+    mCollider.w = DOT_WIDTH;
+    mCollider.h = DOT_HEIGHT;
+
+    // Initialize the velocity
+    mVelX = 0;
+    mVelY = 0;
+}
+
+Dot::Dot( int x, int y )
+{
+    // Initialize the offsets
+    mPosX = x;
+    mPosY = y;
+    mPrevPosX = x;
+    mPrevPosY = y;
+
+    // Set collision box dimension and position
+    mCollider.x = x;
+    mCollider.y = y;
+    mCollider.w = DOT_WIDTH;
+    mCollider.h = DOT_HEIGHT;
+
+    // Initialize the velocity
+    mVelX = 0;
+    mVelY = 0;
+}
+
+void Dot::handleEvent( SDL_Event& e )
+{
+    // if a key was pressed
+    if( e.type == SDL_KEYDOWN && e.key.repeat == 0 )
+    {
+        // Adjust the velocity
+        switch( e.key.keysym.sym )
+        {
+            case SDLK_UP: mVelY -= DOT_VEL; break;
+            case SDLK_DOWN: mVelY += DOT_VEL; break;
+            case SDLK_LEFT: mVelX -= DOT_VEL; break;
+            case SDLK_RIGHT: mVelX += DOT_VEL; break;
+        }
+    }
+
+    // If a key was released
+    else if( e.type == SDL_KEYUP && e.key.repeat == 0 )
+    {
+        // Adjust the velocity
+        switch( e.key.keysym.sym )
+        {
+            case SDLK_UP: mVelY += DOT_VEL; break;
+            case SDLK_DOWN: mVelY -= DOT_VEL; break;
+            case SDLK_LEFT: mVelX += DOT_VEL; break;
+            case SDLK_RIGHT: mVelX -= DOT_VEL; break;
+        }
+    }
+}
+
+void Dot::move( SDL_Rect& wall )
+{
+    moveUnless( [ &wall ]( SDL_Rect& collider ) { return checkCollision( collider, wall ); } );
+}
+
+void Dot::move( std::vector<SDL_Rect>& walls )
+{
+    moveUnless( [ &walls ]( SDL_Rect& collider )
+    {
+        for( int i = 0; i < (int)walls.size(); ++i )
+        {
+            if( checkCollision( collider, walls[ i ] ) )
+            {
+                return true;
+            }
+        }
+        return false;
+    } );
+}
+
+void Dot::move( LRectBlock& walls )
+{
+    moveUnless( [ &walls ]( SDL_Rect& collider ) { return checkCollisionAny( collider, walls ); } );
+}
+
+void Dot::move( LCollisionWorld& world, int colliderId )
+{
+    moveUnless( [ &world ]( SDL_Rect& collider ) { return world.hitsWall( collider ); } );
+    world.updateCollider( colliderId, mCollider );
+}
+
+template <typename Blocked>
+void Dot::moveUnless( Blocked blocked )
+{
+    // Remember where the dot was for interpolation
+    mPrevPosX = mPosX;
+    mPrevPosY = mPosY;
+
+    // Move the dot left or right
+    mPosX += mVelX;
+    mCollider.x = mPosX;
+
+    // If the dot collided or went too far right or left
+    if( ( mPosX < 0 ) || ( mPosX + DOT_WIDTH > SCREEN_WIDTH ) || blocked( mCollider ) )
+    {
+        // Move back
+        mPosX -= mVelX;
+        mCollider.x = mPosX;
+    }
+
+    // Move the dot up or down
+    mPosY += mVelY;
+    mCollider.y = mPosY;
+
+    // If the dot went too far up or down
+    if( ( mPosY < 0 ) || ( mPosY + DOT_HEIGHT > SCREEN_HEIGHT ) || blocked( mCollider ) )
+    {
+        // Move back
+        mPosY -= mVelY;
+        mCollider.y = mPosY;
+    }
+}
+
+void Dot::render()
+{
+    // Show the dot
+    gDotTexture.render( mPosX, mPosY );
+}
+
+void Dot::render( LSpriteBatch& batch )
+{
+    // Queue the dot, it is drawn when the batch ends
+    batch.draw( gDotTexture, mPosX, mPosY );
+}
+
+void Dot::render( LSpriteBatch& batch, double alpha )
+{
+    // Blend previous and current tick positions
+    int x = (int)lround( mPrevPosX + ( mPosX - mPrevPosX ) * alpha );
+    int y = (int)lround( mPrevPosY + ( mPosY - mPrevPosY ) * alpha );
+    batch.draw( gDotTexture, x, y );
+}
+
+void Dot::setVelocity( int velX, int velY )
+{
+    mVelX = velX;
+    mVelY = velY;
+}
+
+SDL_Rect Dot::getCollider()
+{
+    return mCollider;
+}
+
+int Dot::getPosX()
+{
+    return mPosX;
+}
+
+int Dot::getPosY()
+{
+    return mPosY;
+}
+
+bool Dot::isMoving()
+{
+    return mVelX != 0 || mVelY != 0;
+}
+
+int DotSystem::add( int x, int y, int velX, int velY )
+{
+    SDL_Rect collider = { x, y, Dot::DOT_WIDTH, Dot::DOT_HEIGHT };
+    mColliders.add( collider );
+    mVelX.push_back( velX );
+    mVelY.push_back( velY );
+    mPrevious.push_back( 0 );
+    return mVelX.size() - 1;
+}
+
+void DotSystem::clear()
+{
+    mColliders.clear();
+    mVelX.clear();
+    mVelY.clear();
+    mPrevious.clear();
+}
+
+int DotSystem::size()
+{
+    return mVelX.size();
+}
+
+bool DotSystem::isMoving()
+{
+    for( int i = 0; i < (int)mVelX.size(); ++i )
+    {
+        if( mVelX[ i ] != 0 || mVelY[ i ] != 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DotSystem::move()
+{
+    move( 0, size() );
+}
+
+// Moves a range of dots held in side arrays, with restrict pointers and no branches so the compiler can vectorize it
+static void moveDotRange( int* __restrict left, int* __restrict right, int* __restrict top, int* __restrict bottom,
+                          const int* __restrict velX, const int* __restrict velY, int first, int last )
+{
+    for( int i = first; i < last; ++i )
+    {
+        // Move left or right, keep the old spot if the dot would leave the screen
+        int x = left[ i ] + velX[ i ];
+        x = ( x < 0 || x + Dot::DOT_WIDTH > SCREEN_WIDTH ) ? left[ i ] : x;
+        left[ i ] = x;
+        right[ i ] = x + Dot::DOT_WIDTH;
+
+        // Move up or down the same way
+        int y = top[ i ] + velY[ i ];
+        y = ( y < 0 || y + Dot::DOT_HEIGHT > SCREEN_HEIGHT ) ? top[ i ] : y;
+        top[ i ] = y;
+        bottom[ i ] = y + Dot::DOT_HEIGHT;
+    }
+}
+
+void DotSystem::move( int first, int last )
+{
+    if( first >= last )
+    {
+        return;
+    }
+
+    moveDotRange( &mColliders.left[ 0 ], &mColliders.right[ 0 ], &mColliders.top[ 0 ], &mColliders.bottom[ 0 ],
+                  &mVelX[ 0 ], &mVelY[ 0 ], first, last );
+}
+
+// Moves one axis of a range of dots, same idea as moveDotRange, keeping the old positions for moving back
+static void moveDotAxis( int* __restrict position, int* __restrict end, int* __restrict previous, const int* __restrict velocity,
+                         int size, int limit, int first, int last )
+{
+    for( int i = first; i < last; ++i )
+    {
+        int p = position[ i ] + velocity[ i ];
+        previous[ i ] = position[ i ];
+        p = ( p < 0 || p + size > limit ) ? position[ i ] : p;
+        position[ i ] = p;
+        end[ i ] = p + size;
+    }
+}
+
+void DotSystem::move( int first, int last, const LRectBlock& walls )
+{
+    if( first >= last )
+    {
+        return;
+    }
+
+    // Same order as Dot::move: left or right first, back off if that hits a wall, then up or down
+    for( int axis = 0; axis < 2; ++axis )
+    {
+        std::vector<int>& position = axis == 0 ? mColliders.left : mColliders.top;
+        std::vector<int>& end = axis == 0 ? mColliders.right : mColliders.bottom;
+        std::vector<int>& velocity = axis == 0 ? mVelX : mVelY;
+        int size = axis == 0 ? Dot::DOT_WIDTH : Dot::DOT_HEIGHT;
+        int limit = axis == 0 ? SCREEN_WIDTH : SCREEN_HEIGHT;
+
+        moveDotAxis( &position[ 0 ], &end[ 0 ], &mPrevious[ 0 ], &velocity[ 0 ], size, limit, first, last );
+
+        // Test each wall against 32 dots at a time
+        for( int block = first; block < last; block += RECT_BLOCK_MASK_BITS )
+        {
+            Uint32 hits = 0;
+            for( int w = 0; w < walls.size(); ++w )
+            {
+                SDL_Rect wall = { walls.left[ w ], walls.top[ w ], walls.right[ w ] - walls.left[ w ], walls.bottom[ w ] - walls.top[ w ] };
+                hits |= checkCollision( wall, mColliders, block );
+            }
+
+            // Ignore dots past the end of the range
+            if( last - block < RECT_BLOCK_MASK_BITS )
+            {
+                hits &= ( 1u << ( last - block ) ) - 1;
+            }
+
+            for( ; hits != 0; hits &= hits - 1 )
+            {
+                int i = block + __builtin_ctz( hits );
+                position[ i ] = mPrevious[ i ];
+                end[ i ] = mPrevious[ i ] + size;
+            }
+        }
+    }
+}
+
+void DotSystem::getPositions( std::vector<SDL_Point>& positions, int first, int last )
+{
+    for( int i = first; i < last; ++i )
+    {
+        positions[ i ].x = mColliders.left[ i ];
+        positions[ i ].y = mColliders.top[ i ];
+    }
+}
+
+void DotSystem::render( LSpriteBatch& batch )
+{
+    for( int i = 0; i < size(); ++i )
+    {
+        batch.draw( gDotTexture, mColliders.left[ i ], mColliders.top[ i ] );
+    }
+}
+
+int DotSystem::getPosX( int i )
+{
+    return mColliders.left[ i ];
+}
+
+int DotSystem::getPosY( int i )
+{
+    return mColliders.top[ i ];
+}
+
+const LRectBlock& DotSystem::getColliders()
+{
+    return mColliders;
+}
+
+LJobSystem::LJobSystem()
+{
+    mQueuedJobs = 0;
+    mSleepingWorkers = 0;
+    mSleepingWaiters = 0;
+    mRunning = false;
+}
+
+LJobSystem::~LJobSystem()
+{
+    stop();
+}
+
+bool LJobSystem::start( int workers )
+{
+    stop();
+
+    // Leave a hardware thread for the caller, which also runs jobs while it waits
+    if( workers <= 0 )
+    {
+        workers = std::max( 1, SDL_GetCPUCount() - 1 );
+    }
+
+    mQueues.push_back( new Queue );
+    for( int i = 0; i < workers; ++i )
+    {
+        mQueues.push_back( new Queue );
+    }
+
+    mRunning = true;
+    for( int i = 0; i < workers; ++i )
+    {
+        mThreads.push_back( std::thread( &LJobSystem::workerLoop, this, i + 1 ) );
+    }
+    return true;
+}
+
+void LJobSystem::stop()
+{
+    // Wake everyone up to notice we are done
+    {
+        std::lock_guard<std::mutex> lock( mSleepLock );
+        mRunning = false;
+    }
+    mWake.notify_all();
+
+    for( int i = 0; i < (int)mThreads.size(); ++i )
+    {
+        mThreads[ i ].join();
+    }
+    mThreads.clear();
+
+    // Anything still queued runs here, so no counter is left waiting
+    while( !mQueues.empty() && runOne( 0 ) )
+    {
+    }
+
+    for( int i = 0; i < (int)mQueues.size(); ++i )
+    {
+        delete mQueues[ i ];
+    }
+    mQueues.clear();
+}
+
+void LJobSystem::run( std::function<void()> job, LJobCounter* counter )
+{
+    if( counter != NULL )
+    {
+        ++*counter;
+    }
+
+    // No workers, just run it
+    if( mQueues.empty() )
+    {
+        job();
+        if( counter != NULL )
+        {
+            --*counter;
+        }
+        return;
+    }
+
+    Job queued;
+    queued.function = job;
+    queued.counter = counter;
+    {
+        Queue* queue = mQueues[ tJobQueue ];
+        std::lock_guard<std::mutex> lock( queue->lock );
+        queue->jobs.push_back( queued );
+    }
+    ++mQueuedJobs;
+
+    // Only pay for the wake up when someone is asleep, a waiter may want to help with it
+    if( mSleepingWorkers > 0 )
+    {
+        {
+            std::lock_guard<std::mutex> lock( mSleepLock );
+        }
+        mWake.notify_one();
+    }
+    if( mSleepingWaiters > 0 )
+    {
+        {
+            std::lock_guard<std::mutex> lock( mSleepLock );
+        }
+        mJobDone.notify_all();
+    }
+}
+
+void LJobSystem::wait( LJobCounter& counter )
+{
+    // Help out instead of blocking, and once there has been nothing to help with for a while sleep until a job finishes
+    Uint64 spinTicks = (Uint64)( JOB_SPIN_SECONDS * SDL_GetPerformanceFrequency() );
+    Uint64 idleSince = 0;
+    while( counter > 0 )
+    {
+        if( !mQueues.empty() && runOne( tJobQueue ) )
+        {
+            idleSince = 0;
+        }
+        else if( idleSince == 0 )
+        {
+            idleSince = SDL_GetPerformanceCounter();
+        }
+        else if( SDL_GetPerformanceCounter() - idleSince < spinTicks || mQueues.empty() )
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock( mSleepLock );
+            ++mSleepingWaiters;
+            mJobDone.wait( lock, [ this, &counter ]() { return counter <= 0 || mQueuedJobs > 0; } );
+            --mSleepingWaiters;
+            idleSince = 0;
+        }
+    }
+}
+
+void LJobSystem::parallelFor( int count, int chunk, std::function<void( int, int )> body )
+{
+    LJobCounter counter( 0 );
+    for( int first = 0; first < count; first += chunk )
+    {
+        int last = std::min( count, first + chunk );
+        run( [ &body, first, last ]() { body( first, last ); }, &counter );
+    }
+    wait( counter );
+}
+
+int LJobSystem::getWorkerCount()
+{
+    return mThreads.size();
+}
+
+bool LJobSystem::runOne( int queueIndex )
+{
+    Job job;
+    bool found = false;
+
+    // Newest job from our own queue first, it is most likely still in cache
+    {
+        Queue* queue = mQueues[ queueIndex ];
+        std::lock_guard<std::mutex> lock( queue->lock );
+        if( !queue->jobs.empty() )
+        {
+            job = queue->jobs.back();
+            queue->jobs.pop_back();
+            found = true;
+        }
+    }
+
+    // Otherwise steal the oldest job of another queue
+    for( int i = 1; !found && i < (int)mQueues.size(); ++i )
+    {
+        Queue* queue = mQueues[ ( queueIndex + i ) % mQueues.size() ];
+        std::lock_guard<std::mutex> lock( queue->lock );
+        if( !queue->jobs.empty() )
+        {
+            job = queue->jobs.front();
+            queue->jobs.pop_front();
+            found = true;
+        }
+    }
+
+    if( !found )
+    {
+        return false;
+    }
+
+    --mQueuedJobs;
+    job.function();
+    if( job.counter != NULL )
+    {
+        --*job.counter;
+
+        // The waiter counts itself asleep before it looks at the counter, so one of the two always sees the other
+        if( mSleepingWaiters > 0 )
+        {
+            {
+                std::lock_guard<std::mutex> lock( mSleepLock );
+            }
+            mJobDone.notify_all();
+        }
+    }
+    return true;
+}
+
+void LJobSystem::workerLoop( int queueIndex )
+{
+    tJobQueue = queueIndex;
+    Uint64 spinTicks = (Uint64)( JOB_SPIN_SECONDS * SDL_GetPerformanceFrequency() );
+    Uint64 idleSince = 0;
+    while( mRunning )
+    {
+        if( runOne( queueIndex ) )
+        {
+            idleSince = 0;
+            continue;
+        }
+
+        // Jobs often come in bursts, so look again for a moment before paying for a wake up
+        if( idleSince == 0 )
+        {
+            idleSince = SDL_GetPerformanceCounter();
+        }
+        if( SDL_GetPerformanceCounter() - idleSince < spinTicks )
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Nothing to do, sleep until a job is queued
+        idleSince = 0;
+        std::unique_lock<std::mutex> lock( mSleepLock );
+        ++mSleepingWorkers;
+        mWake.wait( lock, [ this ]() { return !mRunning || mQueuedJobs > 0; } );
+        --mSleepingWorkers;
+    }
+}
+
+LAssetLoader::LAssetLoader()
+{
+    mReadyCount = 0;
+    mArchive = NULL;
+    mCache = NULL;
+}
+
+LAssetLoader::~LAssetLoader()
+{
+    free();
+}
+
+int LAssetLoader::loadImage( std::string path )
+{
+    int handle = add( path, false );
+    start( handle );
+    return handle;
+}
+
+int LAssetLoader::loadSound( std::string path )
+{
+    int handle = add( path, true );
+
+    // Convert to whatever the mixer was opened with, or its defaults when it is not open
+    Asset& asset = mAssets[ handle ];
+    if( Mix_QuerySpec( &asset.frequency, &asset.format, &asset.channels ) == 0 )
+    {
+        asset.frequency = MIX_DEFAULT_FREQUENCY;
+        asset.format = MIX_DEFAULT_FORMAT;
+        asset.channels = MIX_DEFAULT_CHANNELS;
+    }
+
+    start( handle );
+    return handle;
+}
+
+bool LAssetLoader::wait( int handle )
+{
+    Asset& asset = mAssets[ handle ];
+    gJobs.wait( asset.pending );
+    return !asset.failed;
+}
+
+bool LAssetLoader::waitAll( std::function<void( int, int )> progress )
+{
+    bool success = true;
+    int reported = -1;
+    for( int i = 0; i < (int)mAssets.size(); ++i )
+    {
+        if( !wait( i ) )
+        {
+            success = false;
+        }
+
+        // Assets finish in any order, so report the count rather than which one
+        int ready = mReadyCount;
+        if( progress && ready != reported )
+        {
+            progress( ready, mAssets.size() );
+            reported = ready;
+        }
+    }
+    return success;
+}
+
+SDL_Surface* LAssetLoader::getSurface( int handle )
+{
+    if( !wait( handle ) )
+    {
+        return NULL;
+    }
+    return mAssets[ handle ].surface;
+}
+
+Mix_Chunk* LAssetLoader::takeChunk( int handle )
+{
+    if( !wait( handle ) || mAssets[ handle ].samples == NULL )
+    {
+        return NULL;
+    }
+
+    Asset& asset = mAssets[ handle ];
+    Mix_Chunk* chunk = Mix_QuickLoad_RAW( asset.samples, asset.sampleBytes );
+    if( chunk == NULL )
+    {
+        printf( "Unable to create chunk for %s! SDL_mixer Error: %s\n", asset.path.c_str(), Mix_GetError() );
+        return NULL;
+    }
+
+    // QuickLoad only borrows the samples, marking them allocated makes Mix_FreeChunk free them, archive samples stay borrowed
+    chunk->allocated = asset.ownsSamples ? 1 : 0;
+    asset.samples = NULL;
+    return chunk;
+}
+
+int LAssetLoader::getReadyCount()
+{
+    return mReadyCount;
+}
+
+int LAssetLoader::getCount()
+{
+    return mAssets.size();
+}
+
+double LAssetLoader::getDecodeSeconds( int handle )
+{
+    wait( handle );
+    return mAssets[ handle ].seconds;
+}
+
+bool LAssetLoader::isCached( int handle )
+{
+    wait( handle );
+    return mAssets[ handle ].cached;
+}
+
+void LAssetLoader::setArchive( LAssetArchive* archive )
+{
+    mArchive = archive;
+}
+
+void LAssetLoader::setCache( LSoundCache* cache )
+{
+    mCache = cache;
+}
+
+void LAssetLoader::free()
+{
+    for( int i = 0; i < (int)mAssets.size(); ++i )
+    {
+        wait( i );
+        if( mAssets[ i ].surface != NULL )
+        {
+            SDL_FreeSurface( mAssets[ i ].surface );
+        }
+        if( mAssets[ i ].samples != NULL && mAssets[ i ].ownsSamples )
+        {
+            SDL_free( mAssets[ i ].samples );
+        }
+    }
+    mAssets.clear();
+    mReadyCount = 0;
+}
+
+int LAssetLoader::add( std::string path, bool isSound )
+{
+    mAssets.emplace_back();
+    Asset& asset = mAssets.back();
+    asset.path = path;
+    asset.archive = mArchive;
+    asset.cache = mCache;
+    asset.isSound = isSound;
+    asset.failed = false;
+    asset.seconds = 0.0;
+    asset.surface = NULL;
+    asset.samples = NULL;
+    asset.sampleBytes = 0;
+    asset.ownsSamples = true;
+    asset.cached = false;
+    asset.frequency = 0;
+    asset.format = 0;
+    asset.channels = 0;
+    asset.pending = 0;
+    return mAssets.size() - 1;
+}
+
+void LAssetLoader::start( int handle )
+{
+    Asset* asset = &mAssets[ handle ];
+    gJobs.run( [ this, asset ]()
+    {
+        decode( *asset );
+        ++mReadyCount;
+    }, &asset->pending );
+}
+
+void LAssetLoader::decode( Asset& asset )
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    if( !asset.isSound )
+    {
+        // Pixels packed already decoded are used where they lie in the archive
+        if( asset.archive != NULL )
+        {
+            asset.surface = asset.archive->getPixels( asset.path );
+        }
+
+        // Decoding needs no renderer, so any thread can do it
+        if( asset.surface == NULL )
+        {
+            asset.surface = IMG_Load_RW( openFile( asset ), 1 );
+        }
+        if( asset.surface == NULL )
+        {
+            printf( "Unable to load image %s! SDL_image Error: %s\n", asset.path.c_str(), IMG_GetError() );
+            asset.failed = true;
+        }
+    }
+    else
+    {
+        SDL_AudioSpec spec;
+        Uint8* buffer = NULL;
+        Uint32 length = 0;
+        SDL_AudioCVT converter;
+        const Uint8* packed = NULL;
+        if( asset.archive != NULL )
+        {
+            packed = asset.archive->getSamples( asset.path, asset.frequency, asset.format, asset.channels, &length );
+        }
+
+        // The file is read whole to hash it, samples an earlier run converted from the same bytes are used where they lie
+        std::vector<Uint8> source;
+        Uint64 sourceHash = 0;
+        if( packed == NULL && asset.cache != NULL && readFile( asset, source ) )
+        {
+            sourceHash = hashBytes( &source[ 0 ], source.size() );
+            packed = asset.cache->find( asset.path, sourceHash, asset.frequency, asset.format, asset.channels, &length );
+            asset.cached = packed != NULL;
+        }
+
+        if( packed != NULL )
+        {
+            // Packed or cached in the mixer's format already, played straight from the mapping
+            // Mix_Chunk only takes writable samples, but SDL_mixer never writes them, effects work on a copy
+            asset.samples = (Uint8*)packed;
+            asset.sampleBytes = length;
+            asset.ownsSamples = false;
+        }
+        else if( SDL_LoadWAV_RW( source.empty() ? openFile( asset ) : SDL_RWFromConstMem( &source[ 0 ], source.size() ), 1, &spec, &buffer, &length ) == NULL )
+        {
+            printf( "Unable to load sound %s! SDL Error: %s\n", asset.path.c_str(), SDL_GetError() );
+            asset.failed = true;
+        }
+        else if( SDL_BuildAudioCVT( &converter, spec.format, spec.channels, spec.freq, asset.format, asset.channels, asset.frequency ) < 0 )
+        {
+            printf( "Unable to convert sound %s! SDL Error: %s\n", asset.path.c_str(), SDL_GetError() );
+            SDL_FreeWAV( buffer );
+            asset.failed = true;
+        }
+        else if( converter.needed == 0 )
+        {
+            // Already in the mixer's format
+            asset.samples = buffer;
+            asset.sampleBytes = length;
+        }
+        else
+        {
+            // Converting happens in place, in a buffer big enough for the largest intermediate step
+            converter.len = length;
+            converter.buf = (Uint8*)SDL_malloc( length * converter.len_mult );
+            if( converter.buf == NULL )
+            {
+                printf( "Unable to convert sound %s! Out of memory\n", asset.path.c_str() );
+                asset.failed = true;
+            }
+            else
+            {
+                SDL_memcpy( converter.buf, buffer, length );
+                if( SDL_ConvertAudio( &converter ) < 0 )
+                {
+                    printf( "Unable to convert sound %s! SDL Error: %s\n", asset.path.c_str(), SDL_GetError() );
+                    SDL_free( converter.buf );
+                    asset.failed = true;
+                }
+                else
+                {
+                    asset.samples = converter.buf;
+                    asset.sampleBytes = converter.len_cvt;
+                }
+            }
+            SDL_FreeWAV( buffer );
+        }
+
+        // Converted for the first time with this device, so the next run does not have to
+        if( !source.empty() && !asset.cached && !asset.failed )
+        {
+            asset.cache->store( asset.path, sourceHash, asset.frequency, asset.format, asset.channels, asset.samples, asset.sampleBytes );
+        }
+    }
+
+    asset.seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+}
+
+SDL_RWops* LAssetLoader::openFile( Asset& asset )
+{
+    SDL_RWops* file = NULL;
+    if( asset.archive != NULL )
+    {
+        file = asset.archive->openFile( asset.path );
+    }
+    if( file == NULL )
+    {
+        file = SDL_RWFromFile( asset.path.c_str(), "rb" );
+    }
+    return file;
+}
+
+bool LAssetLoader::readFile( Asset& asset, std::vector<Uint8>& bytes )
+{
+    SDL_RWops* file = openFile( asset );
+    if( file == NULL )
+    {
+        return false;
+    }
+
+    Sint64 size = SDL_RWsize( file );
+    bytes.resize( std::max( (Sint64)0, size ) );
+    bool success = !bytes.empty() && SDL_RWread( file, &bytes[ 0 ], bytes.size(), 1 ) == 1;
+    SDL_RWclose( file );
+    if( !success )
+    {
+        bytes.clear();
+    }
+    return success;
+}
+
+LAssetArchive::LAssetArchive()
+{
+    mData = NULL;
+    mSize = 0;
+    mMapped = false;
+    mEntries = NULL;
+}
+
+LAssetArchive::~LAssetArchive()
+{
+    free();
+}
+
+bool LAssetArchive::open( std::string path )
+{
+    free();
+
+    #ifdef HAVE_MMAP
+    int file = ::open( path.c_str(), O_RDONLY );
+    if( file < 0 )
+    {
+        printf( "Unable to open archive %s! %s\n", path.c_str(), strerror( errno ) );
+        return false;
+    }
+    struct stat info;
+    void* data = MAP_FAILED;
+    if( fstat( file, &info ) == 0 && info.st_size > 0 )
+    {
+        // Read only, nothing taken from it is written, SDL only reads surface pixels and SDL_mixer chunk samples
+        mSize = info.st_size;
+        data = mmap( NULL, mSize, PROT_READ, MAP_PRIVATE, file, 0 );
+    }
+    ::close( file );
+    if( data == MAP_FAILED )
+    {
+        printf( "Unable to map archive %s! %s\n", path.c_str(), strerror( errno ) );
+        mSize = 0;
+        return false;
+    }
+    mData = (Uint8*)data;
+    mMapped = true;
+    #else
+    SDL_RWops* file = SDL_RWFromFile( path.c_str(), "rb" );
+    if( file == NULL )
+    {
+        printf( "Unable to open archive %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+        return false;
+    }
+    mSize = SDL_RWsize( file );
+    mData = (Uint8*)SDL_malloc( mSize );
+    if( mData == NULL || SDL_RWread( file, mData, mSize, 1 ) != 1 )
+    {
+        printf( "Unable to read archive %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+        SDL_RWclose( file );
+        free();
+        return false;
+    }
+    SDL_RWclose( file );
+    #endif
+
+    // Check the header and that every blob is inside the file before trusting any of it
+    const LArchiveHeader* header = (const LArchiveHeader*)mData;
+    bool valid = mSize >= sizeof( LArchiveHeader ) && memcmp( header->magic, ARCHIVE_MAGIC, sizeof( header->magic ) ) == 0 &&
+                 header->version == ARCHIVE_VERSION &&
+                 header->entryCount <= ( mSize - sizeof( LArchiveHeader ) ) / sizeof( LArchiveEntry );
+    if( valid )
+    {
+        mEntries = (const LArchiveEntry*)( mData + sizeof( LArchiveHeader ) );
+        for( Uint32 i = 0; i < header->entryCount && valid; ++i )
+        {
+            const LArchiveEntry& entry = mEntries[ i ];
+            valid = memchr( entry.name, 0, ARCHIVE_NAME_LENGTH ) != NULL &&
+                    entry.fileOffset <= mSize && entry.fileSize <= mSize - entry.fileOffset &&
+                    entry.decodedOffset <= mSize && entry.decodedSize <= mSize - entry.decodedOffset;
+            if( valid && entry.decoded == ARCHIVE_DECODED_PIXELS )
+            {
+                valid = entry.pitch >= entry.width * 4 && (Uint64)entry.pitch * entry.height <= entry.decodedSize;
+            }
+            mIndex[ entry.name ] = i;
+        }
+    }
+    if( !valid )
+    {
+        printf( "%s is not a valid archive!\n", path.c_str() );
+        free();
+        return false;
+    }
+
+    return true;
+}
+
+void LAssetArchive::free()
+{
+    if( mData != NULL )
+    {
+        #ifdef HAVE_MMAP
+        if( mMapped )
+        {
+            munmap( mData, mSize );
+        }
+        else
+        #endif
+        {
+            SDL_free( mData );
+        }
+    }
+    mData = NULL;
+    mSize = 0;
+    mMapped = false;
+    mEntries = NULL;
+    mIndex.clear();
+}
+
+bool LAssetArchive::isOpen()
+{
+    return mData != NULL;
+}
+
+const LArchiveEntry* LAssetArchive::find( std::string name )
+{
+    std::map<std::string, int>::iterator found = mIndex.find( name );
+    if( found == mIndex.end() )
+    {
+        return NULL;
+    }
+    return &mEntries[ found->second ];
+}
+
+SDL_RWops* LAssetArchive::openFile( std::string name )
+{
+    const LArchiveEntry* entry = find( name );
+    if( entry == NULL )
+    {
+        return NULL;
+    }
+    return SDL_RWFromConstMem( mData + entry->fileOffset, entry->fileSize );
+}
+
+SDL_Surface* LAssetArchive::getPixels( std::string name )
+{
+    const LArchiveEntry* entry = find( name );
+    if( entry == NULL || entry->decoded != ARCHIVE_DECODED_PIXELS )
+    {
+        return NULL;
+    }
+
+    // The surface points into the mapping, SDL_FreeSurface leaves pixels it did not allocate alone
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom( mData + entry->decodedOffset, entry->width, entry->height,
+                                                               32, entry->pitch, SDL_PIXELFORMAT_RGBA32 );
+    if( surface == NULL )
+    {
+        printf( "Unable to create surface for %s! SDL Error: %s\n", name.c_str(), SDL_GetError() );
+    }
+    return surface;
+}
+
+const Uint8* LAssetArchive::getSamples( std::string name, int frequency, Uint16 format, int channels, Uint32* length )
+{
+    const LArchiveEntry* entry = find( name );
+    if( entry == NULL || entry->decoded != ARCHIVE_DECODED_SAMPLES )
+    {
+        return NULL;
+    }
+
+    // Only usable when the mixer was opened the way the packer assumed
+    if( frequency != ARCHIVE_SAMPLE_FREQUENCY || format != ARCHIVE_SAMPLE_FORMAT || channels != ARCHIVE_SAMPLE_CHANNELS )
+    {
+        return NULL;
+    }
+
+    *length = entry->decodedSize;
+    return mData + entry->decodedOffset;
+}
+
+LSoundCache::LSoundCache()
+{
+}
+
+LSoundCache::~LSoundCache()
+{
+    free();
+}
+
+void LSoundCache::setDirectory( std::string directory )
+{
+    mDirectory = directory;
+
+    // Where there is no mkdir the directory has to be there already
+    #ifdef HAVE_MMAP
+    if( !mDirectory.empty() && mkdir( mDirectory.c_str(), 0755 ) != 0 && errno != EEXIST )
+    {
+        printf( "Unable to create sound cache %s! %s\n", mDirectory.c_str(), strerror( errno ) );
+    }
+    #endif
+}
+
+bool LSoundCache::isEnabled()
+{
+    return !mDirectory.empty();
+}
+
+const Uint8* LSoundCache::find( std::string source, Uint64 sourceHash, int frequency, Uint16 format, int channels, Uint32* length )
+{
+    if( mDirectory.empty() )
+    {
+        return NULL;
+    }
+
+    // One mapping or one read, nothing is converted
+    std::string path = getPath( source, sourceHash, frequency, format, channels );
+    Mapping mapping;
+    mapping.data = NULL;
+    mapping.size = 0;
+    mapping.mapped = false;
+    #ifdef HAVE_MMAP
+    int file = ::open( path.c_str(), O_RDONLY );
+    if( file >= 0 )
+    {
+        // Read only like the archive, SDL_mixer only reads chunk samples
+        struct stat info;
+        if( fstat( file, &info ) == 0 && info.st_size > 0 )
+        {
+            void* data = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0 );
+            if( data != MAP_FAILED )
+            {
+                mapping.data = (Uint8*)data;
+                mapping.size = info.st_size;
+                mapping.mapped = true;
+            }
+        }
+        ::close( file );
+    }
+    #else
+    SDL_RWops* file = SDL_RWFromFile( path.c_str(), "rb" );
+    if( file != NULL )
+    {
+        mapping.size = SDL_RWsize( file );
+        mapping.data = (Uint8*)SDL_malloc( mapping.size );
+        if( mapping.data != NULL && SDL_RWread( file, mapping.data, mapping.size, 1 ) != 1 )
+        {
+            SDL_free( mapping.data );
+            mapping.data = NULL;
+        }
+        SDL_RWclose( file );
+    }
+    #endif
+    if( mapping.data == NULL )
+    {
+        return NULL;
+    }
+
+    // A file from another version, damaged or cut short counts as missing and is written again
+    const LSoundCacheHeader* header = (const LSoundCacheHeader*)mapping.data;
+    bool valid = mapping.size >= sizeof( LSoundCacheHeader ) && memcmp( header->magic, SOUND_CACHE_MAGIC, sizeof( header->magic ) ) == 0 &&
+                 header->version == SOUND_CACHE_VERSION && header->sourceHash == sourceHash && (int)header->frequency == frequency &&
+                 header->format == format && header->channels == channels && header->sampleBytes == mapping.size - sizeof( LSoundCacheHeader );
+    if( !valid )
+    {
+        release( mapping );
+        return NULL;
+    }
+
+    *length = header->sampleBytes;
+    {
+        std::lock_guard<std::mutex> lock( mLock );
+        mMappings.push_back( mapping );
+        mFiles.insert( path );
+    }
+    return mapping.data + sizeof( LSoundCacheHeader );
+}
+
+bool LSoundCache::store( std::string source, Uint64 sourceHash, int frequency, Uint16 format, int channels, const Uint8* samples, Uint32 length )
+{
+    if( mDirectory.empty() )
+    {
+        return false;
+    }
+
+    LSoundCacheHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, SOUND_CACHE_MAGIC, sizeof( header.magic ) );
+    header.version = SOUND_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.frequency = frequency;
+    header.format = format;
+    header.channels = channels;
+    header.sampleBytes = length;
+
+    // Written under another name and then renamed, so a crash or a second copy of the game never leaves half a file
+    std::string path = getPath( source, sourceHash, frequency, format, channels );
+    char suffix[ 32 ];
+    snprintf( suffix, sizeof( suffix ), ".%zx.tmp", std::hash<std::thread::id>()( std::this_thread::get_id() ) );
+    std::string temporary = path + suffix;
+    FILE* file = fopen( temporary.c_str(), "wb" );
+    if( file == NULL )
+    {
+        printf( "Unable to write sound cache %s! %s\n", temporary.c_str(), strerror( errno ) );
+        return false;
+    }
+    bool success = fwrite( &header, sizeof( header ), 1, file ) == 1 && ( length == 0 || fwrite( samples, length, 1, file ) == 1 );
+    success = fclose( file ) == 0 && success;
+
+    // Renaming over a file fails on some systems
+    if( success && rename( temporary.c_str(), path.c_str() ) != 0 )
+    {
+        remove( path.c_str() );
+        success = rename( temporary.c_str(), path.c_str() ) == 0;
+    }
+    if( !success )
+    {
+        printf( "Unable to write sound cache %s! %s\n", path.c_str(), strerror( errno ) );
+        remove( temporary.c_str() );
+        return false;
+    }
+
+    removeStale( source, sourceHash );
+    std::lock_guard<std::mutex> lock( mLock );
+    mFiles.insert( path );
+    return true;
+}
+
+void LSoundCache::free()
+{
+    std::lock_guard<std::mutex> lock( mLock );
+    for( int i = 0; i < (int)mMappings.size(); ++i )
+    {
+        release( mMappings[ i ] );
+    }
+    mMappings.clear();
+}
+
+void LSoundCache::clear()
+{
+    free();
+    std::lock_guard<std::mutex> lock( mLock );
+    for( std::set<std::string>::iterator file = mFiles.begin(); file != mFiles.end(); ++file )
+    {
+        remove( file->c_str() );
+    }
+    mFiles.clear();
+}
+
+std::string LSoundCache::getPrefix( std::string source )
+{
+    char prefix[ 32 ];
+    snprintf( prefix, sizeof( prefix ), "%016llx-", (unsigned long long)hashBytes( source.data(), source.size() ) );
+    return prefix;
+}
+
+std::string LSoundCache::getPath( std::string source, Uint64 sourceHash, int frequency, Uint16 format, int channels )
+{
+    char name[ 64 ];
+    snprintf( name, sizeof( name ), "%016llx-%d-%04x-%d.pcm", (unsigned long long)sourceHash, frequency, format, channels );
+    return mDirectory + "/" + getPrefix( source ) + name;
+}
+
+void LSoundCache::removeStale( std::string source, Uint64 sourceHash )
+{
+    // Where the directory cannot be listed, old files stay until the cache is cleared by hand
+    #ifdef HAVE_MMAP
+    std::string prefix = getPrefix( source );
+    char hash[ 32 ];
+    snprintf( hash, sizeof( hash ), "%016llx-", (unsigned long long)sourceHash );
+    std::string current = prefix + hash;
+
+    DIR* directory = opendir( mDirectory.c_str() );
+    if( directory == NULL )
+    {
+        return;
+    }
+    std::vector<std::string> stale;
+    for( struct dirent* entry = readdir( directory ); entry != NULL; entry = readdir( directory ) )
+    {
+        std::string name = entry->d_name;
+        if( name.compare( 0, prefix.size(), prefix ) == 0 && name.compare( 0, current.size(), current ) != 0 && name.find( ".tmp" ) == std::string::npos )
+        {
+            stale.push_back( mDirectory + "/" + name );
+        }
+    }
+    closedir( directory );
+
+    // Mapped ones stay readable until unmapped
+    std::lock_guard<std::mutex> lock( mLock );
+    for( int i = 0; i < (int)stale.size(); ++i )
+    {
+        remove( stale[ i ].c_str() );
+        mFiles.erase( stale[ i ] );
+    }
+    #endif
+}
+
+void LSoundCache::release( const Mapping& mapping )
+{
+    #ifdef HAVE_MMAP
+    if( mapping.mapped )
+    {
+        munmap( mapping.data, mapping.size );
+        return;
+    }
+    #endif
+    SDL_free( mapping.data );
+}
+
+LHotReloader::LHotReloader()
+{
+    mNotify = -1;
+}
+
+LHotReloader::~LHotReloader()
+{
+    stop();
+}
+
+bool LHotReloader::start( std::string directory )
+{
+    stop();
+    mDirectory = directory;
+
+    #ifdef __linux__
+    // Non-blocking, so update() can check every frame without stalling
+    mNotify = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+    if( mNotify < 0 )
+    {
+        printf( "Unable to start inotify! %s\n", strerror( errno ) );
+        return false;
+    }
+
+    // Editors either write the file or write a new one and rename it over the old
+    if( inotify_add_watch( mNotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO ) < 0 )
+    {
+        printf( "Unable to watch %s! %s\n", directory.c_str(), strerror( errno ) );
+        close( mNotify );
+        mNotify = -1;
+        return false;
+    }
+    return true;
+    #else
+    printf( "Hot reload needs inotify, which this platform does not have\n" );
+    return false;
+    #endif
+}
+
+void LHotReloader::stop()
+{
+    #ifdef __linux__
+    if( mNotify >= 0 )
+    {
+        close( mNotify );
+    }
+    #endif
+    mNotify = -1;
+
+    freeRetiredChunks( true );
+    mWatched.clear();
+    mBindings.clear();
+}
+
+void LHotReloader::watchImage( std::string path, LTextureAtlas& atlas, std::string name )
+{
+    Watched watched;
+    watched.path = path;
+    watched.atlas = &atlas;
+    watched.name = name;
+    watched.chunk = NULL;
+    watched.sound = NULL;
+    watched.player = NULL;
+    mWatched.push_back( watched );
+}
+
+void LHotReloader::watchTexture( LTexture& texture, std::string name )
+{
+    Binding binding;
+    binding.texture = &texture;
+    binding.name = name;
+    mBindings.push_back( binding );
+}
+
+void LHotReloader::watchSound( std::string path, Mix_Chunk** chunk, LSound* sound )
+{
+    Watched watched;
+    watched.path = path;
+    watched.atlas = NULL;
+    watched.chunk = chunk;
+    watched.sound = sound;
+    watched.player = NULL;
+    mWatched.push_back( watched );
+}
+
+void LHotReloader::watchMusic( std::string path, LMusicPlayer* player )
+{
+    Watched watched;
+    watched.path = path;
+    watched.atlas = NULL;
+    watched.chunk = NULL;
+    watched.sound = NULL;
+    watched.player = player;
+    mWatched.push_back( watched );
+}
+
+int LHotReloader::update()
+{
+    freeRetiredChunks( false );
+
+    std::set<std::string> changed;
+    readChanges( changed );
+    if( changed.empty() )
+    {
+        return 0;
+    }
+
+    // Decode every changed file at once on the job system, anything not in the list is left alone
+    Uint64 start = SDL_GetPerformanceCounter();
+    LAssetLoader loader;
+    if( gSoundCache.isEnabled() )
+    {
+        loader.setCache( &gSoundCache );
+    }
+    std::vector<int> handles( mWatched.size(), -1 );
+    for( int i = 0; i < (int)mWatched.size(); ++i )
+    {
+        if( changed.count( mWatched[ i ].path ) == 0 )
+        {
+            continue;
+        }
+        if( mWatched[ i ].atlas != NULL )
+        {
+            handles[ i ] = loader.loadImage( mWatched[ i ].path );
+        }
+        else if( mWatched[ i ].chunk != NULL )
+        {
+            handles[ i ] = loader.loadSound( mWatched[ i ].path );
+        }
+    }
+    loader.waitAll();
+
+    // Swap them in, an asset that fails to load keeps its old version
+    int reloaded = 0;
+    for( int i = 0; i < (int)mWatched.size(); ++i )
+    {
+        Watched& watched = mWatched[ i ];
+        if( changed.count( watched.path ) == 0 )
+        {
+            continue;
+        }
+
+        if( watched.atlas != NULL )
+        {
+            if( !watched.atlas->replaceImage( watched.name, loader.getSurface( handles[ i ] ) ) )
+            {
+                printf( "Failed to reload %s!\n", watched.path.c_str() );
+                continue;
+            }
+
+            // The textures are the same objects, only where they point changes
+            for( int b = 0; b < (int)mBindings.size(); ++b )
+            {
+                if( mBindings[ b ].name == watched.name )
+                {
+                    mBindings[ b ].texture->loadFromAtlas( *watched.atlas, watched.name );
+                }
+            }
+        }
+        else if( watched.chunk != NULL )
+        {
+            Mix_Chunk* chunk = loader.takeChunk( handles[ i ] );
+            if( chunk == NULL )
+            {
+                printf( "Failed to reload %s!\n", watched.path.c_str() );
+                continue;
+            }
+
+            // Channels still playing the old chunk finish it, new plays get the new one
+            if( *watched.chunk != NULL )
+            {
+                mRetiredChunks.push_back( *watched.chunk );
+            }
+            *watched.chunk = chunk;
+
+            // The mixer's copy has no retiring, its voices are cut before the samples go
+            if( watched.sound != NULL )
+            {
+                gMixer.stopSound( watched.sound );
+                watched.sound->loadFromChunk( chunk );
+            }
+        }
+        else if( watched.player != NULL )
+        {
+            // Music is streamed, so there is nothing to decode here, the new file fades in where the old one was
+            LMusicPlayer* player = watched.player;
+            if( player->isPlaying() && player->getPath() == watched.path )
+            {
+                player->play( watched.path, MUSIC_SEEK_FADE_SECONDS, player->getPosition() );
+            }
+        }
+
+        printf( "Reloaded %s\n", watched.path.c_str() );
+        ++reloaded;
+    }
+
+    if( reloaded > 0 )
+    {
+        printf( "Hot reload took %.1f ms\n", (double)( SDL_GetPerformanceCounter() - start ) * 1000.0 / SDL_GetPerformanceFrequency() );
+    }
+    return reloaded;
+}
+
+void LHotReloader::readChanges( std::set<std::string>& changed )
+{
+    #ifdef __linux__
+    if( mNotify < 0 )
+    {
+        return;
+    }
+
+    // Events are variable length, the buffer has to be aligned for them
+    char buffer[ 4096 ] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+    while( true )
+    {
+        ssize_t length = read( mNotify, buffer, sizeof( buffer ) );
+        if( length <= 0 )
+        {
+            // EAGAIN, nothing more to read
+            break;
+        }
+
+        for( char* next = buffer; next < buffer + length; )
+        {
+            struct inotify_event* event = (struct inotify_event*)next;
+            if( event->len > 0 )
+            {
+                changed.insert( mDirectory + "/" + event->name );
+            }
+            next += sizeof( struct inotify_event ) + event->len;
+        }
+    }
+    #endif
+}
+
+void LHotReloader::freeRetiredChunks( bool force )
+{
+    if( mRetiredChunks.empty() )
+    {
+        return;
+    }
+
+    // Freeing a chunk halts channels playing it, so wait for them unless we are shutting down
+    int channels = Mix_AllocateChannels( -1 );
+    for( int i = (int)mRetiredChunks.size() - 1; i >= 0; --i )
+    {
+        bool playing = false;
+        for( int channel = 0; channel < channels && !force; ++channel )
+        {
+            if( Mix_Playing( channel ) && Mix_GetChunk( channel ) == mRetiredChunks[ i ] )
+            {
+                playing = true;
+            }
+        }
+
+        if( !playing )
+        {
+            Mix_FreeChunk( mRetiredChunks[ i ] );
+            mRetiredChunks.erase( mRetiredChunks.begin() + i );
+        }
+    }
+}
+
+// Scalar version of the resampler, the taps of both channels summed in the same order as the SIMD kernels
+static Uint64 resampleScalar( const float* samples, Uint64 position, Uint64 step, const float* kernels,
+                              float* out, int frames, float gainLeft, float gainRight, float rampLeft, float rampRight )
+{
+    for( int i = 0; i < frames; ++i )
+    {
+        // Taps start RESAMPLE_TAPS / 2 - 1 frames before the position
+        const float* window = samples + ( (Sint64)( position >> 32 ) - RESAMPLE_TAPS / 2 + 1 ) * 2;
+        Uint32 fraction = (Uint32)position;
+        const float* phase = kernels + ( fraction >> ( 32 - RESAMPLE_PHASE_BITS ) ) * RESAMPLE_TAPS;
+        float blend = ( fraction & ( ( 1u << ( 32 - RESAMPLE_PHASE_BITS ) ) - 1 ) ) * ( 1.0f / ( 1u << ( 32 - RESAMPLE_PHASE_BITS ) ) );
+
+        float left = 0.0f;
+        float right = 0.0f;
+        for( int t = 0; t < RESAMPLE_TAPS; ++t )
+        {
+            float k = phase[ t ] + ( phase[ t + RESAMPLE_TAPS ] - phase[ t ] ) * blend;
+            left += k * window[ t * 2 ];
+            right += k * window[ t * 2 + 1 ];
+        }
+        out[ i * 2 ] += left * gainLeft;
+        out[ i * 2 + 1 ] += right * gainRight;
+
+        gainLeft += rampLeft;
+        gainRight += rampRight;
+        position += step;
+    }
+    return position;
+}
+
+// Scalar version of the unresampled copy
+static void copyScalar( const float* samples, float* out, int frames, float gainLeft, float gainRight, float rampLeft, float rampRight )
+{
+    for( int i = 0; i < frames; ++i )
+    {
+        out[ i * 2 ] += samples[ i * 2 ] * gainLeft;
+        out[ i * 2 + 1 ] += samples[ i * 2 + 1 ] * gainRight;
+        gainLeft += rampLeft;
+        gainRight += rampRight;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Four taps of both channels at a time, each kernel value doubled up to meet its left and right samples
+static Uint64 resampleSSE2( const float* samples, Uint64 position, Uint64 step, const float* kernels,
+                            float* out, int frames, float gainLeft, float gainRight, float rampLeft, float rampRight )
+{
+    __m128 gains = _mm_setr_ps( gainLeft, gainRight, 0.0f, 0.0f );
+    __m128 ramp = _mm_setr_ps( rampLeft, rampRight, 0.0f, 0.0f );
+    for( int i = 0; i < frames; ++i )
+    {
+        const float* window = samples + ( (Sint64)( position >> 32 ) - RESAMPLE_TAPS / 2 + 1 ) * 2;
+        Uint32 fraction = (Uint32)position;
+        const float* phase = kernels + ( fraction >> ( 32 - RESAMPLE_PHASE_BITS ) ) * RESAMPLE_TAPS;
+        __m128 blend = _mm_set1_ps( ( fraction & ( ( 1u << ( 32 - RESAMPLE_PHASE_BITS ) ) - 1 ) ) * ( 1.0f / ( 1u << ( 32 - RESAMPLE_PHASE_BITS ) ) ) );
+
+        __m128 sum = _mm_setzero_ps();
+        for( int t = 0; t < RESAMPLE_TAPS; t += 4 )
+        {
+            __m128 k = _mm_loadu_ps( phase + t );
+            k = _mm_add_ps( k, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( phase + t + RESAMPLE_TAPS ), k ), blend ) );
+            sum = _mm_add_ps( sum, _mm_mul_ps( _mm_unpacklo_ps( k, k ), _mm_loadu_ps( window + t * 2 ) ) );
+            sum = _mm_add_ps( sum, _mm_mul_ps( _mm_unpackhi_ps( k, k ), _mm_loadu_ps( window + t * 2 + 4 ) ) );
+        }
+
+        // Even and odd taps were summed apart, fold them into the low left and right lanes
+        sum = _mm_add_ps( sum, _mm_movehl_ps( sum, sum ) );
+        __m128 mixed = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*)( out + i * 2 ) );
+        _mm_storel_pi( (__m64*)( out + i * 2 ), _mm_add_ps( mixed, _mm_mul_ps( sum, gains ) ) );
+
+        gains = _mm_add_ps( gains, ramp );
+        position += step;
+    }
+    return position;
+}
+
+// Two frames at a time
+static void copySSE2( const float* samples, float* out, int frames, float gainLeft, float gainRight, float rampLeft, float rampRight )
+{
+    __m128 gains = _mm_setr_ps( gainLeft, gainRight, gainLeft + rampLeft, gainRight + rampRight );
+    __m128 ramp = _mm_setr_ps( rampLeft * 2, rampRight * 2, rampLeft * 2, rampRight * 2 );
+    int i = 0;
+    for( ; i + 2 <= frames; i += 2 )
+    {
+        _mm_storeu_ps( out + i * 2, _mm_add_ps( _mm_loadu_ps( out + i * 2 ), _mm_mul_ps( _mm_loadu_ps( samples + i * 2 ), gains ) ) );
+        gains = _mm_add_ps( gains, ramp );
+    }
+
+    // Leftover frame
+    if( i < frames )
+    {
+        copyScalar( samples + i * 2, out + i * 2, frames - i, gainLeft + rampLeft * i, gainRight + rampRight * i, rampLeft, rampRight );
+    }
+}
+
+// Eight taps of both channels at a time, only called when the CPU reports AVX2
+__attribute__(( target( "avx2" ) ))
+static Uint64 resampleAVX2( const float* samples, Uint64 position, Uint64 step, const float* kernels,
+                            float* out, int frames, float gainLeft, float gainRight, float rampLeft, float rampRight )
+{
+    __m128 gains = _mm_setr_ps( gainLeft, gainRight, 0.0f, 0.0f );
+    __m128 ramp = _mm_setr_ps( rampLeft, rampRight, 0.0f, 0.0f );
+    for( int i = 0; i < frames; ++i )
+    {
+        const float* window = samples + ( (Sint64)( position >> 32 ) - RESAMPLE_TAPS / 2 + 1 ) * 2;
+        Uint32 fraction = (Uint32)position;
+        const float* phase = kernels + ( fraction >> ( 32 - RESAMPLE_PHASE_BITS ) ) * RESAMPLE_TAPS;
+        __m256 blend = _mm256_set1_ps( ( fraction & ( ( 1u << ( 32 - RESAMPLE_PHASE_BITS ) ) - 1 ) ) * ( 1.0f / ( 1u << ( 32 - RESAMPLE_PHASE_BITS ) ) ) );
+
+        __m256 sum = _mm256_setzero_ps();
+        for( int t = 0; t < RESAMPLE_TAPS; t += 8 )
+        {
+            __m256 k = _mm256_loadu_ps( phase + t );
+            k = _mm256_add_ps( k, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( phase + t + RESAMPLE_TAPS ), k ), blend ) );
+
+            // Unpacking works within 128 bit lanes, so swap the halves back into tap order
+            __m256 low = _mm256_unpacklo_ps( k, k );
+            __m256 high = _mm256_unpackhi_ps( k, k );
+            sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_permute2f128_ps( low, high, 0x20 ), _mm256_loadu_ps( window + t * 2 ) ) );
+            sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_permute2f128_ps( low, high, 0x31 ), _mm256_loadu_ps( window + t * 2 + 8 ) ) );
+        }
+
+        __m128 folded = _mm_add_ps( _mm256_castps256_ps128( sum ), _mm256_extractf128_ps( sum, 1 ) );
+        folded = _mm_add_ps( folded, _mm_movehl_ps( folded, folded ) );
+        __m128 mixed = _mm_loadl_pi( _mm_setzero_ps(), (const __m64*)( out + i * 2 ) );
+        _mm_storel_pi( (__m64*)( out + i * 2 ), _mm_add_ps( mixed, _mm_mul_ps( folded, gains ) ) );
+
+        gains = _mm_add_ps( gains, ramp );
+        position += step;
+    }
+    _mm256_zeroupper();
+    return position;
+}
+
+// Four frames at a time, only called when the CPU reports AVX2
+__attribute__(( target( "avx2" ) ))
+static void copyAVX2( const float* samples, float* out, int frames, float gainLeft, float gainRight, float rampLeft, float rampRight )
+{
+    __m256 gains = _mm256_setr_ps( gainLeft, gainRight, gainLeft + rampLeft, gainRight + rampRight,
+                                   gainLeft + rampLeft * 2, gainRight + rampRight * 2, gainLeft + rampLeft * 3, gainRight + rampRight * 3 );
+    __m256 ramp = _mm256_setr_ps( rampLeft * 4, rampRight * 4, rampLeft * 4, rampRight * 4,
+                                  rampLeft * 4, rampRight * 4, rampLeft * 4, rampRight * 4 );
+    int i = 0;
+    for( ; i + 4 <= frames; i += 4 )
+    {
+        _mm256_storeu_ps( out + i * 2, _mm256_add_ps( _mm256_loadu_ps( out + i * 2 ), _mm256_mul_ps( _mm256_loadu_ps( samples + i * 2 ), gains ) ) );
+        gains = _mm256_add_ps( gains, ramp );
+    }
+
+    // Leftover frames
+    _mm256_zeroupper();
+    if( i < frames )
+    {
+        copySSE2( samples + i * 2, out + i * 2, frames - i, gainLeft + rampLeft * i, gainRight + rampRight * i, rampLeft, rampRight );
+    }
+}
+#endif
+
+LSound::LSound()
+{
+    mFrameCount = 0;
+    mFrequency = 0;
+}
+
+LSound::~LSound()
+{
+    free();
+}
+
+bool LSound::loadFromChunk( Mix_Chunk* chunk )
+{
+    int frequency = 0;
+    Uint16 format = 0;
+    int channels = 0;
+    if( chunk == NULL || Mix_QuerySpec( &frequency, &format, &channels ) == 0 )
+    {
+        printf( "Unable to copy chunk, the mixer is not open!\n" );
+        return false;
+    }
+
+    // SDL converts to float stereo at the same rate, in place in a buffer big enough for every step
+    SDL_AudioCVT converter;
+    if( SDL_BuildAudioCVT( &converter, format, channels, frequency, AUDIO_F32SYS, 2, frequency ) < 0 )
+    {
+        printf( "Unable to convert chunk! SDL Error: %s\n", SDL_GetError() );
+        return false;
+    }
+    std::vector<Uint8> converted( chunk->abuf, chunk->abuf + chunk->alen );
+    if( converter.needed )
+    {
+        converted.resize( chunk->alen * converter.len_mult );
+        converter.len = chunk->alen;
+        converter.buf = &converted[ 0 ];
+        if( SDL_ConvertAudio( &converter ) < 0 )
+        {
+            printf( "Unable to convert chunk! SDL Error: %s\n", SDL_GetError() );
+            return false;
+        }
+        converted.resize( converter.len_cvt );
+    }
+
+    int frameCount = converted.size() / ( sizeof( float ) * 2 );
+    return loadFromFrames( frameCount > 0 ? (const float*)&converted[ 0 ] : NULL, frameCount, frequency );
+}
+
+bool LSound::loadFromFrames( const float* frames, int frameCount, int frequency )
+{
+    free();
+    if( frameCount <= 0 || frequency <= 0 )
+    {
+        return false;
+    }
+
+    mSamples.assign( ( frameCount + RESAMPLE_TAPS * 2 ) * 2, 0.0f );
+    std::copy( frames, frames + frameCount * 2, mSamples.begin() + RESAMPLE_TAPS * 2 );
+    mFrameCount = frameCount;
+    mFrequency = frequency;
+    return true;
+}
+
+void LSound::free()
+{
+    mSamples.clear();
+    mSamples.shrink_to_fit();
+    mFrameCount = 0;
+    mFrequency = 0;
+}
+
+const float* LSound::getFrames()
+{
+    return mSamples.empty() ? NULL : &mSamples[ RESAMPLE_TAPS * 2 ];
+}
+
+int LSound::getFrameCount()
+{
+    return mFrameCount;
+}
+
+int LSound::getFrequency()
+{
+    return mFrequency;
+}
+
+LAudioQueue::LAudioQueue()
+{
+    mHead = 0;
+    mTail = 0;
+}
+
+bool LAudioQueue::push( const LAudioCommand& command )
+{
+    // Only this thread moves the head, the consumer only ever frees more room
+    Uint32 head = mHead.load( std::memory_order_relaxed );
+    if( head - mTail.load( std::memory_order_acquire ) == (Uint32)AUDIO_QUEUE_SIZE )
+    {
+        return false;
+    }
+
+    // Fill the slot before publishing it
+    mCommands[ head & ( AUDIO_QUEUE_SIZE - 1 ) ] = command;
+    mHead.store( head + 1, std::memory_order_release );
+    return true;
+}
+
+bool LAudioQueue::pop( LAudioCommand& command )
+{
+    Uint32 tail = mTail.load( std::memory_order_relaxed );
+    if( tail == mHead.load( std::memory_order_acquire ) )
+    {
+        return false;
+    }
+
+    // Read the slot before handing it back
+    command = mCommands[ tail & ( AUDIO_QUEUE_SIZE - 1 ) ];
+    mTail.store( tail + 1, std::memory_order_release );
+    return true;
+}
+
+Uint32 LAudioQueue::getPushCount()
+{
+    return mHead.load( std::memory_order_acquire );
+}
+
+Uint32 LAudioQueue::getPopCount()
+{
+    return mTail.load( std::memory_order_acquire );
+}
+
+LMusicStream::LMusicStream()
+{
+    mHead = 0;
+    mTail = 0;
+    mReadOffset = 0;
+    mStopping = false;
+    mEnded = false;
+    mFailed = false;
+    mInUse = false;
+    mUnderrunCount = 0;
+    mFramesRead = 0;
+    mTrackSeconds = 0.0;
+    mFrequency = MIX_DEFAULT_FREQUENCY;
+    mStartSeconds = 0.0;
+    mLoop = true;
+    mReadDelay = 0;
+    mFile = NULL;
+    mConverter = NULL;
+    mDataStart = 0;
+    mDataBytes = 0;
+    mDataPosition = 0;
+    mFrameBytes = 0;
+    mDrained = false;
+}
+
+LMusicStream::~LMusicStream()
+{
+    close();
+}
+
+void LMusicStream::open( std::string path, int frequency, double startSeconds, bool loop )
+{
+    close();
+
+    // The ring is allocated once, every track after the first reuses it
+    if( mBlocks.empty() )
+    {
+        mBlocks.resize( MUSIC_BLOCKS );
+        mReadBuffer.resize( MUSIC_READ_BYTES );
+    }
+
+    mPath = path;
+    mFrequency = frequency;
+    mStartSeconds = std::max( 0.0, startSeconds );
+    mLoop = loop;
+    mHead = 0;
+    mTail = 0;
+    mReadOffset = 0;
+    mStopping = false;
+    mEnded = false;
+    mFailed = false;
+    mUnderrunCount = 0;
+    mFramesRead = 0;
+    mTrackSeconds = 0.0;
+    mThread = std::thread( &LMusicStream::decode, this );
+}
+
+void LMusicStream::close()
+{
+    if( mThread.joinable() )
+    {
+        {
+            std::lock_guard<std::mutex> lock( mLock );
+            mStopping = true;
+        }
+        mWake.notify_one();
+        mThread.join();
+    }
+
+    if( mConverter != NULL )
+    {
+        SDL_FreeAudioStream( mConverter );
+        mConverter = NULL;
+    }
+    if( mFile != NULL )
+    {
+        SDL_RWclose( mFile );
+        mFile = NULL;
+    }
+}
+
+void LMusicStream::setReadDelay( Uint32 milliseconds )
+{
+    mReadDelay.store( milliseconds, std::memory_order_relaxed );
+}
+
+int LMusicStream::read( float* frames, int frameCount )
+{
+    int done = 0;
+    Uint32 tail = mTail.load( std::memory_order_relaxed );
+    Uint32 head = mHead.load( std::memory_order_acquire );
+    while( done < frameCount && tail != head )
+    {
+        Block& block = mBlocks[ tail % MUSIC_BLOCKS ];
+        int count = std::min( frameCount - done, block.frames - mReadOffset );
+        std::copy( block.samples + mReadOffset * 2, block.samples + ( mReadOffset + count ) * 2, frames + done * 2 );
+        done += count;
+        mReadOffset += count;
+
+        // Hand the block back to the decoder
+        if( mReadOffset == block.frames )
+        {
+            mReadOffset = 0;
+            ++tail;
+            mTail.store( tail, std::memory_order_release );
+        }
+    }
+
+    // Running dry plays silence rather than waiting, the end of a track is not a miss
+    if( done < frameCount )
+    {
+        std::fill( frames + done * 2, frames + frameCount * 2, 0.0f );
+        if( !mEnded.load( std::memory_order_acquire ) )
+        {
+            mUnderrunCount.fetch_add( 1, std::memory_order_relaxed );
+        }
+    }
+    mFramesRead.fetch_add( done, std::memory_order_relaxed );
+    return done;
+}
+
+bool LMusicStream::isReady()
+{
+    Uint32 buffered = mHead.load( std::memory_order_acquire ) - mTail.load( std::memory_order_relaxed );
+    return buffered >= (Uint32)MUSIC_START_BLOCKS || mEnded.load( std::memory_order_acquire );
+}
+
+bool LMusicStream::isFinished()
+{
+    return mEnded.load( std::memory_order_acquire ) && mHead.load( std::memory_order_acquire ) == mTail.load( std::memory_order_relaxed );
+}
+
+bool LMusicStream::hasFailed()
+{
+    return mFailed.load( std::memory_order_acquire );
+}
+
+void LMusicStream::setInUse( bool inUse )
+{
+    mInUse.store( inUse, std::memory_order_release );
+}
+
+bool LMusicStream::isInUse()
+{
+    return mInUse.load( std::memory_order_acquire );
+}
+
+std::string LMusicStream::getPath()
+{
+    return mPath;
+}
+
+double LMusicStream::getPosition()
+{
+    double position = mStartSeconds + (double)mFramesRead.load( std::memory_order_relaxed ) / mFrequency;
+    double length = mTrackSeconds.load( std::memory_order_relaxed );
+    if( length > 0.0 )
+    {
+        position = mLoop ? fmod( position, length ) : std::min( position, length );
+    }
+    return position;
+}
+
+int LMusicStream::getBufferedFrames()
+{
+    return ( mHead.load( std::memory_order_acquire ) - mTail.load( std::memory_order_acquire ) ) * MUSIC_BLOCK_FRAMES;
+}
+
+int LMusicStream::getUnderrunCount()
+{
+    return mUnderrunCount.load( std::memory_order_relaxed );
+}
+
+void LMusicStream::decode()
+{
+    // Failing ends the track too, so the mixer stops waiting for it
+    if( !openFile() )
+    {
+        mFailed.store( true, std::memory_order_release );
+        mEnded.store( true, std::memory_order_release );
+        return;
+    }
+
+    while( true )
+    {
+        // The audio callback never signals, a full ring is looked at again every MUSIC_POLL_MS
+        {
+            std::unique_lock<std::mutex> lock( mLock );
+            mWake.wait_for( lock, std::chrono::milliseconds( MUSIC_POLL_MS ), [ this ]() { return mStopping || hasRoom(); } );
+            if( mStopping )
+            {
+                return;
+            }
+        }
+        if( !hasRoom() )
+        {
+            continue;
+        }
+
+        Uint32 head = mHead.load( std::memory_order_relaxed );
+        Block& block = mBlocks[ head % MUSIC_BLOCKS ];
+        int frames = fillBlock( block );
+        if( frames < 0 )
+        {
+            mFailed.store( true, std::memory_order_release );
+        }
+        if( frames <= 0 )
+        {
+            mEnded.store( true, std::memory_order_release );
+            return;
+        }
+        block.frames = frames;
+        mHead.store( head + 1, std::memory_order_release );
+    }
+}
+
+bool LMusicStream::openFile()
+{
+    mFile = gArchive.openFile( mPath );
+    if( mFile == NULL )
+    {
+        mFile = SDL_RWFromFile( mPath.c_str(), "rb" );
+    }
+    if( mFile == NULL )
+    {
+        printf( "Unable to stream %s! SDL Error: %s\n", mPath.c_str(), SDL_GetError() );
+        return false;
+    }
+
+    // RIFF header, then chunks until the samples, the format chunk comes first in every file SDL would load
+    Uint8 riff[ 12 ];
+    if( SDL_RWread( mFile, riff, sizeof( riff ), 1 ) != 1 || memcmp( riff, "RIFF", 4 ) != 0 || memcmp( riff + 8, "WAVE", 4 ) != 0 )
+    {
+        printf( "Unable to stream %s, it is not a WAV file!\n", mPath.c_str() );
+        return false;
+    }
+
+    Uint16 tag = 0;
+    Uint16 channels = 0;
+    Uint32 rate = 0;
+    Uint16 bits = 0;
+    while( true )
+    {
+        Uint8 id[ 4 ];
+        if( SDL_RWread( mFile, id, sizeof( id ), 1 ) != 1 )
+        {
+            printf( "Unable to stream %s, it has no samples!\n", mPath.c_str() );
+            return false;
+        }
+        Uint32 size = SDL_ReadLE32( mFile );
+        Sint64 next = SDL_RWtell( mFile ) + size + ( size & 1 );
+
+        if( memcmp( id, "fmt ", 4 ) == 0 && size >= 16 )
+        {
+            tag = SDL_ReadLE16( mFile );
+            channels = SDL_ReadLE16( mFile );
+            rate = SDL_ReadLE32( mFile );
+            SDL_ReadLE32( mFile );
+            SDL_ReadLE16( mFile );
+            bits = SDL_ReadLE16( mFile );
+
+            // Extensible files keep the real tag at the start of their subformat
+            if( tag == 0xFFFE && size >= 26 )
+            {
+                SDL_ReadLE16( mFile );
+                SDL_ReadLE16( mFile );
+                SDL_ReadLE32( mFile );
+                tag = SDL_ReadLE16( mFile );
+            }
+        }
+        else if( memcmp( id, "data", 4 ) == 0 )
+        {
+            mDataStart = SDL_RWtell( mFile );
+            mDataBytes = std::min( (Sint64)size, SDL_RWsize( mFile ) - mDataStart );
+            break;
+        }
+
+        if( SDL_RWseek( mFile, next, RW_SEEK_SET ) < 0 )
+        {
+            printf( "Unable to stream %s! SDL Error: %s\n", mPath.c_str(), SDL_GetError() );
+            return false;
+        }
+    }
+
+    SDL_AudioFormat format = 0;
+    if( tag == 1 && bits == 8 )
+    {
+        format = AUDIO_U8;
+    }
+    else if( tag == 1 && bits == 16 )
+    {
+        format = AUDIO_S16LSB;
+    }
+    else if( tag == 1 && bits == 32 )
+    {
+        format = AUDIO_S32LSB;
+    }
+    else if( tag == 3 && bits == 32 )
+    {
+        format = AUDIO_F32LSB;
+    }
+    if( format == 0 || channels == 0 || rate == 0 )
+    {
+        printf( "Unable to stream %s, format %#x with %d bits is not supported!\n", mPath.c_str(), tag, bits );
+        return false;
+    }
+
+    // Resampling keeps its state from one read to the next, so blocks and loops join without a seam
+    mConverter = SDL_NewAudioStream( format, channels, rate, AUDIO_F32SYS, 2, mFrequency );
+    if( mConverter == NULL )
+    {
+        printf( "Unable to convert %s! SDL Error: %s\n", mPath.c_str(), SDL_GetError() );
+        return false;
+    }
+    mFrameBytes = channels * bits / 8;
+    mDataBytes -= mDataBytes % mFrameBytes;
+    Sint64 frameCount = mDataBytes / mFrameBytes;
+    mTrackSeconds.store( (double)frameCount / rate, std::memory_order_relaxed );
+
+    // Start where asked, wrapped around for looping tracks
+    Sint64 startFrame = (Sint64)( mStartSeconds * rate );
+    if( frameCount > 0 )
+    {
+        startFrame = mLoop ? startFrame % frameCount : std::min( startFrame, frameCount );
+    }
+    mDataPosition = startFrame * mFrameBytes;
+    mDrained = false;
+    if( SDL_RWseek( mFile, mDataStart + mDataPosition, RW_SEEK_SET ) < 0 )
+    {
+        printf( "Unable to stream %s! SDL Error: %s\n", mPath.c_str(), SDL_GetError() );
+        return false;
+    }
+    return true;
+}
+
+int LMusicStream::fillBlock( Block& block )
+{
+    const int blockBytes = sizeof( block.samples );
+    while( SDL_AudioStreamAvailable( mConverter ) < blockBytes && !mDrained )
+    {
+        Uint32 delay = mReadDelay.load( std::memory_order_relaxed );
+        if( delay > 0 )
+        {
+            SDL_Delay( delay );
+        }
+
+        // Looping goes back to the first sample and keeps converting, at the real end whatever the converter holds comes out
+        Sint64 left = mDataBytes - mDataPosition;
+        if( left == 0 && mLoop && mDataBytes > 0 )
+        {
+            if( SDL_RWseek( mFile, mDataStart, RW_SEEK_SET ) < 0 )
+            {
+                printf( "Unable to loop %s! SDL Error: %s\n", mPath.c_str(), SDL_GetError() );
+                return -1;
+            }
+            mDataPosition = 0;
+            continue;
+        }
+        if( left == 0 )
+        {
+            SDL_AudioStreamFlush( mConverter );
+            mDrained = true;
+            break;
+        }
+
+        // Whole frames only, the converter refuses partial ones
+        Sint64 want = std::min( left, (Sint64)( MUSIC_READ_BYTES - MUSIC_READ_BYTES % mFrameBytes ) );
+        size_t got = SDL_RWread( mFile, &mReadBuffer[ 0 ], 1, want );
+        got -= got % mFrameBytes;
+        if( got == 0 || SDL_AudioStreamPut( mConverter, &mReadBuffer[ 0 ], got ) < 0 )
+        {
+            printf( "Unable to stream %s! SDL Error: %s\n", mPath.c_str(), SDL_GetError() );
+            return -1;
+        }
+        if( (Sint64)got < want && SDL_RWseek( mFile, mDataStart + mDataPosition + got, RW_SEEK_SET ) < 0 )
+        {
+            return -1;
+        }
+        mDataPosition += got;
+    }
+
+    int bytes = SDL_AudioStreamGet( mConverter, block.samples, blockBytes );
+    if( bytes < 0 )
+    {
+        printf( "Unable to convert %s! SDL Error: %s\n", mPath.c_str(), SDL_GetError() );
+        return -1;
+    }
+    return bytes / ( 2 * sizeof( float ) );
+}
+
+bool LMusicStream::hasRoom()
+{
+    return mHead.load( std::memory_order_relaxed ) - mTail.load( std::memory_order_acquire ) < (Uint32)MUSIC_BLOCKS;
+}
+
+LMixer::LMixer( int voiceCount )
+{
+    mKernels = getKernels();
+
+    // Everything the audio thread uses is allocated here, never in the callback
+    mVoices.resize( std::max( 1, voiceCount ) );
+    mVoiceHandles = std::vector< std::atomic<int> >( mVoices.size() );
+    mStolen.reserve( mVoices.size() );
+    for( int i = 0; i < (int)mVoices.size(); ++i )
+    {
+        mVoices[ i ].sound = NULL;
+        mVoiceHandles[ i ] = 0;
+    }
+    mPlayCount = 0;
+    for( int i = 0; i < MUSIC_DECKS; ++i )
+    {
+        mDecks[ i ].stream = NULL;
+    }
+    mMusicLevel = 1.0f;
+    mMusicTarget = 1.0f;
+    mMusicPaused = false;
+
+    mLastHandle = 0;
+    mStartedHandle = 0;
+    mStolenCount = 0;
+    mRefusedCount = 0;
+    mDroppedCount = 0;
+    mCallbackCount = 0;
+    mXrunCount = 0;
+    mWorstCallbackTicks = 0;
+    mCallbackFrames = 0;
+    mLatencyCount = 0;
+    mLastLatencyTicks = 0;
+    mTotalLatencyTicks = 0;
+    mWorstLatencyTicks = 0;
+    mCallbackStart = 0;
+    mCallbackLength = 0;
+    mCallbackOffset = 0;
+
+    mFrequency = MIX_DEFAULT_FREQUENCY;
+    mFormat = MIX_DEFAULT_FORMAT;
+    mChannels = MIX_DEFAULT_CHANNELS;
+    mHooked = false;
+
+    setSimd( true );
+}
+
+LMixer::~LMixer()
+{
+    close();
+}
+
+bool LMixer::open()
+{
+    int frequency = 0;
+    Uint16 format = 0;
+    int channels = 0;
+    if( Mix_QuerySpec( &frequency, &format, &channels ) == 0 )
+    {
+        printf( "Unable to start the software mixer, SDL_mixer is not open! SDL_mixer Error: %s\n", Mix_GetError() );
+        return false;
+    }
+    if( !setOutput( frequency, format, channels ) )
+    {
+        printf( "Unable to start the software mixer, it cannot mix to format %#x with %d channels!\n", format, channels );
+        return false;
+    }
+
+    // Runs on the audio thread after SDL_mixer has mixed its own channels into the stream
+    mCallbackFrames = 0;
+    Mix_SetPostMix( postMix, this );
+    mHooked = true;
+    return true;
+}
+
+void LMixer::close()
+{
+    if( mHooked )
+    {
+        Mix_SetPostMix( NULL, NULL );
+        mHooked = false;
+    }
+}
+
+bool LMixer::setOutput( int frequency, Uint16 format, int channels )
+{
+    // Only while not hooked, the callback reads these without asking
+    if( mHooked || ( format != AUDIO_S16SYS && format != AUDIO_F32SYS ) || channels < 1 || channels > 2 || frequency <= 0 )
+    {
+        return false;
+    }
+
+    mFrequency = frequency;
+    mFormat = format;
+    mChannels = channels;
+    return true;
+}
+
+int LMixer::play( LSound* sound, float gain, float pan, float pitch, int priority, bool loop, Uint64 pressed )
+{
+    if( sound == NULL || sound->getFrameCount() == 0 )
+    {
+        return -1;
+    }
+
+    // Handles are given out here, so the caller has one before the callback picks a voice
+    int handle = mLastHandle % 0x7FFFFFFF + 1;
+
+    LAudioCommand command = {};
+    command.type = AUDIO_PLAY;
+    command.voice = handle;
+    command.sound = sound;
+    command.gain = gain;
+    command.pan = pan;
+    command.pitch = pitch;
+    command.priority = priority;
+    command.loop = loop;
+    command.pressed = pressed;
+    if( !send( command, true ) )
+    {
+        return -1;
+    }
+    mLastHandle = handle;
+    return handle;
+}
+
+void LMixer::stop( int handle )
+{
+    LAudioCommand command = {};
+    command.type = AUDIO_STOP;
+    command.voice = handle;
+    send( command, false );
+}
+
+void LMixer::setGain( int handle, float gain, float pan )
+{
+    LAudioCommand command = {};
+    command.type = AUDIO_SET_GAIN;
+    command.voice = handle;
+    command.gain = gain;
+    command.pan = pan;
+    send( command, false );
+}
+
+void LMixer::setPitch( int handle, float pitch )
+{
+    LAudioCommand command = {};
+    command.type = AUDIO_SET_PITCH;
+    command.voice = handle;
+    command.pitch = pitch;
+    send( command, false );
+}
+
+bool LMixer::isPlaying( int handle )
+{
+    if( handle <= 0 )
+    {
+        return false;
+    }
+
+    // Still queued, handles only go up until they wrap
+    if( (Sint32)( handle - mStartedHandle.load( std::memory_order_acquire ) ) > 0 )
+    {
+        return true;
+    }
+    for( int i = 0; i < (int)mVoiceHandles.size(); ++i )
+    {
+        if( mVoiceHandles[ i ].load( std::memory_order_relaxed ) == handle )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LMixer::stopSound( LSound* sound )
+{
+    LAudioCommand command = {};
+    command.type = AUDIO_STOP_SOUND;
+    command.sound = sound;
+    send( command, false );
+    waitForCallback();
+}
+
+void LMixer::playMusic( LMusicStream* stream, float fadeSeconds )
+{
+    if( stream == NULL )
+    {
+        return;
+    }
+
+    // Marked before it is sent, so detaching never misses a stream still in the queue
+    stream->setInUse( true );
+    LAudioCommand command = {};
+    command.type = AUDIO_PLAY_MUSIC;
+    command.stream = stream;
+    command.seconds = fadeSeconds;
+    send( command, false );
+}
+
+void LMixer::pauseMusic()
+{
+    LAudioCommand command = {};
+    command.type = AUDIO_PAUSE_MUSIC;
+    send( command, false );
+}
+
+void LMixer::resumeMusic()
+{
+    LAudioCommand command = {};
+    command.type = AUDIO_RESUME_MUSIC;
+    send( command, false );
+}
+
+void LMixer::haltMusic()
+{
+    LAudioCommand command = {};
+    command.type = AUDIO_HALT_MUSIC;
+    send( command, false );
+}
+
+void LMixer::detachMusic( LMusicStream* stream )
+{
+    if( stream == NULL || !stream->isInUse() )
+    {
+        return;
+    }
+
+    LAudioCommand command = {};
+    command.type = AUDIO_DETACH_MUSIC;
+    command.stream = stream;
+    send( command, false );
+    waitForCallback();
+}
+
+bool LMixer::cancelMusic( LMusicStream* stream )
+{
+    if( stream == NULL || !stream->isInUse() )
+    {
+        return true;
+    }
+
+    LAudioCommand command = {};
+    command.type = AUDIO_CANCEL_MUSIC;
+    command.stream = stream;
+    send( command, false );
+    waitForCallback();
+    return !stream->isInUse();
+}
+
+int LMixer::getFrequency()
+{
+    return mFrequency;
+}
+
+void LMixer::waitForCallback()
+{
+    // The game thread waits here instead of the callback ever waiting on it, when nothing is mixing it carries the commands out itself
+    // A device that is paused or lost stops calling back, so after a few periods the game thread takes over
+    Uint32 sent = mQueue.getPushCount();
+    Uint64 deadline = 0;
+    while( (Sint32)( sent - mQueue.getPopCount() ) > 0 )
+    {
+        if( mHooked && !hasCallbackStalled( deadline ) )
+        {
+            SDL_Delay( 1 );
+        }
+        else
+        {
+            applyCommandsHere();
+        }
+    }
+}
+
+bool LMixer::hasCallbackStalled( Uint64& deadline )
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    if( deadline == 0 )
+    {
+        int frames = mCallbackFrames > 0 ? mCallbackFrames.load() : AUDIO_MAX_BUFFER_FRAMES;
+        deadline = now + (Uint64)AUDIO_STALL_PERIODS * frames * SDL_GetPerformanceFrequency() / mFrequency;
+        return false;
+    }
+    if( now < deadline )
+    {
+        return false;
+    }
+    printf( "Audio callback stopped running, mixer commands are carried out on the game thread\n" );
+    return true;
+}
+
+void LMixer::applyCommandsHere()
+{
+    std::lock_guard<std::mutex> lock( mMixLock );
+    applyCommands();
+}
+
+void LMixer::mix( float* frames, int frameCount )
+{
+    applyCommands();
+    if( frameCount <= 0 )
+    {
+        return;
+    }
+
+    for( int i = 0; i < (int)mVoices.size(); ++i )
+    {
+        Voice& voice = mVoices[ i ];
+        if( voice.sound != NULL && voice.pressed != 0 )
+        {
+            recordLatency( voice.pressed, frameCount );
+            voice.pressed = 0;
+        }
+        if( voice.sound != NULL && !mixVoice( voice, frames, frameCount ) )
+        {
+            freeVoice( i );
+        }
+    }
+
+    // Stolen voices are fading out, so one block finishes them
+    for( int i = 0; i < (int)mStolen.size(); ++i )
+    {
+        mixVoice( mStolen[ i ], frames, frameCount );
+    }
+    mStolen.clear();
+
+    mixMusic( frames, frameCount );
+}
+
+void LMixer::mixInto( Uint8* stream, int bytes )
+{
+    // The game thread only holds this once the callback had stopped, leave SDL_mixer's channels alone for this buffer
+    std::unique_lock<std::mutex> lock( mMixLock, std::try_to_lock );
+    if( !lock.owns_lock() )
+    {
+        return;
+    }
+
+    int frameCount = bytes / ( SDL_AUDIO_BITSIZE( mFormat ) / 8 * mChannels );
+    Uint64 start = SDL_GetPerformanceCounter();
+    mCallbackStart = start;
+    mCallbackLength = frameCount;
+    for( int first = 0; first < frameCount; first += MIXER_BLOCK_FRAMES )
+    {
+        int count = std::min( MIXER_BLOCK_FRAMES, frameCount - first );
+        std::fill( mBlock, mBlock + count * 2, 0.0f );
+        mCallbackOffset = first;
+        mix( mBlock, count );
+
+        // Add onto what SDL_mixer put in the stream, mono gets the average of both sides
+        int samples = count * mChannels;
+        if( mChannels == 1 )
+        {
+            for( int i = 0; i < count; ++i )
+            {
+                mBlock[ i ] = ( mBlock[ i * 2 ] + mBlock[ i * 2 + 1 ] ) * 0.5f;
+            }
+        }
+        if( mFormat == AUDIO_F32SYS )
+        {
+            float* out = (float*)stream + first * mChannels;
+            for( int i = 0; i < samples; ++i )
+            {
+                out[ i ] += mBlock[ i ];
+            }
+        }
+        else
+        {
+            Sint16* out = (Sint16*)stream + first * mChannels;
+            for( int i = 0; i < samples; ++i )
+            {
+                float sample = out[ i ] + mBlock[ i ] * 32767.0f;
+                out[ i ] = (Sint16)std::max( -32768.0f, std::min( 32767.0f, sample ) );
+            }
+        }
+    }
+
+    // A callback slower than the audio it makes would have the device run dry
+    Uint64 ticks = SDL_GetPerformanceCounter() - start;
+    if( ticks * mFrequency > (Uint64)frameCount * SDL_GetPerformanceFrequency() )
+    {
+        mXrunCount.fetch_add( 1, std::memory_order_relaxed );
+    }
+    if( ticks > mWorstCallbackTicks.load( std::memory_order_relaxed ) )
+    {
+        mWorstCallbackTicks.store( ticks, std::memory_order_relaxed );
+    }
+    mCallbackFrames.store( frameCount, std::memory_order_relaxed );
+    mCallbackCount.fetch_add( 1, std::memory_order_relaxed );
+    mCallbackStart = 0;
+}
+
+void LMixer::setSimd( bool simd )
+{
+    mResample = resampleScalar;
+    mCopy = copyScalar;
+    #ifdef HAVE_X86_SIMD
+    if( simd )
+    {
+        mResample = SDL_HasAVX2() ? resampleAVX2 : resampleSSE2;
+        mCopy = SDL_HasAVX2() ? copyAVX2 : copySSE2;
+    }
+    #endif
+}
+
+int LMixer::getActiveCount()
+{
+    int active = 0;
+    for( int i = 0; i < (int)mVoiceHandles.size(); ++i )
+    {
+        if( mVoiceHandles[ i ].load( std::memory_order_relaxed ) != 0 )
+        {
+            ++active;
+        }
+    }
+    return active;
+}
+
+int LMixer::getStolenCount()
+{
+    return mStolenCount;
+}
+
+int LMixer::getRefusedCount()
+{
+    return mRefusedCount;
+}
+
+int LMixer::getDroppedCount()
+{
+    return mDroppedCount;
+}
+
+int LMixer::getCallbackCount()
+{
+    return mCallbackCount;
+}
+
+int LMixer::getXrunCount()
+{
+    return mXrunCount;
+}
+
+int LMixer::getCallbackFrames()
+{
+    return mCallbackFrames.load( std::memory_order_relaxed );
+}
+
+int LMixer::getLatencyCount()
+{
+    return mLatencyCount.load( std::memory_order_acquire );
+}
+
+double LMixer::getLastLatencySeconds()
+{
+    return (double)mLastLatencyTicks.load( std::memory_order_relaxed ) / SDL_GetPerformanceFrequency();
+}
+
+double LMixer::getAverageLatencySeconds()
+{
+    int count = getLatencyCount();
+    return count == 0 ? 0.0 : (double)mTotalLatencyTicks.load( std::memory_order_relaxed ) / count / SDL_GetPerformanceFrequency();
+}
+
+double LMixer::getWorstLatencySeconds()
+{
+    return (double)mWorstLatencyTicks.load( std::memory_order_relaxed ) / SDL_GetPerformanceFrequency();
+}
+
+double LMixer::getWorstCallbackSeconds()
+{
+    return (double)mWorstCallbackTicks / SDL_GetPerformanceFrequency();
+}
+
+void LMixer::resetWorstCallback()
+{
+    mWorstCallbackTicks.store( 0, std::memory_order_relaxed );
+}
+
+void LMixer::postMix( void* mixer, Uint8* stream, int bytes )
+{
+    ( (LMixer*)mixer )->mixInto( stream, bytes );
+}
+
+const float* LMixer::getKernels()
+{
+    // Built by the first mixer, which may be a global constructed before the rest of this file's globals
+    static std::vector<float> kernels;
+    if( !kernels.empty() )
+    {
+        return &kernels[ 0 ];
+    }
+
+    // Blackman windowed sinc, one extra phase at the end so the last one has a neighbour to blend with
+    const int PHASE_FLOATS = RESAMPLE_TAPS;
+    const int BAND_FLOATS = ( RESAMPLE_PHASES + 1 ) * PHASE_FLOATS;
+    kernels.resize( RESAMPLE_BANDS * BAND_FLOATS );
+    for( int band = 0; band < RESAMPLE_BANDS; ++band )
+    {
+        // Pitched up sounds are band limited to the output's Nyquist rate, counted in source frames
+        double cutoff = 1.0 / RESAMPLE_BAND_STEPS[ band ];
+        for( int phase = 0; phase <= RESAMPLE_PHASES; ++phase )
+        {
+            float* taps = &kernels[ band * BAND_FLOATS + phase * PHASE_FLOATS ];
+            double fraction = (double)phase / RESAMPLE_PHASES;
+            double sum = 0.0;
+            for( int t = 0; t < RESAMPLE_TAPS; ++t )
+            {
+                double x = t - ( RESAMPLE_TAPS / 2 - 1 ) - fraction;
+                double window = 0.42 + 0.5 * cos( M_PI * x / ( RESAMPLE_TAPS / 2 ) ) + 0.08 * cos( 2.0 * M_PI * x / ( RESAMPLE_TAPS / 2 ) );
+                double sinc = x == 0.0 ? 1.0 : sin( M_PI * cutoff * x ) / ( M_PI * cutoff * x );
+                taps[ t ] = cutoff * sinc * window;
+                sum += taps[ t ];
+            }
+
+            // Unity gain at every phase, so a pitched voice is as loud as an unpitched one
+            for( int t = 0; t < RESAMPLE_TAPS; ++t )
+            {
+                taps[ t ] /= sum;
+            }
+        }
+    }
+    return &kernels[ 0 ];
+}
+
+bool LMixer::send( const LAudioCommand& command, bool droppable )
+{
+    Uint64 deadline = 0;
+    while( !mQueue.push( command ) )
+    {
+        // A sound effect is not worth waiting for, anything else waits for the callback to make room
+        if( droppable )
+        {
+            ++mDroppedCount;
+            return false;
+        }
+        if( mHooked && !hasCallbackStalled( deadline ) )
+        {
+            SDL_Delay( 1 );
+        }
+        else
+        {
+            applyCommandsHere();
+        }
+    }
+    return true;
+}
+
+void LMixer::applyCommands()
+{
+    LAudioCommand command = {};
+    while( mQueue.pop( command ) )
+    {
+        apply( command );
+    }
+}
+
+void LMixer::apply( const LAudioCommand& command )
+{
+    Voice* voice = NULL;
+    switch( command.type )
+    {
+        case AUDIO_PLAY:
+        startVoice( command );
+        mStartedHandle.store( command.voice, std::memory_order_release );
+        break;
+
+        case AUDIO_STOP:
+        voice = findVoice( command.voice );
+        if( voice != NULL )
+        {
+            voice->stopping = true;
+            voice->targetLeft = 0.0f;
+            voice->targetRight = 0.0f;
+        }
+        break;
+
+        case AUDIO_SET_GAIN:
+        voice = findVoice( command.voice );
+        if( voice != NULL && !voice->stopping )
+        {
+            panGains( command.gain, command.pan, voice->targetLeft, voice->targetRight );
+        }
+        break;
+
+        case AUDIO_SET_PITCH:
+        voice = findVoice( command.voice );
+        if( voice != NULL )
+        {
+            voice->step = pitchStep( voice->sound, command.pitch );
+        }
+        break;
+
+        // Cut at once, the game thread is waiting to free the samples
+        case AUDIO_STOP_SOUND:
+        for( int i = 0; i < (int)mVoices.size(); ++i )
+        {
+            if( mVoices[ i ].sound == command.sound )
+            {
+                freeVoice( i );
+            }
+        }
+        for( int i = (int)mStolen.size() - 1; i >= 0; --i )
+        {
+            if( mStolen[ i ].sound == command.sound )
+            {
+                mStolen.erase( mStolen.begin() + i );
+            }
+        }
+        break;
+
+        // Streams still decoding when a newer one comes never get to play, and fully paused ones are silent already
+        case AUDIO_PLAY_MUSIC:
+        {
+            bool silent = mMusicPaused && mMusicLevel == 0.0f;
+            MusicDeck* deck = NULL;
+            for( int i = 0; i < MUSIC_DECKS; ++i )
+            {
+                if( mDecks[ i ].stream != NULL && ( mDecks[ i ].waiting || silent ) )
+                {
+                    dropDeck( mDecks[ i ] );
+                }
+                if( mDecks[ i ].stream == NULL )
+                {
+                    deck = &mDecks[ i ];
+                }
+            }
+
+            // With every deck busy the quietest one is cut
+            if( deck == NULL )
+            {
+                deck = &mDecks[ 0 ];
+                for( int i = 1; i < MUSIC_DECKS; ++i )
+                {
+                    if( mDecks[ i ].level < deck->level )
+                    {
+                        deck = &mDecks[ i ];
+                    }
+                }
+                dropDeck( *deck );
+            }
+
+            bool playing = false;
+            for( int i = 0; i < MUSIC_DECKS; ++i )
+            {
+                playing = playing || mDecks[ i ].stream != NULL;
+            }
+            if( !playing )
+            {
+                mMusicLevel = 1.0f;
+            }
+            mMusicTarget = 1.0f;
+            mMusicPaused = false;
+
+            // Even an instant start fades in over a block, so it does not click
+            deck->stream = command.stream;
+            deck->level = 0.0f;
+            deck->target = 1.0f;
+            deck->rate = 1.0f / std::max( command.seconds * mFrequency, (float)MIXER_BLOCK_FRAMES );
+            deck->waiting = true;
+        }
+        break;
+
+        case AUDIO_PAUSE_MUSIC:
+        for( int i = 0; i < MUSIC_DECKS; ++i )
+        {
+            if( mDecks[ i ].stream != NULL )
+            {
+                mMusicPaused = true;
+                mMusicTarget = 0.0f;
+            }
+        }
+        break;
+
+        case AUDIO_RESUME_MUSIC:
+        mMusicPaused = false;
+        mMusicTarget = 1.0f;
+        break;
+
+        // Decks fade out on their own, paused ones hold still and are dropped once silent
+        case AUDIO_HALT_MUSIC:
+        for( int i = 0; i < MUSIC_DECKS; ++i )
+        {
+            MusicDeck& deck = mDecks[ i ];
+            if( deck.stream != NULL && deck.waiting )
+            {
+                dropDeck( deck );
+            }
+            else if( deck.stream != NULL && deck.target > 0.0f )
+            {
+                deck.target = 0.0f;
+                deck.rate = std::max( deck.rate, 1.0f / (float)( MUSIC_PAUSE_FADE_SECONDS * mFrequency ) );
+            }
+        }
+        break;
+
+        case AUDIO_DETACH_MUSIC:
+        for( int i = 0; i < MUSIC_DECKS; ++i )
+        {
+            if( mDecks[ i ].stream == command.stream )
+            {
+                dropDeck( mDecks[ i ] );
+            }
+        }
+        break;
+
+        case AUDIO_CANCEL_MUSIC:
+        for( int i = 0; i < MUSIC_DECKS; ++i )
+        {
+            if( mDecks[ i ].stream == command.stream && mDecks[ i ].waiting )
+            {
+                dropDeck( mDecks[ i ] );
+            }
+        }
+        break;
+    }
+}
+
+void LMixer::startVoice( const LAudioCommand& command )
+{
+    // A free voice, or else the least important one, voices already fading out going first
+    int chosen = -1;
+    int victim = -1;
+    for( int i = 0; i < (int)mVoices.size() && chosen < 0; ++i )
+    {
+        Voice& voice = mVoices[ i ];
+        if( voice.sound == NULL )
+        {
+            chosen = i;
+        }
+        else if( victim < 0 )
+        {
+            victim = i;
+        }
+        else
+        {
+            Voice& other = mVoices[ victim ];
+            if( voice.stopping != other.stopping )
+            {
+                victim = voice.stopping ? i : victim;
+            }
+            else if( voice.priority != other.priority )
+            {
+                victim = voice.priority < other.priority ? i : victim;
+            }
+            else if( (Sint32)( voice.started - other.started ) < 0 )
+            {
+                victim = i;
+            }
+        }
+    }
+    if( chosen < 0 )
+    {
+        // Everything playing matters more than the new sound
+        if( !mVoices[ victim ].stopping && mVoices[ victim ].priority > command.priority )
+        {
+            mRefusedCount.fetch_add( 1, std::memory_order_relaxed );
+            return;
+        }
+        chosen = victim;
+        mStolenCount.fetch_add( 1, std::memory_order_relaxed );
+
+        // The stolen sound fades out over a block like a stopped one, unless more were stolen this block than there are voices
+        if( mStolen.size() < mStolen.capacity() )
+        {
+            Voice tail = mVoices[ victim ];
+            tail.stopping = true;
+            tail.targetLeft = 0.0f;
+            tail.targetRight = 0.0f;
+            tail.pressed = 0;
+            mStolen.push_back( tail );
+        }
+    }
+
+    Voice& voice = mVoices[ chosen ];
+    voice.sound = command.sound;
+    voice.handle = command.voice;
+    voice.position = 0;
+    voice.step = pitchStep( command.sound, command.pitch );
+    panGains( command.gain, command.pan, voice.targetLeft, voice.targetRight );
+    voice.gainLeft = voice.targetLeft;
+    voice.gainRight = voice.targetRight;
+    voice.priority = command.priority;
+    voice.started = mPlayCount++;
+    voice.loop = command.loop;
+    voice.stopping = false;
+    voice.pressed = command.pressed;
+    mVoiceHandles[ chosen ].store( command.voice, std::memory_order_relaxed );
+}
+
+bool LMixer::mixVoice( Voice& voice, float* frames, int frameCount )
+{
+    LSound* sound = voice.sound;
+    const float* samples = sound->getFrames();
+    Sint64 length = sound->getFrameCount();
+    Uint64 end = (Uint64)length << 32;
+
+    // Gains ramp from where the last block left them to the target over this block
+    float rampLeft = ( voice.targetLeft - voice.gainLeft ) / frameCount;
+    float rampRight = ( voice.targetRight - voice.gainRight ) / frameCount;
+
+    // The first band whose step covers the voice's
+    int band = 0;
+    while( band < RESAMPLE_BANDS - 1 && voice.step > (Uint64)( RESAMPLE_BAND_STEPS[ band ] * 4294967296.0 ) )
+    {
+        ++band;
+    }
+    const float* kernels = mKernels + band * ( RESAMPLE_PHASES + 1 ) * RESAMPLE_TAPS;
+
+    int done = 0;
+    bool ended = false;
+    while( done < frameCount && !ended )
+    {
+        float gainLeft = voice.gainLeft + rampLeft * done;
+        float gainRight = voice.gainRight + rampRight * done;
+        float* out = frames + done * 2;
+        Sint64 index = voice.position >> 32;
+
+        // Frames left before the end of the sound, or before the filter reaches past it when looping
+        Uint64 limit = end;
+        bool unresampled = voice.step == ( (Uint64)1 << 32 ) && (Uint32)voice.position == 0;
+        if( voice.loop && !unresampled )
+        {
+            limit = length > RESAMPLE_TAPS ? end - ( (Uint64)( RESAMPLE_TAPS / 2 ) << 32 ) : 0;
+        }
+        int run = 0;
+        if( voice.position < limit && ( !voice.loop || unresampled || index >= RESAMPLE_TAPS / 2 - 1 ) )
+        {
+            run = (int)std::min( (Uint64)( frameCount - done ), ( limit - voice.position + voice.step - 1 ) / voice.step );
+        }
+
+        if( run > 0 && unresampled )
+        {
+            // Played at its own rate the filter is only its center tap, so skip it
+            mCopy( samples + index * 2, out, run, gainLeft, gainRight, rampLeft, rampRight );
+            voice.position += (Uint64)run << 32;
+        }
+        else if( run > 0 )
+        {
+            // Past either end of a one-shot sound the filter reads the silent padding
+            voice.position = mResample( samples, voice.position, voice.step, kernels, out, run, gainLeft, gainRight, rampLeft, rampRight );
+        }
+        else if( voice.loop )
+        {
+            // Near the loop point the filter wraps around, one frame at a time
+            float window[ RESAMPLE_TAPS * 2 ];
+            for( int t = 0; t < RESAMPLE_TAPS; ++t )
+            {
+                Sint64 source = ( ( index - RESAMPLE_TAPS / 2 + 1 + t ) % length + length ) % length;
+                window[ t * 2 ] = samples[ source * 2 ];
+                window[ t * 2 + 1 ] = samples[ source * 2 + 1 ];
+            }
+            resampleScalar( window + ( RESAMPLE_TAPS / 2 - 1 ) * 2, (Uint32)voice.position, voice.step, kernels,
+                            out, 1, gainLeft, gainRight, 0.0f, 0.0f );
+            voice.position += voice.step;
+            run = 1;
+        }
+        done += run;
+
+        if( voice.position >= end )
+        {
+            if( voice.loop )
+            {
+                voice.position %= end;
+            }
+            else
+            {
+                ended = true;
+            }
+        }
+    }
+
+    voice.gainLeft = voice.targetLeft;
+    voice.gainRight = voice.targetRight;
+
+    // Voices fading out are done after one block
+    return !ended && !voice.stopping;
+}
+
+void LMixer::recordLatency( Uint64 pressed, int frameCount )
+{
+    // Mixed outside a callback, the block counts as the whole buffer and as starting now
+    Uint64 start = mCallbackStart;
+    int length = mCallbackLength;
+    int offset = mCallbackOffset;
+    if( start == 0 )
+    {
+        start = SDL_GetPerformanceCounter();
+        length = frameCount;
+        offset = 0;
+    }
+
+    // SDL plays a buffer once the one before it is out, so the first sample leaves a whole buffer after the callback plus where it sits in it
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 due = start + (Uint64)( length + offset ) * frequency / mFrequency;
+    Uint64 ticks = due > pressed ? due - pressed : 0;
+    mLastLatencyTicks.store( ticks, std::memory_order_relaxed );
+    mTotalLatencyTicks.fetch_add( ticks, std::memory_order_relaxed );
+    if( ticks > mWorstLatencyTicks.load( std::memory_order_relaxed ) )
+    {
+        mWorstLatencyTicks.store( ticks, std::memory_order_relaxed );
+    }
+    mLatencyCount.fetch_add( 1, std::memory_order_release );
+}
+
+void LMixer::mixMusic( float* frames, int frameCount )
+{
+    // A stream that failed to open is dropped and whatever played carries on, one that is ready fades the others out as it fades in
+    for( int i = 0; i < MUSIC_DECKS; ++i )
+    {
+        MusicDeck& deck = mDecks[ i ];
+        if( deck.stream == NULL || !deck.waiting || !deck.stream->isReady() )
+        {
+            continue;
+        }
+        if( deck.stream->hasFailed() )
+        {
+            dropDeck( deck );
+            continue;
+        }
+
+        deck.waiting = false;
+        for( int j = 0; j < MUSIC_DECKS; ++j )
+        {
+            MusicDeck& other = mDecks[ j ];
+            if( j != i && other.stream != NULL && !other.waiting && other.target > 0.0f )
+            {
+                other.target = 0.0f;
+                other.rate = deck.rate;
+            }
+        }
+    }
+
+    // Paused music holds its place, and decks that were fading out anyway can go
+    if( mMusicPaused && mMusicLevel == 0.0f )
+    {
+        for( int i = 0; i < MUSIC_DECKS; ++i )
+        {
+            if( mDecks[ i ].stream != NULL && !mDecks[ i ].waiting && mDecks[ i ].target == 0.0f )
+            {
+                dropDeck( mDecks[ i ] );
+            }
+        }
+        return;
+    }
+
+    float masterStart = mMusicLevel;
+    mMusicLevel = fadeToward( mMusicLevel, mMusicTarget, frameCount / (float)( MUSIC_PAUSE_FADE_SECONDS * mFrequency ) );
+    for( int i = 0; i < MUSIC_DECKS; ++i )
+    {
+        MusicDeck& deck = mDecks[ i ];
+        if( deck.stream == NULL || deck.waiting )
+        {
+            continue;
+        }
+
+        // Equal power, so a crossfade keeps the loudness where the two tracks are unrelated
+        float levelStart = deck.level;
+        deck.level = fadeToward( deck.level, deck.target, deck.rate * frameCount );
+        float gainStart = sinf( levelStart * (float)M_PI / 2.0f ) * masterStart;
+        float gainEnd = sinf( deck.level * (float)M_PI / 2.0f ) * mMusicLevel;
+        float gainStep = ( gainEnd - gainStart ) / frameCount;
+
+        deck.stream->read( mMusicBlock, frameCount );
+        for( int f = 0; f < frameCount; ++f )
+        {
+            float gain = gainStart + gainStep * f;
+            frames[ f * 2 ] += mMusicBlock[ f * 2 ] * gain;
+            frames[ f * 2 + 1 ] += mMusicBlock[ f * 2 + 1 ] * gain;
+        }
+
+        if( ( deck.level == 0.0f && deck.target == 0.0f ) || deck.stream->isFinished() )
+        {
+            dropDeck( deck );
+        }
+    }
+}
+
+void LMixer::dropDeck( MusicDeck& deck )
+{
+    deck.stream->setInUse( false );
+    deck.stream = NULL;
+}
+
+void LMixer::freeVoice( int index )
+{
+    mVoices[ index ].sound = NULL;
+    mVoiceHandles[ index ].store( 0, std::memory_order_relaxed );
+}
+
+LMixer::Voice* LMixer::findVoice( int handle )
+{
+    for( int i = 0; i < (int)mVoices.size(); ++i )
+    {
+        if( mVoices[ i ].sound != NULL && mVoices[ i ].handle == handle )
+        {
+            return &mVoices[ i ];
+        }
+    }
+    return NULL;
+}
+
+void LMixer::panGains( float gain, float pan, float& left, float& right )
+{
+    // Equal power, scaled so the middle leaves both sides at full gain like an unpanned sound
+    float angle = ( std::max( -1.0f, std::min( 1.0f, pan ) ) + 1.0f ) * (float)M_PI / 4.0f;
+    left = gain * std::min( 1.0f, (float)M_SQRT2 * cosf( angle ) );
+    right = gain * std::min( 1.0f, (float)M_SQRT2 * sinf( angle ) );
+}
+
+float LMixer::fadeToward( float value, float target, float distance )
+{
+    return value < target ? std::min( target, value + distance ) : std::max( target, value - distance );
+}
+
+Uint64 LMixer::pitchStep( LSound* sound, float pitch )
+{
+    // Sounds recorded at another rate are resampled to the output's too
+    // A NaN pitch fails both comparisons and ends up at the bottom of the range
+    double ratio = std::min( MIXER_MAX_PITCH, std::max( MIXER_MIN_PITCH, (double)pitch ) ) * sound->getFrequency() / mFrequency;
+    return std::max( (Uint64)1, (Uint64)( ratio * 4294967296.0 ) );
+}
+
+LMusicPlayer::LMusicPlayer( LMixer* mixer )
+{
+    mMixer = mixer;
+    mCurrent = 0;
+    mPlaying = false;
+    mPaused = false;
+    mReopening = false;
+    mReopenSeconds = 0.0;
+    mReopenFade = 0.0;
+    mStartCount = 0;
+    for( int i = 0; i < MUSIC_DECKS; ++i )
+    {
+        mStarted[ i ] = 0;
+    }
+}
+
+void LMusicPlayer::play( std::string path, double fadeSeconds, double startSeconds )
+{
+    // The mixer stays paused, so the track only moves until resume()
+    if( mPlaying && mPaused )
+    {
+        mReopening = true;
+        mReopenPath = path;
+        mReopenSeconds = startSeconds;
+        mReopenFade = fadeSeconds;
+        return;
+    }
+
+    // A stream still waiting to start is reopened, so what plays carries on until the newest one is ready
+    // Otherwise one the mixer let go of is taken, and only with every deck still fading is the oldest cut short
+    int next = mCurrent;
+    if( !mPlaying || !mMixer->cancelMusic( &mStreams[ mCurrent ] ) )
+    {
+        next = ( mCurrent + 1 ) % MUSIC_DECKS;
+        for( int i = 0; i < MUSIC_DECKS; ++i )
+        {
+            if( i == mCurrent || i == next )
+            {
+                continue;
+            }
+            bool freer = !mStreams[ i ].isInUse() && mStreams[ next ].isInUse();
+            bool older = mStreams[ i ].isInUse() == mStreams[ next ].isInUse() && mStarted[ i ] < mStarted[ next ];
+            if( freer || older )
+            {
+                next = i;
+            }
+        }
+    }
+    LMusicStream& stream = mStreams[ next ];
+    mMixer->detachMusic( &stream );
+    stream.open( path, mMixer->getFrequency(), startSeconds, true );
+    mMixer->playMusic( &stream, fadeSeconds );
+
+    mStarted[ next ] = ++mStartCount;
+    mCurrent = next;
+    mPlaying = true;
+    mPaused = false;
+}
+
+void LMusicPlayer::seek( double seconds )
+{
+    if( mPlaying )
+    {
+        play( getPath(), MUSIC_SEEK_FADE_SECONDS, seconds );
+    }
+}
+
+void LMusicPlayer::pause()
+{
+    if( mPlaying && !mPaused )
+    {
+        mMixer->pauseMusic();
+        mPaused = true;
+    }
+}
+
+void LMusicPlayer::resume()
+{
+    if( mPlaying && mPaused && mReopening )
+    {
+        mPaused = false;
+        mReopening = false;
+        play( mReopenPath, mReopenFade, mReopenSeconds );
+    }
+    else if( mPlaying && mPaused )
+    {
+        mMixer->resumeMusic();
+        mPaused = false;
+    }
+}
+
+void LMusicPlayer::halt()
+{
+    if( mPlaying )
+    {
+        mMixer->haltMusic();
+        mPlaying = false;
+        mPaused = false;
+        mReopening = false;
+    }
+}
+
+void LMusicPlayer::close()
+{
+    for( int i = 0; i < MUSIC_DECKS; ++i )
+    {
+        mMixer->detachMusic( &mStreams[ i ] );
+        mStreams[ i ].close();
+    }
+    mPlaying = false;
+    mPaused = false;
+    mReopening = false;
+}
+
+bool LMusicPlayer::isPlaying()
+{
+    return mPlaying;
+}
+
+bool LMusicPlayer::isPaused()
+{
+    return mPaused;
+}
+
+std::string LMusicPlayer::getPath()
+{
+    return mReopening ? mReopenPath : mStreams[ mCurrent ].getPath();
+}
+
+double LMusicPlayer::getPosition()
+{
+    return mReopening ? mReopenSeconds : mStreams[ mCurrent ].getPosition();
+}
+
+int LMusicPlayer::getUnderrunCount()
+{
+    return mStreams[ mCurrent ].getUnderrunCount();
+}
+
+LProfiler::LProfiler()
+{
+    mEnabled = false;
+    mFrequency = 1;
+    mFrameCount = 0;
+    mFrameStart = 0;
+    mPhase = PROFILE_PHASE_TOTAL;
+    mPhaseStart = 0;
+    mTracing = false;
+    memset( mFrames, 0, sizeof( mFrames ) );
+}
+
+void LProfiler::setEnabled( bool enabled )
+{
+    mEnabled = enabled;
+    mFrequency = SDL_GetPerformanceFrequency();
+}
+
+bool LProfiler::isEnabled()
+{
+    return mEnabled;
+}
+
+void LProfiler::beginFrame()
+{
+    if( !mEnabled )
+    {
+        return;
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    closePhase( now );
+
+    // The first call only starts timing
+    if( mFrameStart != 0 )
+    {
+        mFrames[ mFrameCount % PROFILE_FRAMES ].total = now - mFrameStart;
+        addTraceEvent( "frame", mFrameStart, now );
+        ++mFrameCount;
+    }
+
+    FrameTiming& frame = mFrames[ mFrameCount % PROFILE_FRAMES ];
+    memset( &frame, 0, sizeof( frame ) );
+    mFrameStart = now;
+}
+
+void LProfiler::mark( ProfilePhase phase )
+{
+    if( !mEnabled )
+    {
+        return;
+    }
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    closePhase( now );
+    mPhase = phase;
+    mPhaseStart = now;
+}
+
+void LProfiler::addTraceEvent( const char* name, Uint64 start, Uint64 end )
+{
+    if( !mTracing )
+    {
+        return;
+    }
+
+    TraceEvent event;
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    event.tid = tJobQueue;
+
+    std::lock_guard<std::mutex> lock( mTraceLock );
+    if( (int)mTrace.size() < PROFILE_MAX_TRACE_EVENTS )
+    {
+        mTrace.push_back( event );
+    }
+}
+
+void LProfiler::startTrace()
+{
+    std::lock_guard<std::mutex> lock( mTraceLock );
+    mTrace.clear();
+    mTrace.reserve( PROFILE_TRACE_RESERVE_EVENTS );
+    mTracing = true;
+}
+
+bool LProfiler::writeTrace( std::string path )
+{
+    FILE* file = fopen( path.c_str(), "w" );
+    if( file == NULL )
+    {
+        printf( "Unable to write trace %s!\n", path.c_str() );
+        return false;
+    }
+
+    // Complete events, timestamps in microseconds from the first event
+    std::lock_guard<std::mutex> lock( mTraceLock );
+    Uint64 origin = mTrace.empty() ? 0 : mTrace[ 0 ].start;
+    for( int i = 0; i < (int)mTrace.size(); ++i )
+    {
+        origin = std::min( origin, mTrace[ i ].start );
+    }
+    fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+    for( int i = 0; i < (int)mTrace.size(); ++i )
+    {
+        const TraceEvent& event = mTrace[ i ];
+        fprintf( file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                 event.name, event.tid, ( event.start - origin ) * 1e6 / mFrequency, ( event.end - event.start ) * 1e6 / mFrequency,
+                 i + 1 < (int)mTrace.size() ? "," : "" );
+    }
+    fprintf( file, "]}\n" );
+    fclose( file );
+
+    printf( "Wrote %d trace events to %s%s\n", (int)mTrace.size(), path.c_str(),
+            (int)mTrace.size() == PROFILE_MAX_TRACE_EVENTS ? ", later events were dropped" : "" );
+    return true;
+}
+
+void LProfiler::renderGraph( int x, int y, int w, int h )
+{
+    int frames = std::min( mFrameCount, PROFILE_FRAMES );
+    if( frames == 0 )
+    {
+        return;
+    }
+
+    // Darken what is behind the graph
+    SDL_Rect background = { x, y, w, h };
+    SDL_SetRenderDrawBlendMode( gRenderer, SDL_BLENDMODE_BLEND );
+    SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0x00, 0x80 );
+    SDL_RenderFillRect( gRenderer, &background );
+    SDL_SetRenderDrawBlendMode( gRenderer, SDL_BLENDMODE_NONE );
+
+    // One column per frame, newest on the right, each phase stacked on the ones before it
+    double pixelsPerTick = h * 30.0 / mFrequency;
+    static std::vector<SDL_Rect> bars[ PROFILE_PHASE_TOTAL ];
+    for( int phase = 0; phase < PROFILE_PHASE_TOTAL; ++phase )
+    {
+        bars[ phase ].clear();
+    }
+    for( int i = 0; i < frames; ++i )
+    {
+        const FrameTiming& frame = mFrames[ ( mFrameCount - frames + i ) % PROFILE_FRAMES ];
+        int left = x + w - ( frames - i ) * w / PROFILE_FRAMES;
+        int right = x + w - ( frames - i - 1 ) * w / PROFILE_FRAMES;
+        int bottom = y + h;
+        for( int phase = 0; phase < PROFILE_PHASE_TOTAL && bottom > y; ++phase )
+        {
+            int height = std::min( bottom - y, (int)( frame.phases[ phase ] * pixelsPerTick ) );
+            if( height > 0 )
+            {
+                SDL_Rect bar = { left, bottom - height, std::max( 1, right - left ), height };
+                bars[ phase ].push_back( bar );
+                bottom -= height;
+            }
+        }
+    }
+
+    // One fill call per phase
+    for( int phase = 0; phase < PROFILE_PHASE_TOTAL; ++phase )
+    {
+        if( !bars[ phase ].empty() )
+        {
+            const SDL_Color& color = PROFILE_PHASE_COLORS[ phase ];
+            SDL_SetRenderDrawColor( gRenderer, color.r, color.g, color.b, color.a );
+            SDL_RenderFillRects( gRenderer, &bars[ phase ][ 0 ], bars[ phase ].size() );
+        }
+    }
+
+    // 60 frames per second line
+    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
+    SDL_RenderDrawLine( gRenderer, x, y + h / 2, x + w - 1, y + h / 2 );
+}
+
+void LProfiler::printSummary()
+{
+    int frames = std::min( mFrameCount, PROFILE_FRAMES );
+    if( frames == 0 )
+    {
+        return;
+    }
+
+    printf( "Last %d frames, milliseconds:\n", frames );
+    for( int phase = 0; phase <= PROFILE_PHASE_TOTAL; ++phase )
+    {
+        Uint64 sum = 0, worst = 0;
+        for( int i = 0; i < frames; ++i )
+        {
+            const FrameTiming& frame = mFrames[ ( mFrameCount - frames + i ) % PROFILE_FRAMES ];
+            Uint64 ticks = phase < PROFILE_PHASE_TOTAL ? frame.phases[ phase ] : frame.total;
+            sum += ticks;
+            worst = std::max( worst, ticks );
+        }
+        printf( "%-8s average %7.3f worst %7.3f\n", phase < PROFILE_PHASE_TOTAL ? PROFILE_PHASE_NAMES[ phase ] : "frame",
+                sum * 1000.0 / frames / mFrequency, worst * 1000.0 / mFrequency );
+    }
+}
+
+void LProfiler::closePhase( Uint64 now )
+{
+    if( mPhase == PROFILE_PHASE_TOTAL )
+    {
+        return;
+    }
+
+    mFrames[ mFrameCount % PROFILE_FRAMES ].phases[ mPhase ] += now - mPhaseStart;
+    addTraceEvent( PROFILE_PHASE_NAMES[ mPhase ], mPhaseStart, now );
+    mPhase = PROFILE_PHASE_TOTAL;
+}
+
+LProfileScope::LProfileScope( const char* name )
+{
+    mName = name;
+    mStart = gProfiler.isEnabled() ? SDL_GetPerformanceCounter() : 0;
+}
+
+LProfileScope::~LProfileScope()
+{
+    if( mStart != 0 )
+    {
+        gProfiler.addTraceEvent( mName, mStart, SDL_GetPerformanceCounter() );
+    }
+}
+
+// Input log identification, bumped when LInputRecord changes
+const char INPUT_LOG_MAGIC[ 4 ] = { 'L', 'I', 'N', 'P' };
+const Uint32 INPUT_LOG_VERSION = 1;
+
+LInputRecorder::LInputRecorder()
+{
+    mFile = NULL;
+    mCount = 0;
+}
+
+LInputRecorder::~LInputRecorder()
+{
+    // Without an end record the replay ends on the last event
+    if( mFile != NULL )
+    {
+        fclose( mFile );
+    }
+}
+
+bool LInputRecorder::start( std::string path )
+{
+    mFile = fopen( path.c_str(), "wb" );
+    if( mFile == NULL )
+    {
+        printf( "Unable to create input log %s! %s\n", path.c_str(), strerror( errno ) );
+        return false;
+    }
+
+    LInputLogHeader header;
+    memcpy( header.magic, INPUT_LOG_MAGIC, sizeof( header.magic ) );
+    header.version = INPUT_LOG_VERSION;
+    header.ticksPerSecond = TICKS_PER_SECOND;
+    header.reserved = 0;
+    fwrite( &header, sizeof( header ), 1, mFile );
+    mCount = 0;
+    return true;
+}
+
+bool LInputRecorder::record( Uint32 tick, const SDL_Event& e )
+{
+    if( mFile == NULL )
+    {
+        return false;
+    }
+
+    LInputRecord record;
+    memset( &record, 0, sizeof( record ) );
+    record.tick = tick;
+    switch( e.type )
+    {
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            record.kind = e.type == SDL_KEYDOWN ? INPUT_RECORD_KEY_DOWN : INPUT_RECORD_KEY_UP;
+            record.detail = e.key.repeat;
+            record.key = e.key.keysym.sym;
+            break;
+
+        case SDL_MOUSEMOTION:
+            record.kind = INPUT_RECORD_MOUSE_MOTION;
+            record.x = e.motion.x;
+            record.y = e.motion.y;
+            break;
+
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP:
+            record.kind = e.type == SDL_MOUSEBUTTONDOWN ? INPUT_RECORD_MOUSE_DOWN : INPUT_RECORD_MOUSE_UP;
+            record.detail = e.button.button;
+            record.x = e.button.x;
+            record.y = e.button.y;
+            break;
+
+        default:
+            return false;
+    }
+
+    fwrite( &record, sizeof( record ), 1, mFile );
+    ++mCount;
+    return true;
+}
+
+void LInputRecorder::stop( Uint32 tick )
+{
+    if( mFile == NULL )
+    {
+        return;
+    }
+
+    LInputRecord record;
+    memset( &record, 0, sizeof( record ) );
+    record.tick = tick;
+    record.kind = INPUT_RECORD_END;
+    fwrite( &record, sizeof( record ), 1, mFile );
+    fclose( mFile );
+    mFile = NULL;
+    printf( "Recorded %d input events over %u ticks\n", mCount, tick );
+}
+
+bool LInputRecorder::isRecording()
+{
+    return mFile != NULL;
+}
+
+LInputReplay::LInputReplay()
+{
+    mNext = 0;
+    mEndTick = 0;
+}
+
+void LInputReplay::add( Uint32 tick, const SDL_Event& e )
+{
+    Entry entry;
+    entry.tick = tick;
+    entry.event = e;
+    mEntries.push_back( entry );
+}
+
+bool LInputReplay::poll( Uint32 tick, SDL_Event& e )
+{
+    if( mNext >= (int)mEntries.size() || mEntries[ mNext ].tick > tick )
+    {
+        return false;
+    }
+    e = mEntries[ mNext ].event;
+    ++mNext;
+    return true;
+}
+
+Uint32 LInputReplay::getEndTick()
+{
+    return mEndTick;
+}
+
+bool LInputReplay::isFinished( Uint32 tick )
+{
+    // Events stamped with the last tick came after it ran, so they never changed anything
+    return tick >= mEndTick && ( mNext >= (int)mEntries.size() || mEntries[ mNext ].tick >= mEndTick );
+}
+
+void LInputReplay::generate( Uint32 ticks, unsigned int seed )
+{
+    clear();
+
+    // Hold one arrow key at a time for a quarter to one second, sometimes none
+    const SDL_Keycode KEYS[] = { SDLK_UP, SDLK_DOWN, SDLK_LEFT, SDLK_RIGHT };
+    SDL_Event e;
+    memset( &e, 0, sizeof( e ) );
+    Uint32 tick = 0;
+    while( tick < ticks )
+    {
+        // Small linear congruential generator, so every platform gets the same pattern
+        seed = seed * 1103515245 + 12345;
+        int key = ( seed >> 16 ) % 5;
+        Uint32 hold = TICKS_PER_SECOND / 4 + ( seed >> 8 ) % ( TICKS_PER_SECOND * 3 / 4 );
+
+        if( key < 4 )
+        {
+            e.type = SDL_KEYDOWN;
+            e.key.keysym.sym = KEYS[ key ];
+            add( tick, e );
+        }
+        tick += hold;
+        if( key < 4 )
+        {
+            e.type = SDL_KEYUP;
+            add( tick, e );
+        }
+    }
+    mEndTick = ticks;
+}
+
+bool LInputReplay::load( std::string path )
+{
+    clear();
+
+    FILE* file = fopen( path.c_str(), "rb" );
+    if( file == NULL )
+    {
+        printf( "Unable to open input log %s! %s\n", path.c_str(), strerror( errno ) );
+        return false;
+    }
+
+    // Ticks only line up if the log was made at our tick rate
+    LInputLogHeader header;
+    if( fread( &header, sizeof( header ), 1, file ) != 1 || memcmp( header.magic, INPUT_LOG_MAGIC, sizeof( header.magic ) ) != 0 ||
+        header.version != INPUT_LOG_VERSION || header.ticksPerSecond != (Uint32)TICKS_PER_SECOND )
+    {
+        printf( "%s is not an input log for this build!\n", path.c_str() );
+        fclose( file );
+        return false;
+    }
+
+    LInputRecord record;
+    SDL_Event e;
+    bool ended = false;
+    while( !ended && fread( &record, sizeof( record ), 1, file ) == 1 )
+    {
+        memset( &e, 0, sizeof( e ) );
+        switch( record.kind )
+        {
+            case INPUT_RECORD_KEY_DOWN:
+            case INPUT_RECORD_KEY_UP:
+                e.type = record.kind == INPUT_RECORD_KEY_DOWN ? SDL_KEYDOWN : SDL_KEYUP;
+                e.key.state = record.kind == INPUT_RECORD_KEY_DOWN ? SDL_PRESSED : SDL_RELEASED;
+                e.key.repeat = record.detail;
+                e.key.keysym.sym = record.key;
+                break;
+
+            case INPUT_RECORD_MOUSE_MOTION:
+                e.type = SDL_MOUSEMOTION;
+                e.motion.x = record.x;
+                e.motion.y = record.y;
+                break;
+
+            case INPUT_RECORD_MOUSE_DOWN:
+            case INPUT_RECORD_MOUSE_UP:
+                e.type = record.kind == INPUT_RECORD_MOUSE_DOWN ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+                e.button.state = record.kind == INPUT_RECORD_MOUSE_DOWN ? SDL_PRESSED : SDL_RELEASED;
+                e.button.button = record.detail;
+                e.button.x = record.x;
+                e.button.y = record.y;
+                break;
+
+            case INPUT_RECORD_END:
+                ended = true;
+                break;
+
+            default:
+                continue;
+        }
+
+        if( !ended )
+        {
+            add( record.tick, e );
+        }
+        mEndTick = std::max( mEndTick, record.tick );
+    }
+    fclose( file );
+    return true;
+}
+
+void LInputReplay::clear()
+{
+    mEntries.clear();
+    mNext = 0;
+    mEndTick = 0;
+}
+
+int LInputReplay::getCount()
+{
+    return mEntries.size();
+}
+
+LDirtyRegions::LDirtyRegions()
+{
+    invalidateAll();
+}
+
+void LDirtyRegions::track( int id, const SDL_Rect& bounds )
+{
+    // Items seen for the first time were not drawn anywhere before
+    if( id >= (int)mBounds.size() )
+    {
+        SDL_Rect none = { 0, 0, 0, 0 };
+        mBounds.resize( id + 1, none );
+    }
+
+    SDL_Rect& last = mBounds[ id ];
+    if( last.x == bounds.x && last.y == bounds.y && last.w == bounds.w && last.h == bounds.h )
+    {
+        return;
+    }
+
+    // Uncover where it was and draw where it is
+    add( last );
+    add( bounds );
+    last = bounds;
+}
+
+void LDirtyRegions::add( const SDL_Rect& rect )
+{
+    SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    SDL_Rect merged;
+    if( !SDL_IntersectRect( &rect, &screen, &merged ) )
+    {
+        return;
+    }
+
+    // Fold in every area that overlaps, or is close enough that one box costs no more than both
+    bool changed = true;
+    while( changed )
+    {
+        changed = false;
+        for( int i = 0; i < (int)mRects.size(); ++i )
+        {
+            SDL_Rect both;
+            SDL_UnionRect( &merged, &mRects[ i ], &both );
+            if( SDL_HasIntersection( &merged, &mRects[ i ] ) ||
+                both.w * both.h <= merged.w * merged.h + mRects[ i ].w * mRects[ i ].h )
+            {
+                merged = both;
+                mRects[ i ] = mRects.back();
+                mRects.pop_back();
+                changed = true;
+                break;
+            }
+        }
+    }
+    mRects.push_back( merged );
+
+    // Too many small areas cost more in draw calls than one box around them all
+    if( (int)mRects.size() > DIRTY_MAX_RECTS )
+    {
+        for( int i = 1; i < (int)mRects.size(); ++i )
+        {
+            SDL_UnionRect( &mRects[ 0 ], &mRects[ i ], &mRects[ 0 ] );
+        }
+        mRects.resize( 1 );
+    }
+}
+
+void LDirtyRegions::invalidateAll()
+{
+    SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    mRects.clear();
+    mRects.push_back( screen );
+}
+
+bool LDirtyRegions::isEmpty()
+{
+    return mRects.empty();
+}
+
+const std::vector<SDL_Rect>& LDirtyRegions::getRects()
+{
+    return mRects;
+}
+
+void LDirtyRegions::clear()
+{
+    mRects.clear();
+}
+
+LCollisionWorld::LCollisionWorld( int width, int height, int cellSize )
+{
+    // Round up so the last partial cell is covered
+    mCellSize = cellSize;
+    mColumns = ( width + cellSize - 1 ) / cellSize;
+    mRows = ( height + cellSize - 1 ) / cellSize;
+
+    mWallCells.resize( mColumns * mRows );
+    mColliderCells.resize( mColumns * mRows );
+    mQueryStamp = 0;
+}
+
+int LCollisionWorld::addWall( SDL_Rect wall )
+{
+    int id = mWalls.size();
+    SDL_Rect range = cellRange( wall );
+    mWalls.push_back( wall );
+    mWallStamps.push_back( 0 );
+    insert( mWallCells, range, id );
+    return id;
+}
+
+int LCollisionWorld::addCollider( SDL_Rect collider )
+{
+    int id = mColliders.size();
+    SDL_Rect range = cellRange( collider );
+    mColliders.push_back( collider );
+    mColliderRanges.push_back( range );
+    mColliderStamps.push_back( 0 );
+    insert( mColliderCells, range, id );
+    return id;
+}
+
+void LCollisionWorld::updateCollider( int id, SDL_Rect collider )
+{
+    mColliders[ id ] = collider;
+
+    // Most moves stay inside the same cells
+    SDL_Rect range = cellRange( collider );
+    SDL_Rect& oldRange = mColliderRanges[ id ];
+    if( range.x == oldRange.x && range.y == oldRange.y && range.w == oldRange.w && range.h == oldRange.h )
+    {
+        return;
+    }
+
+    erase( mColliderCells, oldRange, id );
+    insert( mColliderCells, range, id );
+    oldRange = range;
+}
+
+void LCollisionWorld::queryWalls( SDL_Rect area, std::vector<int>& candidates )
+{
+    query( mWallCells, mWallStamps, area, candidates );
+}
+
+void LCollisionWorld::queryColliders( SDL_Rect area, std::vector<int>& candidates )
+{
+    query( mColliderCells, mColliderStamps, area, candidates );
+}
+
+bool LCollisionWorld::hitsWall( SDL_Rect rect )
+{
+    // Broadphase narrows the walls down, checkCollision gives the exact answer
+    mCandidates.clear();
+    queryWalls( rect, mCandidates );
+    for( int i = 0; i < (int)mCandidates.size(); ++i )
+    {
+        if( checkCollision( rect, mWalls[ mCandidates[ i ] ] ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+SDL_Rect LCollisionWorld::getWall( int id )
+{
+    return mWalls[ id ];
+}
+
+SDL_Rect LCollisionWorld::getCollider( int id )
+{
+    return mColliders[ id ];
+}
+
+int LCollisionWorld::getWallCount()
+{
+    return mWalls.size();
+}
+
+int LCollisionWorld::getColliderCount()
+{
+    return mColliders.size();
+}
+
+void LCollisionWorld::clear()
+{
+    for( int i = 0; i < (int)mWallCells.size(); ++i )
+    {
+        mWallCells[ i ].clear();
+        mColliderCells[ i ].clear();
+    }
+    mWalls.clear();
+    mColliders.clear();
+    mColliderRanges.clear();
+    mWallStamps.clear();
+    mColliderStamps.clear();
+}
+
+SDL_Rect LCollisionWorld::cellRange( SDL_Rect rect )
+{
+    // Cells holding the first and last pixel, clamped so nothing falls off the grid
+    int firstColumn = std::min( mColumns - 1, std::max( 0, rect.x ) / mCellSize );
+    int firstRow = std::min( mRows - 1, std::max( 0, rect.y ) / mCellSize );
+    int lastColumn = std::min( mColumns - 1, std::max( 0, rect.x + rect.w - 1 ) / mCellSize );
+    int lastRow = std::min( mRows - 1, std::max( 0, rect.y + rect.h - 1 ) / mCellSize );
+
+    SDL_Rect range = { firstColumn, firstRow, lastColumn - firstColumn + 1, lastRow - firstRow + 1 };
+    return range;
+}
+
+void LCollisionWorld::insert( std::vector< std::vector<int> >& cells, SDL_Rect range, int id )
+{
+    for( int row = range.y; row < range.y + range.h; ++row )
+    {
+        for( int column = range.x; column < range.x + range.w; ++column )
+        {
+            cells[ row * mColumns + column ].push_back( id );
+        }
+    }
+}
+
+void LCollisionWorld::erase( std::vector< std::vector<int> >& cells, SDL_Rect range, int id )
+{
+    for( int row = range.y; row < range.y + range.h; ++row )
+    {
+        for( int column = range.x; column < range.x + range.w; ++column )
+        {
+            // Order inside a cell does not matter, so swap with the last id and pop
+            std::vector<int>& cell = cells[ row * mColumns + column ];
+            for( int i = 0; i < (int)cell.size(); ++i )
+            {
+                if( cell[ i ] == id )
+                {
+                    cell[ i ] = cell.back();
+                    cell.pop_back();
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void LCollisionWorld::query( std::vector< std::vector<int> >& cells, std::vector<unsigned int>& stamps, SDL_Rect area, std::vector<int>& candidates )
+{
+    // New stamp for this query, wrap around by clearing old stamps
+    ++mQueryStamp;
+    if( mQueryStamp == 0 )
+    {
+        std::fill( mWallStamps.begin(), mWallStamps.end(), 0 );
+        std::fill( mColliderStamps.begin(), mColliderStamps.end(), 0 );
+        mQueryStamp = 1;
+    }
+
+    SDL_Rect range = cellRange( area );
+    for( int row = range.y; row < range.y + range.h; ++row )
+    {
+        for( int column = range.x; column < range.x + range.w; ++column )
+        {
+            std::vector<int>& cell = cells[ row * mColumns + column ];
+            for( int i = 0; i < (int)cell.size(); ++i )
+            {
+                if( stamps[ cell[ i ] ] != mQueryStamp )
+                {
+                    stamps[ cell[ i ] ] = mQueryStamp;
+                    candidates.push_back( cell[ i ] );
+                }
+            }
+        }
+    }
+}
+
+bool checkCollision( SDL_Rect a, SDL_Rect b )
+{
+    // Sides of the rectangle
+    int leftA, leftB;
+    int rightA, rightB;
+    int topA, topB;
+    int bottomA, bottomB;
+
+    // Calculates the sides of rect A
+    leftA = a.x;
+    rightA = a.x + a.w;
+    topA = a.y;
+    bottomA = a.y + a.h;
+
+    // Calculate the sides of rect B
+    leftB = b.x;
+    rightB = b.x + b.w;
+    topB = b.y;
+    bottomB = b.y + b.h;
+
+    // Check if any of the sides from A are outside of B
+    if( bottomA <= topB )
+    {
+        return false;
+    }
+
+    if( topA >= bottomB )
+    {
+        return false;
+    }
+
+    if( rightA <= leftB )
+    {
+        return false;
+    }
+
+    if( leftA >= rightB )
+    {
+        return false;
+    }
+
+    // If none of the sides from A are outside B
+    return true;
+}
+
+void LRectBlock::add( SDL_Rect rect )
+{
+    left.push_back( rect.x );
+    right.push_back( rect.x + rect.w );
+    top.push_back( rect.y );
+    bottom.push_back( rect.y + rect.h );
+}
+
+void LRectBlock::clear()
+{
+    left.clear();
+    right.clear();
+    top.clear();
+    bottom.clear();
+}
+
+int LRectBlock::size() const
+{
+    return left.size();
+}
+
+// Scalar version of the block test, same comparisons as checkCollision( SDL_Rect, SDL_Rect ) turned around
+static Uint32 checkCollisionScalar( int leftA, int rightA, int topA, int bottomA, const LRectBlock& block, int first, int count )
+{
+    Uint32 hits = 0;
+    for( int i = 0; i < count; ++i )
+    {
+        int b = first + i;
+        if( bottomA > block.top[ b ] && topA < block.bottom[ b ] && rightA > block.left[ b ] && leftA < block.right[ b ] )
+        {
+            hits |= 1u << i;
+        }
+    }
+    return hits;
+}
+
+#ifdef HAVE_X86_SIMD
+// Four rects at a time, each comparison gives all ones in a lane where it holds
+static Uint32 checkCollisionSSE2( int leftA, int rightA, int topA, int bottomA, const LRectBlock& block, int first, int count )
+{
+    __m128i vLeftA = _mm_set1_epi32( leftA );
+    __m128i vRightA = _mm_set1_epi32( rightA );
+    __m128i vTopA = _mm_set1_epi32( topA );
+    __m128i vBottomA = _mm_set1_epi32( bottomA );
+
+    Uint32 hits = 0;
+    int i = 0;
+    for( ; i + 4 <= count; i += 4 )
+    {
+        int b = first + i;
+        __m128i hit = _mm_cmpgt_epi32( vBottomA, _mm_loadu_si128( (const __m128i*)&block.top[ b ] ) );
+        hit = _mm_and_si128( hit, _mm_cmpgt_epi32( _mm_loadu_si128( (const __m128i*)&block.bottom[ b ] ), vTopA ) );
+        hit = _mm_and_si128( hit, _mm_cmpgt_epi32( vRightA, _mm_loadu_si128( (const __m128i*)&block.left[ b ] ) ) );
+        hit = _mm_and_si128( hit, _mm_cmpgt_epi32( _mm_loadu_si128( (const __m128i*)&block.right[ b ] ), vLeftA ) );
+        hits |= (Uint32)_mm_movemask_ps( _mm_castsi128_ps( hit ) ) << i;
+    }
+
+    // Leftover rects
+    if( i < count )
+    {
+        hits |= checkCollisionScalar( leftA, rightA, topA, bottomA, block, first + i, count - i ) << i;
+    }
+    return hits;
+}
+
+// Eight rects at a time, only called when the CPU reports AVX2
+__attribute__(( target( "avx2" ) ))
+static Uint32 checkCollisionAVX2( int leftA, int rightA, int topA, int bottomA, const LRectBlock& block, int first, int count )
+{
+    __m256i vLeftA = _mm256_set1_epi32( leftA );
+    __m256i vRightA = _mm256_set1_epi32( rightA );
+    __m256i vTopA = _mm256_set1_epi32( topA );
+    __m256i vBottomA = _mm256_set1_epi32( bottomA );
+
+    Uint32 hits = 0;
+    int i = 0;
+    for( ; i + 8 <= count; i += 8 )
+    {
+        int b = first + i;
+        __m256i hit = _mm256_cmpgt_epi32( vBottomA, _mm256_loadu_si256( (const __m256i*)&block.top[ b ] ) );
+        hit = _mm256_and_si256( hit, _mm256_cmpgt_epi32( _mm256_loadu_si256( (const __m256i*)&block.bottom[ b ] ), vTopA ) );
+        hit = _mm256_and_si256( hit, _mm256_cmpgt_epi32( vRightA, _mm256_loadu_si256( (const __m256i*)&block.left[ b ] ) ) );
+        hit = _mm256_and_si256( hit, _mm256_cmpgt_epi32( _mm256_loadu_si256( (const __m256i*)&block.right[ b ] ), vLeftA ) );
+        hits |= (Uint32)_mm256_movemask_ps( _mm256_castsi256_ps( hit ) ) << i;
+    }
+
+    // Leftover rects, clearing the upper halves first so the SSE code does not pay a state switch penalty
+    _mm256_zeroupper();
+    if( i < count )
+    {
+        hits |= checkCollisionSSE2( leftA, rightA, topA, bottomA, block, first + i, count - i ) << i;
+    }
+    return hits;
+}
+#endif
+
+// Kernels checkCollision picks between
+typedef Uint32 ( *BlockTest )( int, int, int, int, const LRectBlock&, int, int );
+
+// The widest kernel this CPU runs
+static BlockTest pickBlockTest()
+{
+    #ifdef HAVE_X86_SIMD
+    return SDL_HasAVX2() ? checkCollisionAVX2 : checkCollisionSSE2;
+    #else
+    return checkCollisionScalar;
+    #endif
+}
+
+Uint32 checkCollision( SDL_Rect a, const LRectBlock& block, int first )
+{
+    // Picked once, the first caller initializes it while any others wait, since job workers call this at the same time
+    static const BlockTest test = pickBlockTest();
+
+    int count = std::min( RECT_BLOCK_MASK_BITS, block.size() - first );
+    if( count <= 0 )
+    {
+        return 0;
+    }
+    return test( a.x, a.x + a.w, a.y, a.y + a.h, block, first, count );
+}
+
+bool checkCollisionAny( SDL_Rect a, const LRectBlock& block )
+{
+    for( int first = 0; first < block.size(); first += RECT_BLOCK_MASK_BITS )
+    {
+        if( checkCollision( a, block, first ) != 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool checkCollisionSelfTest()
+{
+    bool success = true;
+
+    // Edge cases: rects touching on every side, overlapping by one pixel, empty, and negative sized
+    std::vector<SDL_Rect> rects;
+    for( int x = -2; x <= 2; ++x )
+    {
+        for( int y = -2; y <= 2; ++y )
+        {
+            for( int w = -1; w <= 2; ++w )
+            {
+                for( int h = -1; h <= 2; ++h )
+                {
+                    SDL_Rect rect = { x, y, w, h };
+                    rects.push_back( rect );
+                }
+            }
+        }
+    }
+
+    // Random rects of every size, seeded so failures repeat, and a count that leaves the last block short of 4 and 8
+    srand( 1 );
+    for( int i = 0; i < 4005; ++i )
+    {
+        SDL_Rect rect = { rand() % 200 - 100, rand() % 200 - 100, rand() % 60 - 5, rand() % 60 - 5 };
+        rects.push_back( rect );
+    }
+
+    LRectBlock block;
+    for( int i = 0; i < (int)rects.size(); ++i )
+    {
+        block.add( rects[ i ] );
+    }
+
+    // Every kernel this CPU runs is checked on its own, not just the one checkCollision picks
+    std::vector<BlockTest> kernels;
+    std::vector<const char*> kernelNames;
+    kernels.push_back( checkCollisionScalar );
+    kernelNames.push_back( "scalar" );
+    #ifdef HAVE_X86_SIMD
+    kernels.push_back( checkCollisionSSE2 );
+    kernelNames.push_back( "SSE2" );
+    if( SDL_HasAVX2() )
+    {
+        kernels.push_back( checkCollisionAVX2 );
+        kernelNames.push_back( "AVX2" );
+    }
+    #endif
+
+    // Every rect against every block of 32, bit by bit against the rect function
+    // Blocks are cut shorter by up to 7 rects as the rect changes, so every leftover path runs
+    for( int k = 0; k < (int)kernels.size(); ++k )
+    {
+        int mismatches = 0;
+        long long pairs = 0;
+        for( int a = 0; a < (int)rects.size(); ++a )
+        {
+            SDL_Rect rectA = rects[ a ];
+            for( int first = 0; first < block.size(); first += RECT_BLOCK_MASK_BITS )
+            {
+                int count = std::min( RECT_BLOCK_MASK_BITS, block.size() - first ) - a % 8;
+                if( count <= 0 )
+                {
+                    continue;
+                }
+                Uint32 hits = kernels[ k ]( rectA.x, rectA.x + rectA.w, rectA.y, rectA.y + rectA.h, block, first, count );
+                for( int i = 0; i < RECT_BLOCK_MASK_BITS; ++i )
+                {
+                    bool expected = i < count && checkCollision( rectA, rects[ first + i ] );
+                    if( expected != ( ( hits >> i ) & 1 ) )
+                    {
+                        if( mismatches < 10 )
+                        {
+                            printf( "%s mismatch: { %d, %d, %d, %d } against rect %d of a block of %d, expected %d\n",
+                                    kernelNames[ k ], rectA.x, rectA.y, rectA.w, rectA.h, i, count, expected );
+                        }
+                        ++mismatches;
+                        success = false;
+                    }
+                }
+                pairs += count;
+            }
+        }
+        printf( "%s: %d rects, %lld pairs compared, %d mismatches\n", kernelNames[ k ], (int)rects.size(), pairs, mismatches );
+    }
+
+    // Time both over the same pairs
+    Uint64 start = SDL_GetPerformanceCounter();
+    int scalarHits = 0;
+    for( int a = 0; a < (int)rects.size(); ++a )
+    {
+        for( int b = 0; b < (int)rects.size(); ++b )
+        {
+            scalarHits += checkCollision( rects[ a ], rects[ b ] );
+        }
+    }
+    double scalarSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+    // Masks are counted after the clock stops, one bit at a time
+    std::vector<Uint32> masks;
+    masks.reserve( rects.size() * ( ( block.size() + RECT_BLOCK_MASK_BITS - 1 ) / RECT_BLOCK_MASK_BITS ) );
+    start = SDL_GetPerformanceCounter();
+    for( int a = 0; a < (int)rects.size(); ++a )
+    {
+        for( int first = 0; first < block.size(); first += RECT_BLOCK_MASK_BITS )
+        {
+            masks.push_back( checkCollision( rects[ a ], block, first ) );
+        }
+    }
+    double blockSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+    int blockHits = 0;
+    for( int i = 0; i < (int)masks.size(); ++i )
+    {
+        for( Uint32 hits = masks[ i ]; hits != 0; hits &= hits - 1 )
+        {
+            ++blockHits;
+        }
+    }
+
+    #ifdef HAVE_X86_SIMD
+    const char* kernel = SDL_HasAVX2() ? "AVX2" : "SSE2";
+    #else
+    const char* kernel = "scalar";
+    #endif
+    printf( "Scalar: %.2f ns per pair, %s block: %.2f ns per pair (%d and %d hits)\n",
+            scalarSeconds * 1e9 / ( rects.size() * rects.size() ), kernel,
+            blockSeconds * 1e9 / ( rects.size() * rects.size() ), scalarHits, blockHits );
+
+    return success;
+}
+
+void createFrameTexture()
+{
+    gFrameTexture = SDL_CreateTexture( gRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT );
+    if( gFrameTexture == NULL )
+    {
+        printf( "Unable to create frame texture, redrawing every frame! SDL Error: %s\n", SDL_GetError() );
+    }
+    else
+    {
+        SDL_SetTextureBlendMode( gFrameTexture, SDL_BLENDMODE_NONE );
+    }
+}
+
+bool init()
+{
+    // Initialization Flag
+    bool success = true;
+
+    // Headless runs need no display or sound card
+    if( gHeadless )
+    {
+        SDL_setenv( "SDL_VIDEODRIVER", "dummy", 1 );
+        SDL_setenv( "SDL_AUDIODRIVER", "dummy", 1 );
+    }
+
+    // Initialize SDL
+    if( SDL_Init( SDL_INIT_VIDEO | SDL_INIT_AUDIO ) < 0 )
+    {
+        printf( "SDL could not initalize! SDL_Error: %s\n", SDL_GetError() );
+        success = false;
+    }
+    else
+    {
+        // Set texture filtering to linear
+        if( !SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" ) )
+        {
+            printf("Warning: Linear texture filtering not enabled" );
+        }
+
+        // Create a window, or in headless mode only a surface to draw on
+        if( gHeadless )
+        {
+            gFrameSurface = SDL_CreateRGBSurfaceWithFormat( 0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888 );
+        }
+        else
+        {
+            gWindow = SDL_CreateWindow("SDL Tutorial", SDL_WINDOWPOS_UNDEFINED,
+                SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+        }
+        if( gWindow == NULL && gFrameSurface == NULL )
+        {
+            printf("Window could not be created! SDL_Error: %s\n", SDL_GetError() );
+            success = false;
+        }
+        else
+        {
+            // Create renderer for the window - Vertical Sync allows rendering to update
+            // at the same time as your monitor during vertical refresh
+            Uint32 rendererFlags = gUseSoftwareRenderer ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED;
+            if( gUseVSync )
+            {
+                rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+            }
+            if( gHeadless )
+            {
+                gRenderer = SDL_CreateSoftwareRenderer( gFrameSurface );
+            }
+            else
+            {
+                gRenderer = SDL_CreateRenderer( gWindow, -1, rendererFlags );
+            }
+
+            // Without an accelerated renderer SDL can still present, and our rasterizer does the drawing
+            if( gRenderer == NULL && !gUseSoftwareRenderer && !gHeadless )
+            {
+                printf( "Accelerated renderer could not be created, drawing in software! SDL Error: %s\n", SDL_GetError() );
+                gRenderer = SDL_CreateRenderer( gWindow, -1, ( rendererFlags & ~SDL_RENDERER_ACCELERATED ) | SDL_RENDERER_SOFTWARE );
+                gUseRasterizer = true;
+            }
+            if( gRenderer == NULL )
+            {
+                printf( "Renderer could not be created! SDL Error: %s\n", SDL_GetError() );
+                success = false;
+            }
+            else
+            {
+                // Initialize renderer color
+                SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
+
+                // Textures drawn into memory, presented through one streaming texture
+                if( gUseRasterizer )
+                {
+                    if( gRasterizer.open( SCREEN_WIDTH, SCREEN_HEIGHT ) )
+                    {
+                        gRasterizer.setFilter( gRasterFilter );
+                        gRasterizer.setTiled( gRasterTiled );
+                        printf( "Drawing with the rasterizer, %s blending, %s filtering, %s\n", gRasterizer.getKernelName(),
+                                gRasterFilter == RASTER_BILINEAR ? "bilinear" : "nearest",
+                                gRasterTiled ? "tiles spread over the job system" : "on the main thread" );
+                    }
+                    else
+                    {
+                        printf( "Unable to open the rasterizer, drawing with SDL instead!\n" );
+                    }
+                }
+
+                // Frame kept between frames, without render target support everything is redrawn,
+                // the rasterizer's framebuffer is kept anyway
+                if( gDirtyRendering && !gRasterizer.isOpen() )
+                {
+                    createFrameTexture();
+                }
+
+                // Initialize PNG Loading
+                int imgFlags = IMG_INIT_PNG;
+                if( !( IMG_Init( imgFlags ) & imgFlags ) )
+                {
+                    printf("SDL_image could not initialize! SDL_Image Error: %s\n", IMG_GetError() );
+                    success = false;
+                }
+
+                // Initialize SDL_TTF
+                if( TTF_Init() == -1 )
+                {
+                    printf("SDL_TTF could not initialize! SDL_TTF Error: %s\n", TTF_GetError() );
+                    success = false;
+                }
+
+                // Initialize SDL_mixer
+                if( !openAudio() )
+                {
+                    success = false;
+                }
+            }
+        }
+    }
+    return success;
+}
+
+bool openAudio()
+{
+    // The last doubling stops at the largest buffer, so a size that does not double up to it still tries it
+    for( int frames = gAudioBufferFrames; frames <= AUDIO_MAX_BUFFER_FRAMES;
+         frames = frames < AUDIO_MAX_BUFFER_FRAMES ? std::min( frames * 2, AUDIO_MAX_BUFFER_FRAMES ) : frames * 2 )
+    {
+        if( Mix_OpenAudio( gAudioFrequency, gAudioFormat, 2, frames ) < 0 )
+        {
+            printf( "Audio device refused %d frame buffers! SDL_Mixer Error: %s\n", frames, Mix_GetError() );
+            continue;
+        }
+
+        // Sound effects and music go through our own mixer, SDL_mixer only owns the device
+        if( !gMixer.open() )
+        {
+            Mix_CloseAudio();
+            return false;
+        }
+        int frequency = 0;
+        Uint16 format = 0;
+        int channels = 0;
+        Mix_QuerySpec( &frequency, &format, &channels );
+
+        // A small buffer that comes back late glitches, so listen for a moment and count callbacks, headless runs have no device to listen to
+        if( frames < AUDIO_PROBE_BUFFER_FRAMES && !gHeadless )
+        {
+            int callbacks = gMixer.getCallbackCount();
+            int xruns = gMixer.getXrunCount();
+            SDL_Delay( AUDIO_PROBE_MS );
+            double expected = AUDIO_PROBE_MS / 1000.0 * frequency / std::max( 1, gMixer.getCallbackFrames() );
+            if( gMixer.getXrunCount() != xruns || gMixer.getCallbackCount() - callbacks < expected * 0.8 )
+            {
+                printf( "Audio device cannot keep %d frame buffers fed, %d of %.0f callbacks came\n", frames,
+                        gMixer.getCallbackCount() - callbacks, expected );
+                gMixer.close();
+                Mix_CloseAudio();
+                continue;
+            }
+        }
+
+        // SDL may have picked another size, the callback tells
+        gAudioBufferFrames = gMixer.getCallbackFrames() > 0 ? gMixer.getCallbackFrames() : frames;
+        printf( "Audio on the %s driver at %d Hz, format %#x, %d frame buffers of %.1f ms\n", SDL_GetCurrentAudioDriver(), frequency, format,
+                gAudioBufferFrames, gAudioBufferFrames * 1000.0 / frequency );
+        return true;
+    }
+
+    printf( "SDL_mixer could not initialize! SDL_Mixer Error: %s\n", Mix_GetError() );
+    return false;
+}
+
+bool loadMedia()
+{
+    PROFILE_SCOPE( "loadMedia" );
+
+    // Loading success flag
+    bool success = true;
+
+    // Load Foo texture
+    //if( !gFooTexture.loadFromAtlas( gAtlas, "foo" ))
+    //{
+    //    printf("Failed to load Foo texture image!\n" );
+    //    success = false;
+    //}
+
+    //// Load background texture
+    //if( !gBackgroundTexture.loadFromAtlas( gAtlas, "background" ))
+    //{
+    //    printf("Failed to load background texture image!\n" );
+    //    success = false;
+    //}
+
+    // Load PNG texture
+    //gTexture = loadTexture( "resources/loading_image.png");
+    //if( gTexture == NULL )
+    //{
+    //    printf("Failed to load texture image!\n");
+    //    success = false;
+    //}
+
+    // Load Sprite Sheet Texture
+    //if( !gSpriteSheetTexture.loadFromAtlas( gAtlas, "dots" ) )
+    //{
+    //    printf("Failed to load sprite sheet texture!\n" );
+    //    success = false;
+    //}
+    //else
+    //{
+    //    // Set top left sprite
+    //    gSpriteClips[ 0 ].x = 0;
+    //    gSpriteClips[ 0 ].y = 0;
+    //    gSpriteClips[ 0 ].w = 100;
+    //    gSpriteClips[ 0 ].h = 100;
+
+    //    // Set top right sprite
+    //    gSpriteClips[ 1 ].x = 100;
+    //    gSpriteClips[ 1 ].y = 0;
+    //    gSpriteClips[ 1 ].w = 100;
+    //    gSpriteClips[ 1 ].h = 100;
+
+    //    // Set bottom left sprite
+    //    gSpriteClips[ 2 ].x = 0;
+    //    gSpriteClips[ 2 ].y = 100;
+    //    gSpriteClips[ 2 ].w = 100;
+    //    gSpriteClips[ 2 ].h = 100;
+
+    //    // Set bottom right sprite
+    //    gSpriteClips[ 3 ].x = 100;
+    //    gSpriteClips[ 3 ].y = 100;
+    //    gSpriteClips[ 3 ].w = 100;
+    //    gSpriteClips[ 3 ].h = 100;
+    //}
+
+    // Load Walking Sprite Animation
+    //if( !gSpriteWalkSheetTexture.loadFromAtlas( gAtlas, "foo_walk" ))
+    //{
+    //    printf( "Failed to load walking animation texture!\n" );
+    //    success = false;
+    //}
+    //else
+    //{
+    //    // Set Sprite Class
+    //    gSpriteWalkClips[ 0 ].x = 0;
+    //    gSpriteWalkClips[ 0 ].y = 0;
+    //    gSpriteWalkClips[ 0 ].w = 64;
+    //    gSpriteWalkClips[ 0 ].h = 205;
+
+    //    gSpriteWalkClips[ 1 ].x = 64;
+    //    gSpriteWalkClips[ 1 ].y = 0;
+    //    gSpriteWalkClips[ 1 ].w = 64;
+    //    gSpriteWalkClips[ 1 ].h = 205;
+
+    //    gSpriteWalkClips[ 2 ].x = 128;
+    //    gSpriteWalkClips[ 2 ].y = 0;
+    //    gSpriteWalkClips[ 2 ].w = 64;
+    //    gSpriteWalkClips[ 2 ].h = 205;
+
+    //    gSpriteWalkClips[ 3 ].x = 196;
+    //    gSpriteWalkClips[ 3 ].y = 0;
+    //    gSpriteWalkClips[ 3 ].w = 64;
+    //    gSpriteWalkClips[ 3 ].h = 205;
+    //}
+
+    // Arrow for rotation and flip
+    //if( !gArrowTexture.loadFromAtlas( gAtlas, "arrow" ) )
+    //{
+    //    printf( "Failed to load arrow texture!\n" );
+    //    success = false;
+    //}
+
+    // Open the font
+    //gFont = TTF_OpenFont( "resources/lazy.ttf", 28);
+    //if( gFont == NULL )
+    //{
+    //    printf( "Failed to load lazy font! SDL_TTF Error: %s\n", TTF_GetError() );
+    //    success = false;
+    //}
+    //else
+    //{
+    //    // Render text
+    //    SDL_Color textColor = { 0, 0, 0 };
+    //    if( !gTextTexture.loadFromRenderedText( "Hello World!", textColor ) )
+    //    {
+    //        printf( "Failed to render text texture!\n" );
+    //        success = false;
+    //    }
+    //}
+
+    // Sprites
+    // if( !gButtonSpriteSheetTexture.loadFromAtlas( gAtlas, "button" ) )
+    // {
+    //     printf("Failed to load button sprite texture!\n");
+    //     success = false;
+    // }
+    // else
+    // {
+    //     //Set sprites
+	// 	for( int i = 0; i < BUTTON_SPRITE_TOTAL; ++i )
+	// 	{
+	// 		gSpriteClips[ i ].x = 0;
+	// 		gSpriteClips[ i ].y = i * 200;
+	// 		gSpriteClips[ i ].w = BUTTON_WIDTH;
+	// 		gSpriteClips[ i ].h = BUTTON_HEIGHT;
+	// 	}
+
+	// 	//Set buttons in corners
+	// 	gButtons[ 0 ].setPosition( 0, 0 );
+	// 	gButtons[ 1 ].setPosition( SCREEN_WIDTH - BUTTON_WIDTH, 0 );
+	// 	gButtons[ 2 ].setPosition( 0, SCREEN_HEIGHT - BUTTON_HEIGHT );
+	// 	gButtons[ 3 ].setPosition( SCREEN_WIDTH - BUTTON_WIDTH, SCREEN_HEIGHT - BUTTON_HEIGHT );
+
+	// 	//File them for hit testing
+	// 	for( int i = 0; i < TOTAL_BUTTONS; ++i )
+	// 	{
+	// 		gButtonLayer.add( &gButtons[ i ] );
+	// 	}
+    // }
+
+    // Load key press textures
+    // if( !gPressTexture.loadFromAtlas( gAtlas, "press" ) )
+    // {
+    //     printf( "Failed to load press texture!\n" );
+    //     success = false;
+    // }
+
+    // if( !gUpTexture.loadFromAtlas( gAtlas, "up" ) )
+    // {
+    //     printf( "Failed to load up texture!\n" );
+    //     success = false;
+    // }
+    // if( !gDownTexture.loadFromAtlas( gAtlas, "down" ) )
+    // {
+    //     printf( "Failed to load down texture!\n" );
+    //     success = false;
+    // }
+    // if( !gLeftTexture.loadFromAtlas( gAtlas, "left" ) )
+    // {
+    //     printf( "Failed to load left texture!\n" );
+    //     success = false;
+    // }
+    // if( !gRightTexture.loadFromAtlas( gAtlas, "right" ) )
+    // {
+    //     printf( "Failed to load right texture!\n" );
+    //     success = false;
+    // }
+
+    // Images and sounds are decoded on the job system, only uploading them is left to this thread
+    LAssetLoader loader;
+    if( gArchive.isOpen() )
+    {
+        loader.setArchive( &gArchive );
+    }
+    if( gSoundCache.isEnabled() )
+    {
+        loader.setCache( &gSoundCache );
+    }
+
+    // The loading screen's own image comes first, so it can show while everything else decodes
+    LTexture loadingTexture;
+    int loadingImage = loader.loadImage( "resources/loading_image.png" );
+    if( !loadingTexture.loadFromAsset( loader, loadingImage ) )
+    {
+        printf( "Failed to load loading screen texture!\n" );
+        success = false;
+    }
+    renderLoadingScreen( loadingTexture, 0, 1 );
+
+    // Queue every atlas image, loading_image is already decoded
+    int atlasImages[ TOTAL_ATLAS_IMAGES ];
+    for( int i = 0; i < TOTAL_ATLAS_IMAGES; ++i )
+    {
+        if( std::string( ATLAS_IMAGES[ i ][ 0 ] ) == "loading_image" )
+        {
+            atlasImages[ i ] = loadingImage;
+        }
+        else
+        {
+            atlasImages[ i ] = loader.loadImage( ATLAS_IMAGES[ i ][ 1 ] );
+        }
+    }
+
+    // Queue Sound Effects
+    int scratchSound = loader.loadSound( "resources/scratch.wav" );
+    int highSound = loader.loadSound( "resources/high.wav" );
+    int mediumSound = loader.loadSound( "resources/medium.wav" );
+    int lowSound = loader.loadSound( "resources/low.wav" );
+
+    // Help decode while keeping the loading screen up to date
+    if( !loader.waitAll( [ &loadingTexture ]( int ready, int total ) { renderLoadingScreen( loadingTexture, ready, total ); } ) )
+    {
+        printf( "Failed to decode media!\n" );
+        success = false;
+    }
+    loadingTexture.free();
+
+    // Converting is the slow part of a sound, once the cache has it for this device only the mapping is left
+    int sounds[] = { scratchSound, highSound, mediumSound, lowSound };
+    double soundSeconds = 0.0;
+    int cachedSounds = 0;
+    for( int i = 0; i < 4; ++i )
+    {
+        soundSeconds += loader.getDecodeSeconds( sounds[ i ] );
+        cachedSounds += loader.isCached( sounds[ i ] ) ? 1 : 0;
+    }
+    printf( "Sound effects took %.2f ms to load, %d of 4 from the sound cache\n", soundSeconds * 1000.0, cachedSounds );
+
+    // Pack every image into the atlas, so textures below can share pages
+    for( int i = 0; i < TOTAL_ATLAS_IMAGES; ++i )
+    {
+        if( !gAtlas.addSurface( ATLAS_IMAGES[ i ][ 0 ], loader.getSurface( atlasImages[ i ] ) ) )
+        {
+            printf( "Failed to add %s to the texture atlas!\n", ATLAS_IMAGES[ i ][ 1 ] );
+            success = false;
+        }
+    }
+    if( !gAtlas.pack() )
+    {
+        printf( "Failed to pack texture atlas!\n" );
+        success = false;
+    }
+
+    // Music
+    if( !gPromptTexture.loadFromAtlas( gAtlas, "prompt" ) )
+    {
+        printf( "Failed to load prompt texture!\n" );
+        success = false;
+    }
+
+    // Sound effects, already converted to the mixer's format
+    gScratch = loader.takeChunk( scratchSound );
+    if( gScratch == NULL )
+    {
+        printf( "Failed to load scratch sound effect!\n" );
+        success = false;
+    }
+
+    gHigh = loader.takeChunk( highSound );
+    if( gHigh == NULL )
+    {
+        printf( "Failed to load high sound effect!\n" );
+        success = false;
+    }
+
+    gMedium = loader.takeChunk( mediumSound );
+    if( gMedium == NULL )
+    {
+        printf( "Failed to load medium sound effect!\n" );
+        success = false;
+    }
+
+    gLow = loader.takeChunk( lowSound );
+    if( gLow == NULL )
+    {
+        printf( "Failed to load low sound effect!\n" );
+        success = false;
+    }
+
+    // Float copies for the software mixer
+    if( !gScratchSound.loadFromChunk( gScratch ) || !gHighSound.loadFromChunk( gHigh ) ||
+        !gMediumSound.loadFromChunk( gMedium ) || !gLowSound.loadFromChunk( gLow ) )
+    {
+        printf( "Failed to copy sound effects for the mixer!\n" );
+        success = false;
+    }
+
+    // Load dot texture
+    if( !gDotTexture.loadFromAtlas( gAtlas, "dot" ) )
+    {
+        printf( "Failed to load dot texture!\n" );
+        success = false;
+    }
+
+    // Font for text drawn every frame, glyphs are rasterized as they are first drawn
+    if( !gGlyphs.open( "resources/lazy.ttf" ) )
+    {
+        printf( "Failed to load lazy font!\n" );
+        success = false;
+    }
+
+    return success;
+}
+
+void watchMedia( LHotReloader& reloader )
+{
+    // Atlas images, and the textures that show them
+    for( int i = 0; i < TOTAL_ATLAS_IMAGES; ++i )
+    {
+        reloader.watchImage( ATLAS_IMAGES[ i ][ 1 ], gAtlas, ATLAS_IMAGES[ i ][ 0 ] );
+    }
+    reloader.watchTexture( gPromptTexture, "prompt" );
+    reloader.watchTexture( gDotTexture, "dot" );
+
+    // Sound effects and music
+    reloader.watchSound( "resources/scratch.wav", &gScratch, &gScratchSound );
+    reloader.watchSound( "resources/high.wav", &gHigh, &gHighSound );
+    reloader.watchSound( "resources/medium.wav", &gMedium, &gMediumSound );
+    reloader.watchSound( "resources/low.wav", &gLow, &gLowSound );
+    reloader.watchMusic( "resources/beat.wav", &gMusic );
+}
+
+void close()
+{
+    // Free loaded images
+    gFooTexture.free();
+    gBackgroundTexture.free();
+    gTextTexture.free();
+    gDotTexture.free();
+    gPromptTexture.free();
+    gAtlas.free();
+
+    // Free global font
+    TTF_CloseFont( gFont );
+    gFont = NULL;
+    gGlyphs.free();
+
+    // Free loaded image
+    //SDL_DestroyTexture( gTexture );
+    //gTexture = NULL;
+
+    // Stop mixing before the sound effects and music go
+    gMixer.close();
+    gScratchSound.free();
+    gHighSound.free();
+    gMediumSound.free();
+    gLowSound.free();
+
+    // Free sound effects
+    Mix_FreeChunk( gScratch );
+    Mix_FreeChunk( gHigh );
+    Mix_FreeChunk( gMedium );
+    Mix_FreeChunk( gLow );
+    gScratch = NULL;
+    gHigh = NULL;
+    gMedium = NULL;
+    gLow = NULL;
+
+    // Stop streaming music, the mixer already let go of it
+    gMusic.close();
+
+    // Chunks above may have been reading from the archive or the sound cache
+    gArchive.free();
+    gSoundCache.free();
+
+
+    // Destroy the window and renderer
+    SDL_DestroyTexture( gFrameTexture );
+    gFrameTexture = NULL;
+    gRasterizer.close();
+    SDL_DestroyRenderer( gRenderer );
+    SDL_DestroyWindow( gWindow );
+    SDL_FreeSurface( gFrameSurface );
+    gWindow = NULL;
+    gRenderer = NULL;
+    gFrameSurface = NULL;
+
+    // Shut down Music
+    Mix_Quit();
+
+    // Shut down TTF
+    TTF_Quit();
+
+    // Shut down SDL_Image
+    IMG_Quit();
+
+    // Quit SDL subsystems
+    SDL_Quit();
+
+}
+
+void createViewPorts()
 {
-    // Show the dot
-    gDotTexture.render( mPosX, mPosY );
+    // Create top left viewport
+    SDL_Rect topLeftViewport;
+    topLeftViewport.x = 0;
+    topLeftViewport.y = 0;
+    topLeftViewport.w = SCREEN_WIDTH / 2;
+    topLeftViewport.h = SCREEN_HEIGHT / 2;
+    SDL_RenderSetViewport( gRenderer, &topLeftViewport );
+    SDL_RenderCopy( gRenderer, gTexture, NULL, NULL );  // Now that screen is cleared, render the texture to screen
+
+    // Create top right viewport
+    SDL_Rect topRightViewport;
+    topLeftViewport.x = SCREEN_WIDTH / 2;
+    topLeftViewport.y = 0;
+    topLeftViewport.w = SCREEN_WIDTH / 2;
+    topLeftViewport.h = SCREEN_HEIGHT / 2;
+    SDL_RenderSetViewport( gRenderer, &topLeftViewport );
+    SDL_RenderCopy( gRenderer, gTexture, NULL, NULL );  // Now that screen is cleared, render the texture to screen
+}
+
+void createDrawings()
+{
+    // Draw red filled quad, a solid rectangle
+    SDL_Rect fillRect = { SCREEN_WIDTH / 4, SCREEN_HEIGHT / 4,SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 }; // Area we want filled with x, y, width, height
+
+    // The same drawings through the rasterizer
+    if( gRasterizer.isDrawing() )
+    {
+        SDL_Color white = { 0xFF, 0xFF, 0xFF, 0xFF };
+        SDL_Color blue = { 0x00, 0x00, 0xFF, 0xFF };
+        SDL_Color yellow = { 0xFF, 0xFF, 0x00, 0xFF };
+        gRasterizer.fillRect( fillRect, white, SDL_BLENDMODE_NONE );
+        gRasterizer.drawLine( 0, SCREEN_HEIGHT / 2, SCREEN_WIDTH, SCREEN_HEIGHT / 2, blue, SDL_BLENDMODE_NONE );
+        for( int i = 0; i < SCREEN_HEIGHT; i += 4)
+        {
+            gRasterizer.drawPoint( SCREEN_WIDTH / 2, i, yellow, SDL_BLENDMODE_NONE );
+        }
+        return;
+    }
+    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF);
+    SDL_RenderFillRect( gRenderer, &fillRect );  // update texture to screen
+
+    // Draw blue horizontal line
+    SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0xFF, 0xFF );
+    SDL_RenderDrawLine( gRenderer, 0, SCREEN_HEIGHT / 2, SCREEN_WIDTH, SCREEN_HEIGHT / 2);
+
+    // Draw sequence of dots
+    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0x00, 0xFF );
+    for( int i = 0; i < SCREEN_HEIGHT; i += 4)
+    {
+        SDL_RenderDrawPoint( gRenderer, SCREEN_WIDTH / 2, i );
+    }
+
+    SDL_RenderCopy( gRenderer, gTexture, NULL, NULL );  // Render the texture to screen
+}
+
+void createRotateFlip()
+{
+    // Clear the screen
+    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
+    SDL_RenderClear( gRenderer );
+
+    double degrees = 30;  // angle of rotation
+    SDL_RendererFlip flipType = SDL_FLIP_NONE;  // type of flip
+
+    flipType = SDL_FLIP_HORIZONTAL;
+    //flipType = SDL_FLIP_VERTICAL;
+
+    // Render an arrow
+    gArrowTexture.render( ( SCREEN_WIDTH - gArrowTexture.getWidth() ) / 2, ( SCREEN_HEIGHT - gArrowTexture.getHeight() ) / 2, NULL, degrees, NULL, flipType );
+}
+
+SDL_Texture* loadTexture( std::string path)
+{
+    // The final texture
+    SDL_Texture* newTexture = NULL;
+
+    // Load image at the specified path
+    SDL_Surface* loadedSurface = IMG_Load( path.c_str() );
+    if( loadedSurface == NULL )
+    {
+        printf(" Unable to load image %s! SDL Error: %s\n", path.c_str(), SDL_GetError());
+    }
+    else
+    {
+        // Create texture from surface pixels
+        newTexture = SDL_CreateTextureFromSurface( gRenderer, loadedSurface );
+        if( newTexture == NULL)
+        {
+            printf("Unable to create texture from %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+        }
+
+        // Get rid of old loaded surface
+        SDL_FreeSurface( loadedSurface );
+    }
+    return newTexture;
+}
+
+void benchmarkSpriteBatch( int sprites )
+{
+    const int FRAMES = 100;
+
+    // Scatter the dots over the screen, seeded so every run draws the same scene
+    srand( 1 );
+    std::vector<Dot> dots;
+    for( int i = 0; i < sprites; ++i )
+    {
+        dots.push_back( Dot( rand() % ( SCREEN_WIDTH - Dot::DOT_WIDTH ), rand() % ( SCREEN_HEIGHT - Dot::DOT_HEIGHT ) ) );
+    }
+
+    for( int pass = 0; pass < 2; ++pass )
+    {
+        bool batched = pass == 1;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int frame = 0; frame < FRAMES; ++frame )
+        {
+            SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
+            SDL_RenderClear( gRenderer );
+
+            if( batched )
+            {
+                gSpriteBatch.begin();
+                for( int i = 0; i < sprites; ++i )
+                {
+                    dots[ i ].render( gSpriteBatch );
+                }
+                gSpriteBatch.end();
+            }
+            else
+            {
+                for( int i = 0; i < sprites; ++i )
+                {
+                    dots[ i ].render();
+                }
+            }
+
+            SDL_RenderPresent( gRenderer );
+        }
+        double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        printf( "%s: %d sprites x %d frames in %.3f s, %.0f draws per second, %.1f frames per second\n",
+                batched ? "Batched" : "Immediate", sprites, FRAMES, seconds,
+                sprites * FRAMES / seconds, FRAMES / seconds );
+    }
+}
+
+void runSimulation( int ticks )
+{
+    // Same scene as the main loop
+    Dot dot;
+    SDL_Rect wall = { 300, 40, 40, 400 };
+
+    // Scripted input: hold each arrow key in turn for two seconds of simulated time
+    const SDL_Keycode KEYS[ 4 ] = { SDLK_RIGHT, SDLK_DOWN, SDLK_LEFT, SDLK_UP };
+    const int HOLD_TICKS = 2 * TICKS_PER_SECOND;
+
+    SDL_Event e;
+    e.key.repeat = 0;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for( int tick = 0; tick < ticks; ++tick )
+    {
+        if( tick % HOLD_TICKS == 0 )
+        {
+            int key = ( tick / HOLD_TICKS ) % 4;
+            if( tick > 0 )
+            {
+                e.type = SDL_KEYUP;
+                e.key.keysym.sym = KEYS[ ( key + 3 ) % 4 ];
+                dot.handleEvent( e );
+            }
+            e.type = SDL_KEYDOWN;
+            e.key.keysym.sym = KEYS[ key ];
+            dot.handleEvent( e );
+        }
+
+        dot.move( wall );
+    }
+    double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+    printf( "Simulated %d ticks (%.1f s of game time) in %.4f s, %.0f ticks per second, dot ended at %d, %d\n",
+            ticks, ticks * TICK_SECONDS, seconds, ticks / seconds, dot.getPosX(), dot.getPosY() );
+}
+
+void waitForFrameCap( Uint64 frameStart, bool presented )
+{
+    // Vsync already paces the loop, unless there was nothing to present
+    if( gHeadless || ( gUseVSync && presented ) || ( !gUseVSync && gFrameCap <= 0 ) )
+    {
+        return;
+    }
+
+    // Sleep for whatever is left of this frame's share of a second, idle frames with vsync go at the tick rate
+    int framesPerSecond = gUseVSync ? TICKS_PER_SECOND : gFrameCap;
+    double elapsed = (double)( SDL_GetPerformanceCounter() - frameStart ) / SDL_GetPerformanceFrequency();
+    double remaining = 1.0 / framesPerSecond - elapsed;
+    if( remaining > 0.0 )
+    {
+        SDL_Delay( (Uint32)( remaining * 1000.0 ) );
+    }
+}
+
+void handleAudioKey( SDL_Keycode key, Uint64 pressed )
+{
+    switch( key )
+    {
+        case SDLK_1:
+        gMixer.play( &gHighSound, 1.0f, 0.0f, 1.0f, 0, false, pressed );
+        break;
+
+        case SDLK_2:
+        gMixer.play( &gMediumSound, 1.0f, 0.0f, 1.0f, 0, false, pressed );
+        break;
+
+        case SDLK_3:
+        gMixer.play( &gLowSound, 1.0f, 0.0f, 1.0f, 0, false, pressed );
+        break;
+
+        // Scratches vary a little, and are cut last when every voice is busy
+        // The pitch comes from a generator of its own, rand() drives the crowd that headless and replay checksums cover
+        case SDLK_4:
+        {
+            static Uint32 scratchSeed = 1;
+            scratchSeed = scratchSeed * 1664525u + 1013904223u;
+            gMixer.play( &gScratchSound, 1.0f, 0.0f, 0.9f + 0.2f * ( scratchSeed >> 8 ) / 16777216.0f, 1, false, pressed );
+        }
+        break;
+
+        // Start the music, or pause and resume it
+        case SDLK_9:
+        if( !gMusic.isPlaying() )
+        {
+            gMusic.play( "resources/beat.wav" );
+        }
+        else if( gMusic.isPaused() )
+        {
+            gMusic.resume();
+        }
+        else
+        {
+            gMusic.pause();
+        }
+        break;
+
+        // Jump back to the top of the music
+        case SDLK_8:
+        gMusic.seek( 0.0 );
+        break;
+
+        // Stop the music
+        case SDLK_0:
+        gMusic.halt();
+        break;
+    }
+}
+
+void benchmarkBroadphase()
+{
+    const int TICKS = 60;
+    const int DOT_COUNTS[ 3 ] = { 1000, 10000, 20000 };
+    const int WALL_COUNTS[ 3 ] = { 10, 100, 400 };
+
+    for( int d = 0; d < 3; ++d )
+    {
+        for( int w = 0; w < 3; ++w )
+        {
+            // Same seed for every pass, so they move identical scenes
+            // Pass 0 is brute force one wall at a time, pass 1 brute force with the SIMD block test, pass 2 the broadphase
+            double seconds[ 3 ];
+            unsigned int finalChecksum[ 3 ];
+            for( int pass = 0; pass < 3; ++pass )
+            {
+                srand( 1 );
+
+                // Small walls scattered over the screen
+                std::vector<SDL_Rect> walls;
+                LRectBlock wallBlock;
+                LCollisionWorld world;
+                for( int i = 0; i < WALL_COUNTS[ w ]; ++i )
+                {
+                    SDL_Rect wall = { rand() % SCREEN_WIDTH, rand() % SCREEN_HEIGHT, 4 + rand() % 40, 4 + rand() % 40 };
+                    walls.push_back( wall );
+                    wallBlock.add( wall );
+                    world.addWall( wall );
+                }
+
+                // Dots moving in random directions
+                std::vector<Dot> dots;
+                std::vector<int> ids;
+                for( int i = 0; i < DOT_COUNTS[ d ]; ++i )
+                {
+                    Dot dot( rand() % ( SCREEN_WIDTH - Dot::DOT_WIDTH ), rand() % ( SCREEN_HEIGHT - Dot::DOT_HEIGHT ) );
+                    dot.setVelocity( rand() % ( 2 * Dot::DOT_VEL + 1 ) - Dot::DOT_VEL, rand() % ( 2 * Dot::DOT_VEL + 1 ) - Dot::DOT_VEL );
+                    dots.push_back( dot );
+                    ids.push_back( world.addCollider( dot.getCollider() ) );
+                }
+
+                Uint64 start = SDL_GetPerformanceCounter();
+                for( int tick = 0; tick < TICKS; ++tick )
+                {
+                    for( int i = 0; i < (int)dots.size(); ++i )
+                    {
+                        if( pass == 0 )
+                        {
+                            dots[ i ].move( walls );
+                        }
+                        else if( pass == 1 )
+                        {
+                            dots[ i ].move( wallBlock );
+                        }
+                        else
+                        {
+                            dots[ i ].move( world, ids[ i ] );
+                        }
+                    }
+                }
+                seconds[ pass ] = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+                // Every pass must end with the dots in the same places
+                finalChecksum[ pass ] = 0;
+                for( int i = 0; i < (int)dots.size(); ++i )
+                {
+                    finalChecksum[ pass ] = finalChecksum[ pass ] * 31 + dots[ i ].getPosX() * 1000 + dots[ i ].getPosY();
+                }
+            }
+
+            printf( "%6d dots, %4d walls: brute force %8.2f ms/tick, SIMD brute force %8.2f ms/tick, broadphase %8.2f ms/tick, %5.1fx%s\n",
+                    DOT_COUNTS[ d ], WALL_COUNTS[ w ], seconds[ 0 ] * 1000.0 / TICKS, seconds[ 1 ] * 1000.0 / TICKS,
+                    seconds[ 2 ] * 1000.0 / TICKS, seconds[ 0 ] / seconds[ 2 ],
+                    finalChecksum[ 0 ] == finalChecksum[ 1 ] && finalChecksum[ 0 ] == finalChecksum[ 2 ] ? "" : "  MISMATCH" );
+        }
+    }
+}
+
+void benchmarkDotSystem()
+{
+    const int DOT_COUNTS[ 3 ] = { 1000, 100000, 1000000 };
+
+    // Same amount of work for every size
+    const int UPDATES = 100000000;
+
+    for( int d = 0; d < 3; ++d )
+    {
+        int count = DOT_COUNTS[ d ];
+        int ticks = UPDATES / count;
+
+        // Identical dots in both layouts
+        srand( 1 );
+        std::vector<Dot> dots;
+        DotSystem system;
+        for( int i = 0; i < count; ++i )
+        {
+            int x = rand() % ( SCREEN_WIDTH - Dot::DOT_WIDTH );
+            int y = rand() % ( SCREEN_HEIGHT - Dot::DOT_HEIGHT );
+            int velX = rand() % ( 2 * Dot::DOT_VEL + 1 ) - Dot::DOT_VEL;
+            int velY = rand() % ( 2 * Dot::DOT_VEL + 1 ) - Dot::DOT_VEL;
+
+            Dot dot( x, y );
+            dot.setVelocity( velX, velY );
+            dots.push_back( dot );
+            system.add( x, y, velX, velY );
+        }
+
+        // Objects, one call per dot, with no walls to hit
+        LRectBlock noWalls;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int tick = 0; tick < ticks; ++tick )
+        {
+            for( int i = 0; i < count; ++i )
+            {
+                dots[ i ].move( noWalls );
+            }
+        }
+        double objectSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        // Arrays, one loop over everything
+        start = SDL_GetPerformanceCounter();
+        for( int tick = 0; tick < ticks; ++tick )
+        {
+            system.move();
+        }
+        double systemSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        // Both must end with the dots in the same places
+        bool same = true;
+        for( int i = 0; i < count; ++i )
+        {
+            same = same && dots[ i ].getPosX() == system.getPosX( i ) && dots[ i ].getPosY() == system.getPosY( i );
+        }
+
+        // Every update reads six ints and writes four
+        double updates = (double)count * ticks;
+        printf( "%8d dots: Dot objects %7.1f M updates/s, DotSystem %7.1f M updates/s (%.1f GB/s)%s\n",
+                count, updates / objectSeconds / 1e6, updates / systemSeconds / 1e6,
+                updates * 10 * sizeof( int ) / systemSeconds / 1e9, same ? "" : "  MISMATCH" );
+    }
+}
+
+void benchmarkJobSystem()
+{
+    // 1, 2, 4 and so on, ending at one worker per spare hardware thread
+    int maxWorkers = std::max( 1, SDL_GetCPUCount() - 1 );
+    std::vector<int> workerCounts;
+    for( int workers = 1; workers < maxWorkers; workers *= 2 )
+    {
+        workerCounts.push_back( workers );
+    }
+    workerCounts.push_back( maxWorkers );
+
+    // Throughput: many tiny jobs
+    const int JOBS = 1000000;
+    for( int w = 0; w < (int)workerCounts.size(); ++w )
+    {
+        int workers = workerCounts[ w ];
+        gJobs.start( workers );
+        std::atomic<int> sum( 0 );
+        LJobCounter counter( 0 );
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int i = 0; i < JOBS; ++i )
+        {
+            gJobs.run( [ &sum ]() { sum.fetch_add( 1, std::memory_order_relaxed ); }, &counter );
+        }
+        gJobs.wait( counter );
+        double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        printf( "Throughput, %2d threads: %.2f M jobs/s%s\n", workers + 1, JOBS / seconds / 1e6, sum == JOBS ? "" : "  LOST JOBS" );
+        gJobs.stop();
+    }
+
+    // Latency: one job at a time, from run() until a worker starts it
+    // A millisecond apart the workers have gone to sleep, the case a frame's first jobs see
+    // Back to back they are still looking for jobs within JOB_SPIN_SECONDS, the case of jobs later in a frame
+    gJobs.start( maxWorkers );
+    const int SAMPLES = 2000;
+    for( int pass = 0; pass < 2; ++pass )
+    {
+        bool sleeping = pass == 0;
+        std::vector<double> latencies;
+        for( int i = 0; i < SAMPLES; ++i )
+        {
+            if( sleeping )
+            {
+                SDL_Delay( 1 );
+            }
+
+            std::atomic<Uint64> startedAt( 0 );
+            LJobCounter counter( 0 );
+            Uint64 queuedAt = SDL_GetPerformanceCounter();
+            gJobs.run( [ &startedAt ]() { startedAt = SDL_GetPerformanceCounter(); }, &counter );
+
+            // Spin instead of wait(), so the job has to be picked up by a worker
+            while( counter > 0 )
+            {
+            }
+            latencies.push_back( (double)( startedAt - queuedAt ) * 1e6 / SDL_GetPerformanceFrequency() );
+        }
+        std::sort( latencies.begin(), latencies.end() );
+        printf( "Latency, workers %s: p50 %.1f us, p99 %.1f us\n", sleeping ? "asleep" : "awake ",
+                latencies[ SAMPLES / 2 ], latencies[ SAMPLES * 99 / 100 ] );
+    }
+    gJobs.stop();
+
+    // Scaling: a million dots moved in chunks
+    const int DOTS = 1000000;
+    const int TICKS = 200;
+    DotSystem system;
+    srand( 1 );
+    for( int i = 0; i < DOTS; ++i )
+    {
+        system.add( rand() % ( SCREEN_WIDTH - Dot::DOT_WIDTH ), rand() % ( SCREEN_HEIGHT - Dot::DOT_HEIGHT ),
+                    rand() % ( 2 * Dot::DOT_VEL + 1 ) - Dot::DOT_VEL, rand() % ( 2 * Dot::DOT_VEL + 1 ) - Dot::DOT_VEL );
+    }
+    LRectBlock walls;
+    SDL_Rect wall = { 300, 40, 40, 400 };
+    walls.add( wall );
+
+    // The caller runs jobs too, so n workers make n + 1 threads, the first row is the caller alone without the job system
+    double oneThreadSeconds = 0.0;
+    for( int w = -1; w < (int)workerCounts.size(); ++w )
+    {
+        int workers = w < 0 ? 0 : workerCounts[ w ];
+        if( workers > 0 )
+        {
+            gJobs.start( workers );
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        if( workers == 0 )
+        {
+            for( int tick = 0; tick < TICKS; ++tick )
+            {
+                for( int first = 0; first < DOTS; first += DOTS_PER_JOB )
+                {
+                    system.move( first, std::min( DOTS, first + DOTS_PER_JOB ), walls );
+                }
+            }
+        }
+        else
+        {
+            for( int tick = 0; tick < TICKS; ++tick )
+            {
+                gJobs.parallelFor( DOTS, DOTS_PER_JOB, [ &system, &walls ]( int first, int last ) { system.move( first, last, walls ); } );
+            }
+        }
+        double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        if( workers > 0 )
+        {
+            gJobs.stop();
+        }
+        else
+        {
+            oneThreadSeconds = seconds;
+        }
+        printf( "DotSystem, %2d thread%s: %.2f ms per tick for %d dots, %.2fx\n",
+                workers + 1, workers == 0 ? " " : "s", seconds * 1000.0 / TICKS, DOTS, oneThreadSeconds / seconds );
+    }
 }
 
-bool checkCollision( SDL_Rect a, SDL_Rect b )
+SDL_Point interpolatePoint( const SDL_Point& previous, const SDL_Point& current, double alpha )
 {
-    // Sides of the rectangle
-    int leftA, leftB;
-    int rightA, rightB;
-    int topA, topB;
-    int bottomA, bottomB;
+    SDL_Point point;
+    point.x = (int)lround( previous.x + ( current.x - previous.x ) * alpha );
+    point.y = (int)lround( previous.y + ( current.y - previous.y ) * alpha );
+    return point;
+}
 
-    // Calculates the sides of rect A
-    leftA = a.x;
-    rightA = a.x + a.w;
-    topA = a.y;
-    bottomA = a.y + a.h;
+void renderSnapshot( const LFrameSnapshot& snapshot, double alpha, const SDL_Rect* clip )
+{
+    // Render the wall
+    if( gRasterizer.isDrawing() )
+    {
+        SDL_Color black = { 0x00, 0x00, 0x00, 0xFF };
+        gRasterizer.drawRect( snapshot.wall, black, SDL_BLENDMODE_NONE );
+    }
+    else
+    {
+        SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0x00, 0xFF );
+        SDL_RenderDrawRect( gRenderer, &snapshot.wall );
+    }
 
-    // Calculate the sides of rect B
-    leftB = b.x;
-    rightB = b.x + b.w;
-    topB = b.y;
-    bottomB = b.y + b.h;
+    // Dots between their previous and current tick, the player dot last so it stays on top
+    gSpriteBatch.begin();
+    SDL_Rect bounds = { 0, 0, gDotTexture.getWidth(), gDotTexture.getHeight() };
+    for( int i = 0; i <= (int)snapshot.crowdCurrent.size(); ++i )
+    {
+        bool player = i == (int)snapshot.crowdCurrent.size();
+        SDL_Point position = player ? interpolatePoint( snapshot.dotPrevious, snapshot.dotCurrent, alpha )
+                                    : interpolatePoint( snapshot.crowdPrevious[ i ], snapshot.crowdCurrent[ i ], alpha );
+        bounds.x = position.x;
+        bounds.y = position.y;
+        if( clip == NULL || SDL_HasIntersection( &bounds, clip ) )
+        {
+            gSpriteBatch.draw( gDotTexture, position.x, position.y );
+        }
+    }
+    gSpriteBatch.end();
+}
 
-    // Check if any of the sides from A are outside of B
-    if( bottomA <= topB )
+bool renderDirtySnapshot( const LFrameSnapshot& snapshot, double alpha, LDirtyRegions& dirty )
+{
+    // Item 0 is the wall, 1 the player dot, then the crowd
+    dirty.track( 0, snapshot.wall );
+    SDL_Rect bounds = { 0, 0, gDotTexture.getWidth(), gDotTexture.getHeight() };
+    for( int i = 0; i <= (int)snapshot.crowdCurrent.size(); ++i )
+    {
+        bool player = i == (int)snapshot.crowdCurrent.size();
+        SDL_Point position = player ? interpolatePoint( snapshot.dotPrevious, snapshot.dotCurrent, alpha )
+                                    : interpolatePoint( snapshot.crowdPrevious[ i ], snapshot.crowdCurrent[ i ], alpha );
+        bounds.x = position.x;
+        bounds.y = position.y;
+        dirty.track( player ? 1 : i + 2, bounds );
+    }
+    if( dirty.isEmpty() )
     {
         return false;
     }
 
-    if( topA >= bottomB )
+    // Clear and redraw each changed area on its own, clipped so nothing outside it is touched.
+    // The rasterizer's framebuffer is already kept from the last frame
+    const std::vector<SDL_Rect>& rects = dirty.getRects();
+    if( gRasterizer.isDrawing() )
+    {
+        SDL_Color white = { 0xFF, 0xFF, 0xFF, 0xFF };
+        for( int i = 0; i < (int)rects.size(); ++i )
+        {
+            gRasterizer.setClip( &rects[ i ] );
+            gRasterizer.fillRect( rects[ i ], white, SDL_BLENDMODE_NONE );
+            renderSnapshot( snapshot, alpha, &rects[ i ] );
+        }
+        gRasterizer.setClip( NULL );
+        dirty.clear();
+        return true;
+    }
+    SDL_SetRenderTarget( gRenderer, gFrameTexture );
+    for( int i = 0; i < (int)rects.size(); ++i )
+    {
+        SDL_RenderSetClipRect( gRenderer, &rects[ i ] );
+        SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
+        SDL_RenderFillRect( gRenderer, &rects[ i ] );
+        renderSnapshot( snapshot, alpha, &rects[ i ] );
+    }
+    SDL_RenderSetClipRect( gRenderer, NULL );
+    SDL_SetRenderTarget( gRenderer, NULL );
+    dirty.clear();
+    return true;
+}
+
+Uint64 checksumFrame()
+{
+    // Read in a fixed format, whatever the renderer uses inside
+    std::vector<Uint32> pixels( SCREEN_WIDTH * SCREEN_HEIGHT );
+    if( SDL_RenderReadPixels( gRenderer, NULL, SDL_PIXELFORMAT_ARGB8888, &pixels[ 0 ], SCREEN_WIDTH * 4 ) != 0 )
+    {
+        printf( "Unable to read frame! SDL Error: %s\n", SDL_GetError() );
+        return 0;
+    }
+
+    return hashBytes( &pixels[ 0 ], pixels.size() * 4 );
+}
+
+Uint64 hashBytes( const void* bytes, size_t size )
+{
+    Uint64 hash = 14695981039346656037ULL;
+    for( size_t i = 0; i < size; ++i )
+    {
+        hash = ( hash ^ ( (const Uint8*)bytes )[ i ] ) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+void printFrameTimes( std::vector<double>& frameSeconds )
+{
+    if( frameSeconds.empty() )
+    {
+        return;
+    }
+
+    double total = 0.0;
+    for( int i = 0; i < (int)frameSeconds.size(); ++i )
+    {
+        total += frameSeconds[ i ];
+    }
+    std::sort( frameSeconds.begin(), frameSeconds.end() );
+    double p50 = frameSeconds[ frameSeconds.size() / 2 ];
+    double p99 = frameSeconds[ std::min( frameSeconds.size() - 1, frameSeconds.size() * 99 / 100 ) ];
+    printf( "%d frames, %.1f frames per second, p50 %.3f ms, p99 %.3f ms\n", (int)frameSeconds.size(),
+            frameSeconds.size() / total, p50 * 1000.0, p99 * 1000.0 );
+}
+
+void renderLoadingScreen( LTexture& image, int ready, int total )
+{
+    // Keep the window responsive, events stay queued for the main loop
+    SDL_PumpEvents();
+
+    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
+    SDL_RenderClear( gRenderer );
+
+    // Image scaled to a square above the bar
+    const int BAR_HEIGHT = 20;
+    const int MARGIN = 20;
+    int side = std::min( SCREEN_WIDTH, SCREEN_HEIGHT - BAR_HEIGHT - MARGIN ) - 2 * MARGIN;
+    if( image.getTexture() != NULL )
+    {
+        SDL_Rect source = image.getSourceRect();
+        SDL_Rect destination = { ( SCREEN_WIDTH - side ) / 2, MARGIN, side, side };
+        SDL_RenderCopy( gRenderer, image.getTexture(), &source, &destination );
+    }
+
+    // Progress bar outline and fill
+    SDL_Rect bar = { MARGIN, SCREEN_HEIGHT - BAR_HEIGHT - MARGIN, SCREEN_WIDTH - 2 * MARGIN, BAR_HEIGHT };
+    SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0x00, 0xFF );
+    SDL_RenderDrawRect( gRenderer, &bar );
+    if( total > 0 )
+    {
+        SDL_Rect fill = { bar.x, bar.y, bar.w * ready / total, bar.h };
+        SDL_RenderFillRect( gRenderer, &fill );
+    }
+
+    SDL_RenderPresent( gRenderer );
+}
+
+void benchmarkAssetLoader( int workers )
+{
+    // Everything loadMedia decodes
+    std::vector<std::string> images;
+    for( int i = 0; i < TOTAL_ATLAS_IMAGES; ++i )
+    {
+        images.push_back( ATLAS_IMAGES[ i ][ 1 ] );
+    }
+    const char* sounds[] = { "resources/scratch.wav", "resources/high.wav", "resources/medium.wav", "resources/low.wav" };
+
+    // Pass 0 only warms the file cache, pass 1 has no workers so jobs run inline one after another
+    for( int pass = 0; pass < 3; ++pass )
+    {
+        if( pass == 2 )
+        {
+            gJobs.start( workers );
+        }
+
+        LAssetLoader loader;
+        if( gArchive.isOpen() )
+        {
+            loader.setArchive( &gArchive );
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int i = 0; i < (int)images.size(); ++i )
+        {
+            loader.loadImage( images[ i ] );
+        }
+        for( int i = 0; i < 4; ++i )
+        {
+            loader.loadSound( sounds[ i ] );
+        }
+        bool success = loader.waitAll();
+        double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        // With enough workers the total should come close to the slowest asset
+        double slowest = 0.0;
+        for( int i = 0; i < loader.getCount(); ++i )
+        {
+            slowest = std::max( slowest, loader.getDecodeSeconds( i ) );
+        }
+
+        if( pass == 1 )
+        {
+            printf( "Serial: %d assets in %.2f ms, slowest asset %.2f ms%s\n", loader.getCount(), seconds * 1000.0, slowest * 1000.0, success ? "" : " (some failed)" );
+        }
+        else if( pass == 2 )
+        {
+            printf( "%d workers: %d assets in %.2f ms, slowest asset %.2f ms%s\n", gJobs.getWorkerCount(), loader.getCount(), seconds * 1000.0, slowest * 1000.0, success ? "" : " (some failed)" );
+        }
+    }
+
+    gJobs.stop();
+}
+
+void benchmarkButtons()
+{
+    const int EVENTS = 200000;
+    const int BUTTON_SIZES[ 3 ] = { 64, 32, 16 };
+
+    for( int s = 0; s < 3; ++s )
+    {
+        // A toolbar of square buttons with a gap between them, filling the screen
+        int size = BUTTON_SIZES[ s ];
+        int perRow = SCREEN_WIDTH / ( size + 2 );
+        int rows = SCREEN_HEIGHT / ( size + 2 );
+        std::vector<LButton> scanned( perRow * rows );
+        std::vector<LButton> layered( perRow * rows );
+        LButtonLayer layer;
+        for( int i = 0; i < (int)scanned.size(); ++i )
+        {
+            scanned[ i ].setPosition( ( i % perRow ) * ( size + 2 ), ( i / perRow ) * ( size + 2 ) );
+            scanned[ i ].setSize( size, size );
+            layered[ i ] = scanned[ i ];
+            layer.add( &layered[ i ] );
+        }
+
+        // The mouse wandering about, clicking now and then
+        std::vector<SDL_Event> events( EVENTS );
+        srand( 1 );
+        int x = SCREEN_WIDTH / 2;
+        int y = SCREEN_HEIGHT / 2;
+        for( int i = 0; i < EVENTS; ++i )
+        {
+            x = std::min( SCREEN_WIDTH - 1, std::max( 0, x + rand() % 21 - 10 ) );
+            y = std::min( SCREEN_HEIGHT - 1, std::max( 0, y + rand() % 21 - 10 ) );
+            SDL_Event& e = events[ i ];
+            memset( &e, 0, sizeof( e ) );
+            int kind = rand() % 16;
+            if( kind == 0 || kind == 1 )
+            {
+                e.type = kind == 0 ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+                e.button.x = x;
+                e.button.y = y;
+            }
+            else
+            {
+                e.type = SDL_MOUSEMOTION;
+                e.motion.x = x;
+                e.motion.y = y;
+            }
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int i = 0; i < EVENTS; ++i )
+        {
+            for( int b = 0; b < (int)scanned.size(); ++b )
+            {
+                scanned[ b ].handleEvent( &events[ i ] );
+            }
+        }
+        double scanSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        start = SDL_GetPerformanceCounter();
+        for( int i = 0; i < EVENTS; ++i )
+        {
+            layer.handleEvent( &events[ i ] );
+        }
+        double layerSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        // Both ways must leave every button showing the same sprite
+        int mismatches = 0;
+        for( int b = 0; b < (int)scanned.size(); ++b )
+        {
+            if( scanned[ b ].getSprite() != layered[ b ].getSprite() )
+            {
+                ++mismatches;
+            }
+        }
+
+        printf( "%4d buttons: every button %.3f us per event, LButtonLayer %.3f us per event, %.1fx, %d mismatches\n",
+                (int)scanned.size(), scanSeconds * 1e6 / EVENTS, layerSeconds * 1e6 / EVENTS, scanSeconds / layerSeconds, mismatches );
+    }
+}
+
+void addWidgetLevel( LContainer* parent, int depth, int fanout, const SDL_Rect* clips, std::vector<LWidget*>& leaves )
+{
+    for( int i = 0; i < fanout; ++i )
+    {
+        if( depth == 0 )
+        {
+            LWidget* label = parent->add( new LLabel() );
+            label->setMinimumSize( 40, 12 );
+            parent->add( new LImage() )->setMinimumSize( 16, 16 );
+            parent->add( new LButtonWidget( &gButtonSpriteSheetTexture, clips ) );
+            leaves.push_back( label );
+        }
+        else
+        {
+            LayoutDirection direction = depth % 2 == 0 ? LAYOUT_VERTICAL : LAYOUT_HORIZONTAL;
+            addWidgetLevel( parent->add( new LContainer( direction, 2, 1 ) ), depth - 1, fanout, clips, leaves );
+        }
+    }
+}
+
+void collectWidgetRects( LWidget* widget, std::vector<SDL_Rect>& rects )
+{
+    rects.push_back( widget->getRect() );
+    for( int i = 0; i < widget->getChildCount(); ++i )
+    {
+        collectWidgetRects( widget->getChild( i ), rects );
+    }
+}
+
+bool benchmarkWidgets()
+{
+    bool success = true;
+    const int DEPTH = 6;
+    const int FANOUT = 4;
+    const int FRAMES = 1000;
+
+    // Small button sprites, nothing is drawn so the textures can stay empty
+    SDL_Rect clips[ BUTTON_SPRITE_TOTAL ];
+    for( int i = 0; i < BUTTON_SPRITE_TOTAL; ++i )
+    {
+        SDL_Rect clip = { 0, i * 20, 20, 20 };
+        clips[ i ] = clip;
+    }
+
+    LWidgetTree tree( 4096, 4096 );
+    std::vector<LWidget*> leaves;
+    addWidgetLevel( &tree.getRoot(), DEPTH, FANOUT, clips, leaves );
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    int placed = tree.update();
+    double firstSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+    printf( "First layout: %d widgets placed in %.3f ms, draw list of %d sprites\n", placed, firstSeconds * 1000.0,
+            (int)tree.getDrawList().size() );
+
+    // Frames where nothing changed
+    placed = 0;
+    start = SDL_GetPerformanceCounter();
+    for( int frame = 0; frame < FRAMES; ++frame )
+    {
+        placed += tree.update();
+    }
+    double steadySeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+    printf( "Unchanged: %.3f us per update, %d widgets placed\n", steadySeconds * 1e6 / FRAMES, placed );
+
+    // Frames where one leaf grows or shrinks, only its ancestors and what they push along are placed again
+    placed = 0;
+    start = SDL_GetPerformanceCounter();
+    for( int frame = 0; frame < FRAMES; ++frame )
+    {
+        leaves[ leaves.size() / 2 ]->setMinimumSize( 40 + frame % 2, 12 );
+        placed += tree.update();
+    }
+    double changedSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+    printf( "One leaf resized: %.3f us per update, %d widgets placed per update\n", changedSeconds * 1e6 / FRAMES, placed / FRAMES );
+
+    // Frames where the last leaf changes, nothing after it moves
+    placed = 0;
+    start = SDL_GetPerformanceCounter();
+    for( int frame = 0; frame < FRAMES; ++frame )
+    {
+        leaves.back()->setMinimumSize( 40 + frame % 2, 12 );
+        placed += tree.update();
+    }
+    changedSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+    printf( "Last leaf resized: %.3f us per update, %d widgets placed per update\n", changedSeconds * 1e6 / FRAMES, placed / FRAMES );
+
+    // Random leaves resized one at a time, an update after nothing changed places nothing, and one after a change places
+    // only what moved plus the leaf and its ancestors, everything else keeps its cached size and place
+    std::vector<SDL_Point> sizes( leaves.size() );
+    for( int i = 0; i < (int)leaves.size(); ++i )
+    {
+        sizes[ i ].x = 40;
+        sizes[ i ].y = 12;
+        leaves[ i ]->setMinimumSize( sizes[ i ].x, sizes[ i ].y );
+    }
+    tree.update();
+
+    int overplaced = 0;
+    std::vector<SDL_Rect> before;
+    std::vector<SDL_Rect> after;
+    srand( 1 );
+    for( int frame = 0; frame < FRAMES; ++frame )
+    {
+        before.clear();
+        collectWidgetRects( &tree.getRoot(), before );
+        int leaf = rand() % leaves.size();
+        sizes[ leaf ].x = 20 + rand() % 40;
+        sizes[ leaf ].y = 8 + rand() % 16;
+        leaves[ leaf ]->setMinimumSize( sizes[ leaf ].x, sizes[ leaf ].y );
+        placed = tree.update();
+
+        after.clear();
+        collectWidgetRects( &tree.getRoot(), after );
+        int moved = 0;
+        for( int i = 0; i < (int)after.size(); ++i )
+        {
+            if( memcmp( &before[ i ], &after[ i ], sizeof( SDL_Rect ) ) != 0 )
+            {
+                ++moved;
+            }
+        }
+        if( placed < moved || placed > moved + DEPTH + 2 || tree.update() != 0 )
+        {
+            ++overplaced;
+        }
+    }
+
+    // The same leaf sizes laid out from scratch have to land everything in the same place
+    LWidgetTree fresh( 4096, 4096 );
+    std::vector<LWidget*> freshLeaves;
+    addWidgetLevel( &fresh.getRoot(), DEPTH, FANOUT, clips, freshLeaves );
+    for( int i = 0; i < (int)freshLeaves.size(); ++i )
+    {
+        freshLeaves[ i ]->setMinimumSize( sizes[ i ].x, sizes[ i ].y );
+    }
+    fresh.update();
+
+    before.clear();
+    collectWidgetRects( &fresh.getRoot(), before );
+    int misplaced = 0;
+    for( int i = 0; i < (int)after.size(); ++i )
+    {
+        if( memcmp( &before[ i ], &after[ i ], sizeof( SDL_Rect ) ) != 0 )
+        {
+            ++misplaced;
+        }
+    }
+    printf( "%d random leaves resized: %d updates placed more than moved, %d of %d widgets differ from a fresh layout\n",
+            FRAMES, overplaced, misplaced, (int)after.size() );
+    success = overplaced == 0 && misplaced == 0;
+    return success;
+}
+
+bool benchmarkMixer()
+{
+    bool success = true;
+    const int FREQUENCY = 44100;
+    const int SECONDS = 4;
+    const int VOICE_COUNTS[] = { 8, 32, 128, 512 };
+    const int KERNEL_RUNS = 20000;
+
+    // Kernels add taps in different orders, so only rounding may differ
+    const float KERNEL_TOLERANCE = 1e-5f;
+    const float MIX_TOLERANCE = 1e-4f;
+
+    // A second of a chord with a little noise, looped by every voice so none goes quiet
+    std::vector<float> frames( FREQUENCY * 2 );
+    srand( 1 );
+    for( int i = 0; i < FREQUENCY; ++i )
+    {
+        double t = (double)i / FREQUENCY;
+        float sample = (float)( 0.2 * sin( 2.0 * M_PI * 220.0 * t ) + 0.1 * sin( 2.0 * M_PI * 330.0 * t ) ) +
+                       0.05f * ( rand() * 2.0f / RAND_MAX - 1.0f );
+        frames[ i * 2 ] = sample;
+        frames[ i * 2 + 1 ] = sample * 0.8f;
+    }
+    LSound sound;
+    sound.loadFromFrames( &frames[ 0 ], FREQUENCY, FREQUENCY );
+
+    // Every kernel this CPU runs is checked on its own against the scalar one, not just the one setSimd picks
+    std::vector<LMixer::ResampleKernel> resamplers;
+    std::vector<LMixer::CopyKernel> copiers;
+    std::vector<const char*> kernelNames;
+    resamplers.push_back( resampleScalar );
+    copiers.push_back( copyScalar );
+    kernelNames.push_back( "scalar" );
+    #ifdef HAVE_X86_SIMD
+    resamplers.push_back( resampleSSE2 );
+    copiers.push_back( copySSE2 );
+    kernelNames.push_back( "SSE2" );
+    if( SDL_HasAVX2() )
+    {
+        resamplers.push_back( resampleAVX2 );
+        copiers.push_back( copyAVX2 );
+        kernelNames.push_back( "AVX2" );
+    }
+    #endif
+
+    // Random runs in every band with ramping gains, odd lengths so the leftover frames of the wide copies run too
+    // Whole blocks are compared, so a kernel writing past its run shows up as well
+    const float* filters = LMixer::getKernels();
+    std::vector<float> expected( MIXER_BLOCK_FRAMES * 2 );
+    std::vector<float> actual( MIXER_BLOCK_FRAMES * 2 );
+    for( int k = 1; k < (int)kernelNames.size(); ++k )
+    {
+        int mismatches = 0;
+        srand( 3 );
+        for( int run = 0; run < KERNEL_RUNS; ++run )
+        {
+            int count = 1 + rand() % MIXER_BLOCK_FRAMES;
+            int band = rand() % RESAMPLE_BANDS;
+            const float* kernels = filters + band * ( RESAMPLE_PHASES + 1 ) * RESAMPLE_TAPS;
+            Uint64 step = (Uint64)( RESAMPLE_BAND_STEPS[ band ] * rand() / RAND_MAX * 4294967296.0 ) + 1;
+            Sint64 index = RESAMPLE_TAPS + rand() % ( FREQUENCY / 2 );
+            Uint64 position = ( (Uint64)index << 32 ) | ( (Uint64)rand() * 65537u & 0xffffffffu );
+            float gainLeft = (float)rand() / RAND_MAX;
+            float gainRight = (float)rand() / RAND_MAX;
+            float rampLeft = ( (float)rand() / RAND_MAX - 0.5f ) / count;
+            float rampRight = ( (float)rand() / RAND_MAX - 0.5f ) / count;
+
+            std::fill( expected.begin(), expected.end(), 0.0f );
+            std::fill( actual.begin(), actual.end(), 0.0f );
+            bool resampled = run % 2 == 0;
+            bool moved = true;
+            if( resampled )
+            {
+                Uint64 end = resampleScalar( sound.getFrames(), position, step, kernels, &expected[ 0 ], count, gainLeft, gainRight, rampLeft, rampRight );
+                moved = resamplers[ k ]( sound.getFrames(), position, step, kernels, &actual[ 0 ], count, gainLeft, gainRight, rampLeft, rampRight ) == end;
+            }
+            else
+            {
+                copyScalar( sound.getFrames() + index * 2, &expected[ 0 ], count, gainLeft, gainRight, rampLeft, rampRight );
+                copiers[ k ]( sound.getFrames() + index * 2, &actual[ 0 ], count, gainLeft, gainRight, rampLeft, rampRight );
+            }
+
+            float difference = 0.0f;
+            for( int i = 0; i < (int)expected.size(); ++i )
+            {
+                difference = std::max( difference, fabsf( expected[ i ] - actual[ i ] ) );
+            }
+            if( !moved || difference > KERNEL_TOLERANCE )
+            {
+                if( mismatches < 10 )
+                {
+                    printf( "%s %s mismatch: %d frames in band %d, largest diff %g%s\n", kernelNames[ k ], resampled ? "resample" : "copy",
+                            count, band, difference, moved ? "" : ", ends at another position" );
+                }
+                ++mismatches;
+                success = false;
+            }
+        }
+        printf( "%s: %d runs compared with scalar, %d mismatches\n", kernelNames[ k ], KERNEL_RUNS, mismatches );
+    }
+
+    #ifdef HAVE_X86_SIMD
+    const char* kernel = SDL_HasAVX2() ? "AVX2" : "SSE2";
+    #else
+    const char* kernel = "scalar";
+    #endif
+    printf( "Mixing %d seconds at %d Hz in %d frame blocks, a quarter of the voices unpitched and the rest at 0.5 to 2\n",
+            SECONDS, FREQUENCY, MIXER_BLOCK_FRAMES );
+    printf( "%8s %16s %16s %14s\n", "voices", "scalar", kernel, "largest diff" );
+
+    std::vector<float> output[ 2 ];
+    for( int c = 0; c < (int)( sizeof( VOICE_COUNTS ) / sizeof( VOICE_COUNTS[ 0 ] ) ); ++c )
+    {
+        int voices = VOICE_COUNTS[ c ];
+        double realTime[ 2 ];
+        for( int pass = 0; pass < 2; ++pass )
+        {
+            LMixer mixer( voices );
+            mixer.setOutput( FREQUENCY, AUDIO_F32SYS, 2 );
+            mixer.setSimd( pass == 1 );
+
+            // Same voices for both passes
+            srand( 2 );
+            for( int v = 0; v < voices; ++v )
+            {
+                float pitch = v % 4 == 0 ? 1.0f : 0.5f + 1.5f * rand() / RAND_MAX;
+                mixer.play( &sound, 1.0f / voices, rand() * 2.0f / RAND_MAX - 1.0f, pitch, 0, true );
+            }
+
+            output[ pass ].assign( FREQUENCY * SECONDS * 2, 0.0f );
+            Uint64 start = SDL_GetPerformanceCounter();
+            for( int first = 0; first < FREQUENCY * SECONDS; first += MIXER_BLOCK_FRAMES )
+            {
+                mixer.mix( &output[ pass ][ first * 2 ], std::min( MIXER_BLOCK_FRAMES, FREQUENCY * SECONDS - first ) );
+            }
+            double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+            realTime[ pass ] = SECONDS / seconds;
+        }
+
+        // The kernels add taps in different orders, so expect rounding differences only
+        float difference = 0.0f;
+        for( int i = 0; i < (int)output[ 0 ].size(); ++i )
+        {
+            difference = std::max( difference, fabsf( output[ 0 ][ i ] - output[ 1 ][ i ] ) );
+        }
+        printf( "%8d %15.1fx %15.1fx %14.2g\n", voices, realTime[ 0 ], realTime[ 1 ], difference );
+        success = success && difference <= MIX_TOLERANCE;
+    }
+
+    // More sounds than voices, every third more important than the rest
+    LMixer mixer;
+    mixer.setOutput( FREQUENCY, AUDIO_F32SYS, 2 );
+    for( int i = 0; i < MIXER_VOICES * 4; ++i )
+    {
+        mixer.play( &sound, 0.1f, 0.0f, 1.0f, i % 3 == 0 ? 1 : 0 );
+    }
+    std::vector<float> block( MIXER_BLOCK_FRAMES * 2, 0.0f );
+    mixer.mix( &block[ 0 ], MIXER_BLOCK_FRAMES );
+    printf( "Played %d sounds on %d voices: %d voices stolen, %d sounds refused\n",
+            MIXER_VOICES * 4, MIXER_VOICES, mixer.getStolenCount(), mixer.getRefusedCount() );
+    return success;
+}
+
+bool benchmarkAudioQueue()
+{
+    const int FREQUENCY = 44100;
+    const int BUFFER_FRAMES = 256;
+    const int SECONDS_PER_RATE = 2;
+    const int RATES[] = { 10000, 100000, 1000000 };
+
+    // A real audio thread, on the dummy driver when there is no sound card, which keeps the same pace
+    if( SDL_Init( SDL_INIT_AUDIO ) < 0 || Mix_OpenAudio( FREQUENCY, MIX_DEFAULT_FORMAT, 2, BUFFER_FRAMES ) < 0 )
+    {
+        SDL_QuitSubSystem( SDL_INIT_AUDIO );
+        SDL_setenv( "SDL_AUDIODRIVER", "dummy", 1 );
+        if( SDL_Init( SDL_INIT_AUDIO ) < 0 || Mix_OpenAudio( FREQUENCY, MIX_DEFAULT_FORMAT, 2, BUFFER_FRAMES ) < 0 )
+        {
+            printf( "Unable to open audio! SDL_mixer Error: %s\n", Mix_GetError() );
+            return false;
+        }
+    }
+
+    // A short blip for the effects, declared first so it outlives the mixer
+    std::vector<float> frames( FREQUENCY / 8 * 2 );
+    for( int i = 0; i < FREQUENCY / 8; ++i )
+    {
+        frames[ i * 2 ] = frames[ i * 2 + 1 ] = 0.05f * (float)sin( 2.0 * M_PI * 440.0 * i / FREQUENCY );
+    }
+    LSound blip;
+    blip.loadFromFrames( &frames[ 0 ], FREQUENCY / 8, FREQUENCY );
+
+    LMixer mixer;
+    if( !mixer.open() )
     {
+        Mix_CloseAudio();
         return false;
     }
+    int frequency = 0;
+    Uint16 format = 0;
+    int channels = 0;
+    Mix_QuerySpec( &frequency, &format, &channels );
+    printf( "Audio on the %s driver, %d frame buffers at %d Hz, %.2f ms of audio per callback\n",
+            SDL_GetCurrentAudioDriver(), BUFFER_FRAMES, frequency, BUFFER_FRAMES * 1000.0 / frequency );
+    printf( "%10s %10s %10s %10s %8s %14s\n", "wanted/s", "sent/s", "dropped", "callbacks", "xruns", "worst callback" );
+
+    srand( 1 );
+    int handle = -1;
+    int lateRates = 0;
+    for( int r = 0; r < (int)( sizeof( RATES ) / sizeof( RATES[ 0 ] ) ); ++r )
+    {
+        int callbacks = mixer.getCallbackCount();
+        int xruns = mixer.getXrunCount();
+        int dropped = mixer.getDroppedCount();
+        int sent = 0;
+        mixer.resetWorstCallback();
+
+        // Bursts every millisecond, a mix of everything the game can ask for
+        Uint64 start = SDL_GetPerformanceCounter();
+        Uint64 end = start + SECONDS_PER_RATE * SDL_GetPerformanceFrequency();
+        for( int burst = 0; SDL_GetPerformanceCounter() < end; ++burst )
+        {
+            for( int i = 0; i < RATES[ r ] / 1000; ++i, ++sent )
+            {
+                switch( sent % 8 )
+                {
+                    case 0:
+                    case 1:
+                    case 2:
+                    handle = mixer.play( &blip, 0.5f, rand() * 2.0f / RAND_MAX - 1.0f, 0.5f + 1.5f * rand() / RAND_MAX, rand() % 3 );
+                    break;
+
+                    case 3:
+                    mixer.setGain( handle, 0.25f, 0.0f );
+                    break;
+
+                    case 4:
+                    mixer.setPitch( handle, 1.5f );
+                    break;
+
+                    case 5:
+                    mixer.stop( handle );
+                    break;
+
+                    case 6:
+                    mixer.pauseMusic();
+                    break;
+
+                    case 7:
+                    mixer.resumeMusic();
+                    break;
+                }
+            }
+
+            // Wait for the next burst
+            Uint64 next = start + ( burst + 1 ) * SDL_GetPerformanceFrequency() / 1000;
+            while( SDL_GetPerformanceCounter() < next )
+            {
+                SDL_Delay( 0 );
+            }
+        }
+        double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        // A stop waits for the callback to take everything queued before it
+        mixer.stopSound( &blip );
+        xruns = mixer.getXrunCount() - xruns;
+        printf( "%10d %10.0f %10d %10d %8d %11.3f ms%s\n", RATES[ r ], sent / seconds, mixer.getDroppedCount() - dropped,
+                mixer.getCallbackCount() - callbacks, xruns, mixer.getWorstCallbackSeconds() * 1000.0, xruns > 0 ? "  FAIL" : "" );
+        if( xruns > 0 )
+        {
+            ++lateRates;
+        }
+    }
 
-    if( rightA <= leftB )
+    // Only the mixer's own part of the callback is timed, SDL_mixer's channels and underruns in the device itself are not seen here
+    if( lateRates > 0 )
     {
-        return false;
+        printf( "FAIL: callbacks ran late at %d of %d rates\n", lateRates, (int)( sizeof( RATES ) / sizeof( RATES[ 0 ] ) ) );
     }
-
-    if( leftA >= rightB )
+    else
     {
-        return false;
+        printf( "PASS: no callback ran late, counting the mixer's own time only\n" );
     }
 
-    // If none of the sides from A are outside B
-    return true;
+    mixer.close();
+    Mix_CloseAudio();
+    SDL_QuitSubSystem( SDL_INIT_AUDIO );
+    return lateRates == 0;
 }
 
-bool init()
+void benchmarkAudioLatency()
 {
-    // Initialization Flag
-    bool success = true;
+    const int BUFFER_FRAMES[] = { 64, 128, 256, 512, 1024, 2048 };
+    const int PRESSES = 40;
 
-    // Initialize SDL
-    if( SDL_Init( SDL_INIT_VIDEO | SDL_INIT_AUDIO ) < 0 )
+    // Presses come at odd times, so they land all over the callback period
+    const Uint32 PRESS_GAP_MS = 23;
+
+    // A real device if there is one, the dummy driver keeps the same pace without one
+    if( SDL_Init( SDL_INIT_AUDIO ) < 0 || Mix_OpenAudio( gAudioFrequency, gAudioFormat, 2, AUDIO_MAX_BUFFER_FRAMES ) < 0 )
     {
-        printf( "SDL could not initalize! SDL_Error: %s\n", SDL_GetError() );
-        success = false;
+        SDL_QuitSubSystem( SDL_INIT_AUDIO );
+        SDL_setenv( "SDL_AUDIODRIVER", "dummy", 1 );
+        if( SDL_Init( SDL_INIT_AUDIO ) < 0 )
+        {
+            printf( "SDL could not initialize! SDL Error: %s\n", SDL_GetError() );
+            return;
+        }
     }
     else
     {
-        // Set texture filtering to linear
-        if( !SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" ) )
-        {
-            printf("Warning: Linear texture filtering not enabled" );
-        }
+        Mix_CloseAudio();
+    }
+
+    std::vector<float> frames( gAudioFrequency / 20 * 2 );
+    for( int i = 0; i < (int)frames.size() / 2; ++i )
+    {
+        frames[ i * 2 ] = frames[ i * 2 + 1 ] = 0.1f * (float)sin( 2.0 * M_PI * 880.0 * i / gAudioFrequency );
+    }
+    LSound blip;
+    blip.loadFromFrames( &frames[ 0 ], frames.size() / 2, gAudioFrequency );
 
-        // Create a window
-        gWindow = SDL_CreateWindow("SDL Tutorial", SDL_WINDOWPOS_UNDEFINED,
-            SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-        if( gWindow == NULL )
+    std::vector<std::string> results;
+    for( int b = 0; b < (int)( sizeof( BUFFER_FRAMES ) / sizeof( BUFFER_FRAMES[ 0 ] ) ); ++b )
+    {
+        gAudioBufferFrames = BUFFER_FRAMES[ b ];
+        if( !openAudio() )
         {
-            printf("Window could not be created! SDL_Error: %s\n", SDL_GetError() );
-            success = false;
+            break;
         }
-        else
+
+        // Each press waits for the callback to play it, the last latency is then that press's
+        int xruns = gMixer.getXrunCount();
+        double total = 0.0;
+        double worst = 0.0;
+        int measured = 0;
+        for( int p = 0; p < PRESSES; ++p )
         {
-            // Create renderer for the window - Vertical Sync allows rendering to update
-            // at the same time as your monitor during vertical refresh
-            gRenderer = SDL_CreateRenderer( gWindow, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
-            if( gRenderer == NULL )
+            int count = gMixer.getLatencyCount();
+            gMixer.play( &blip, 1.0f, 0.0f, 1.0f, 0, false, SDL_GetPerformanceCounter() );
+            Uint32 start = SDL_GetTicks();
+            while( gMixer.getLatencyCount() == count && SDL_GetTicks() - start < 1000 )
             {
-                printf( "Renderer could not be created! SDL Error: %s\n", SDL_GetError() );
-                success = false;
+                SDL_Delay( 1 );
             }
-            else
+            if( gMixer.getLatencyCount() != count )
             {
-                // Initialize renderer color
-                SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
+                double seconds = gMixer.getLastLatencySeconds();
+                total += seconds;
+                worst = std::max( worst, seconds );
+                ++measured;
+            }
+            SDL_Delay( PRESS_GAP_MS );
+        }
 
-                // Initialize PNG Loading
-                int imgFlags = IMG_INIT_PNG;
-                if( !( IMG_Init( imgFlags ) & imgFlags ) )
-                {
-                    printf("SDL_image could not initialize! SDL_Image Error: %s\n", IMG_GetError() );
-                    success = false;
-                }
+        char line[ 128 ];
+        snprintf( line, sizeof( line ), "%8d %8d %10.2f ms %10.2f ms %10.2f ms %8d", BUFFER_FRAMES[ b ], gAudioBufferFrames,
+                  measured > 0 ? total * 1000.0 / measured : 0.0, worst * 1000.0, gAudioBufferFrames * 1000.0 / gMixer.getFrequency(), gMixer.getXrunCount() - xruns );
+        results.push_back( line );
 
-                // Initialize SDL_TTF
-                //if( TTF_Init() == -1 )
-                //{
-                //    printf("SDL_TTF could not initialize! SDL_TTF Error: %s\n", TTF_GetError() );
-                //    success = false;
-                //}
+        gMixer.stopSound( &blip );
+        gMixer.close();
+        Mix_CloseAudio();
+    }
 
-                // Initialize SDL_mixer
-                if( Mix_OpenAudio( 44100, MIX_DEFAULT_FORMAT, 2, 2048 ) < 0 )
-                {
-                    printf( "SDL_mixer could not initialize! SDL_Mixer Error: %s\n", Mix_GetError() );
-                    success = false;
-                }
-            }
-        }
+    // After the device's own messages, the time from press to the first sample leaving SDL, the device's latency comes on top
+    printf( "%8s %8s %13s %13s %13s %8s\n", "asked", "buffer", "average", "worst", "one buffer", "xruns" );
+    for( int i = 0; i < (int)results.size(); ++i )
+    {
+        printf( "%s\n", results[ i ].c_str() );
     }
-    return success;
+    SDL_QuitSubSystem( SDL_INIT_AUDIO );
 }
 
-bool loadMedia()
+bool writeWav( std::string path, const std::vector<Sint16>& samples, int channels, int frequency )
 {
-    // Loading success flag
-    bool success = true;
-
-    // Load Foo texture
-    //if( !gFooTexture.loadFromFile( "resources/foo.png" ))
-    //{
-    //    printf("Failed to load Foo texture image!\n" );
-    //    success = false;
-    //}
-
-    //// Load background texture
-    //if( !gBackgroundTexture.loadFromFile("resources/background.png"))
-    //{
-    //    printf("Failed to load background texture image!\n" );
-    //    success = false;
-    //}
-
-    // Load PNG texture
-    //gTexture = loadTexture( "resources/loading_image.png");
-    //if( gTexture == NULL )
-    //{
-    //    printf("Failed to load texture image!\n");
-    //    success = false;
-    //}
-
-    // Load Sprite Sheet Texture
-    //if( !gSpriteSheetTexture.loadFromFile( "resources/dots.png" ) )
-    //{
-    //    printf("Failed to load sprite sheet texture!\n" );
-    //    success = false;
-    //}
-    //else
-    //{
-    //    // Set top left sprite
-    //    gSpriteClips[ 0 ].x = 0;
-    //    gSpriteClips[ 0 ].y = 0;
-    //    gSpriteClips[ 0 ].w = 100;
-    //    gSpriteClips[ 0 ].h = 100;
-
-    //    // Set top right sprite
-    //    gSpriteClips[ 1 ].x = 100;
-    //    gSpriteClips[ 1 ].y = 0;
-    //    gSpriteClips[ 1 ].w = 100;
-    //    gSpriteClips[ 1 ].h = 100;
-
-    //    // Set bottom left sprite
-    //    gSpriteClips[ 2 ].x = 0;
-    //    gSpriteClips[ 2 ].y = 100;
-    //    gSpriteClips[ 2 ].w = 100;
-    //    gSpriteClips[ 2 ].h = 100;
-
-    //    // Set bottom right sprite
-    //    gSpriteClips[ 3 ].x = 100;
-    //    gSpriteClips[ 3 ].y = 100;
-    //    gSpriteClips[ 3 ].w = 100;
-    //    gSpriteClips[ 3 ].h = 100;
-    //}
-
-    // Load Walking Sprite Animation
-    //if( !gSpriteWalkSheetTexture.loadFromFile( "resources/foo_walk.png" ))
-    //{
-    //    printf( "Failed to load walking animation texture!\n" );
-    //    success = false;
-    //}
-    //else
-    //{
-    //    // Set Sprite Class
-    //    gSpriteWalkClips[ 0 ].x = 0;
-    //    gSpriteWalkClips[ 0 ].y = 0;
-    //    gSpriteWalkClips[ 0 ].w = 64;
-    //    gSpriteWalkClips[ 0 ].h = 205;
-
-    //    gSpriteWalkClips[ 1 ].x = 64;
-    //    gSpriteWalkClips[ 1 ].y = 0;
-    //    gSpriteWalkClips[ 1 ].w = 64;
-    //    gSpriteWalkClips[ 1 ].h = 205;
-
-    //    gSpriteWalkClips[ 2 ].x = 128;
-    //    gSpriteWalkClips[ 2 ].y = 0;
-    //    gSpriteWalkClips[ 2 ].w = 64;
-    //    gSpriteWalkClips[ 2 ].h = 205;
-
-    //    gSpriteWalkClips[ 3 ].x = 196;
-    //    gSpriteWalkClips[ 3 ].y = 0;
-    //    gSpriteWalkClips[ 3 ].w = 64;
-    //    gSpriteWalkClips[ 3 ].h = 205;
-    //}
-
-    // Arrow for rotation and flip
-    //if( !gArrowTexture.loadFromFile( "resources/arrow.png" ) )
-    //{
-    //    printf( "Failed to load arrow texture!\n" );
-    //    success = false;
-    //}
-
-    // Open the font
-    //gFont = TTF_OpenFont( "resources/lazy.ttf", 28);
-    //if( gFont == NULL )
-    //{
-    //    printf( "Failed to load lazy font! SDL_TTF Error: %s\n", TTF_GetError() );
-    //    success = false;
-    //}
-    //else
-    //{
-    //    // Render text
-    //    SDL_Color textColor = { 0, 0, 0 };
-    //    if( !gTextTexture.loadFromRenderedText( "Hello World!", textColor ) )
-    //    {
-    //        printf( "Failed to render text texture!\n" );
-    //        success = false;
-    //    }
-    //}
-
-    // Sprites
-    // if( !gButtonSpriteSheetTexture.loadFromFile( "resources/button.png") )
-    // {
-    //     printf("Failed to load button sprite texture!\n");
-    //     success = false;
-    // }
-    // else
-    // {
-    //     //Set sprites
-	// 	for( int i = 0; i < BUTTON_SPRITE_TOTAL; ++i )
-	// 	{
-	// 		gSpriteClips[ i ].x = 0;
-	// 		gSpriteClips[ i ].y = i * 200;
-	// 		gSpriteClips[ i ].w = BUTTON_WIDTH;
-	// 		gSpriteClips[ i ].h = BUTTON_HEIGHT;
-	// 	}
-
-	// 	//Set buttons in corners
-	// 	gButtons[ 0 ].setPosition( 0, 0 );
-	// 	gButtons[ 1 ].setPosition( SCREEN_WIDTH - BUTTON_WIDTH, 0 );
-	// 	gButtons[ 2 ].setPosition( 0, SCREEN_HEIGHT - BUTTON_HEIGHT );
-	// 	gButtons[ 3 ].setPosition( SCREEN_WIDTH - BUTTON_WIDTH, SCREEN_HEIGHT - BUTTON_HEIGHT );
-    // }
+    FILE* file = fopen( path.c_str(), "wb" );
+    if( file == NULL )
+    {
+        printf( "Unable to create %s!\n", path.c_str() );
+        return false;
+    }
 
-    // Load key press textures
-    // if( !gPressTexture.loadFromFile( "resources/press.png" ) )
-    // {
-    //     printf( "Failed to load press texture!\n" );
-    //     success = false;
-    // }
+    // Canonical 44 byte header, every field little endian
+    Uint32 dataBytes = samples.size() * sizeof( Sint16 );
+    Uint32 header[ 11 ];
+    memcpy( &header[ 0 ], "RIFF", 4 );
+    header[ 1 ] = SDL_SwapLE32( 36 + dataBytes );
+    memcpy( &header[ 2 ], "WAVE", 4 );
+    memcpy( &header[ 3 ], "fmt ", 4 );
+    header[ 4 ] = SDL_SwapLE32( 16 );
+    header[ 5 ] = SDL_SwapLE32( 1 | channels << 16 );
+    header[ 6 ] = SDL_SwapLE32( frequency );
+    header[ 7 ] = SDL_SwapLE32( frequency * channels * sizeof( Sint16 ) );
+    header[ 8 ] = SDL_SwapLE32( channels * sizeof( Sint16 ) | 16 << 16 );
+    memcpy( &header[ 9 ], "data", 4 );
+    header[ 10 ] = SDL_SwapLE32( dataBytes );
+    fwrite( header, sizeof( header ), 1, file );
+    for( int i = 0; i < (int)samples.size(); ++i )
+    {
+        Sint16 sample = SDL_SwapLE16( samples[ i ] );
+        fwrite( &sample, sizeof( sample ), 1, file );
+    }
 
-    // if( !gUpTexture.loadFromFile( "resources/up.png" ) )
-    // {
-    //     printf( "Failed to load up texture!\n" );
-    //     success = false;
-    // }
-    // if( !gDownTexture.loadFromFile( "resources/down.png" ) )
-    // {
-    //     printf( "Failed to load down texture!\n" );
-    //     success = false;
-    // }
-    // if( !gLeftTexture.loadFromFile( "resources/left.png" ) )
-    // {
-    //     printf( "Failed to load left texture!\n" );
-    //     success = false;
-    // }
-    // if( !gRightTexture.loadFromFile( "resources/right.png" ) )
-    // {
-    //     printf( "Failed to load right texture!\n" );
-    //     success = false;
-    // }
+    bool success = fclose( file ) == 0;
+    if( !success )
+    {
+        printf( "Unable to write %s!\n", path.c_str() );
+    }
+    return success;
+}
 
-    // Music
-    if( !gPromptTexture.loadFromFile( "resources/prompt.png" ) )
+void benchmarkMusic()
+{
+    const int FREQUENCY = 44100;
+    const int FILE_FREQUENCY = 48000;
+    const int FILE_SECONDS = 20;
+    const int CALLBACK_FRAMES = 256;
+    const double RUN_SECONDS = 4.0;
+    const Uint32 READ_DELAYS[] = { 0, 100, 200, 300, 400 };
+    const char* PATHS[] = { "bench-music-a.wav", "bench-music-b.wav" };
+
+    // Two tones recorded at another rate than the output, so every block is resampled
+    for( int p = 0; p < 2; ++p )
     {
-        printf( "Failed to load prompt texture!\n" );
-        success = false;
+        std::vector<Sint16> samples( FILE_FREQUENCY * FILE_SECONDS * 2 );
+        for( int i = 0; i < FILE_FREQUENCY * FILE_SECONDS; ++i )
+        {
+            double sample = 0.25 * sin( 2.0 * M_PI * ( p == 0 ? 440.0 : 660.0 ) * i / FILE_FREQUENCY );
+            samples[ i * 2 ] = samples[ i * 2 + 1 ] = (Sint16)( sample * 32767.0 );
+        }
+        if( !writeWav( PATHS[ p ], samples, 2, FILE_FREQUENCY ) )
+        {
+            return;
+        }
     }
-    // Load Music
-    gMusic = Mix_LoadMUS( "resources/beat.wav" );
-    if( gMusic == NULL )
+
+    // A 64 KB read holds about a third of a second of this file, and the ring about one and a half
+    double readSeconds = (double)MUSIC_READ_BYTES / ( FILE_FREQUENCY * 4 );
+    printf( "Each stream holds %d blocks of %d frames, %.2f s of audio in %d KB whatever the track length, reads are %d KB or %.0f ms of audio\n",
+            MUSIC_BLOCKS, MUSIC_BLOCK_FRAMES, (double)MUSIC_BLOCKS * MUSIC_BLOCK_FRAMES / FREQUENCY,
+            (int)( ( MUSIC_BLOCKS * MUSIC_BLOCK_FRAMES * 2 * sizeof( float ) + MUSIC_READ_BYTES ) / 1024 ), MUSIC_READ_BYTES / 1024, readSeconds * 1000.0 );
+    printf( "%12s %10s %10s %14s\n", "read delay", "start", "underruns", "least buffered" );
+
+    // The calling thread stands in for the audio callback, pulling a buffer on time however the disk keeps up
+    std::vector<float> buffer( CALLBACK_FRAMES * 2 );
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    for( int d = 0; d < (int)( sizeof( READ_DELAYS ) / sizeof( READ_DELAYS[ 0 ] ) ); ++d )
     {
-        printf( "Failed to load beat music! SDL_mixer Error: %s\n", Mix_GetError() );
-        success = false;
+        LMusicStream stream;
+        stream.setReadDelay( READ_DELAYS[ d ] );
+        Uint64 start = SDL_GetPerformanceCounter();
+        stream.open( PATHS[ 0 ], FREQUENCY );
+        while( !stream.isReady() )
+        {
+            SDL_Delay( 1 );
+        }
+        double startMs = (double)( SDL_GetPerformanceCounter() - start ) * 1000.0 / frequency;
+
+        int leastBuffered = MUSIC_BLOCKS * MUSIC_BLOCK_FRAMES;
+        start = SDL_GetPerformanceCounter();
+        int callbacks = (int)( RUN_SECONDS * FREQUENCY / CALLBACK_FRAMES );
+        for( int c = 0; c < callbacks; ++c )
+        {
+            Uint64 due = start + (Uint64)c * CALLBACK_FRAMES * frequency / FREQUENCY;
+            while( SDL_GetPerformanceCounter() < due )
+            {
+                SDL_Delay( 1 );
+            }
+            leastBuffered = std::min( leastBuffered, stream.getBufferedFrames() );
+            stream.read( &buffer[ 0 ], CALLBACK_FRAMES );
+        }
+        printf( "%9u ms %7.1f ms %10d %11.0f ms\n", READ_DELAYS[ d ], startMs, stream.getUnderrunCount(), leastBuffered * 1000.0 / FREQUENCY );
+        stream.close();
     }
 
-    // Load Sound Effects
-    gScratch = Mix_LoadWAV( "resources/scratch.wav" );
-    if( gScratch == NULL )
-    {
-        printf( "Failed to load scratch sound effect! SDL_mixer Error: %s\n", Mix_GetError() );
-        success = false;
-    }
+    // Seeks and a crossfade through a mixer with no device, the game's calls are applied as it mixes
+    LMixer mixer;
+    mixer.setOutput( FREQUENCY, AUDIO_F32SYS, 2 );
+    LMusicPlayer player( &mixer );
+    player.play( PATHS[ 0 ] );
+    int seeks = 0;
+    int crossfades = 0;
+    int gaps = 0;
+    int silentRun = 0;
+    bool started = false;
+    float largestStep = 0.0f;
+    float lastSample = 0.0f;
+    Uint64 start = SDL_GetPerformanceCounter();
+    int callbacks = (int)( RUN_SECONDS * FREQUENCY / CALLBACK_FRAMES );
+    for( int c = 0; c < callbacks; ++c )
+    {
+        // A seek each half second, with a crossfade to the other track and back in between
+        // Every other seek is followed by another before the first stream can be ready, the way a scrubbing player sends them
+        if( c > 0 && c % ( FREQUENCY / 2 / CALLBACK_FRAMES ) == 0 )
+        {
+            int event = c / ( FREQUENCY / 2 / CALLBACK_FRAMES );
+            if( event % 3 == 0 )
+            {
+                player.play( PATHS[ event / 3 % 2 ], 0.5 );
+                ++crossfades;
+            }
+            else
+            {
+                player.seek( event * 1.7 );
+                ++seeks;
+            }
+            if( event % 3 == 2 )
+            {
+                player.seek( event * 1.3 );
+                ++seeks;
+            }
+        }
+
+        Uint64 due = start + (Uint64)c * CALLBACK_FRAMES * frequency / FREQUENCY;
+        while( SDL_GetPerformanceCounter() < due )
+        {
+            SDL_Delay( 1 );
+        }
+        std::fill( buffer.begin(), buffer.end(), 0.0f );
+        mixer.mix( &buffer[ 0 ], CALLBACK_FRAMES );
 
-    gHigh = Mix_LoadWAV( "resources/high.wav" );
-    if( gHigh == NULL )
-    {
-        printf( "Failed to load high sound effect! SDL_mixer Error: %s\n", Mix_GetError() );
-        success = false;
+        // A gap is more than 16 frames of silence once the music has started, a click is a large jump between frames
+        for( int i = 0; i < CALLBACK_FRAMES; ++i )
+        {
+            float sample = buffer[ i * 2 ];
+            silentRun = sample == 0.0f ? silentRun + 1 : 0;
+            gaps += started && silentRun == 17 ? 1 : 0;
+            started = started || sample != 0.0f;
+            if( started )
+            {
+                largestStep = std::max( largestStep, fabsf( sample - lastSample ) );
+            }
+            lastSample = sample;
+        }
     }
+    float toneStep = (float)( 0.25 * 2.0 * M_PI * 660.0 / FREQUENCY );
+    printf( "%d seeks, some back to back, and %d crossfades in %.0f s: %d gaps, %d underruns, largest step between frames %.4f where the tones alone reach %.4f\n",
+            seeks, crossfades, RUN_SECONDS, gaps, player.getUnderrunCount(), largestStep, toneStep );
 
-    gMedium = Mix_LoadWAV( "resources/medium.wav" );
-    if( gMedium == NULL )
+    player.close();
+    for( int p = 0; p < 2; ++p )
     {
-        printf( "Failed to load medium sound effect! SDL_mixer Error: %s\n", Mix_GetError() );
-        success = false;
+        remove( PATHS[ p ] );
     }
+}
 
-    gLow = Mix_LoadWAV( "resources/low.wav" );
-    if( gLow == NULL )
+void benchmarkSoundLoading()
+{
+    const char* SOUNDS[] = { "resources/scratch.wav", "resources/high.wav", "resources/medium.wav", "resources/low.wav" };
+    const int SOUND_COUNT = sizeof( SOUNDS ) / sizeof( SOUNDS[ 0 ] );
+    const char* CACHE_DIRECTORY = "bench-sound-cache";
+
+    // The game's device, then one with another rate and format, on the dummy driver so no sound card is needed
+    const int FREQUENCIES[] = { 44100, 48000 };
+    const Uint16 FORMATS[] = { MIX_DEFAULT_FORMAT, AUDIO_F32SYS };
+    SDL_setenv( "SDL_AUDIODRIVER", "dummy", 1 );
+    if( SDL_Init( SDL_INIT_AUDIO ) < 0 )
     {
-        printf( "Failed to load low sound effect! SDL_mixer Error: %s\n", Mix_GetError() );
-        success = false;
+        printf( "SDL could not initialize! SDL Error: %s\n", SDL_GetError() );
+        return;
     }
 
-    // Load dot texture
-    if( !gDotTexture.loadFromFile( "resources/dot.bmp" ) )
+    // Its own directory, so the game's cache is left alone
+    LSoundCache cache;
+    cache.setDirectory( CACHE_DIRECTORY );
+    printf( "%-44s %10s %8s %14s\n", "", "total", "cached", "per sound" );
+    for( int device = 0; device < 2; ++device )
     {
-        printf( "Failed to load dot texture!\n" );
-        success = false;
+        if( Mix_OpenAudio( FREQUENCIES[ device ], FORMATS[ device ], 2, 2048 ) < 0 )
+        {
+            printf( "Unable to open audio! SDL_mixer Error: %s\n", Mix_GetError() );
+            break;
+        }
+
+        // No cache, then the first run that converts and writes, then every run after
+        const char* PASSES[] = { "converted, no cache", "cold, converted and written", "warm, mapped" };
+        for( int pass = 0; pass < 3; ++pass )
+        {
+            LAssetLoader loader;
+            if( pass > 0 )
+            {
+                loader.setCache( &cache );
+            }
+            Uint64 start = SDL_GetPerformanceCounter();
+            int cached = 0;
+            for( int i = 0; i < SOUND_COUNT; ++i )
+            {
+                int handle = loader.loadSound( SOUNDS[ i ] );
+                Mix_FreeChunk( loader.takeChunk( handle ) );
+                cached += loader.isCached( handle ) ? 1 : 0;
+            }
+            double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+            char label[ 64 ];
+            snprintf( label, sizeof( label ), "%d Hz %#x, %s", FREQUENCIES[ device ], FORMATS[ device ], PASSES[ pass ] );
+            printf( "%-44s %7.3f ms %5d/%d %11.3f ms\n", label, seconds * 1000.0, cached, SOUND_COUNT, seconds * 1000.0 / SOUND_COUNT );
+        }
+        Mix_CloseAudio();
     }
 
-    return success;
+    // Leave nothing behind
+    cache.clear();
+    remove( CACHE_DIRECTORY );
+    SDL_QuitSubSystem( SDL_INIT_AUDIO );
 }
 
-void close()
+void benchmarkText()
 {
-    // Free loaded images
-    gFooTexture.free();
-    gBackgroundTexture.free();
-    gTextTexture.free();
-    gDotTexture.free();
-    gPromptTexture.free();
+    const int FRAMES = 2000;
+    const char* FONT_PATH = "resources/lazy.ttf";
 
-    // Free global font
-    //TTF_CloseFont( gFont );
-    //gFont = NULL;
+    // Draw into memory, no window needed
+    if( TTF_Init() == -1 )
+    {
+        printf( "SDL_TTF could not initialize! SDL_TTF Error: %s\n", TTF_GetError() );
+        return;
+    }
+    SDL_Surface* target = SDL_CreateRGBSurfaceWithFormat( 0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888 );
+    gRenderer = target == NULL ? NULL : SDL_CreateSoftwareRenderer( target );
+    TTF_Font* font = TTF_OpenFont( FONT_PATH, OVERLAY_FONT_SIZE );
+    LGlyphAtlas glyphs;
+    if( gRenderer == NULL || font == NULL || !glyphs.open( FONT_PATH ) )
+    {
+        printf( "Unable to set up the text benchmark! SDL Error: %s\n", SDL_GetError() );
+    }
+    else
+    {
+        SDL_Color color = { 0, 0, 0, 0xFF };
+        char text[ 64 ];
 
-    // Free loaded image
-    //SDL_DestroyTexture( gTexture );
-    //gTexture = NULL;
+        // A new texture for every change of the counter, the way loadFromRenderedText does it
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int frame = 0; frame < FRAMES; ++frame )
+        {
+            snprintf( text, sizeof( text ), "FPS %.1f  dots %d", 60.0 + frame % 100 * 0.1, 1000 + frame );
+            SDL_Surface* surface = TTF_RenderUTF8_Blended( font, text, color );
+            SDL_Texture* texture = surface == NULL ? NULL : SDL_CreateTextureFromSurface( gRenderer, surface );
+            if( texture != NULL )
+            {
+                SDL_Rect destination = { 8, 8, surface->w, surface->h };
+                SDL_RenderCopy( gRenderer, texture, NULL, &destination );
+                SDL_DestroyTexture( texture );
+            }
+            SDL_FreeSurface( surface );
+        }
+        double textureSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
 
-    // Free sound effects
-    Mix_FreeChunk( gScratch );
-    Mix_FreeChunk( gHigh );
-    Mix_FreeChunk( gMedium );
-    Mix_FreeChunk( gLow );
-    gScratch = NULL;
-    gHigh = NULL;
-    gMedium = NULL;
-    gLow = NULL;
+        // The same strings as glyph quads, after the first frame every glyph is already in the atlas
+        start = SDL_GetPerformanceCounter();
+        for( int frame = 0; frame < FRAMES; ++frame )
+        {
+            snprintf( text, sizeof( text ), "FPS %.1f  dots %d", 60.0 + frame % 100 * 0.1, 1000 + frame );
+            glyphs.beginFrame();
+            gSpriteBatch.begin();
+            glyphs.drawText( gSpriteBatch, text, 8, 8, OVERLAY_FONT_SIZE, color );
+            gSpriteBatch.end();
+        }
+        double atlasSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
 
-    // Free Music
-    Mix_FreeMusic( gMusic );
-    gMusic = NULL;
+        printf( "Texture per string: %.1f us per frame\n", textureSeconds * 1e6 / FRAMES );
+        printf( "Glyph atlas: %.1f us per frame, %.1fx, %d glyphs cached\n", atlasSeconds * 1e6 / FRAMES,
+                textureSeconds / atlasSeconds, glyphs.getGlyphCount() );
 
+        // Every printable character at many sizes is more than the atlas holds, so shelves get reused
+        start = SDL_GetPerformanceCounter();
+        for( int size = 10; size <= 72; size += 2 )
+        {
+            std::string all;
+            for( char c = '!'; c <= '~'; ++c )
+            {
+                all += c;
+            }
+            glyphs.beginFrame();
+            gSpriteBatch.begin();
+            glyphs.drawText( gSpriteBatch, all, 0, 0, size, color );
+            gSpriteBatch.end();
+        }
+        double churnSeconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+        printf( "32 sizes of 94 glyphs: %.1f ms, %d shelves evicted, %d glyphs cached\n", churnSeconds * 1000.0,
+                glyphs.getEvictionCount(), glyphs.getGlyphCount() );
+    }
 
-    // Destroy the window and renderer
+    glyphs.free();
+    TTF_CloseFont( font );
     SDL_DestroyRenderer( gRenderer );
-    SDL_DestroyWindow( gWindow );
-    gWindow = NULL;
     gRenderer = NULL;
+    SDL_FreeSurface( target );
+    TTF_Quit();
+}
 
-    // Shut down Music
-    Mix_Quit();
+bool benchmarkRasterizer()
+{
+    bool success = true;
+    const int FRAMES = 100;
+    const int SCENES = 3;
+    const char* SCENE_NAMES[ SCENES ] = { "rotate/flip", "alpha", "scaled" };
+    const int SPANS = 20000;
+    const int MAX_SPAN = 67;
+
+    // Every kernel this CPU runs is checked on its own against the scalar one, not just the one setSimd picks
+    std::vector<LRasterizer::BlendKernel> kernels;
+    std::vector<const char*> kernelNames;
+    #ifdef HAVE_X86_SIMD
+    kernels.push_back( blendSSE2 );
+    kernelNames.push_back( "SSE2" );
+    if( SDL_HasAVX2() )
+    {
+        kernels.push_back( blendAVX2 );
+        kernelNames.push_back( "AVX2" );
+    }
+    #endif
+
+    // Random spans of every length up to MAX_SPAN at any offset, so the leftovers past groups of 4 and 8 run in every blend mode
+    // Sources mix clear, opaque and in between pixels, and some spans are clear throughout so skipped groups are checked too
+    // Whole buffers are compared, so a kernel writing past its span shows up as well
+    const SDL_BlendMode BLEND_MODES[ 4 ] = { SDL_BLENDMODE_NONE, SDL_BLENDMODE_BLEND, SDL_BLENDMODE_ADD, SDL_BLENDMODE_MOD };
+    std::vector<Uint32> source( MAX_SPAN * 2 );
+    std::vector<Uint32> destination( MAX_SPAN * 2 );
+    std::vector<Uint32> expected( MAX_SPAN * 2 );
+    std::vector<Uint32> actual( MAX_SPAN * 2 );
+    for( int k = 0; k < (int)kernels.size(); ++k )
+    {
+        int mismatches = 0;
+        srand( 1 );
+        for( int span = 0; span < SPANS; ++span )
+        {
+            int count = 1 + rand() % MAX_SPAN;
+            int offset = rand() % ( MAX_SPAN * 2 - count + 1 );
+            SDL_BlendMode blending = BLEND_MODES[ span % 4 ];
+            Uint32 color = ( (Uint32)rand() << 16 ) ^ (Uint32)rand();
+            bool clear = rand() % 8 == 0;
+            for( int i = 0; i < MAX_SPAN * 2; ++i )
+            {
+                Uint32 alpha = clear ? 0 : ( rand() % 3 == 0 ? 0 : rand() % 3 == 0 ? 0xFF : rand() & 0xFF );
+                source[ i ] = ( alpha << 24 ) | ( ( ( (Uint32)rand() << 12 ) ^ (Uint32)rand() ) & 0xFFFFFF );
+                destination[ i ] = ( (Uint32)rand() << 16 ) ^ (Uint32)rand();
+            }
 
-    // Shut down TTF
-    //TTF_Quit();
+            expected = destination;
+            actual = destination;
+            blendScalar( &expected[ offset ], &source[ offset ], count, color, blending );
+            kernels[ k ]( &actual[ offset ], &source[ offset ], count, color, blending );
+            if( expected != actual )
+            {
+                if( mismatches < 10 )
+                {
+                    printf( "%s mismatch: %d pixels at offset %d, blend mode %d, color %08x\n", kernelNames[ k ], count, offset, (int)blending, color );
+                }
+                ++mismatches;
+                success = false;
+            }
+        }
+        printf( "%s: %d random spans compared with scalar, %d mismatches\n", kernelNames[ k ], SPANS, mismatches );
+    }
 
-    // Shut down SDL_Image
-    IMG_Quit();
+    // Draw into memory with SDL's software renderer, which the rasterizer presents through as well
+    SDL_Surface* target = SDL_CreateRGBSurfaceWithFormat( 0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888 );
+    gRenderer = target == NULL ? NULL : SDL_CreateSoftwareRenderer( target );
+    LTexture arrow, background, foo;
+    if( gRenderer == NULL || !gRasterizer.open( SCREEN_WIDTH, SCREEN_HEIGHT )
+        || !arrow.loadFromFile( "resources/arrow.png" ) || !background.loadFromFile( "resources/background.png" )
+        || !foo.loadFromFile( "resources/foo.png" ) )
+    {
+        printf( "Unable to set up the rasterizer benchmark! SDL Error: %s\n", SDL_GetError() );
+    }
+    else
+    {
+        // The same draw goes to whichever renderer is drawing
+        auto blit = [ & ]( LTexture& texture, SDL_Rect destination, double angle, SDL_RendererFlip flip )
+        {
+            SDL_Rect source = texture.getSourceRect();
+            if( gRasterizer.isDrawing() )
+            {
+                gRasterizer.copy( *texture.getImage(), source, destination, angle, NULL, flip, texture.getColor(), texture.getBlendMode() );
+            }
+            else
+            {
+                SDL_RenderCopyEx( gRenderer, texture.getTexture(), &source, &destination, angle, NULL, flip );
+            }
+        };
+        const SDL_RendererFlip FLIPS[ 3 ] = { SDL_FLIP_NONE, SDL_FLIP_HORIZONTAL, SDL_FLIP_VERTICAL };
+        SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+        auto drawScene = [ & ]( int scene, int frame )
+        {
+            if( scene == 0 )
+            {
+                // createRotateFlip() many times over, every arrow at its own angle and flip
+                for( int i = 0; i < 64; ++i )
+                {
+                    SDL_Rect destination = { ( i % 8 ) * 80 + 40 - arrow.getWidth() / 2, ( i / 8 ) * 80 + 40 - arrow.getHeight() / 2,
+                                             arrow.getWidth(), arrow.getHeight() };
+                    blit( arrow, destination, ( frame * 3 + i * 37 ) % 360, FLIPS[ i % 3 ] );
+                }
+            }
+            else if( scene == 1 )
+            {
+                // Faded and tinted sprites over the background, then the background again at half alpha over everything
+                background.setAlpha( 0xFF );
+                blit( background, screen, 0.0, SDL_FLIP_NONE );
+                for( int i = 0; i < 16; ++i )
+                {
+                    foo.setAlpha( ( frame * 5 + i * 16 ) % 256 );
+                    foo.setColor( 0xFF, ( i * 40 ) % 256, 0xFF - i * 8 );
+                    SDL_Rect destination = { ( i % 4 ) * 160 + 80 - foo.getWidth() / 2, ( i / 4 ) * 160 + 80 - foo.getHeight() / 2,
+                                             foo.getWidth(), foo.getHeight() };
+                    blit( foo, destination, 0.0, SDL_FLIP_NONE );
+                }
+                background.setAlpha( 0x80 );
+                blit( background, screen, 0.0, SDL_FLIP_NONE );
+            }
+            else
+            {
+                // The background zoomed and turned a little, with arrows at twice their size on top
+                background.setAlpha( 0xFF );
+                SDL_Rect zoomed = { -160, -160, SCREEN_WIDTH * 3 / 2, SCREEN_HEIGHT * 3 / 2 };
+                blit( background, zoomed, ( frame % 20 ) - 10.0, SDL_FLIP_NONE );
+                for( int i = 0; i < 16; ++i )
+                {
+                    SDL_Rect destination = { ( i % 4 ) * 160 + 80 - arrow.getWidth(), ( i / 4 ) * 160 + 80 - arrow.getHeight(),
+                                             arrow.getWidth() * 2, arrow.getHeight() * 2 };
+                    blit( arrow, destination, ( frame * 2 + i * 45 ) % 360, FLIPS[ i % 3 ] );
+                }
+            }
+        };
+
+        // SDL's software renderer, then the rasterizer with its scalar kernel and with SIMD, sampling nearest and then bilinear
+        const int MODES = 5;
+        const char* MODE_NAMES[ MODES ] = { "SDL software", "rasterizer scalar", "rasterizer SIMD", "rasterizer scalar bilinear",
+                                            "rasterizer SIMD bilinear" };
+        std::vector<Uint32> sdlFrame( SCREEN_WIDTH * SCREEN_HEIGHT );
+        SDL_Color white = { 0xFF, 0xFF, 0xFF, 0xFF };
+        gRasterizer.setSimd( true );
+        printf( "SIMD kernel is %s, %d frames of %dx%d per run\n", gRasterizer.getKernelName(), FRAMES, SCREEN_WIDTH, SCREEN_HEIGHT );
+        printf( "%-12s %-26s %10s %8s %14s\n", "scene", "renderer", "per frame", "vs SDL", "close to SDL" );
+        for( int scene = 0; scene < SCENES; ++scene )
+        {
+            double sdlSeconds = 0.0;
+            Uint64 scalarHash = 0;
+            bool simdMatches = true;
+            for( int mode = 0; mode < MODES; ++mode )
+            {
+                gRasterizer.setSimd( mode == 2 || mode == 4 );
+                gRasterizer.setFilter( mode >= 3 ? RASTER_BILINEAR : RASTER_NEAREST );
+                Uint64 start = SDL_GetPerformanceCounter();
+                for( int frame = 0; frame < FRAMES; ++frame )
+                {
+                    // Presenting is part of the rasterizer's frame, and the software renderer draws once flushed
+                    if( mode == 0 )
+                    {
+                        SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
+                        SDL_RenderClear( gRenderer );
+                        drawScene( scene, frame );
+                    }
+                    else
+                    {
+                        gRasterizer.begin();
+                        gRasterizer.clear( white );
+                        drawScene( scene, frame );
+                        gRasterizer.present();
+                    }
+                    SDL_RenderFlush( gRenderer );
+                }
+                double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
 
-    // Quit SDL subsystems
-    SDL_Quit();
+                // The last frame, to compare against SDL's and between kernels
+                const Uint32* pixels = (const Uint32*)target->pixels;
+                int pitch = target->pitch / 4;
+                int nearSdl = 0;
+                for( int y = 0; y < SCREEN_HEIGHT; ++y )
+                {
+                    for( int x = 0; x < SCREEN_WIDTH; ++x )
+                    {
+                        Uint32 a = pixels[ y * pitch + x ];
+                        if( mode == 0 )
+                        {
+                            sdlFrame[ y * SCREEN_WIDTH + x ] = a;
+                            continue;
+                        }
+                        Uint32 b = sdlFrame[ y * SCREEN_WIDTH + x ];
+                        int difference = 0;
+                        for( int shift = 0; shift < 24; shift += 8 )
+                        {
+                            difference = std::max( difference, abs( (int)( ( a >> shift ) & 0xFF ) - (int)( ( b >> shift ) & 0xFF ) ) );
+                        }
+                        nearSdl += difference <= 8 ? 1 : 0;
+                    }
+                }
+                Uint64 hash = hashBytes( gRasterizer.getPixels(), SCREEN_WIDTH * SCREEN_HEIGHT * 4 );
+                if( mode == 1 || mode == 3 )
+                {
+                    scalarHash = hash;
+                }
+                else if( mode == 2 || mode == 4 )
+                {
+                    simdMatches = simdMatches && hash == scalarHash;
+                }
+
+                if( mode == 0 )
+                {
+                    sdlSeconds = seconds;
+                    printf( "%-12s %-26s %7.2f ms\n", SCENE_NAMES[ scene ], MODE_NAMES[ mode ], seconds * 1000.0 / FRAMES );
+                }
+                else
+                {
+                    printf( "%-12s %-26s %7.2f ms %7.2fx %13.1f%%\n", SCENE_NAMES[ scene ], MODE_NAMES[ mode ], seconds * 1000.0 / FRAMES,
+                            sdlSeconds / seconds, nearSdl * 100.0 / ( SCREEN_WIDTH * SCREEN_HEIGHT ) );
+                }
+            }
+            printf( "%-12s SIMD and scalar kernels drew %s, nearest and bilinear\n", SCENE_NAMES[ scene ],
+                    simdMatches ? "the same pixels" : "DIFFERENT PIXELS" );
+            success = success && simdMatches;
+        }
+        gRasterizer.setSimd( true );
+    }
 
+    arrow.free();
+    background.free();
+    foo.free();
+    gRasterizer.close();
+    SDL_DestroyRenderer( gRenderer );
+    gRenderer = NULL;
+    SDL_FreeSurface( target );
+    return success;
 }
 
-void createViewPorts()
+void benchmarkTiledRasterizer()
 {
-    // Create top left viewport
-    SDL_Rect topLeftViewport;
-    topLeftViewport.x = 0;
-    topLeftViewport.y = 0;
-    topLeftViewport.w = SCREEN_WIDTH / 2;
-    topLeftViewport.h = SCREEN_HEIGHT / 2;
-    SDL_RenderSetViewport( gRenderer, &topLeftViewport );
-    SDL_RenderCopy( gRenderer, gTexture, NULL, NULL );  // Now that screen is cleared, render the texture to screen
+    const int FRAMES = 60;
+    const int SPRITES = 2000;
+    const int LINES = 64;
+
+    // Draw into memory, the renderer is only needed for the rasterizer's texture
+    SDL_Surface* target = SDL_CreateRGBSurfaceWithFormat( 0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888 );
+    gRenderer = target == NULL ? NULL : SDL_CreateSoftwareRenderer( target );
+    LTexture arrow, background;
+    if( gRenderer == NULL || !gRasterizer.open( SCREEN_WIDTH, SCREEN_HEIGHT )
+        || !arrow.loadFromFile( "resources/arrow.png" ) || !background.loadFromFile( "resources/background.png" ) )
+    {
+        printf( "Unable to set up the tiled rasterizer benchmark! SDL Error: %s\n", SDL_GetError() );
+    }
+    else
+    {
+        // Overlapping sprites over a faded background, then createDrawings() many times over
+        const SDL_RendererFlip FLIPS[ 3 ] = { SDL_FLIP_NONE, SDL_FLIP_HORIZONTAL, SDL_FLIP_VERTICAL };
+        SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+        SDL_Rect arrowSource = arrow.getSourceRect();
+        SDL_Rect backgroundSource = background.getSourceRect();
+        auto drawFrame = [ & ]( int frame )
+        {
+            SDL_Color white = { 0xFF, 0xFF, 0xFF, 0xFF };
+            gRasterizer.begin();
+            gRasterizer.clear( white );
+            SDL_Color faded = { 0xFF, 0xFF, 0xFF, 0x60 };
+            gRasterizer.copy( *background.getImage(), backgroundSource, screen, 0.0, NULL, SDL_FLIP_NONE, faded, SDL_BLENDMODE_BLEND );
+
+            Uint32 seed = 1;
+            for( int i = 0; i < SPRITES; ++i )
+            {
+                seed = seed * 1664525 + 1013904223;
+                SDL_Rect destination = { (int)( seed >> 8 ) % SCREEN_WIDTH - arrowSource.w / 2, (int)( seed >> 20 ) % SCREEN_HEIGHT - arrowSource.h / 2,
+                                         arrowSource.w, arrowSource.h };
+                SDL_Color tint = { 0xFF, (Uint8)( i * 7 ), (Uint8)( 0xFF - i * 3 ), (Uint8)( 0x80 + i % 128 ) };
+                gRasterizer.copy( *arrow.getImage(), arrowSource, destination, ( frame * 3 + i * 37 ) % 360, NULL, FLIPS[ i % 3 ],
+                                  tint, SDL_BLENDMODE_BLEND );
+            }
 
-    // Create top right viewport
-    SDL_Rect topRightViewport;
-    topLeftViewport.x = SCREEN_WIDTH / 2;
-    topLeftViewport.y = 0;
-    topLeftViewport.w = SCREEN_WIDTH / 2;
-    topLeftViewport.h = SCREEN_HEIGHT / 2;
-    SDL_RenderSetViewport( gRenderer, &topLeftViewport );
-    SDL_RenderCopy( gRenderer, gTexture, NULL, NULL );  // Now that screen is cleared, render the texture to screen
+            SDL_Color red = { 0xFF, 0x00, 0x00, 0x80 };
+            SDL_Color blue = { 0x00, 0x00, 0xFF, 0xFF };
+            SDL_Color yellow = { 0xFF, 0xFF, 0x00, 0xFF };
+            SDL_Rect fill = { SCREEN_WIDTH / 4 + frame % 32, SCREEN_HEIGHT / 4, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 };
+            gRasterizer.fillRect( fill, red, SDL_BLENDMODE_BLEND );
+            for( int i = 0; i < LINES; ++i )
+            {
+                gRasterizer.drawLine( 0, i * SCREEN_HEIGHT / LINES, SCREEN_WIDTH - 1, SCREEN_HEIGHT - 1 - ( i * 7 + frame ) % SCREEN_HEIGHT,
+                                      blue, SDL_BLENDMODE_NONE );
+            }
+            for( int x = 0; x < SCREEN_WIDTH; x += 80 )
+            {
+                for( int y = 0; y < SCREEN_HEIGHT; y += 4 )
+                {
+                    gRasterizer.drawPoint( x + frame % 80, y, yellow, SDL_BLENDMODE_NONE );
+                }
+            }
+            gRasterizer.end();
+        };
+
+        // Untiled first, every other run has to give the same frames
+        auto run = [ & ]( double* seconds )
+        {
+            Uint64 hash = 0;
+            Uint64 ticks = 0;
+            for( int frame = 0; frame < FRAMES; ++frame )
+            {
+                Uint64 start = SDL_GetPerformanceCounter();
+                drawFrame( frame );
+                ticks += SDL_GetPerformanceCounter() - start;
+                hash = hash * 31 + hashBytes( gRasterizer.getPixels(), SCREEN_WIDTH * SCREEN_HEIGHT * 4 );
+            }
+            *seconds = (double)ticks / SDL_GetPerformanceFrequency();
+            return hash;
+        };
+
+        printf( "%d frames of %d sprites, %d lines and %d points, %s blending, %dx%d tiles\n", FRAMES, SPRITES, LINES,
+                ( SCREEN_WIDTH / 80 ) * ( SCREEN_HEIGHT / 4 ), gRasterizer.getKernelName(), RASTER_TILE_SIZE, RASTER_TILE_SIZE );
+        gRasterizer.setTiled( false );
+        double untiledSeconds = 0.0;
+        Uint64 untiledHash = run( &untiledSeconds );
+        printf( "Untiled:          %7.2f ms per frame\n", untiledSeconds * 1000.0 / FRAMES );
+
+        // 1, 2, 4 and so on up to every core, the calling thread is one of them
+        int maxCores = std::max( 1, SDL_GetCPUCount() );
+        std::vector<int> coreCounts;
+        for( int cores = 1; cores < maxCores; cores *= 2 )
+        {
+            coreCounts.push_back( cores );
+        }
+        coreCounts.push_back( maxCores );
+
+        gRasterizer.setTiled( true );
+        double oneCoreSeconds = 0.0;
+        for( int c = 0; c < (int)coreCounts.size(); ++c )
+        {
+            int cores = coreCounts[ c ];
+            if( cores > 1 )
+            {
+                gJobs.start( cores - 1 );
+            }
+            double seconds = 0.0;
+            Uint64 hash = run( &seconds );
+            gJobs.stop();
+
+            if( cores == 1 )
+            {
+                oneCoreSeconds = seconds;
+            }
+            printf( "Tiled, %2d cores: %7.2f ms per frame, %5.2fx one core, %5.2fx untiled, %s\n", cores, seconds * 1000.0 / FRAMES,
+                    oneCoreSeconds / seconds, untiledSeconds / seconds, hash == untiledHash ? "same pixels" : "DIFFERENT PIXELS" );
+        }
+        gRasterizer.setTiled( false );
+    }
+
+    arrow.free();
+    background.free();
+    gRasterizer.close();
+    SDL_DestroyRenderer( gRenderer );
+    gRenderer = NULL;
+    SDL_FreeSurface( target );
 }
 
-void createDrawings()
+int main(int argc, char* args[])
 {
-    // Draw red filled quad, a solid rectangle
-    SDL_Rect fillRect = { SCREEN_WIDTH / 4, SCREEN_HEIGHT / 4,SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 }; // Area we want filled with x, y, width, height
-    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF);
-    SDL_RenderFillRect( gRenderer, &fillRect );  // update texture to screen
+    // Command line options
+    int benchmarkSprites = 0;
+    int simulationTicks = 0;
+    bool benchmarkCollision = false;
+    bool testCollision = false;
+    bool benchmarkDots = false;
+    bool benchmarkJobs = false;
+    bool benchmarkLoading = false;
+    bool benchmarkButtonLayer = false;
+    bool benchmarkUI = false;
+    bool hotReload = false;
+    int crowdSize = 0;
+    int workerCount = 0;
+    std::string archivePath;
+    std::string soundCachePath = SOUND_CACHE_DIRECTORY;
+    bool benchmarkSoundCache = false;
+    bool showLatency = false;
+    bool benchmarkLatency = false;
+    bool benchmarkRaster = false;
+    bool benchmarkRasterThreads = false;
+    bool showProfile = false;
+    bool showOverlay = false;
+    bool benchmarkGlyphs = false;
+    bool benchmarkSound = false;
+    bool benchmarkCommands = false;
+    bool benchmarkStreaming = false;
+    std::string tracePath;
+    int headlessFrames = 0;
+    std::string recordPath;
+    std::string replayPath;
+    double idleBenchmarkSeconds = 0.0;
+    for( int i = 1; i < argc; ++i )
+    {
+        std::string arg = args[ i ];
 
-    // Draw blue horizontal line
-    SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0xFF, 0xFF );
-    SDL_RenderDrawLine( gRenderer, 0, SCREEN_HEIGHT / 2, SCREEN_WIDTH, SCREEN_HEIGHT / 2);
+        // --bench-sprites N draws N thousand dots under the software renderer
+        if( arg == "--bench-sprites" && i + 1 < argc )
+        {
+            benchmarkSprites = atoi( args[ ++i ] ) * 1000;
+            gUseSoftwareRenderer = true;
+            gUseVSync = false;
+        }
+        else if( arg == "--no-vsync" )
+        {
+            gUseVSync = false;
+        }
+        else if( arg == "--fps-cap" && i + 1 < argc )
+        {
+            gFrameCap = atoi( args[ ++i ] );
+        }
+        else if( arg == "--audio-buffer" && i + 1 < argc )
+        {
+            gAudioBufferFrames = std::max( AUDIO_MIN_BUFFER_FRAMES, std::min( AUDIO_MAX_BUFFER_FRAMES, atoi( args[ ++i ] ) ) );
+        }
+        else if( arg == "--audio-rate" && i + 1 < argc )
+        {
+            gAudioFrequency = std::max( 8000, atoi( args[ ++i ] ) );
+        }
+        else if( arg == "--audio-format" && i + 1 < argc )
+        {
+            std::string format = args[ ++i ];
+            if( format != "s16" && format != "f32" )
+            {
+                printf( "Unknown audio format %s, use s16 or f32\n", format.c_str() );
+                return 1;
+            }
+            gAudioFormat = format == "f32" ? AUDIO_F32SYS : AUDIO_S16SYS;
+        }
+        else if( arg == "--audio-latency" )
+        {
+            showLatency = true;
+        }
+        else if( arg == "--bench-audio-latency" )
+        {
+            benchmarkLatency = true;
+        }
+        else if( arg == "--raster" )
+        {
+            gUseRasterizer = true;
+        }
+        else if( arg == "--raster-filter" && i + 1 < argc )
+        {
+            gRasterFilter = std::string( args[ ++i ] ) == "bilinear" ? RASTER_BILINEAR : RASTER_NEAREST;
+        }
+        else if( arg == "--bench-raster" )
+        {
+            benchmarkRaster = true;
+        }
+        else if( arg == "--raster-untiled" )
+        {
+            gRasterTiled = false;
+        }
+        else if( arg == "--bench-raster-threads" )
+        {
+            benchmarkRasterThreads = true;
+        }
+        else if( arg == "--sim-ticks" && i + 1 < argc )
+        {
+            simulationTicks = atoi( args[ ++i ] );
+        }
+        else if( arg == "--bench-broadphase" )
+        {
+            benchmarkCollision = true;
+        }
+        else if( arg == "--bench-ui" )
+        {
+            benchmarkUI = true;
+        }
+        else if( arg == "--bench-buttons" )
+        {
+            benchmarkButtonLayer = true;
+        }
+        else if( arg == "--check-collision" )
+        {
+            testCollision = true;
+        }
+        else if( arg == "--bench-dots" )
+        {
+            benchmarkDots = true;
+        }
+        else if( arg == "--dots" && i + 1 < argc )
+        {
+            crowdSize = atoi( args[ ++i ] );
+        }
+        else if( arg == "--workers" && i + 1 < argc )
+        {
+            workerCount = atoi( args[ ++i ] );
+        }
+        else if( arg == "--bench-jobs" )
+        {
+            benchmarkJobs = true;
+        }
+        else if( arg == "--bench-loading" )
+        {
+            benchmarkLoading = true;
+        }
+        else if( arg == "--hot-reload" )
+        {
+            hotReload = true;
+        }
+        else if( arg == "--archive" && i + 1 < argc )
+        {
+            archivePath = args[ ++i ];
+        }
+        else if( arg == "--sound-cache" && i + 1 < argc )
+        {
+            soundCachePath = args[ ++i ];
+        }
+        else if( arg == "--no-sound-cache" )
+        {
+            soundCachePath.clear();
+        }
+        else if( arg == "--bench-sound-cache" )
+        {
+            benchmarkSoundCache = true;
+        }
+        else if( arg == "--overlay" )
+        {
+            showOverlay = true;
+        }
+        else if( arg == "--bench-text" )
+        {
+            benchmarkGlyphs = true;
+        }
+        else if( arg == "--bench-mixer" )
+        {
+            benchmarkSound = true;
+        }
+        else if( arg == "--bench-audio-queue" )
+        {
+            benchmarkCommands = true;
+        }
+        else if( arg == "--bench-music" )
+        {
+            benchmarkStreaming = true;
+        }
+        else if( arg == "--profile" )
+        {
+            showProfile = true;
+        }
+        else if( arg == "--trace" && i + 1 < argc )
+        {
+            tracePath = args[ ++i ];
+        }
+        else if( arg == "--no-idle" )
+        {
+            gIdleWaiting = false;
+        }
+        else if( arg == "--bench-idle" && i + 1 < argc )
+        {
+            idleBenchmarkSeconds = atof( args[ ++i ] );
+        }
+        else if( arg == "--full-redraw" )
+        {
+            gDirtyRendering = false;
+        }
+        else if( arg == "--record" && i + 1 < argc )
+        {
+            recordPath = args[ ++i ];
+        }
+        else if( arg == "--replay" && i + 1 < argc )
+        {
+            replayPath = args[ ++i ];
+        }
+        else if( arg == "--headless" && i + 1 < argc )
+        {
+            headlessFrames = std::max( 1, atoi( args[ ++i ] ) );
+            gHeadless = true;
+            gUseSoftwareRenderer = true;
+            gUseVSync = false;
+        }
+        else
+        {
+            printf( "Unknown option %s\n", arg.c_str() );
+        }
+    }
 
-    // Draw sequence of dots
-    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0x00, 0xFF );
-    for( int i = 0; i < SCREEN_HEIGHT; i += 4)
+    // Without the hooks there is nothing to time, graph or trace
+    #if !LPROFILER
+    if( showProfile || !tracePath.empty() )
     {
-        SDL_RenderDrawPoint( gRenderer, SCREEN_WIDTH / 2, i );
+        printf( "The profiler was compiled out, rebuild without -DLPROFILER=0\n" );
+        showProfile = false;
+        tracePath.clear();
     }
+    #endif
 
-    SDL_RenderCopy( gRenderer, gTexture, NULL, NULL );  // Render the texture to screen
-}
-
-void createRotateFlip()
-{
-    // Clear the screen
-    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );
-    SDL_RenderClear( gRenderer );
-
-    double degrees = 30;  // angle of rotation
-    SDL_RendererFlip flipType = SDL_FLIP_NONE;  // type of flip
-
-    flipType = SDL_FLIP_HORIZONTAL;
-    //flipType = SDL_FLIP_VERTICAL;
-
-    // Render an arrow
-    gArrowTexture.render( ( SCREEN_WIDTH - gArrowTexture.getWidth() ) / 2, ( SCREEN_HEIGHT - gArrowTexture.getHeight() ) / 2, NULL, degrees, NULL, flipType );
-}
+    // Start timing before anything loads, so loading shows up in the trace
+    if( showProfile || !tracePath.empty() )
+    {
+        gProfiler.setEnabled( true );
+    }
+    if( !tracePath.empty() )
+    {
+        gProfiler.startTrace();
+    }
 
-SDL_Texture* loadTexture( std::string path)
-{
-    // The final texture
-    SDL_Texture* newTexture = NULL;
+    // Map the archive first, loading falls back to loose files without it
+    if( !archivePath.empty() && !gArchive.open( archivePath ) )
+    {
+        printf( "Failed to open archive, loading loose files instead\n" );
+    }
 
-    // Load image at the specified path
-    SDL_Surface* loadedSurface = IMG_Load( path.c_str() );
-    if( loadedSurface == NULL )
+    // The simulation and collision benchmark do not need a window
+    if( simulationTicks > 0 )
     {
-        printf(" Unable to load image %s! SDL Error: %s\n", path.c_str(), SDL_GetError());
+        runSimulation( simulationTicks );
+        return 0;
     }
-    else
+    if( benchmarkCollision )
     {
-        // Create texture from surface pixels
-        newTexture = SDL_CreateTextureFromSurface( gRenderer, loadedSurface );
-        if( newTexture == NULL)
-        {
-            printf("Unable to create texture from %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
-        }
-
-        // Get rid of old loaded surface
-        SDL_FreeSurface( loadedSurface );
+        benchmarkBroadphase();
+        return 0;
+    }
+    if( testCollision )
+    {
+        return checkCollisionSelfTest() ? 0 : 1;
+    }
+    if( benchmarkDots )
+    {
+        benchmarkDotSystem();
+        return 0;
+    }
+    if( benchmarkJobs )
+    {
+        benchmarkJobSystem();
+        return 0;
+    }
+    if( benchmarkLoading )
+    {
+        benchmarkAssetLoader( workerCount );
+        return 0;
+    }
+    if( benchmarkButtonLayer )
+    {
+        benchmarkButtons();
+        return 0;
+    }
+    if( benchmarkGlyphs )
+    {
+        benchmarkText();
+        return 0;
+    }
+    if( benchmarkUI )
+    {
+        return benchmarkWidgets() ? 0 : 1;
+    }
+    if( benchmarkSound )
+    {
+        return benchmarkMixer() ? 0 : 1;
+    }
+    if( benchmarkCommands )
+    {
+        return benchmarkAudioQueue() ? 0 : 1;
+    }
+    if( benchmarkStreaming )
+    {
+        benchmarkMusic();
+        return 0;
+    }
+    if( benchmarkSoundCache )
+    {
+        benchmarkSoundLoading();
+        return 0;
+    }
+    if( benchmarkLatency )
+    {
+        benchmarkAudioLatency();
+        return 0;
+    }
+    if( benchmarkRaster )
+    {
+        return benchmarkRasterizer() ? 0 : 1;
+    }
+    if( benchmarkRasterThreads )
+    {
+        benchmarkTiledRasterizer();
+        return 0;
     }
-    return newTexture;
-}
 
-int main(int argc, char* args[])
-{
+    // Workers for the update phase
+    gJobs.start( workerCount );
+
     // Start up SDL and create the window
     if( !init() )
     {
@@ -1028,11 +12837,21 @@ int main(int argc, char* args[])
     }
     else
     {
+        // Only a windowed run that loads media keeps a sound cache, headless runs leave no files behind
+        if( !gHeadless )
+        {
+            gSoundCache.setDirectory( soundCachePath );
+        }
+
         // Load the media
         if( !loadMedia() )
         {
             printf("Failed to load media!\n");
         }
+        else if( benchmarkSprites > 0 )
+        {
+            benchmarkSpriteBatch( benchmarkSprites );
+        }
         else
         {
             bool quit = false;  // Main Loop Flag
@@ -1044,6 +12863,13 @@ int main(int argc, char* args[])
             // Current rendered texture
             //LTexture* currentTexture = NULL;
 
+            // Reload assets as they are saved, instead of restarting
+            LHotReloader reloader;
+            if( hotReload && reloader.start( "resources" ) )
+            {
+                watchMedia( reloader );
+            }
+
             // Create the Dot that will move around on the screen
             Dot dot;
 
@@ -1054,74 +12880,133 @@ int main(int argc, char* args[])
             wall.w = 40;
             wall.h = 400;
 
+            // File the wall and the dot in the collision world
+            LCollisionWorld world;
+            world.addWall( wall );
+            int dotCollider = world.addCollider( dot.getCollider() );
+
+            // Crowd of dots wandering around, bouncing off the wall
+            DotSystem crowd;
+            LRectBlock crowdWalls;
+            crowdWalls.add( wall );
+            srand( 1 );
+            for( int i = 0; i < crowdSize; ++i )
+            {
+                crowd.add( rand() % ( SCREEN_WIDTH - Dot::DOT_WIDTH ), rand() % ( SCREEN_HEIGHT - Dot::DOT_HEIGHT ),
+                           rand() % ( 2 * Dot::DOT_VEL + 1 ) - Dot::DOT_VEL, rand() % ( 2 * Dot::DOT_VEL + 1 ) - Dot::DOT_VEL );
+            }
+
+            // What the renderer sees, rebuilt after every frame's ticks
+            LFrameSnapshot snapshot;
+            snapshot.wall = wall;
+            snapshot.dotPrevious.x = snapshot.dotCurrent.x = dot.getPosX();
+            snapshot.dotPrevious.y = snapshot.dotCurrent.y = dot.getPosY();
+            snapshot.crowdPrevious.resize( crowd.size() );
+            snapshot.crowdCurrent.resize( crowd.size() );
+            crowd.getPositions( snapshot.crowdCurrent, 0, crowd.size() );
+            snapshot.crowdPrevious = snapshot.crowdCurrent;
+
+            // Time not yet simulated, used up one fixed tick at a time
+            double accumulator = 0.0;
+            Uint64 previousCounter = SDL_GetPerformanceCounter();
+
+            // Ticks simulated so far, replayed input is stamped with these
+            Uint32 simulationTick = 0;
+            LInputReplay replay;
+
+            // A replayed log takes the place of live input, and the run ends with it
+            bool replaying = false;
+            if( !replayPath.empty() )
+            {
+                replaying = replay.load( replayPath );
+                if( !replaying )
+                {
+                    quit = true;
+                }
+            }
+
+            // Logged input is stamped with the tick it will go in before
+            LInputRecorder recorder;
+            if( !recordPath.empty() && !recorder.start( recordPath ) )
+            {
+                quit = true;
+            }
+
+            // Headless runs play scripted input unless replaying, and keep every frame time
+            int headlessFrame = 0;
+            std::vector<double> headlessFrameSeconds;
+            Uint64 headlessChecksum = 0;
+            if( gHeadless && !replaying )
+            {
+                replay.generate( headlessFrames, 1 );
+            }
+
+            // Nothing moved last frame, so the next one waits for input instead of polling
+            bool idle = false;
+
+            // What --bench-idle reports
+            Uint64 runStart = SDL_GetPerformanceCounter();
+            clock_t runClock = clock();
+            int framesDrawn = 0;
+            int framesPresented = 0;
+            int idleWaits = 0;
+
+            // Key sound latencies printed so far by --audio-latency
+            int latencyReported = 0;
+
+            // Overlay text, refreshed twice a second from the frames drawn since
+            std::string overlayText;
+            int overlayFrames = 0;
+            Uint64 overlayStart = SDL_GetPerformanceCounter();
+
             // while application is running
             while( !quit )
             {
+                PROFILE_FRAME();
+                gGlyphs.beginFrame();
+
+                // Measure how long the last frame took
+                Uint64 frameStart = SDL_GetPerformanceCounter();
+                double frameSeconds = (double)( frameStart - previousCounter ) / SDL_GetPerformanceFrequency();
+                previousCounter = frameStart;
+
+                // Headless runs advance exactly one tick a frame, so every run does the same work
+                if( gHeadless )
+                {
+                    frameSeconds = TICK_SECONDS;
+                }
+                accumulator += std::min( frameSeconds, MAX_FRAME_SECONDS );
+
                 // Handle events on queue by polling them for the most recent event
-                while( SDL_PollEvent( &e ) != 0 )  // When SDL_PollEvent is empty, returns 0
+                // While idle, sleep until input arrives or it is time to look at hot reload again
+                PROFILE_PHASE( PROFILE_EVENTS );
+                bool woken = false;
+                if( idle )
                 {
+                    woken = SDL_WaitEventTimeout( &e, IDLE_WAIT_MS ) != 0;
+                    ++idleWaits;
+
+                    // Nothing happened while asleep, so the wait is not simulated and a key press moves from here
+                    previousCounter = SDL_GetPerformanceCounter();
+                }
+                while( woken || SDL_PollEvent( &e ) != 0 )  // When SDL_PollEvent is empty, returns 0
+                {
+                    woken = false;
+
                     // User requests quit
                     if( e.type == SDL_QUIT )
                     {
                         quit = true;
                     }
 
-                    // Handle Music
-                    // else if( e.type == SDL_KEYDOWN )
-					// {
-					// 	switch( e.key.keysym.sym )
-					// 	{
-					// 		//Play high sound effect
-					// 		case SDLK_1:
-					// 		Mix_PlayChannel( -1, gHigh, 0 );
-					// 		break;
-
-					// 		//Play medium sound effect
-					// 		case SDLK_2:
-					// 		Mix_PlayChannel( -1, gMedium, 0 );
-					// 		break;
-
-					// 		//Play low sound effect
-					// 		case SDLK_3:
-					// 		Mix_PlayChannel( -1, gLow, 0 );
-					// 		break;
-
-					// 		//Play scratch sound effect
-					// 		case SDLK_4:
-					// 		Mix_PlayChannel( -1, gScratch, 0 );
-					// 		break;
-
-					// 		case SDLK_9:
-					// 		//If there is no music playing
-					// 		if( Mix_PlayingMusic() == 0 )
-					// 		{
-					// 			//Play the music
-					// 			Mix_PlayMusic( gMusic, -1 );
-					// 		}
-					// 		//If music is being played
-					// 		else
-					// 		{
-					// 			//If the music is paused
-					// 			if( Mix_PausedMusic() == 1 )
-					// 			{
-					// 				//Resume the music
-					// 				Mix_ResumeMusic();
-					// 			}
-					// 			//If the music is playing
-					// 			else
-					// 			{
-					// 				//Pause the music
-					// 				Mix_PauseMusic();
-					// 			}
-					// 		}
-					// 		break;
-
-					// 		case SDLK_0:
-					// 		//Stop the music
-					// 		Mix_HaltMusic();
-					// 		break;
-					// 	}
-					// }
+                    // Number keys play sound effects and music through the software mixer, which only queues them for the callback
+                    // While replaying, the recorded presses play instead
+                    else if( e.type == SDL_KEYDOWN && e.key.repeat == 0 && !replaying )
+                    {
+                        // When the key went down, the event's millisecond stamp takes off the time it waited in the queue
+                        Uint64 pressed = SDL_GetPerformanceCounter() - (Uint64)( SDL_GetTicks() - e.key.timestamp ) * SDL_GetPerformanceFrequency() / 1000;
+                        handleAudioKey( e.key.keysym.sym, pressed );
+                    }
 
                     // // Set texture based on current keystate
                     // const Uint8* currentKeyStates = SDL_GetKeyboardState( NULL );
@@ -1146,28 +13031,142 @@ int main(int argc, char* args[])
                     //     currentTexture = &gPressTexture;
                     // }
 
-                    // Handle button events
-                    //for( int i = 0; i < TOTAL_BUTTONS; ++i )
-                    //{
-                    //    gButtons[ i ].handleEvent( &e );
-                    //}
+                    // Handle button events, only the buttons under the mouse and the ones it left
+                    //gButtonLayer.handleEvent( &e );
+
+                    // A reset device takes every texture with it, the kept frame and the rasterizer's are made again
+                    if( e.type == SDL_RENDER_DEVICE_RESET )
+                    {
+                        if( gFrameTexture != NULL )
+                        {
+                            SDL_DestroyTexture( gFrameTexture );
+                            createFrameTexture();
+                        }
+                        if( gRasterizer.isOpen() )
+                        {
+                            gRasterizer.resetTexture();
+                        }
+                    }
+
+                    // The kept frame is lost along with render targets, and a window uncovered, resized or restored needs presenting
+                    // Focus and the mouse coming and going change nothing on screen
+                    bool exposed = e.type == SDL_WINDOWEVENT && ( e.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                                   e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED || e.window.event == SDL_WINDOWEVENT_RESTORED );
+                    if( e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET || exposed )
+                    {
+                        gDirtyRegions.invalidateAll();
+                    }
+
+                    // Live input goes in before the next tick, which is what the log stamps it with
+                    if( !replaying )
+                    {
+                        recorder.record( simulationTick, e );
+                        dot.handleEvent( e );
+                    }
 
-                    dot.handleEvent( e );
+                }
 
+                // Swap in changed assets before anything uses them this frame
+                PROFILE_PHASE( PROFILE_UPDATE );
+                if( reloader.update() > 0 )
+                {
+                    gDirtyRegions.invalidateAll();
                 }
 
-                // Move the wall and check collision
-                dot.move( wall );
+                // Key sounds the callback has started since the last frame
+                if( showLatency && gMixer.getLatencyCount() != latencyReported )
+                {
+                    latencyReported = gMixer.getLatencyCount();
+                    printf( "Key to first sample %.2f ms\n", gMixer.getLastLatencySeconds() * 1000.0 );
+                }
 
-                // Render the screen
-                // Clear the screen with the color last set from SDL_SetRenderDrawColor
-                SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );  // Set clearing color as White
-                SDL_RenderClear( gRenderer );
+                // Move the dot and check collision, once for every whole tick that has passed
+                int ticks = (int)( accumulator / TICK_SECONDS );
+                accumulator -= ticks * TICK_SECONDS;
+
+                // A slow last frame must not run past the tick the replayed session ended on, or the end state differs
+                if( replaying && simulationTick + ticks > replay.getEndTick() )
+                {
+                    ticks = replay.getEndTick() > simulationTick ? (int)( replay.getEndTick() - simulationTick ) : 0;
+                }
+                for( int tick = 0; tick < ticks; ++tick )
+                {
+                    // Replayed input goes in right before the tick it was stamped with
+                    // Number keys play as they did live, there is no queue wait to take off a replayed key
+                    while( replay.poll( simulationTick, e ) )
+                    {
+                        if( e.type == SDL_KEYDOWN && e.key.repeat == 0 )
+                        {
+                            handleAudioKey( e.key.keysym.sym, SDL_GetPerformanceCounter() );
+                        }
+                        dot.handleEvent( e );
+                    }
+
+                    // The renderer interpolates from where things were before the last tick
+                    if( tick == ticks - 1 )
+                    {
+                        snapshot.dotPrevious.x = dot.getPosX();
+                        snapshot.dotPrevious.y = dot.getPosY();
+                        gJobs.parallelFor( crowd.size(), DOTS_PER_JOB, [ &crowd, &snapshot ]( int first, int last )
+                        {
+                            crowd.getPositions( snapshot.crowdPrevious, first, last );
+                        } );
+                    }
+
+                    // The crowd moves in parallel chunks while this thread moves the player dot
+                    LJobCounter crowdMoved( 0 );
+                    for( int first = 0; first < crowd.size(); first += DOTS_PER_JOB )
+                    {
+                        int last = std::min( crowd.size(), first + DOTS_PER_JOB );
+                        gJobs.run( [ &crowd, &crowdWalls, first, last ]()
+                        {
+                            PROFILE_SCOPE( "DotSystem::move" );
+                            crowd.move( first, last, crowdWalls );
+                        }, &crowdMoved );
+                    }
+                    dot.move( world, dotCollider );
+                    gJobs.wait( crowdMoved );
+                    ++simulationTick;
+                }
+
+                // Publish where everything ended up, the renderer only reads the snapshot
+                if( ticks > 0 )
+                {
+                    snapshot.dotCurrent.x = dot.getPosX();
+                    snapshot.dotCurrent.y = dot.getPosY();
+                    gJobs.parallelFor( crowd.size(), DOTS_PER_JOB, [ &crowd, &snapshot ]( int first, int last )
+                    {
+                        crowd.getPositions( snapshot.crowdCurrent, first, last );
+                    } );
+                }
+
+                // How far we are between the last tick and the next one
+                double alpha = accumulator / TICK_SECONDS;
+
+                // The replayed session is over once its last tick has run
+                bool replayDone = replaying && replay.isFinished( simulationTick );
 
-                // Render the wall
-                SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0x00, 0xFF );  // Set clearing color as White
-                SDL_RenderDrawRect( gRenderer, &wall );
+                // The last headless frame is always drawn, so it can be fingerprinted
+                bool checksumming = gHeadless && ( headlessFrame + 1 == headlessFrames || replayDone );
 
+                // Render the screen
+                // Clear the screen with the color last set from SDL_SetRenderDrawColor
+                // The kept frame is not cleared, only the parts that changed are
+                PROFILE_PHASE( PROFILE_CLEAR );
+                if( gRasterizer.isOpen() )
+                {
+                    gRasterizer.begin();
+                    if( !gDirtyRendering )
+                    {
+                        SDL_Color white = { 0xFF, 0xFF, 0xFF, 0xFF };
+                        gRasterizer.clear( white );
+                    }
+                }
+                else if( gFrameTexture == NULL )
+                {
+                    SDL_SetRenderDrawColor( gRenderer, 0xFF, 0xFF, 0xFF, 0xFF );  // Set clearing color as White
+                    SDL_RenderClear( gRenderer );
+                }
 
                 // Render Buttons
                 //for( int i = 0; i < TOTAL_BUTTONS; ++i )
@@ -1218,19 +13217,165 @@ int main(int argc, char* args[])
 				//gPromptTexture.render( 0, 0 );
 
                 // Render objects
-                dot.render();
+                // Nothing moved and nothing is drawn over the frame, so the screen already shows it
+                PROFILE_PHASE( PROFILE_DRAW );
+                bool presenting = true;
+                if( gRasterizer.isOpen() )
+                {
+                    // One texture update, before anything SDL draws on top of it
+                    if( gDirtyRendering )
+                    {
+                        presenting = renderDirtySnapshot( snapshot, alpha, gDirtyRegions ) || showProfile || showOverlay || checksumming;
+                    }
+                    else
+                    {
+                        renderSnapshot( snapshot, alpha );
+                    }
+                    if( presenting )
+                    {
+                        gRasterizer.present();
+                    }
+                    gRasterizer.end();
+                }
+                else if( gFrameTexture == NULL )
+                {
+                    renderSnapshot( snapshot, alpha );
+                }
+                else
+                {
+                    presenting = renderDirtySnapshot( snapshot, alpha, gDirtyRegions ) || showProfile || showOverlay || checksumming;
+                    if( presenting )
+                    {
+                        SDL_RenderCopy( gRenderer, gFrameTexture, NULL, NULL );
+                    }
+                }
+
+                // Frame time graph along the bottom
+                if( showProfile )
+                {
+                    gProfiler.renderGraph( 0, SCREEN_HEIGHT - 100, SCREEN_WIDTH, 100 );
+                }
+
+                // Frame rate and dot count in the corner, a few quads from the glyph atlas
+                if( showOverlay )
+                {
+                    PROFILE_SCOPE( "overlay" );
+                    ++overlayFrames;
+                    double overlaySeconds = (double)( SDL_GetPerformanceCounter() - overlayStart ) / SDL_GetPerformanceFrequency();
+                    if( overlayText.empty() || overlaySeconds >= 0.5 )
+                    {
+                        char text[ 64 ];
+                        snprintf( text, sizeof( text ), "FPS %.1f  dots %d", overlayFrames / overlaySeconds, crowd.size() + 1 );
+                        overlayText = text;
+                        overlayFrames = 0;
+                        overlayStart = SDL_GetPerformanceCounter();
+                    }
+
+                    SDL_Color textColor = { 0xC0, 0x00, 0x00, 0xFF };
+                    gSpriteBatch.begin();
+                    gGlyphs.drawText( gSpriteBatch, overlayText, 8, 8, OVERLAY_FONT_SIZE, textColor );
+                    gSpriteBatch.end();
+                }
+
+                // Fingerprint the last headless frame before presenting it
+                if( checksumming )
+                {
+                    headlessChecksum = checksumFrame();
+                }
 
                 // Update screen with our render
-                SDL_RenderPresent( gRenderer );
+                PROFILE_PHASE( PROFILE_PRESENT );
+                if( presenting )
+                {
+                    SDL_RenderPresent( gRenderer );
+                }
+
+                // Headless frames end here, there is nothing to wait for
+                if( gHeadless )
+                {
+                    headlessFrameSeconds.push_back( (double)( SDL_GetPerformanceCounter() - frameStart ) / SDL_GetPerformanceFrequency() );
+                    if( ++headlessFrame == headlessFrames )
+                    {
+                        quit = true;
+                    }
+                }
+                if( replayDone )
+                {
+                    printf( "Replay finished at tick %u\n", simulationTick );
+                    quit = true;
+                }
+
+                // Idle once nothing has velocity and everything has come to rest where it is drawn,
+                // the profile graph and scripted input need every frame though
+                ++framesDrawn;
+                if( presenting )
+                {
+                    ++framesPresented;
+                }
+                idle = gIdleWaiting && !gHeadless && !replaying && !showProfile && !dot.isMoving() && !crowd.isMoving() &&
+                       snapshot.dotPrevious.x == snapshot.dotCurrent.x && snapshot.dotPrevious.y == snapshot.dotCurrent.y;
+
+                // A measured run ends on its own
+                double runSeconds = (double)( SDL_GetPerformanceCounter() - runStart ) / SDL_GetPerformanceFrequency();
+                if( idleBenchmarkSeconds > 0.0 && runSeconds >= idleBenchmarkSeconds )
+                {
+                    quit = true;
+                }
+
+                // Hold the frame rate down when vsync is not doing it, idle frames already waited for input
+                PROFILE_PHASE( PROFILE_WAIT );
+                if( !idle )
+                {
+                    waitForFrameCap( frameStart, presenting );
+                }
 
                 // Wait two seconds
                 //SDL_Delay(2000);
 
             }
+
+            // Close the log on the tick the session ended
+            recorder.stop( simulationTick );
+
+            // CPU time counts every thread, so a busy loop shows as a whole core
+            if( idleBenchmarkSeconds > 0.0 )
+            {
+                double wallSeconds = (double)( SDL_GetPerformanceCounter() - runStart ) / SDL_GetPerformanceFrequency();
+                double cpuSeconds = (double)( clock() - runClock ) / CLOCKS_PER_SEC;
+                printf( "%.1f s %s: %d frames drawn, %d presented, %d idle waits, %.2f s CPU, %.1f%% of a core\n", wallSeconds,
+                        gIdleWaiting ? "with idle waiting" : "without idle waiting", framesDrawn, framesPresented, idleWaits,
+                        cpuSeconds, cpuSeconds * 100.0 / wallSeconds );
+            }
+
+            // What tuning the audio buffer comes down to
+            if( showLatency && latencyReported > 0 )
+            {
+                printf( "Key to first sample over %d key sounds: %.2f ms on average, %.2f ms at worst, %.2f ms of it a %d frame buffer, the device's own latency comes on top\n",
+                        gMixer.getLatencyCount(), gMixer.getAverageLatencySeconds() * 1000.0, gMixer.getWorstLatencySeconds() * 1000.0,
+                        gAudioBufferFrames * 1000.0 / gMixer.getFrequency(), gAudioBufferFrames );
+            }
+
+            // Regression numbers for the headless run
+            if( gHeadless )
+            {
+                printFrameTimes( headlessFrameSeconds );
+                printf( "Final frame checksum %016llx\n", (unsigned long long)headlessChecksum );
+            }
         }
     }
 
+    // Report what the profiler saw
+    if( showProfile )
+    {
+        gProfiler.printSummary();
+    }
+    if( !tracePath.empty() )
+    {
+        gProfiler.writeTrace( tracePath );
+    }
+
     // Free resources and close SDL
+    gJobs.stop();
     close();
 
     return 0;
@@ -0,0 +1,282 @@
+/*
+Packs every file of a directory into one archive that main.cpp can map and load from
+
+To compile on Ubuntu
+* g++ packer.cpp -I /usr/include/SDL2/ -lSDL2 -lSDL2_image -o packer
+* Execute with ./packer resources resources.pak
+* Then run the game with ./a.out --archive resources.pak
+
+Options
+* --decode  also store images as RGBA pixels and WAVs as mixer-ready samples, so loading does no decoding
+
+*/
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+// Reads a whole file into memory
+bool readFile( std::string path, std::vector<Uint8>& bytes );
+
+// Decodes an image to RGBA32 with its cyan color key turned into transparency, like LTextureAtlas does
+bool decodePixels( std::string path, LArchiveEntry& entry, std::vector<Uint8>& pixels );
+
+// Decodes a WAV and converts it to the format the game opens the mixer with
+bool decodeSamples( std::string path, LArchiveEntry& entry, std::vector<Uint8>& samples );
+
+// Writes bytes at the next aligned offset and returns where they went
+Uint64 writeBlob( FILE* file, const std::vector<Uint8>& bytes );
+
+bool readFile( std::string path, std::vector<Uint8>& bytes )
+{
+    SDL_RWops* file = SDL_RWFromFile( path.c_str(), "rb" );
+    if( file == NULL )
+    {
+        printf( "Unable to open %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+        return false;
+    }
+
+    bytes.resize( SDL_RWsize( file ) );
+    bool success = bytes.empty() || SDL_RWread( file, &bytes[ 0 ], bytes.size(), 1 ) == 1;
+    if( !success )
+    {
+        printf( "Unable to read %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+    }
+    SDL_RWclose( file );
+    return success;
+}
+
+bool decodePixels( std::string path, LArchiveEntry& entry, std::vector<Uint8>& pixels )
+{
+    SDL_Surface* loadedSurface = IMG_Load( path.c_str() );
+    if( loadedSurface == NULL )
+    {
+        printf( "Unable to load image %s! SDL_image Error: %s\n", path.c_str(), IMG_GetError() );
+        return false;
+    }
+
+    // Blit onto transparent RGBA, color keyed pixels are skipped and stay transparent
+    SDL_SetColorKey( loadedSurface, SDL_TRUE, SDL_MapRGB( loadedSurface->format, 0, 0xFF, 0xFF ) );
+    SDL_Surface* rgba = SDL_CreateRGBSurfaceWithFormat( 0, loadedSurface->w, loadedSurface->h, 32, SDL_PIXELFORMAT_RGBA32 );
+    if( rgba == NULL )
+    {
+        printf( "Unable to convert image %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+        SDL_FreeSurface( loadedSurface );
+        return false;
+    }
+    SDL_FillRect( rgba, NULL, SDL_MapRGBA( rgba->format, 0, 0, 0, 0 ) );
+    SDL_SetSurfaceBlendMode( loadedSurface, SDL_BLENDMODE_NONE );
+    SDL_BlitSurface( loadedSurface, NULL, rgba, NULL );
+
+    entry.decoded = ARCHIVE_DECODED_PIXELS;
+    entry.width = rgba->w;
+    entry.height = rgba->h;
+    entry.pitch = rgba->pitch;
+    pixels.assign( (Uint8*)rgba->pixels, (Uint8*)rgba->pixels + rgba->pitch * rgba->h );
+
+    SDL_FreeSurface( rgba );
+    SDL_FreeSurface( loadedSurface );
+    return true;
+}
+
+bool decodeSamples( std::string path, LArchiveEntry& entry, std::vector<Uint8>& samples )
+{
+    SDL_AudioSpec spec;
+    Uint8* buffer = NULL;
+    Uint32 length = 0;
+    if( SDL_LoadWAV( path.c_str(), &spec, &buffer, &length ) == NULL )
+    {
+        printf( "Unable to load sound %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+        return false;
+    }
+
+    SDL_AudioCVT converter;
+    if( SDL_BuildAudioCVT( &converter, spec.format, spec.channels, spec.freq,
+                           ARCHIVE_SAMPLE_FORMAT, ARCHIVE_SAMPLE_CHANNELS, ARCHIVE_SAMPLE_FREQUENCY ) < 0 )
+    {
+        printf( "Unable to convert sound %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+        SDL_FreeWAV( buffer );
+        return false;
+    }
+
+    // Converting happens in place, in a buffer big enough for the largest intermediate step
+    samples.assign( buffer, buffer + length );
+    SDL_FreeWAV( buffer );
+    if( converter.needed )
+    {
+        samples.resize( length * converter.len_mult );
+        converter.len = length;
+        converter.buf = &samples[ 0 ];
+        if( SDL_ConvertAudio( &converter ) < 0 )
+        {
+            printf( "Unable to convert sound %s! SDL Error: %s\n", path.c_str(), SDL_GetError() );
+            return false;
+        }
+        samples.resize( converter.len_cvt );
+    }
+
+    entry.decoded = ARCHIVE_DECODED_SAMPLES;
+    return true;
+}
+
+Uint64 writeBlob( FILE* file, const std::vector<Uint8>& bytes )
+{
+    // Pad up to the next boundary
+    long offset = ftell( file );
+    while( offset % ARCHIVE_ALIGNMENT != 0 )
+    {
+        fputc( 0, file );
+        ++offset;
+    }
+
+    if( !bytes.empty() )
+    {
+        fwrite( &bytes[ 0 ], 1, bytes.size(), file );
+    }
+    return offset;
+}
+
+int main( int argc, char* args[] )
+{
+    // Command line options
+    bool decode = false;
+    std::vector<std::string> paths;
+    for( int i = 1; i < argc; ++i )
+    {
+        std::string arg = args[ i ];
+        if( arg == "--decode" )
+        {
+            decode = true;
+        }
+        else
+        {
+            paths.push_back( arg );
+        }
+    }
+    if( paths.size() != 2 )
+    {
+        printf( "Usage: %s [--decode] DIRECTORY ARCHIVE\n", args[ 0 ] );
+        return 1;
+    }
+    std::string directory = paths[ 0 ];
+    std::string archivePath = paths[ 1 ];
+
+    // Names are looked up as the game spells them, so ./resources/ packs the same as resources
+    while( directory.size() > 2 && directory.compare( 0, 2, "./" ) == 0 )
+    {
+        directory.erase( 0, 2 );
+    }
+    while( directory.size() > 1 && directory[ directory.size() - 1 ] == '/' )
+    {
+        directory.erase( directory.size() - 1 );
+    }
+
+    // Every regular file in the directory, sorted so the same files always pack the same way
+    // Subdirectories are not walked, the game loads nothing from them
+    std::vector<std::string> names;
+    DIR* dir = opendir( directory.c_str() );
+    if( dir == NULL )
+    {
+        printf( "Unable to open directory %s!\n", directory.c_str() );
+        return 1;
+    }
+    for( struct dirent* found = readdir( dir ); found != NULL; found = readdir( dir ) )
+    {
+        std::string name = found->d_name;
+        struct stat info;
+        if( name[ 0 ] != '.' && stat( ( directory + "/" + name ).c_str(), &info ) == 0 && S_ISREG( info.st_mode ) )
+        {
+            names.push_back( name );
+        }
+    }
+    closedir( dir );
+    std::sort( names.begin(), names.end() );
+
+    FILE* file = fopen( archivePath.c_str(), "wb" );
+    if( file == NULL )
+    {
+        printf( "Unable to create %s!\n", archivePath.c_str() );
+        return 1;
+    }
+
+    // The index is written last, once every offset is known, so leave room for it
+    LArchiveHeader header;
+    memcpy( header.magic, ARCHIVE_MAGIC, sizeof( header.magic ) );
+    header.version = ARCHIVE_VERSION;
+    header.entryCount = names.size();
+    header.reserved = 0;
+    std::vector<LArchiveEntry> entries( names.size() );
+    fwrite( &header, sizeof( header ), 1, file );
+    if( !entries.empty() )
+    {
+        fwrite( &entries[ 0 ], sizeof( LArchiveEntry ), entries.size(), file );
+    }
+
+    bool success = true;
+    Uint64 decodedBytes = 0;
+    for( int i = 0; i < (int)names.size(); ++i )
+    {
+        // Entries are looked up by the path the game would have opened
+        std::string path = directory + "/" + names[ i ];
+        LArchiveEntry& entry = entries[ i ];
+        memset( &entry, 0, sizeof( entry ) );
+        if( path.size() >= (size_t)ARCHIVE_NAME_LENGTH )
+        {
+            printf( "Path %s is too long for the archive!\n", path.c_str() );
+            success = false;
+            continue;
+        }
+        strcpy( entry.name, path.c_str() );
+
+        std::vector<Uint8> bytes;
+        if( !readFile( path, bytes ) )
+        {
+            success = false;
+            continue;
+        }
+        entry.fileOffset = writeBlob( file, bytes );
+        entry.fileSize = bytes.size();
+
+        // Pre-decode what the game would otherwise decode at startup
+        std::string extension = names[ i ].substr( names[ i ].find_last_of( '.' ) + 1 );
+        std::vector<Uint8> decoded;
+        bool isImage = extension == "png" || extension == "bmp";
+        bool isSound = extension == "wav";
+        if( decode && isImage && decodePixels( path, entry, decoded ) )
+        {
+            entry.decodedOffset = writeBlob( file, decoded );
+            entry.decodedSize = decoded.size();
+        }
+        else if( decode && isSound && decodeSamples( path, entry, decoded ) )
+        {
+            entry.decodedOffset = writeBlob( file, decoded );
+            entry.decodedSize = decoded.size();
+        }
+        decodedBytes += entry.decodedSize;
+    }
+
+    // Now the index
+    fseek( file, sizeof( header ), SEEK_SET );
+    if( !entries.empty() )
+    {
+        fwrite( &entries[ 0 ], sizeof( LArchiveEntry ), entries.size(), file );
+    }
+    fseek( file, 0, SEEK_END );
+    long archiveSize = ftell( file );
+    if( fclose( file ) != 0 )
+    {
+        printf( "Unable to write %s!\n", archivePath.c_str() );
+        success = false;
+    }
+
+    printf( "Packed %d files into %s, %ld bytes, %llu of them pre-decoded\n", (int)names.size(), archivePath.c_str(),
+            archiveSize, (unsigned long long)decodedBytes );
+    return success ? 0 : 1;
+}